@@ -172,6 +172,7 @@ public:
 std::string TargetnameForLightStyle(int style);
 const std::vector<light_t>& GetLights();
 const std::vector<sun_t>& GetSuns();
+const std::vector<entdict_t>& GetEntdicts();
 
 const entdict_t *FindEntDictWithKeyPair(const std::string &key, const std::string &value);
 const char *ValueForKey(const light_t *ent, const char *key);
@@ -181,10 +182,12 @@ void SetWorldKeyValue(const std::string &key, const std::string &value);
 std::string WorldValueForKey(const std::string &key);
 
 void LoadEntities(const globalconfig_t &cfg, const mbsp_t *bsp);
+void ResetEntities();
 void SetupLights(const globalconfig_t &cfg, const mbsp_t *bsp);
 bool ParseLightsFile(const char *fname);
 void WriteEntitiesToString(const globalconfig_t &cfg, mbsp_t *bsp);
-void EstimateVisibleBoundsAtPoint(const vec3_t point, vec3_t mins, vec3_t maxs);
+void EstimateVisibleBoundsAtPoint(const mbsp_t *bsp, const vec3_t point, vec3_t mins, vec3_t maxs);
+void PrintVisibleBoundsStats(const char *what);
 
 bool EntDict_CheckNoEmptyValues(const mbsp_t *bsp, const entdict_t &entdict);
 
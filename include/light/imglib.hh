@@ -50,6 +50,8 @@ void LoadPalette(bspdata_t *bspdata);
 qvec3f Palette_GetColor(const int i);
 //mxd. Returns RGBA color components in [0, 255]
 qvec4f Texture_GetColor(const rgba_miptex_t *tex, const int i);
+// Returns the average color of the opaque pixels of bsp->drgbatexdata texture miptexnum in [0, 255]
+qvec3f Texture_AvgColor(const mbsp_t *bsp, const int miptexnum);
 
 // Image loading
 qboolean LoadPCX(const char *filename, uint8_t **pixels, uint8_t **palette, int *width, int *height);
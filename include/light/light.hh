@@ -149,11 +149,21 @@ typedef struct {
     /* for lit water. receive light from either front or back. */
     bool twosided;
     
+    /* -adaptive's supersamples of some luxels, rather than a width*height grid */
+    bool scattered;
+    
     // ray batch stuff
     raystream_occlusion_t *occlusion_stream;
     raystream_intersection_t *intersection_stream;
     
     lightmapdict_t lightmapsByStyle;
+    
+    /* indices of the lights that passed CullLight, for -incremental */
+    mutable std::vector<int> lights;
+    
+    /* PVS row of the leafs this can see, empty if unknown; set up on first use */
+    mutable std::vector<uint8_t> pvs;
+    mutable bool pvsready;
 } lightsurf_t;
 
 /* debug */
@@ -277,6 +287,7 @@ public:
     /* dirt */
     lockable_bool_t globalDirt;          // apply dirt to all lights (unless they override it) + sunlight + minlight?
     lockable_vec_t dirtMode, dirtDepth, dirtScale, dirtGain, dirtAngle;
+    lockable_vec_t dirtAdaptive, dirtSeed;  // error target for adaptive dirt (0 = off), seed for its random vectors
     
     lockable_bool_t minlightDirt;   // apply dirt to minlight?
     
@@ -329,6 +340,8 @@ public:
         dirtScale {"dirtscale", 1.0f, 0.0f, 100.0f},
         dirtGain {"dirtgain", 1.0f, 0.0f, 100.0f},
         dirtAngle {"dirtangle", 88.0f, 0.0f, 90.0f},
+        dirtAdaptive {"dirtadaptive", 0.0f, 0.0f, 1.0f},
+        dirtSeed {"dirtseed", 0.0f},
         minlightDirt {"minlight_dirt", false},
 
         /* phong */
@@ -374,6 +387,7 @@ public:
             &compilerstyle_start,
             &globalDirt,
             &dirtMode, &dirtDepth, &dirtScale, &dirtGain, &dirtAngle,
+            &dirtAdaptive, &dirtSeed,
             &minlightDirt,
             &phongallowed,
             &bounce, &bouncestyled, &bouncescale, &bouncecolorscale,
@@ -401,6 +415,7 @@ extern uint8_t *lit_filebase;
 extern uint8_t *lux_filebase;
 
 extern int oversample;
+extern int undersample;
 extern int write_litfile;
 extern int write_luxfile;
 extern qboolean onlyents;
@@ -409,6 +424,11 @@ extern surfflags_t *extended_texinfo_flags;
 extern qboolean novisapprox;
 extern bool nolights;
 extern bool litonly;
+extern bool incremental;
+extern bool texcache;
+extern bool nopvs;
+extern bool fastsky;
+extern float adaptive;
 
 extern qboolean surflight_dump;
 extern char mapfilename[1024];
@@ -428,4 +448,22 @@ const modelinfo_t *ModelInfoForFace(const mbsp_t *bsp, int facenum);
 //bool Leaf_HasSky(const mbsp_t *bsp, const mleaf_t *leaf); //mxd. Missing definition
 int light_main(int argc, const char **argv);
 
+/**
+ * Setup work that is only done if something needs it. light_main defines
+ * what each stage does; RequireStage runs it (and its dependencies) the
+ * first time it's asked for, and does nothing after that or if the stage
+ * isn't defined. Main thread only.
+ */
+enum class lightstage_t {
+    textures,       // palette and RGBA textures
+    entities,       // .texinfo flags, entity lump and light entities
+    modelinfo,      // per-model settings and shadow lists
+    tracescene,     // the ray tracing scene
+    vertexnormals,  // phong normals
+    pvs,            // leaf tables from the visdata
+    lights,         // surface lights, suns, light visibility estimates
+    COUNT
+};
+void RequireStage(lightstage_t stage);
+
 #endif /* __LIGHT_LIGHT_H__ */
@@ -77,9 +77,16 @@ void WorldToTexCoord(const vec3_t world, const gtexinfo_t *tex, vec_t coord[2]);
 void PrintFaceInfo(const bsp2_dface_t *face, const mbsp_t *bsp);
 // FIXME: remove light param. add normal param and dir params.
 vec_t GetLightValue(const globalconfig_t &cfg, const light_t *entity, vec_t dist);
+bool CullLightBounds(const globalconfig_t &cfg, const light_t *entity, const vec3_t origin, vec_t radius,
+                     const vec3_t mins, const vec3_t maxs);
 std::map<int, qvec3f> GetDirectLighting(const mbsp_t *bsp, const globalconfig_t &cfg, const vec3_t origin, const vec3_t normal);
 void SetupDirt(globalconfig_t &cfg);
 float DirtAtPoint(const globalconfig_t &cfg, raystream_intersection_t *rs, const vec3_t point, const vec3_t normal, const modelinfo_t *selfshadow);
 void LightFace(const mbsp_t *bsp, bsp2_dface_t *face, facesup_t *facesup, const globalconfig_t &cfg);
 
+/* -progressive's coarse pass lights every undersample'th luxel, plus the last */
+int CoarseSampleCount(int texsize);
+int CoarseSampleLuxel(int sample, int texsize);
+void UpsampleCoarseImage(const std::vector<qvec4f> &input, const lightsurf_t *lightsurf, std::vector<qvec4f> &res);
+
 #endif /* __LIGHT_LTFACE_H__ */
@@ -49,20 +49,43 @@ public:
 
 std::vector<neighbour_t> FacesOverlappingEdge(const vec3_t p0, const vec3_t p1, const mbsp_t *bsp, const dmodel_t *model);
 
+/// a range of faces in one of the adjacency arrays built by CalculateVertexNormals
+class facelist_t {
+private:
+    const bsp2_dface_t *const *m_begin;
+    const bsp2_dface_t *const *m_end;
+    
+public:
+    facelist_t(const bsp2_dface_t *const *b, const bsp2_dface_t *const *e)
+    : m_begin(b),
+    m_end(e) {
+    }
+    
+    const bsp2_dface_t *const *begin() const { return m_begin; }
+    const bsp2_dface_t *const *end() const { return m_end; }
+    size_t size() const { return static_cast<size_t>(m_end - m_begin); }
+    bool empty() const { return m_begin == m_end; }
+};
+
+/// compressed rows: the faces of row i are faces[offsets[i]] .. faces[offsets[i + 1] - 1]
+class faceadjacency_t {
+public:
+    std::vector<int> offsets;
+    std::vector<const bsp2_dface_t *> faces;
+    
+    facelist_t row(int i) const;
+};
+
 void CalculateVertexNormals(const mbsp_t *bsp);
 const qvec3f GetSurfaceVertexNormal(const mbsp_t *bsp, const bsp2_dface_t *f, const int vertindex);
 bool FacesSmoothed(const bsp2_dface_t *f1, const bsp2_dface_t *f2);
-const std::set<const bsp2_dface_t *> &GetSmoothFaces(const bsp2_dface_t *face);
-const std::vector<const bsp2_dface_t *> &GetPlaneFaces(const bsp2_dface_t *face);
+facelist_t GetSmoothFaces(const bsp2_dface_t *face);
+facelist_t GetPlaneFaces(const bsp2_dface_t *face);
 const qvec3f GetSurfaceVertexNormal(const mbsp_t *bsp, const bsp2_dface_t *f, const int v);
 const bsp2_dface_t *Face_EdgeIndexSmoothed(const mbsp_t *bsp, const bsp2_dface_t *f, const int edgeindex);
 
-/// a directed edge can be used by more than one face, e.g. two cube touching just along an edge
-using edgeToFaceMap_t = std::map<std::pair<int,int>, std::vector<const bsp2_dface_t *>>;
-
 std::vector<neighbour_t> NeighbouringFaces_new(const mbsp_t *bsp, const bsp2_dface_t *face);
 std::vector<const bsp2_dface_t *> FacesUsingVert(int vertnum);
-const edgeToFaceMap_t &GetEdgeToFaceMap();
 
 class face_cache_t {
 private:
@@ -74,6 +97,7 @@ private:
     std::vector<neighbour_t> m_neighbours;
     
 public:
+    face_cache_t() = default;
     face_cache_t(const mbsp_t *bsp, const bsp2_dface_t *face, const std::vector<qvec3f> &normals) :
         m_points(GLM_FacePoints(bsp, face)),
         m_normals(normals),
@@ -0,0 +1,46 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#ifndef __LIGHT_PVS_H__
+#define __LIGHT_PVS_H__
+
+#include <light/light.hh>
+
+#include <vector>
+
+/*
+ * If the map has been vised, a light can only reach a face if the leaf
+ * it's in can see one of the leafs the face's sample points are in.
+ * Pvs_Begin places the lights and bounce lights in leafs, and the Pvs_Cull
+ * functions test them against the leafs a lightsurf can see, which are
+ * worked out the first time a light gets past the cheaper culling tests.
+ * Anything that isn't in a vised leaf is never culled. -nopvs turns this
+ * off, for maps with broken vis.
+ *
+ * Pvs_Setup builds the tables that only depend on the map (the pvs stage).
+ * Pvs_VisibleBounds gives the bounds of the leafs visible from a point, padded
+ * a little, and returns false if it can't tell.
+ */
+void Pvs_Setup(const mbsp_t *bsp);
+void Pvs_Begin(const mbsp_t *bsp);
+bool Pvs_VisibleBounds(const mbsp_t *bsp, const vec3_t point, vec3_t mins, vec3_t maxs);
+bool Pvs_CullLight(const lightsurf_t *lightsurf, int lightnum);
+bool Pvs_CullBounceLight(const lightsurf_t *lightsurf, int vplnum);
+
+#endif /* __LIGHT_PVS_H__ */
@@ -0,0 +1,40 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#ifndef __LIGHT_RELIGHT_H__
+#define __LIGHT_RELIGHT_H__
+
+#include <light/light.hh>
+
+/*
+ * -incremental keeps a mapname.lightcache file next to the .bsp with each
+ * face's lightmaps and the lights that weren't culled for it. When only
+ * light entities changed since the last run, faces that none of the
+ * changed lights can reach are copied from the cache instead of relit.
+ */
+void Relight_Begin(const mbsp_t *bsp, const facesup_t *faces_sup, const globalconfig_t &cfg);
+bool Relight_ReuseFace(const mbsp_t *bsp, bsp2_dface_t *face, facesup_t *facesup);
+void Relight_RecordFace(const mbsp_t *bsp, const bsp2_dface_t *face, const facesup_t *facesup,
+                        const lightsurf_t *lightsurf);
+void Relight_Finish(const mbsp_t *bsp);
+
+/* the cache is only used if this is unchanged since the run that wrote it */
+uint64_t Relight_Key(const mbsp_t *bsp, const facesup_t *faces_sup, const globalconfig_t &cfg);
+
+#endif /* __LIGHT_RELIGHT_H__ */
@@ -0,0 +1,44 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#ifndef __LIGHT_SERVE_H__
+#define __LIGHT_SERVE_H__
+
+/*
+ * light --serve <socket> listens on a Unix socket and keeps the last map
+ * it lit loaded, along with its textures, trace scene and phong normals.
+ * light --connect <socket> [options] mapname.bsp sends a run to it, and
+ * lights the map itself when nothing is listening.
+ *
+ * A request is reused only if the map's geometry, .texinfo file and the
+ * shadow/alpha/phong settings of its brush entities are unchanged; light
+ * entities, worldspawn keys and options are free to change.
+ */
+
+/* exit status of a request whose map no longer matches the warm state */
+#define LIGHT_SERVE_STALE 75
+
+int LightServe(const char *socketpath);
+int LightConnect(const char *socketpath, int argc, const char **argv);
+
+/* in light.cc */
+int LightServeWarm(int argc, const char **argv);
+int LightServeRequest(int argc, const char **argv);
+
+#endif /* __LIGHT_SERVE_H__ */
@@ -47,7 +47,9 @@ enum class rotation_t {
 brush_t *LoadBrush(const mapentity_t *src, const mapbrush_t *mapbrush, const contentflags_t &contents, const vec3_t rotate_offset, const rotation_t rottype, const int hullnum);
 void FreeBrushes(mapentity_t *ent);
 
+int NormalizePlane(qbsp_plane_t *p, bool flip = true);
 int FindPlane(const vec3_t normal, const vec_t dist, int *side);
+int LookupPlane(const vec3_t normal, const vec_t dist, int *side);
 bool PlaneEqual(const qbsp_plane_t *p1, const qbsp_plane_t *p2);
 bool PlaneInvEqual(const qbsp_plane_t *p1, const qbsp_plane_t *p2);
 
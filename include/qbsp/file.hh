@@ -25,5 +25,7 @@
 #include <stdbool.h>
 
 size_t LoadFile(const char *filename, void *bufptr, bool nofail);
+size_t MapFile(const char *filename, const char **bufptr, bool nofail);
+void UnmapFile(const char *buf, size_t len);
     
 #endif
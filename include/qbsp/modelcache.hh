@@ -0,0 +1,37 @@
+/*
+    Copyright (C) 1996-1997  Id Software, Inc.
+    Copyright (C) 1997       Greg Lewis
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#ifndef QBSP_MODELCACHE_HH
+#define QBSP_MODELCACHE_HH
+
+/*
+ * Per-bmodel compile cache (-bmodelcache <dir>). Brush entities other than
+ * the world are keyed by a hash of their brushes, texinfo, keys and the
+ * compile options; an unchanged entity has its exported data for a hull
+ * spliced back in instead of being rebuilt.
+ */
+bool ModelCache_Splice(mapentity_t *entity, const int hullnum);
+void ModelCache_Begin(mapentity_t *entity, const int hullnum);
+void ModelCache_AddBrushPlanes(const mapentity_t *entity, const int hullnum);
+void ModelCache_Store(mapentity_t *entity, const int hullnum);
+uint64_t ModelCache_EntityKey(const mapentity_t *entity);
+
+#endif
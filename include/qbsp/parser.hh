@@ -49,6 +49,25 @@ void ParserInit(parser_t *p, const char *data);
 
 #ifdef __cplusplus
 }
+
+#include <string_view>
+
+/*
+ * Zero-copy variant of ParseToken, used to parse brushes in parallel.
+ * Follows the same rules but never reports errors itself: anything that
+ * ParseToken would stop on with an Error() is returned as PARSEVIEW_FAIL,
+ * so the caller can go back and let ParseToken produce the message.
+ * Quoted tokens containing backslashes are returned as PARSEVIEW_ESCAPED
+ * (ParseToken may print a warning for those). parser->unget is ignored.
+ */
+typedef enum parseview {
+    PARSEVIEW_NONE,     /* ParseToken would return false */
+    PARSEVIEW_TOKEN,
+    PARSEVIEW_ESCAPED,
+    PARSEVIEW_FAIL,
+} parseview_t;
+
+parseview_t ParseTokenView(parser_t *p, int flags, std::string_view *token);
 #endif
 
 #endif /* PARSER_H */
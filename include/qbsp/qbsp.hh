@@ -127,8 +127,13 @@
 #define SIDESPACE       24
 
 // AllocMem types
+// everything but OTHER comes from the per-entity arena and must be released
+// with FreeMem
 enum {
     WINDING,
+    FACE,
+    NODE,
+    PORTAL,
     OTHER
 };
 
@@ -218,6 +223,7 @@ typedef struct node_s {
     int viscluster;             // detail cluster for faster vis
     int occupied;               // 0=can't reach entity, 1 = has entity, >1 = distance from leaf with entity
     mapentity_t *occupant;      // example occupant, for leak hunting
+    int leafnum;                // internal use in outside.cc, index into the flat leaf array
     bool detail_separator;      // for vis portal generation. true if ALL faces on node, and on all descendant nodes/leafs, are detail.
     uint32_t firstleafbrush;         // Q2
     uint32_t numleafbrushes;
@@ -292,6 +298,8 @@ public:
     };
 
     std::vector<wadpath> wadPathsVec;
+    std::string wadCacheDir;    // if set, wad directory indexes are cached here between runs
+    std::string bmodelCacheDir; // if set, compiled brush models are cached here between runs
     vec_t on_epsilon;
     bool fObjExport;
     bool fOmitDetail;
@@ -304,6 +312,7 @@ public:
     bool fContentHack;
     vec_t worldExtent;
     bool fNoThreads;
+    int numThreads; // 0 = let TBB decide
 
     options_t() :
     fNofill(false),
@@ -344,7 +353,8 @@ public:
     fLeakTest(false),
     fContentHack(false),
     worldExtent(65536.0f),
-    fNoThreads(false) {}
+    fNoThreads(false),
+    numThreads(0) {}
 };
 
 extern options_t options;
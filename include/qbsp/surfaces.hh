@@ -24,7 +24,8 @@
 
 typedef struct hashvert_s {
     vec3_t point;
-    int num;
+    int cell[3];    // floor(point), the spatial hash cell
+    int num;        // -1 = empty slot
 } hashvert_t;
 
 surface_t *GatherNodeFaces(node_t *headnode);
@@ -33,6 +33,12 @@
 extern const char *rgszWarnings[cWarnings];
 
 void *AllocMem(int Type, int cSize, bool fZero);
+void FreeMem(void *pMem, int Type);
+size_t AllocSize(const void *pMem);
+
+void MemArena_Begin(void);
+void MemArena_End(void);
+void MemArena_PrintStats(void);
 
 void Message(int MsgType, ...);
 [[noreturn]] void Error(const char *error, ...)
@@ -22,6 +22,7 @@
 #ifndef WAD_H
 #define WAD_H
 
+#include <string>
 #include <unordered_map>
 #include <vector>
 #include <list>
@@ -70,17 +71,20 @@ struct case_insensitive_equal {
 };
 
 struct wad_t {
+    std::string path;
     wadinfo_t header;
-    int version;
+    int version = 0;
     std::unordered_map<std::string, lumpinfo_t, case_insensitive_hash, case_insensitive_equal> lumps;
     std::unordered_map<std::string, texture_t, case_insensitive_hash, case_insensitive_equal> textures;
-    FILE *file;
 
-    ~wad_t() {
-        if (file) {
-            fclose(file);
-        }
-    }
+    // read-only mapping of the whole file; only made once lump data is needed
+    const char *data = nullptr;
+    size_t datalen = 0;
+
+    wad_t() = default;
+    wad_t(const wad_t &) = delete;
+    wad_t &operator=(const wad_t &) = delete;
+    ~wad_t();
 };
 
 // Q1 miptex format
@@ -95,6 +99,7 @@ void WADList_Init(const char *wadstring);
 void WADList_Process();
 const texture_t *WADList_GetTexture(const char *name);
 // for getting a texture width/height
+void WADList_Free();
 
 // FIXME: don't like global state like this :(
 extern std::list<wad_t> wadlist;
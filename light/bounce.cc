@@ -254,7 +254,7 @@ AddBounceLight(const vec3_t pos, const std::map<int, qvec3f> &colorByStyle, cons
     VectorSet(l.maxs, 0, 0, 0);
     
     if (!novisapprox) {
-        EstimateVisibleBoundsAtPoint(pos, l.mins, l.maxs);
+        EstimateVisibleBoundsAtPoint(bsp, pos, l.mins, l.maxs);
     }
     
     unique_lock<mutex> lck { radlights_lock };
@@ -280,27 +280,6 @@ const std::vector<int> &BounceLightsForFaceNum(int facenum)
     return empty;
 }
 
-// Returns color in [0,255]
-static qvec3f
-Texture_AvgColor (const mbsp_t *bsp, const rgba_miptex_t *miptex)
-{
-    qvec4f color(0);
-
-    if (!bsp->rgbatexdatasize)
-        return color;
-    
-    //mxd
-    const auto miptexsize = miptex->width * miptex->height;
-    for(auto i = 0; i < miptexsize; i++)
-    {
-        auto c = Texture_GetColor(miptex, i);
-        if(c[3] < 128) continue; // Skip transparent pixels...
-        color += c;
-    }
-
-    return color / miptexsize;
-}
-
 void
 MakeTextureColors (const mbsp_t *bsp)
 {
@@ -316,7 +295,7 @@ MakeTextureColors (const mbsp_t *bsp)
         
         const rgba_miptex_t *miptex = (rgba_miptex_t *)((uint8_t *)bsp->drgbatexdata + ofs);
         const string name { miptex->name };
-        const qvec3f color = Texture_AvgColor(bsp, miptex);
+        const qvec3f color = Texture_AvgColor(bsp, i);
         
 //      printf("%s has color %s\n", name.c_str(), VecStr(color));
         texturecolors[name] = color;
@@ -328,6 +307,10 @@ MakeBounceLights (const globalconfig_t &cfg, const mbsp_t *bsp)
 {
     logprint("--- MakeBounceLights ---\n");
     
+    // -progressive lights the map more than once
+    radlights.clear();
+    radlightsByFacenum.clear();
+    
     make_bounce_lights_args_t args { bsp, &cfg }; //mxd. https://clang.llvm.org/extra/clang-tidy/checks/cppcoreguidelines-pro-type-member-init.html
     
     RunThreadsOn(0, bsp->numfaces, MakeBounceLightsThread, (void *)&args);
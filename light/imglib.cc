@@ -210,6 +210,7 @@ LoadPCX(const char *filename, uint8_t **pixels, uint8_t **palette, int *width, i
     return true;
 }
 
+
 /*
 ============================================================================
 TARGA IMAGE
@@ -225,55 +226,59 @@ typedef struct _TargaHeader {
     unsigned char	pixel_size, attributes;
 } TargaHeader;
 
-int
-fgetLittleShort(FILE *f)
-{
-    const uint8_t b1 = fgetc(f);
-    const uint8_t b2 = fgetc(f);
-    return static_cast<short>(b1 + b2 * 256);
-}
+/* reads from a file loaded into memory; reading past the end returns zeros and sets overrun */
+struct bytereader_t {
+    const uint8_t *data;
+    int len;
+    int pos;
+    bool overrun;
+
+    uint8_t getByte() {
+        if (pos >= len) {
+            overrun = true;
+            return 0;
+        }
+        return data[pos++];
+    }
+
+    int getLittleShort() {
+        const uint8_t b1 = getByte();
+        const uint8_t b2 = getByte();
+        return static_cast<short>(b1 + b2 * 256);
+    }
+};
 
-int
-fgetLittleLong(FILE *f)
+static inline void
+ReadTGAPixel(bytereader_t *reader, int pixel_size, uint8_t *rgba)
 {
-    const uint8_t b1 = fgetc(f);
-    const uint8_t b2 = fgetc(f);
-    const uint8_t b3 = fgetc(f);
-    const uint8_t b4 = fgetc(f);
-    return b1 + (b2 << 8) + (b3 << 16) + (b4 << 24);
+    const uint8_t blue = reader->getByte();
+    const uint8_t green = reader->getByte();
+    const uint8_t red = reader->getByte();
+    rgba[0] = red;
+    rgba[1] = green;
+    rgba[2] = blue;
+    rgba[3] = (pixel_size == 32) ? reader->getByte() : 255;
 }
 
-/*
-=============
-LoadTGA
-=============
-*/
-qboolean
-LoadTGA(const char *filename, uint8_t **pixels, int *width, int *height)
+static qboolean
+DecodeTGA(const char *filename, const uint8_t *data, int len, uint8_t **pixels, int *width, int *height)
 {
-    uint8_t			*pixbuf;
-    int				row, column;
-    TargaHeader		targa_header;
-
-    FILE *fin = fopen(filename, "rb");
-    if (!fin) {
-        logprint("LoadTGA: Failed to load '%s'. File does not exist.\n", filename);
-        return false; //mxd
-    }
-
-    targa_header.id_length = fgetc(fin);
-    targa_header.colormap_type = fgetc(fin);
-    targa_header.image_type = fgetc(fin);
-
-    targa_header.colormap_index = fgetLittleShort(fin);
-    targa_header.colormap_length = fgetLittleShort(fin);
-    targa_header.colormap_size = fgetc(fin);
-    targa_header.x_origin = fgetLittleShort(fin);
-    targa_header.y_origin = fgetLittleShort(fin);
-    targa_header.width = fgetLittleShort(fin);
-    targa_header.height = fgetLittleShort(fin);
-    targa_header.pixel_size = fgetc(fin);
-    targa_header.attributes = fgetc(fin);
+    bytereader_t reader { data, len, 0, false };
+    TargaHeader targa_header;
+
+    targa_header.id_length = reader.getByte();
+    targa_header.colormap_type = reader.getByte();
+    targa_header.image_type = reader.getByte();
+
+    targa_header.colormap_index = reader.getLittleShort();
+    targa_header.colormap_length = reader.getLittleShort();
+    targa_header.colormap_size = reader.getByte();
+    targa_header.x_origin = reader.getLittleShort();
+    targa_header.y_origin = reader.getLittleShort();
+    targa_header.width = reader.getLittleShort();
+    targa_header.height = reader.getLittleShort();
+    targa_header.pixel_size = reader.getByte();
+    targa_header.attributes = reader.getByte();
 
     if (targa_header.image_type != 2 && targa_header.image_type != 10) {
         logprint("LoadTGA: Failed to load '%s'. Only type 2 and 10 targa RGB images supported.\n", filename);
@@ -288,125 +293,50 @@ LoadTGA(const char *filename, uint8_t **pixels, int *width, int *height)
     const int columns = targa_header.width;
     const int rows = targa_header.height;
     const int numPixels = columns * rows;
+    const int bytesPerPixel = targa_header.pixel_size / 8;
 
-    if (width)
-        *width = columns;
-    if (height)
-        *height = rows;
+    reader.pos += targa_header.id_length; // skip TARGA image comment
 
     uint8_t *targa_rgba = static_cast<uint8_t*>(malloc(numPixels * 4));
-    *pixels = targa_rgba;
-
-    if (targa_header.id_length != 0)
-        fseek(fin, targa_header.id_length, SEEK_CUR);  // skip TARGA image comment
 
     if (targa_header.image_type == 2) {  // Uncompressed, RGB images
-        for (row = rows - 1; row >= 0; row--) {
-            pixbuf = targa_rgba + row * columns * 4;
-            for (column = 0; column < columns; column++) {
-                unsigned char red, green, blue, alphabyte;
-                switch (targa_header.pixel_size) {
-                case 24:
-                    blue = getc(fin);
-                    green = getc(fin);
-                    red = getc(fin);
-                    *pixbuf++ = red;
-                    *pixbuf++ = green;
-                    *pixbuf++ = blue;
-                    *pixbuf++ = 255;
-                    break;
-                case 32:
-                    blue = getc(fin);
-                    green = getc(fin);
-                    red = getc(fin);
-                    alphabyte = getc(fin);
-                    *pixbuf++ = red;
-                    *pixbuf++ = green;
-                    *pixbuf++ = blue;
-                    *pixbuf++ = alphabyte;
-                    break;
-                default:
-                    logprint("LoadTGA: unsupported pixel size: %i\n", targa_header.pixel_size); //mxd
-                    return false;
+        if (reader.overrun || len - reader.pos < numPixels * bytesPerPixel) {
+            reader.overrun = true;
+        } else {
+            const uint8_t *in = data + reader.pos;
+            for (int row = rows - 1; row >= 0; row--) {
+                uint8_t *pixbuf = targa_rgba + row * columns * 4;
+                for (int column = 0; column < columns; column++, in += bytesPerPixel, pixbuf += 4) {
+                    pixbuf[0] = in[2];
+                    pixbuf[1] = in[1];
+                    pixbuf[2] = in[0];
+                    pixbuf[3] = (bytesPerPixel == 4) ? in[3] : 255;
                 }
             }
         }
     } else if (targa_header.image_type == 10) {   // Runlength encoded RGB images
-        unsigned char red, green, blue, alphabyte, j;
-        for (row = rows - 1; row >= 0; row--) {
-            pixbuf = targa_rgba + row * columns * 4;
-            for (column = 0; column<columns; ) {
-                const unsigned char packetHeader = getc(fin);
+        for (int row = rows - 1; row >= 0 && !reader.overrun; row--) {
+            uint8_t *pixbuf = targa_rgba + row * columns * 4;
+            for (int column = 0; column < columns && !reader.overrun; ) {
+                const unsigned char packetHeader = reader.getByte();
                 const unsigned char packetSize = 1 + (packetHeader & 0x7f);
-                if (packetHeader & 0x80) {        // run-length packet
-                    switch (targa_header.pixel_size) {
-                    case 24:
-                        blue = getc(fin);
-                        green = getc(fin);
-                        red = getc(fin);
-                        alphabyte = 255;
-                        break;
-                    case 32:
-                        blue = getc(fin);
-                        green = getc(fin);
-                        red = getc(fin);
-                        alphabyte = getc(fin);
-                        break;
-                    default:
-                        logprint("LoadTGA: unsupported pixel size: %i\n", targa_header.pixel_size); //mxd
-                        return false;
-                    }
-
-                    for (j = 0; j<packetSize; j++) {
-                        *pixbuf++ = red;
-                        *pixbuf++ = green;
-                        *pixbuf++ = blue;
-                        *pixbuf++ = alphabyte;
-                        column++;
-                        if (column == columns) { // run spans across rows
-                            column = 0;
-                            if (row>0)
-                                row--;
-                            else
-                                goto breakOut;
-                            pixbuf = targa_rgba + row * columns * 4;
-                        }
-                    }
-                } else {                         // non run-length packet
-                    for (j = 0; j<packetSize; j++) {
-                        switch (targa_header.pixel_size) {
-                        case 24:
-                            blue = getc(fin);
-                            green = getc(fin);
-                            red = getc(fin);
-                            *pixbuf++ = red;
-                            *pixbuf++ = green;
-                            *pixbuf++ = blue;
-                            *pixbuf++ = 255;
-                            break;
-                        case 32:
-                            blue = getc(fin);
-                            green = getc(fin);
-                            red = getc(fin);
-                            alphabyte = getc(fin);
-                            *pixbuf++ = red;
-                            *pixbuf++ = green;
-                            *pixbuf++ = blue;
-                            *pixbuf++ = alphabyte;
-                            break;
-                        default:
-                            logprint("LoadTGA: unsupported pixel size: %i\n", targa_header.pixel_size); //mxd
-                            return false;
-                        }
-                        column++;
-                        if (column == columns) { // pixel packet run spans across rows
-                            column = 0;
-                            if (row>0)
-                                row--;
-                            else
-                                goto breakOut;
-                            pixbuf = targa_rgba + row * columns * 4;
-                        }
+                uint8_t rgba[4] = {};
+                if (packetHeader & 0x80)          // run-length packet
+                    ReadTGAPixel(&reader, targa_header.pixel_size, rgba);
+
+                for (unsigned char j = 0; j < packetSize; j++) {
+                    if (!(packetHeader & 0x80))   // non run-length packet
+                        ReadTGAPixel(&reader, targa_header.pixel_size, rgba);
+                    memcpy(pixbuf, rgba, 4);
+                    pixbuf += 4;
+                    column++;
+                    if (column == columns) { // packet spans across rows
+                        column = 0;
+                        if (row>0)
+                            row--;
+                        else
+                            goto breakOut;
+                        pixbuf = targa_rgba + row * columns * 4;
                     }
                 }
             }
@@ -414,39 +344,67 @@ LoadTGA(const char *filename, uint8_t **pixels, int *width, int *height)
         }
     }
 
-    fclose(fin);
+    if (reader.overrun) {
+        logprint("LoadTGA: File '%s' was malformed.\n", filename);
+        free(targa_rgba);
+        return false;
+    }
+
+    if (width)
+        *width = columns;
+    if (height)
+        *height = rows;
+    *pixels = targa_rgba;
 
     return true; //mxd
 }
 
+/*
+=============
+LoadTGA
+=============
+*/
+qboolean
+LoadTGA(const char *filename, uint8_t **pixels, int *width, int *height)
+{
+    if (FileTime(filename) == -1) {
+        logprint("LoadTGA: Failed to load '%s'. File does not exist.\n", filename);
+        return false; //mxd
+    }
+
+    uint8_t *data;
+    const int len = LoadFile(filename, static_cast<void *>(&data));
+    const qboolean ok = DecodeTGA(filename, data, len, pixels, width, height);
+    free(data);
+
+    return ok;
+}
+
 /*
 ============================================================================
 WAL IMAGE
 ============================================================================
 */
 
-qboolean LoadWAL(const char *filename, uint8_t **pixels, int *width, int *height)
+static qboolean
+DecodeWAL(const char *filename, const uint8_t *data, int len, uint8_t **pixels, int *width, int *height)
 {
-    if (FileTime(filename) == -1) {
-        logprint("LoadWAL: Failed to load '%s'. File does not exist.\n", filename);
-        return false; // Because LoadFile will throw an Error if the file doesn't exist... 
-    }
-
-    q2_miptex_t	*mt;
-    const int len = LoadFile(filename, static_cast<void *>(&mt));
-    if (len < 1) {
-        logprint("LoadWAL: Failed to load '%s'. File is empty.\n", filename);
+    if (len < static_cast<int>(sizeof(q2_miptex_t))) {
+        logprint("LoadWAL: File '%s' was malformed.\n", filename);
         return false;
     }
 
+    const q2_miptex_t *mt = reinterpret_cast<const q2_miptex_t *>(data);
     const int w = LittleLong(mt->width);
     const int h = LittleLong(mt->height);
     const int offset = LittleLong(mt->offsets[0]);
     const int numbytes = w * h;
     const int numpixels = numbytes * 4; // RGBA
 
-    if (width) *width = w;
-    if (height) *height = h;
+    if (w < 0 || h < 0 || offset < 0 || offset > len || len - offset < numbytes) {
+        logprint("LoadWAL: File '%s' was malformed.\n", filename);
+        return false;
+    }
 
     uint8_t *out = static_cast<uint8_t*>(malloc(numpixels));
     if (!out) {
@@ -454,27 +412,82 @@ qboolean LoadWAL(const char *filename, uint8_t **pixels, int *width, int *height
         return false;
     }
 
-    *pixels = out;
-
     for (int i = 0; i < numbytes; i++) {
-        const int palindex = reinterpret_cast<uint8_t*>(mt)[offset + i];
+        const int palindex = data[offset + i];
         out[i * 4]     = thepalette[palindex * 3];
         out[i * 4 + 1] = thepalette[palindex * 3 + 1];
         out[i * 4 + 2] = thepalette[palindex * 3 + 2];
         out[i * 4 + 3] = (palindex == 255 ? 0 : 255); // Last palette index is transparent color
     }
 
-    free(mt);
+    if (width) *width = w;
+    if (height) *height = h;
+    *pixels = out;
 
     return true;
 }
 
+qboolean LoadWAL(const char *filename, uint8_t **pixels, int *width, int *height)
+{
+    if (FileTime(filename) == -1) {
+        logprint("LoadWAL: Failed to load '%s'. File does not exist.\n", filename);
+        return false; // Because LoadFile will throw an Error if the file doesn't exist...
+    }
+
+    uint8_t *data;
+    const int len = LoadFile(filename, static_cast<void *>(&data));
+    if (len < 1) {
+        logprint("LoadWAL: Failed to load '%s'. File is empty.\n", filename);
+        free(data);
+        return false;
+    }
+
+    const qboolean ok = DecodeWAL(filename, data, len, pixels, width, height);
+    free(data);
+
+    return ok;
+}
+
 /*
 ==============================================================================
 Load (Quake 2) / Convert (Quake, Hexen 2) textures from paletted to RGBA (mxd)
 ==============================================================================
 */
 
+/* average color of each bsp->drgbatexdata texture, worked out while loading it */
+static std::vector<qvec3f> texture_avgcolors;
+
+// Returns color in [0,255]
+static qvec3f
+AverageColor(const uint8_t *pixels, const int numpixels)
+{
+    qvec4f color(0);
+
+    for (int i = 0; i < numpixels; i++) {
+        const uint8_t *c = pixels + i * 4;
+        if (c[3] < 128) continue; // Skip transparent pixels...
+        color += qvec4f((float)c[0], (float)c[1], (float)c[2], (float)c[3]);
+    }
+
+    return color / static_cast<float>(numpixels);
+}
+
+qvec3f
+Texture_AvgColor(const mbsp_t *bsp, const int miptexnum)
+{
+    if (miptexnum >= 0 && miptexnum < static_cast<int>(texture_avgcolors.size()))
+        return texture_avgcolors[miptexnum];
+
+    if (!bsp->rgbatexdatasize || miptexnum < 0 || miptexnum >= bsp->drgbatexdata->nummiptex)
+        return qvec3f(0);
+    const int ofs = bsp->drgbatexdata->dataofs[miptexnum];
+    if (ofs < 0)
+        return qvec3f(0);
+
+    const rgba_miptex_t *miptex = (const rgba_miptex_t *)((const uint8_t *)bsp->drgbatexdata + ofs);
+    return AverageColor((const uint8_t *)miptex + miptex->offset, miptex->width * miptex->height);
+}
+
 static void
 WriteRGBATextureData(mbsp_t *bsp, const std::vector<rgba_miptex_t*> &tex_mips, const std::vector<uint8_t*> &tex_bytes)
 {
@@ -500,6 +513,7 @@ WriteRGBATextureData(mbsp_t *bsp, const std::vector<rgba_miptex_t*> &tex_mips, c
     texdata = texdatastart = static_cast<uint8_t*>(malloc(totalsize));
     memcpy(texdata, miplmp, headersize);
     texdata += headersize;
+    free(miplmp);
 
     for (unsigned int i = 0; i < tex_mips.size(); i++) {
         if (tex_mips[i] == nullptr)
@@ -520,6 +534,248 @@ WriteRGBATextureData(mbsp_t *bsp, const std::vector<rgba_miptex_t*> &tex_mips, c
     bsp->rgbatexdatasize = totalsize;
 }
 
+static rgba_miptex_t *
+MakeRGBAMiptex(const char *name, const int width, const int height)
+{
+    const int miptexsize = sizeof(rgba_miptex_t);
+    rgba_miptex_t *tex = static_cast<rgba_miptex_t*>(malloc(miptexsize));
+    strcpy(tex->name, name);
+    tex->width = width;
+    tex->height = height;
+    tex->offset = miptexsize;
+    return tex;
+}
+
+/*
+ * -texcache keeps the decoded RGBA pixels and average color of every
+ * texture loaded from disk in mapname.texcache. Entries are keyed by a
+ * hash of the image file and the palette, so a texture that was edited
+ * since the last run is simply decoded again.
+ */
+
+#define TEXCACHE_IDENT "LTXC"
+#define TEXCACHE_VERSION 1
+
+struct texcacheheader_t {
+    char identification[4];
+    int version;
+    int numtextures;
+};
+
+/* followed by width * height RGBA pixels */
+struct texcacherecord_t {
+    uint64_t key;
+    int width, height;
+    float color[3];
+};
+
+struct texcacheentry_t {
+    texcacherecord_t record;
+    std::vector<uint8_t> pixels;
+};
+
+static std::map<uint64_t, texcacheentry_t> texcache_entries;
+
+static std::string
+TexCache_Path()
+{
+    char path[1024];
+    strcpy(path, mapfilename);
+    StripExtension(path);
+    DefaultExtension(path, ".texcache");
+    return path;
+}
+
+static uint64_t
+TexCache_Hash(uint64_t hash, const uint8_t *data, const size_t len)
+{
+    // a word at a time, this runs over every texture file on every load
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+        hash ^= hash >> 29;
+    }
+    for (; i < len; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t
+TexCache_Key(const bool wal, const uint8_t *data, const int len)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL ^ (static_cast<uint64_t>(wal) << 32) ^ static_cast<uint64_t>(len);
+    if (wal) // TGAs don't use the palette
+        hash = TexCache_Hash(hash, thepalette, sizeof(thepalette));
+    return TexCache_Hash(hash, data, len);
+}
+
+static void
+TexCache_Load()
+{
+    texcache_entries.clear();
+
+    FILE *f = fopen(TexCache_Path().c_str(), "rb");
+    if (!f)
+        return;
+
+    texcacheheader_t header;
+    bool ok = fread(&header, 1, sizeof(header), f) == sizeof(header)
+        && !memcmp(header.identification, TEXCACHE_IDENT, 4)
+        && header.version == TEXCACHE_VERSION
+        && header.numtextures >= 0;
+
+    for (int i = 0; ok && i < header.numtextures; i++) {
+        texcacheentry_t entry;
+        ok = fread(&entry.record, 1, sizeof(entry.record), f) == sizeof(entry.record)
+            && entry.record.width >= 0 && entry.record.height >= 0;
+        if (!ok)
+            break;
+        entry.pixels.resize(static_cast<size_t>(entry.record.width) * entry.record.height * 4);
+        ok = entry.pixels.empty() || fread(entry.pixels.data(), 1, entry.pixels.size(), f) == entry.pixels.size();
+        if (ok)
+            texcache_entries[entry.record.key] = std::move(entry);
+    }
+    fclose(f);
+
+    if (!ok) {
+        logprint("WARNING: ignoring damaged %s\n", TexCache_Path().c_str());
+        texcache_entries.clear();
+    }
+}
+
+struct texturejob_t {
+    std::string name;
+    std::string path;       // empty if the texture is missing or unsupported
+    bool wal;
+
+    uint64_t key;
+    bool cached;
+    int width, height;
+    uint8_t *pixels;        // RGBA, nullptr if loading failed
+    qvec3f color;
+};
+
+static void *
+LoadTextureThread(void *arg)
+{
+    std::vector<texturejob_t> &jobs = *static_cast<std::vector<texturejob_t> *>(arg);
+
+    while (1) {
+        const int i = GetThreadWork();
+        if (i == -1)
+            break;
+
+        texturejob_t &job = jobs[i];
+        if (job.path.empty())
+            continue; // Missing or unsupported, already warned about
+        const char *loader = job.wal ? "LoadWAL" : "LoadTGA";
+        if (FileTime(job.path.c_str()) == -1) {
+            logprint("%s: Failed to load '%s'. File does not exist.\n", loader, job.path.c_str());
+            continue; // Because LoadFile will throw an Error if the file doesn't exist...
+        }
+
+        uint8_t *data;
+        const int len = LoadFile(job.path.c_str(), static_cast<void *>(&data));
+        if (len < 1) {
+            logprint("%s: Failed to load '%s'. File is empty.\n", loader, job.path.c_str());
+            free(data);
+            continue;
+        }
+
+        if (texcache) {
+            job.key = TexCache_Key(job.wal, data, len);
+
+            const auto it = texcache_entries.find(job.key);
+            if (it != texcache_entries.end()) {
+                const texcacheentry_t &entry = it->second;
+                job.cached = true;
+                job.width = entry.record.width;
+                job.height = entry.record.height;
+                job.color = qvec3f(entry.record.color[0], entry.record.color[1], entry.record.color[2]);
+                job.pixels = static_cast<uint8_t *>(malloc(entry.pixels.size()));
+                memcpy(job.pixels, entry.pixels.data(), entry.pixels.size());
+                free(data);
+                continue;
+            }
+        }
+
+        qboolean ok;
+        if (job.wal)
+            ok = DecodeWAL(job.path.c_str(), data, len, &job.pixels, &job.width, &job.height);
+        else
+            ok = DecodeTGA(job.path.c_str(), data, len, &job.pixels, &job.width, &job.height);
+        free(data);
+
+        if (!ok) {
+            job.pixels = nullptr;
+            continue;
+        }
+        job.color = AverageColor(job.pixels, job.width * job.height);
+    }
+    return nullptr;
+}
+
+static void
+TexCache_Save(const std::vector<texturejob_t> &jobs)
+{
+    int numtextures = 0;
+    bool changed = false;
+    for (const texturejob_t &job : jobs) {
+        if (!job.pixels)
+            continue;
+        numtextures++;
+        changed |= !job.cached;
+    }
+
+    // nothing new was decoded and nothing would be dropped
+    if (!changed && numtextures == static_cast<int>(texcache_entries.size()))
+        return;
+
+    const std::string path = TexCache_Path();
+    const std::string temppath = path + ".tmp";
+    FILE *f = fopen(temppath.c_str(), "wb");
+    if (!f) {
+        logprint("WARNING: couldn't write %s\n", temppath.c_str());
+        return;
+    }
+
+    texcacheheader_t header {};
+    memcpy(header.identification, TEXCACHE_IDENT, 4);
+    header.version = TEXCACHE_VERSION;
+    header.numtextures = numtextures;
+    fwrite(&header, 1, sizeof(header), f);
+
+    for (const texturejob_t &job : jobs) {
+        if (!job.pixels)
+            continue;
+
+        texcacherecord_t record {};
+        record.key = job.key;
+        record.width = job.width;
+        record.height = job.height;
+        for (int i = 0; i < 3; i++)
+            record.color[i] = job.color[i];
+        fwrite(&record, 1, sizeof(record), f);
+        fwrite(job.pixels, 1, static_cast<size_t>(job.width) * job.height * 4, f);
+    }
+
+    bool ok = !ferror(f);
+    fclose(f);
+    if (ok && rename(temppath.c_str(), path.c_str())) {
+        // rename doesn't replace an existing file on Windows
+        remove(path.c_str());
+        ok = !rename(temppath.c_str(), path.c_str());
+    }
+    if (!ok) {
+        logprint("WARNING: couldn't write %s\n", path.c_str());
+        remove(temppath.c_str());
+    }
+}
+
 static void AddTextureName(std::map<std::string, std::string> &texturenames, const char *texture)
 {
     // See if an earlier texinfo allready got the value
@@ -536,7 +792,7 @@ static void AddTextureName(std::map<std::string, std::string> &texturenames, con
 
     int c;
     for (c = 0; c < 4; c++) {
-        // Skip paths at even indexes when running from game folder... 
+        // Skip paths at even indexes when running from game folder...
         if ((is_mod || c % 2 == 0) && FileTime(path[c]) != -1) {
             texturenames[std::string{ texture }] = std::string{ path[c] };
             break;
@@ -549,7 +805,7 @@ static void AddTextureName(std::map<std::string, std::string> &texturenames, con
         else
             logprint("WARNING: failed to find texture '%s'. Checked paths:\n'%s'\n'%s'\n", texture, path[0], path[2]);
 
-        // Store to preserve offset... 
+        // Store to preserve offset...
         texturenames[std::string{ texture }] = std::string{};
     }
 }
@@ -578,21 +834,24 @@ LoadTextures(mbsp_t *bsp)
         }
     }
 
-    // Step 3: load and convert to miptex_t, store texturename indices...
+    // Step 3: work out how to load each one, store texturename indices...
     std::map<std::string, int> indicesbytexturename;
-    std::vector<rgba_miptex_t*> tex_mips{};
-    std::vector<uint8_t*> tex_bytes{};
-    const int miptexsize = sizeof(rgba_miptex_t);
+    std::vector<texturejob_t> jobs(texturenames.size());
     int counter = 0;
 
     for (auto pair : texturenames) {
         // Store texturename index...
-        indicesbytexturename[std::string{ pair.first }] = counter++;
+        indicesbytexturename[std::string{ pair.first }] = counter;
+
+        texturejob_t &job = jobs[counter++];
+        job.name = pair.first;
+        job.wal = false;
+        job.key = 0;
+        job.cached = false;
+        job.width = job.height = 0;
+        job.pixels = nullptr;
+        job.color = qvec3f(0);
 
-        // Add nullptrs to keep texture index in case of load problems...
-        tex_mips.push_back(nullptr);
-        tex_bytes.push_back(nullptr);
-        
         // Find file extension
         const int dpos = pair.second.rfind('.');
         if (dpos == -1) {
@@ -602,31 +861,44 @@ LoadTextures(mbsp_t *bsp)
         }
         const std::string ext = pair.second.substr(dpos + 1);
 
-        // Load images as RGBA
-        int width, height;
-        uint8_t *pixels;
-
-        if (string_iequals(ext, "tga")) {
-            if (!LoadTGA(pair.second.c_str(), &pixels, &width, &height)) 
-                continue;
-        } else if (string_iequals(ext, "wal")) {
-            if (!LoadWAL(pair.second.c_str(), &pixels, &width, &height)) 
-                continue;
-        } else {
+        if (string_iequals(ext, "wal")) {
+            job.wal = true;
+        } else if (!string_iequals(ext, "tga")) {
             logprint("WARNING: unsupported image format: '%s'\n", pair.second.c_str());
             continue;
         }
+        job.path = pair.second;
+    }
 
-        // Create rgba_miptex_t...
-        rgba_miptex_t *tex = static_cast<rgba_miptex_t*>(malloc(miptexsize));
-        strcpy(tex->name, pair.first.c_str());
-        tex->width = width;
-        tex->height = height;
-        tex->offset = miptexsize;
+    // Step 4: load images as RGBA, jobs that failed keep nullptrs to keep texture indices...
+    if (texcache)
+        TexCache_Load();
+
+    RunThreadsOn(0, static_cast<int>(jobs.size()), LoadTextureThread, &jobs);
+
+    if (texcache) {
+        int hits = 0, loaded = 0;
+        for (const texturejob_t &job : jobs) {
+            hits += job.cached;
+            loaded += (job.pixels != nullptr);
+        }
+        logprint("%d of %d textures read from %s\n", hits, loaded, TexCache_Path().c_str());
+
+        TexCache_Save(jobs);
+        texcache_entries.clear();
+    }
 
-        // Replace nullptrs with actual data...
-        tex_mips[tex_mips.size() - 1] = tex;
-        tex_bytes[tex_bytes.size() - 1] = pixels;
+    std::vector<rgba_miptex_t*> tex_mips(jobs.size(), nullptr);
+    std::vector<uint8_t*> tex_bytes(jobs.size(), nullptr);
+    texture_avgcolors.assign(jobs.size(), qvec3f(0));
+    for (size_t i = 0; i < jobs.size(); i++) {
+        if (!jobs[i].pixels)
+            continue;
+
+        // Create rgba_miptex_t...
+        tex_mips[i] = MakeRGBAMiptex(jobs[i].name.c_str(), jobs[i].width, jobs[i].height);
+        tex_bytes[i] = jobs[i].pixels;
+        texture_avgcolors[i] = jobs[i].color;
     }
 
     // Sanity checks...
@@ -634,10 +906,14 @@ LoadTextures(mbsp_t *bsp)
     Q_assert(texturenames.size() == tex_bytes.size());
     Q_assert(texturenames.size() == indicesbytexturename.size());
 
-    // Step 4: write data to bsp...
+    // Step 5: write data to bsp...
     WriteRGBATextureData(bsp, tex_mips, tex_bytes);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        free(tex_mips[i]);
+        free(tex_bytes[i]);
+    }
 
-    // Step 5: set miptex indices to gtexinfo_t
+    // Step 6: set miptex indices to gtexinfo_t
     for (int i = 0; i < bsp->numtexinfo; i++) {
         gtexinfo_t *info = &bsp->texinfo[i];
 
@@ -647,65 +923,84 @@ LoadTextures(mbsp_t *bsp)
     }
 }
 
-static void // Converts paletted bsp->dtexdata textures to RGBA bsp->drgbatexdata textures (Quake / Hexen2)
-ConvertTextures(mbsp_t *bsp)
-{
-    if (!bsp->texdatasize) return;
+struct convertjobs_t {
+    const mbsp_t *bsp;
+    std::vector<rgba_miptex_t*> tex_mips;
+    std::vector<uint8_t*> tex_bytes;
+};
 
-    logprint("--- ConvertTextures ---\n");
+static void *
+ConvertTextureThread(void *arg)
+{
+    convertjobs_t *jobs = static_cast<convertjobs_t *>(arg);
+    const dmiptexlump_t *texdata = jobs->bsp->dtexdata;
 
-    std::map<int, std::string> texturenamesbyindex;
-    std::vector<rgba_miptex_t*> tex_mips{};
-    std::vector<uint8_t*> tex_bytes{};
-    const int miptexsize = sizeof(rgba_miptex_t);
+    while (1) {
+        const int i = GetThreadWork();
+        if (i == -1)
+            break;
 
-    // Step 1: store texture data and RGBA bytes in temporary arrays...
-    for (int i = 0; i < bsp->dtexdata->nummiptex; i++) {
-        const int ofs = bsp->dtexdata->dataofs[i];
+        const int ofs = texdata->dataofs[i];
 
         // Pad to keep offsets...
-        if (ofs < 0) {
-            tex_mips.push_back(nullptr);
-            tex_bytes.push_back(nullptr);
+        if (ofs < 0)
             continue;
-        }
 
-        miptex_t *miptex = (miptex_t *)((uint8_t *)bsp->dtexdata + ofs);
+        const miptex_t *miptex = (const miptex_t *)((const uint8_t *)texdata + ofs);
 
         // Create rgba_miptex_t...
-        rgba_miptex_t *tex = static_cast<rgba_miptex_t*>(malloc(miptexsize));
-        strcpy(tex->name, miptex->name);
-        tex->width = miptex->width;
-        tex->height = miptex->height;
-        tex->offset = miptexsize;
-
-        // Store texturename index...
-        texturenamesbyindex[i] = std::string{ tex->name };
+        rgba_miptex_t *tex = MakeRGBAMiptex(miptex->name, miptex->width, miptex->height);
 
         // Convert to RGBA
         const int numpalpixels = tex->width * tex->height;
         uint8_t *pixels = static_cast<uint8_t*>(malloc(numpalpixels * 4)); //RGBA
-        const uint8_t *data = reinterpret_cast<uint8_t*>(miptex) + miptex->offsets[0];
+        const uint8_t *data = reinterpret_cast<const uint8_t*>(miptex) + miptex->offsets[0];
 
         for (int c = 0; c < numpalpixels; c++) {
             const uint8_t palindex = data[c];
-            auto color = Palette_GetColor(palindex);
             for (int d = 0; d < 3; d++)
-                pixels[c * 4 + d] = static_cast<uint8_t>(color[d]);
+                pixels[c * 4 + d] = thepalette[palindex * 3 + d];
             pixels[c * 4 + 3] = static_cast<uint8_t>(palindex == 255 ? 0 : 255);
         }
 
         // Store...
-        tex_mips.push_back(tex);
-        tex_bytes.push_back(pixels);
+        jobs->tex_mips[i] = tex;
+        jobs->tex_bytes[i] = pixels;
+        texture_avgcolors[i] = AverageColor(pixels, numpalpixels);
+    }
+    return nullptr;
+}
+
+static void // Converts paletted bsp->dtexdata textures to RGBA bsp->drgbatexdata textures (Quake / Hexen2)
+ConvertTextures(mbsp_t *bsp)
+{
+    if (!bsp->texdatasize) return;
+
+    logprint("--- ConvertTextures ---\n");
+
+    // Step 1: convert to RGBA in temporary arrays, nullptrs keep the offsets of missing textures...
+    const int nummiptex = bsp->dtexdata->nummiptex;
+    convertjobs_t jobs { bsp, std::vector<rgba_miptex_t*>(nummiptex, nullptr), std::vector<uint8_t*>(nummiptex, nullptr) };
+    texture_avgcolors.assign(nummiptex, qvec3f(0));
+    RunThreadsOn(0, nummiptex, ConvertTextureThread, &jobs);
+
+    // Store texturename indices...
+    std::map<int, std::string> texturenamesbyindex;
+    for (int i = 0; i < nummiptex; i++) {
+        if (jobs.tex_mips[i])
+            texturenamesbyindex[i] = std::string{ jobs.tex_mips[i]->name };
     }
 
     // Sanity checks...
-    Q_assert(tex_mips.size() == tex_bytes.size());
-    Q_assert(bsp->dtexdata->nummiptex == tex_mips.size());
+    Q_assert(jobs.tex_mips.size() == jobs.tex_bytes.size());
+    Q_assert(nummiptex == jobs.tex_mips.size());
 
     // Step 2: write data to bsp...
-    WriteRGBATextureData(bsp, tex_mips, tex_bytes);
+    WriteRGBATextureData(bsp, jobs.tex_mips, jobs.tex_bytes);
+    for (int i = 0; i < nummiptex; i++) {
+        free(jobs.tex_mips[i]);
+        free(jobs.tex_bytes[i]);
+    }
 
     // Step 3: set texturenames to gmiptex_t
     for (int i = 0; i < bsp->numtexinfo; i++) {
@@ -720,6 +1015,8 @@ ConvertTextures(mbsp_t *bsp)
 void // Expects correct palette and game/mod paths to be set
 LoadOrConvertTextures(mbsp_t *bsp)
 {
+    texture_avgcolors.clear();
+
     // Load or convert textures...
     if (bsp->loadversion->game->id == GAME_QUAKE_II)
         LoadTextures(bsp);
@@ -727,4 +1024,4 @@ LoadOrConvertTextures(mbsp_t *bsp)
         ConvertTextures(bsp);
     else
         logprint("WARNING: failed to load or convert textures.\n");
-}
\ No newline at end of file
+}
@@ -29,6 +29,9 @@
 #include <light/imglib.hh> //mxd
 #include <light/entities.hh>
 #include <light/ltface.hh>
+#include <light/serve.hh>
+#include <light/relight.hh>
+#include <light/pvs.hh>
 
 #include <common/polylib.hh>
 #include <common/bsputils.hh>
@@ -39,6 +42,7 @@
 #endif
 
 #include <memory>
+#include <functional>
 #include <vector>
 #include <map>
 #include <unordered_map>
@@ -95,6 +99,8 @@ std::vector<const modelinfo_t *> shadowworldonlylist;
 std::vector<const modelinfo_t *> switchableshadowlist;
 
 int oversample = 1;
+int undersample = 1;    /* >1 only lights every n'th luxel (-progressive's first pass) */
+float progressive = 0;  /* -progressive time budget in seconds, 0 when off */
 int write_litfile = 0;  /* 0 for none, 1 for .lit, 2 for bspx, 3 for both */
 int write_luxfile = 0;  /* 0 for none, 1 for .lux, 2 for bspx, 3 for both */
 qboolean onlyents = false;
@@ -104,6 +110,11 @@ bool debug_highlightseams = false;
 debugmode_t debugmode = debugmode_none;
 bool verbose_log = false;
 bool litonly = false;
+bool incremental = false;
+bool texcache = false;
+bool nopvs = false;
+bool fastsky = false;
+float adaptive = 0;    /* >0: -extra/-extra4 only supersample luxels whose neighbours differ by more than this */
 
 surfflags_t *extended_texinfo_flags = nullptr;
 
@@ -119,6 +130,64 @@ vec3_t dump_vert_point = {0,0,0};
 
 qboolean arghradcompat = false; //mxd
 
+struct lightstage_info_t {
+    const char *name;
+    std::vector<lightstage_t> deps;
+    std::function<void()> run;
+    bool done;
+    bool reused;        // done by the --serve process before this request
+    double seconds;     // excluding stages it required while running
+};
+
+static lightstage_info_t lightstages[static_cast<int>(lightstage_t::COUNT)];
+static double lightstage_nested;    // time spent in stages required by the running stage
+
+static void
+DefineStage(lightstage_t stage, const char *name, std::vector<lightstage_t> deps, std::function<void()> run)
+{
+    lightstage_info_t &info = lightstages[static_cast<int>(stage)];
+    info.name = name;
+    info.deps = std::move(deps);
+    info.run = std::move(run);
+    info.done = false;
+    info.reused = false;
+    info.seconds = 0;
+}
+
+void
+RequireStage(lightstage_t stage)
+{
+    lightstage_info_t &info = lightstages[static_cast<int>(stage)];
+    if (info.done || !info.run)
+        return;
+    info.done = true;
+
+    for (const lightstage_t dep : info.deps)
+        RequireStage(dep);
+
+    const double outer_nested = lightstage_nested;
+    lightstage_nested = 0;
+
+    const double start = I_FloatTime();
+    info.run();
+    const double elapsed = I_FloatTime() - start;
+
+    info.seconds = elapsed - lightstage_nested;
+    lightstage_nested = outer_nested + elapsed;
+}
+
+static void
+PrintStageTimes()
+{
+    logprint("setup stages:\n");
+    for (const lightstage_info_t &info : lightstages) {
+        if (info.reused)
+            logprint("  reused         %s\n", info.name);
+        else if (info.done)
+            logprint("%8.3f seconds %s\n", info.seconds, info.name);
+    }
+}
+
 lockable_setting_t *FindSetting(std::string name) {
     settingsdict_t sd = cfg_static.settings();
     return sd.findSetting(name);
@@ -129,10 +198,11 @@ void SetGlobalSetting(std::string name, std::string value, bool cmdline) {
     sd.setSetting(name, value, cmdline);
 }
 
+static bool settings_fixed_up = false;
+
 void FixupGlobalSettings() {
-    static bool once = false;
-    Q_assert(!once);
-    once = true;
+    Q_assert(!settings_fixed_up);
+    settings_fixed_up = true;
     
     // NOTE: This is confusing.. Setting "dirt" "1" implies "minlight_dirt" "1"
     // (and sunlight_dir/sunlight2_dirt as well), unless those variables were
@@ -377,13 +447,18 @@ FindModelInfo(const mbsp_t *bsp, const char *lmscaleoverride)
     Q_assert(modelinfo.size() == bsp->nummodels);
 }
 
+static void StoreLighting(bspdata_t *bspdata);
+
 /*
  * =============
  *  LightWorld
+ *
+ *  relight: record the lightmaps for -incremental and reuse the ones
+ *  from the last run (only for the final lighting, not previews)
  * =============
  */
 static void
-LightWorld(bspdata_t *bspdata, qboolean forcedscale)
+LightWorld(bspdata_t *bspdata, qboolean forcedscale, bool relight)
 {
     logprint("--- LightWorld ---\n" );
     
@@ -416,6 +491,8 @@ LightWorld(bspdata_t *bspdata, qboolean forcedscale)
     if (forcedscale)
         BSPX_AddLump(bspdata, "LMSHIFT", NULL, 0);
 
+    free(faces_sup);
+
     const unsigned char *lmshift_lump = (const unsigned char *)BSPX_GetLump(bspdata, "LMSHIFT", NULL);
     if (!lmshift_lump && write_litfile != ~0)
         faces_sup = NULL; //no scales, no lit2
@@ -435,7 +512,10 @@ LightWorld(bspdata_t *bspdata, qboolean forcedscale)
         }
     }
 
-    CalculateVertexNormals(bsp);
+    RequireStage(lightstage_t::textures);
+    RequireStage(lightstage_t::tracescene);
+    RequireStage(lightstage_t::vertexnormals);
+    RequireStage(lightstage_t::pvs);
     
     const qboolean bouncerequired = cfg_static.bounce.boolValue() && (debugmode == debugmode_none || debugmode == debugmode_bounce || debugmode == debugmode_bouncelights); //mxd
     const qboolean isQuake2map = bsp->loadversion->game->id == GAME_QUAKE_II; //mxd
@@ -444,8 +524,11 @@ LightWorld(bspdata_t *bspdata, qboolean forcedscale)
         MakeTextureColors(bsp);
         if (isQuake2map)   MakeSurfaceLights(cfg_static, bsp);
         if (bouncerequired) MakeBounceLights(cfg_static, bsp);
+        PrintVisibleBoundsStats("surface and bounce lights");
     }
     
+    Pvs_Begin(bsp);
+    
 #if 0
     lightbatchthread_info_t info;
     info.all_batches = MakeLightingBatches(bsp);
@@ -453,9 +536,15 @@ LightWorld(bspdata_t *bspdata, qboolean forcedscale)
     info.bsp = bsp;
     RunThreadsOn(0, info.all_batches.size(), LightBatchThread, &info);
 #else
+    if (relight)
+        Relight_Begin(bsp, faces_sup, cfg_static);
+    
     logprint("--- LightThread ---\n"); //mxd
     RunThreadsOn(0, bsp->numfaces, LightThread, bsp);
 #endif
+    
+    if (relight)
+        Relight_Finish(bsp);
 
     if (bouncerequired || isQuake2map) { //mxd. Print some extra stats...
         logprint("Indirect lights: %i bounce lights, %i surface lights (%i light points) in use.\n",
@@ -466,6 +555,18 @@ LightWorld(bspdata_t *bspdata, qboolean forcedscale)
 
     logprint("Lighting Completed.\n\n");
 
+    StoreLighting(bspdata);
+}
+
+/*
+ * Copies the lighting from the file buffers into the bsp, and the
+ * LMSHIFT styles and offsets into BSPX lumps.
+ */
+static void
+StoreLighting(bspdata_t *bspdata)
+{
+    mbsp_t *const bsp = &bspdata->data.mbsp;
+
     // Transfer greyscale lightmap (or color lightmap for Q2/HL) to the bsp and update lightdatasize
     if (!litonly) {
         free(bsp->dlightdata);
@@ -775,6 +876,15 @@ static void PrintUsage()
 "  -gate n             cutoff lights at this brightness level\n"
 "  -sunsamples n       set samples for _sunlight2, default 64\n"
 "  -surflight_subdivide  surface light subdivision size\n"
+"  -incremental        only relight faces reached by changed lights\n"
+"  -texcache           keep decoded textures in mapname.texcache for later runs\n"
+"  -nopvs              don't use the map's vis data to skip lights a face can't see\n"
+"  -progressive n      light in passes of increasing quality, rewriting the\n"
+"                      output after each, until n seconds are used\n"
+"  -fastsky            interpolate sunlight between coarse sample points where\n"
+"                      they agree, may miss thin shadows\n"
+"  -adaptive [n]       with -extra/-extra4, only supersample luxels at shadow\n"
+"                      edges or differing from a neighbour by more than n\n"
 "\n"
 "Output format options:\n"
 "  -lit                write .lit file\n"
@@ -797,7 +907,12 @@ static void PrintUsage()
 "  -bspxlit            writes rgb data into the bsp itself\n"
 "  -bspx               writes both rgb and directions data into the bsp itself\n"
 "  -novanilla          implies -bspxlit. don't write vanilla lighting\n"
-"  -radlights filename.rad loads a <surfacename> <r> <g> <b> <intensity> file\n");
+"  -radlights filename.rad loads a <surfacename> <r> <g> <b> <intensity> file\n"
+"\n"
+"Server mode:\n"
+"  light --serve socket                 keep maps loaded between runs\n"
+"  light --connect socket [options] mapname.bsp\n"
+"                      light through a server, or directly if none is running\n");
     
     printf("\n");
     printf("Overridable worldspawn keys:\n");
@@ -859,7 +974,10 @@ static bool ParseVec3Optional(vec3_t vec3_out, int *i_inout, int argc, const cha
 static bool ParseVecOptional(vec_t *result, int *i_inout, int argc, const char **argv)
 {
     if ((*i_inout + 1) < argc) {
-        if (!isdigit(argv[*i_inout + 1][0])) {
+        const char *arg = argv[*i_inout + 1];
+        
+        // accept a digit, or '.' followed by a digit (e.g. ".5")
+        if (!isdigit(arg[0]) && !(arg[0] == '.' && isdigit(arg[1]))) {
             return false;
         }
         *result = atof( argv[ ++(*i_inout) ] );
@@ -928,30 +1046,26 @@ static const char *ParseString(int *i_inout, int argc, const char **argv)
 }
 
 /*
- * ==================
- * main
- * light modelfile
- * ==================
+ * The map being lit. These live at file scope rather than in light_main
+ * so that --serve can keep a loaded map between requests.
  */
-int
-light_main(int argc, const char **argv)
-{
+static struct {
     bspdata_t bspdata;
-    mbsp_t *const bsp = &bspdata.data.mbsp;
     const bspversion_t *loadversion;
-    int i;
-    double start;
-    double end;
     char source[1024];
-    const char *lmscaleoverride = NULL;
-    
-    init_log("light.log");
-    logprint("---- light / ericw-tools " stringify(ERICWTOOLS_VERSION) " ----\n");
+    std::string bspfilename;
+    const char *lmscaleoverride;
+    double start;
+} lightinput;
 
-    LowerProcessPriority();
-    numthreads = GetDefaultThreads();
-    
+/*
+ * Parses the options, returning the index of the map argument.
+ */
+static int
+ParseOptions(int argc, const char **argv)
+{
     globalconfig_t &cfg = cfg_static;
+    int i;
     
     for (i = 1; i < argc; i++) {
         if (!strcmp(argv[i], "-threads")) {
@@ -990,7 +1104,7 @@ light_main(int argc, const char **argv)
             if (!ParseLightsFile(argv[++i]))
                 logprint( "Unable to read surfacelights file %s\n", argv[i] );
         } else if ( !strcmp( argv[ i ], "-lmscale" ) ) {
-            lmscaleoverride = argv[++i];
+            lightinput.lmscaleoverride = argv[++i];
         } else if (!strcmp(argv[i], "-soft")) {
             if ((i + 1) < argc && isdigit(argv[i + 1][0]))
                 softsamples = ParseInt(&i, argc, argv);
@@ -1065,6 +1179,29 @@ light_main(int argc, const char **argv)
             logprint("-litonly specified; .bsp file will not be modified\n");
             litonly = true;
             write_litfile |= 1;
+        } else if (!strcmp(argv[i], "-incremental")) {
+            logprint("Reusing lightmaps of faces unaffected by light changes\n");
+            incremental = true;
+        } else if (!strcmp(argv[i], "-texcache")) {
+            logprint("Caching decoded textures\n");
+            texcache = true;
+        } else if (!strcmp(argv[i], "-nopvs")) {
+            logprint("Not using vis data to cull lights\n");
+            nopvs = true;
+        } else if (!strcmp(argv[i], "-fastsky")) {
+            logprint("Interpolating sunlight visibility between coarse sample points\n");
+            fastsky = true;
+        } else if (!strcmp(argv[i], "-adaptive")) {
+            adaptive = 4;
+            ParseVecOptional(&adaptive, &i, argc, argv);
+            if (adaptive <= 0)
+                Error("-adaptive threshold must be greater than 0\n");
+            logprint("Adaptive supersampling, threshold %g\n", adaptive);
+        } else if (!strcmp(argv[i], "-progressive")) {
+            progressive = ParseVec(&i, argc, argv);
+            if (progressive <= 0)
+                Error("-progressive requires a time budget in seconds\n");
+            logprint("Progressive lighting with a budget of %g seconds\n", progressive);
         } else if ( !strcmp( argv[ i ], "-verbose" ) || !strcmp( argv[ i ], "-v" ) ) { // Quark always passes -v
             verbose_log = true;
         } else if ( !strcmp( argv[ i ], "-help" ) ) {
@@ -1127,7 +1264,8 @@ light_main(int argc, const char **argv)
     }
 
     if (softsamples == -1) {
-        switch (oversample) {
+        // adaptive supersampling writes lightmaps at the base resolution
+        switch (adaptive > 0 ? 1 : oversample) {
         case 2:
             softsamples = 1;
             break;
@@ -1140,10 +1278,21 @@ light_main(int argc, const char **argv)
         }
     }
 
-    start = I_FloatTime();
+    return i;
+}
 
-    strcpy(source, argv[i]);
-    strcpy(mapfilename, argv[i]);
+/*
+ * Loads the map, along with its .rad files, and defines the setup stages
+ * that work on it.
+ */
+static void
+LoadInput(const char *filename)
+{
+    globalconfig_t &cfg = cfg_static;
+    char *const source = lightinput.source;
+    
+    strcpy(source, filename);
+    strcpy(mapfilename, filename);
     
     // delete previous litfile
     if (!onlyents) {
@@ -1162,100 +1311,322 @@ light_main(int argc, const char **argv)
     
     StripExtension(source);
     DefaultExtension(source, ".bsp");
-    LoadBSPFile(source, &bspdata);
+    LoadBSPFile(source, &lightinput.bspdata);
 
-    loadversion = bspdata.version;
-    ConvertBSPFormat(&bspdata, &bspver_generic);
+    lightinput.loadversion = lightinput.bspdata.version;
+    ConvertBSPFormat(&lightinput.bspdata, &bspver_generic);
 
     //mxd. Use 1.0 rangescale as a default to better match with qrad3/arghrad
-    if ((loadversion->game->id == GAME_QUAKE_II) && !cfg.rangescale.isChanged())
+    if ((lightinput.loadversion->game->id == GAME_QUAKE_II) && !cfg.rangescale.isChanged())
     {
         const auto rs = new lockable_vec_t(cfg.rangescale.primaryName(), 1.0f, 0.0f, 100.0f);
         cfg.rangescale = *rs; // Gross hacks to avoid displaying this in OptionsSummary...
     }
 
-    //mxd. Load or convert textures...
-    SetQdirFromPath(GetBaseDirName(&bspdata), source);
-    LoadPalette(&bspdata);
-    LoadOrConvertTextures(bsp);
+    lightinput.bspfilename = source;
+}
+
+/*
+ * Setup work runs when something first needs it. -onlyents only
+ * rewrites the entity lump, so it never builds the trace scene or
+ * loads textures unless a light projects one.
+ */
+static void
+DefineStages()
+{
+    DefineStage(lightstage_t::textures, "textures", {}, []() {
+        //mxd. Load or convert textures...
+        SetQdirFromPath(GetBaseDirName(&lightinput.bspdata), lightinput.bspfilename.c_str());
+        LoadPalette(&lightinput.bspdata);
+        LoadOrConvertTextures(&lightinput.bspdata.data.mbsp);
+    });
+    DefineStage(lightstage_t::entities, "entities", {}, []() {
+        LoadExtendedTexinfoFlags(lightinput.bspfilename.c_str(), &lightinput.bspdata.data.mbsp);
+        LoadEntities(cfg_static, &lightinput.bspdata.data.mbsp);
+    });
+    DefineStage(lightstage_t::modelinfo, "modelinfo", { lightstage_t::entities }, []() {
+        FindModelInfo(&lightinput.bspdata.data.mbsp, lightinput.lmscaleoverride);
+    });
+    DefineStage(lightstage_t::tracescene, "tracescene", { lightstage_t::textures, lightstage_t::modelinfo }, []() {
+        MakeTnodes(&lightinput.bspdata.data.mbsp);
+    });
+    DefineStage(lightstage_t::vertexnormals, "vertexnormals", { lightstage_t::modelinfo }, []() {
+        CalculateVertexNormals(&lightinput.bspdata.data.mbsp);
+    });
+    DefineStage(lightstage_t::pvs, "pvs", {}, []() {
+        Pvs_Setup(&lightinput.bspdata.data.mbsp);
+    });
+    DefineStage(lightstage_t::lights, "lights", { lightstage_t::modelinfo }, []() {
+        SetupLights(cfg_static, &lightinput.bspdata.data.mbsp);
+    });
+}
+
+/*
+ * Writes the .bsp, and the .lit/.lux files if enabled, converting the bsp
+ * back to the format it was loaded in.
+ */
+static void
+WriteOutput(bspdata_t *bspdata, const bspversion_t *loadversion, const char *filename)
+{
+    mbsp_t *const bsp = &bspdata->data.mbsp;
+
+    if (!onlyents) {
+        /*invalidate any bspx lighting info early*/
+        BSPX_AddLump(bspdata, "RGBLIGHTING", NULL, 0);
+        BSPX_AddLump(bspdata, "LIGHTINGDIR", NULL, 0);
+
+        /*fixme: add a new per-surface offset+lmscale lump for compat/versitility?*/
+        if (write_litfile & 1)
+            WriteLitFile(bsp, faces_sup, filename, LIT_VERSION);
+        if (write_litfile & 2)
+            BSPX_AddLump(bspdata, "RGBLIGHTING", lit_filebase, bsp->lightdatasize*3);
+        if (write_luxfile & 1)
+            WriteLuxFile(bsp, filename, LIT_VERSION);
+        if (write_luxfile & 2)
+            BSPX_AddLump(bspdata, "LIGHTINGDIR", lux_filebase, bsp->lightdatasize*3);
+    }
+
+    /* -novanilla + internal lighting = no grey lightmap */
+    if (scaledonly && (write_litfile & 2))
+        bsp->lightdatasize = 0;
+
+#if 0
+    ExportObj(filename, bsp);
+#endif
+    
+    WriteEntitiesToString(cfg_static, bsp);
+    /* Convert data format back if necessary */
+    ConvertBSPFormat(bspdata, loadversion);
+
+    if (!litonly) {
+        WriteBSPFile(filename, bspdata);
+    }
+}
+
+static void
+ReplaceOutputFile(const char *tempname, const char *source, const char *ext)
+{
+    char from[1024], to[1024];
+
+    q_snprintf(from, sizeof(from), "%s", tempname);
+    StripExtension(from);
+    DefaultExtension(from, ext);
+    q_snprintf(to, sizeof(to), "%s", source);
+    StripExtension(to);
+    DefaultExtension(to, ext);
+
+    if (rename(from, to)) {
+        // rename doesn't replace an existing file on Windows
+        remove(to);
+        if (rename(from, to))
+            Error("%s: couldn't rename %s to %s", __func__, from, to);
+    }
+}
+
+/*
+ * -progressive rewrites the output after every pass, so it is written to
+ * mapname-preview.* first and then moved over the real files. That way a
+ * game or editor reloading the map never sees a half-written file.
+ */
+static void
+WriteOutputAtomically(bspdata_t *bspdata, const bspversion_t *loadversion, const char *source)
+{
+    char tempname[1024];
+
+    q_snprintf(tempname, sizeof(tempname), "%s", source);
+    StripExtension(tempname);
+    strcat(tempname, "-preview.bsp");
+
+    WriteOutput(bspdata, loadversion, tempname);
+
+    if (write_litfile & 1)
+        ReplaceOutputFile(tempname, source, ".lit");
+    if (write_luxfile & 1)
+        ReplaceOutputFile(tempname, source, ".lux");
+    ReplaceOutputFile(tempname, source, ".bsp");
+}
+
+/*
+ * Writes the lighting of a finished -progressive pass. Writing converts
+ * the bsp back to its file format, which the trace scene and modelinfo
+ * can't survive, so the lighting goes into a fresh copy of the file.
+ */
+static void
+WritePreview(bspdata_t *bspdata, const bspversion_t *loadversion, const char *source)
+{
+    const mbsp_t *const bsp = &bspdata->data.mbsp;
+    char filename[1024];
+    bspdata_t preview {};
+
+    q_snprintf(filename, sizeof(filename), "%s", source);
+    LoadBSPFile(filename, &preview);
+    ConvertBSPFormat(&preview, &bspver_generic);
+
+    mbsp_t *const out = &preview.data.mbsp;
+    Q_assert(out->numfaces == bsp->numfaces);
+    for (int i = 0; i < bsp->numfaces; i++) {
+        out->dfaces[i].lightofs = bsp->dfaces[i].lightofs;
+        memcpy(out->dfaces[i].styles, bsp->dfaces[i].styles, sizeof(out->dfaces[i].styles));
+    }
+    if (!BSPX_GetLump(bspdata, "LMSHIFT", NULL))
+        BSPX_AddLump(&preview, "LMSHIFT", NULL, 0);
+
+    StoreLighting(&preview);
+    WriteOutputAtomically(&preview, loadversion, source);
+}
+
+struct lightpass_t {
+    const char *name;
+    int undersample;
+    int oversample;
+    bool dirt;
+    bool bounce;
+};
+
+/*
+ * -progressive <seconds>: lights the map in passes of increasing quality
+ * up to the one the options ask for, writing the output after each pass.
+ * A pass is only started if the time used so far plus the length of the
+ * previous pass fits the budget. The passes before the last use -fastsky;
+ * the last uses the options as given, so a run that gets there writes the
+ * same output as a normal one. Only the last pass reads and writes the
+ * -incremental cache.
+ */
+static void
+LightProgressive(bspdata_t *bspdata, const bspversion_t *loadversion, const char *source, qboolean forcedscale)
+{
+    const int final_oversample = oversample;
+    const bool final_dirt = dirt_in_use;
+    const lockable_bool_t final_bounce = cfg_static.bounce;
+    const bool final_fastsky = fastsky;
+
+    std::vector<lightpass_t> passes;
+    passes.push_back({ "coarse", 4, 1, false, false });
+    passes.push_back({ "full resolution", 1, 1, false, false });
+    if (final_dirt)
+        passes.push_back({ "dirt", 1, 1, true, false });
+    if (final_oversample > 1)
+        passes.push_back({ "oversampling", 1, final_oversample, final_dirt, false });
+    if (final_bounce.boolValue())
+        passes.push_back({ "bounce", 1, final_oversample, final_dirt, true });
+
+    if (litonly || write_litfile == ~0 || debugmode != debugmode_none) {
+        logprint("WARNING: -progressive has no effect with -litonly, -lit2 or debug modes\n");
+        passes.erase(passes.begin(), passes.end() - 1);
+    }
+
+    double lastpass = 0;
+    for (size_t i = 0; i < passes.size(); i++) {
+        const lightpass_t &pass = passes[i];
+
+        if (i > 0) {
+            const double elapsed = I_FloatTime() - lightinput.start;
+            if (elapsed + lastpass > progressive) {
+                logprint("Progressive: stopping after the %s pass, %.3f of %g seconds used\n",
+                         passes[i - 1].name, elapsed, progressive);
+                break;
+            }
+            WritePreview(bspdata, loadversion, source);
+        }
+
+        logprint("--- Progressive pass %d/%d: %s ---\n",
+                 static_cast<int>(i + 1), static_cast<int>(passes.size()), pass.name);
+        const double passstart = I_FloatTime();
+
+        undersample = pass.undersample;
+        oversample = pass.oversample;
+        dirt_in_use = pass.dirt;
+        cfg_static.bounce.setBoolValueLocked(pass.bounce);
+        fastsky = final_fastsky || (i + 1 < passes.size());
+
+        // the stats printed at the end are for the last pass
+        total_light_rays = total_light_ray_hits = total_samplepoints = 0;
+        total_bounce_rays = total_bounce_ray_hits = 0;
+        total_surflight_rays = total_surflight_ray_hits = 0;
+
+        LightWorld(bspdata, forcedscale, i + 1 == passes.size());
+
+        lastpass = I_FloatTime() - passstart;
+        logprint("Progressive: %s pass took %.3f seconds\n", pass.name, lastpass);
+    }
+
+    undersample = 1;
+    oversample = final_oversample;
+    dirt_in_use = final_dirt;
+    cfg_static.bounce = final_bounce;
+    fastsky = final_fastsky;
+}
+
+/*
+ * Lights the loaded map and writes the results.
+ */
+static int
+LightInput()
+{
+    bspdata_t &bspdata = lightinput.bspdata;
+    mbsp_t *const bsp = &bspdata.data.mbsp;
+    const bspversion_t *const loadversion = lightinput.loadversion;
+    char *const source = lightinput.source;
+    const char *const lmscaleoverride = lightinput.lmscaleoverride;
+    globalconfig_t &cfg = cfg_static;
+    double end;
 
-    LoadExtendedTexinfoFlags(source, bsp);
-    LoadEntities(cfg, bsp);
+    RequireStage(lightstage_t::entities);
 
     PrintOptionsSummary();
     
-    FindModelInfo(bsp, lmscaleoverride);
+    RequireStage(lightstage_t::modelinfo);
     
     FindDebugFace(bsp);
     FindDebugVert(bsp);
 
-    MakeTnodes(bsp);
-    
     if (debugmode == debugmode_phong_obj) {
         StripExtension(source);
         DefaultExtension(source, ".obj");
         
-        CalculateVertexNormals(bsp);
+        RequireStage(lightstage_t::vertexnormals);
         ExportObj(source, bsp);
         
+        PrintStageTimes();
         close_log();
         return 0;
     }
     
-    SetupLights(cfg, bsp);
-    
-    //PrintLights();
-    
     if (!onlyents)
     {
+        RequireStage(lightstage_t::lights);
+        
+        //PrintLights();
+        
         if (!loadversion->game->has_rgb_lightmap) {
             CheckLitNeeded(cfg);
         }
         SetupDirt(cfg);
         
-        LightWorld(&bspdata, !!lmscaleoverride);
-        
-        /*invalidate any bspx lighting info early*/
-        BSPX_AddLump(&bspdata, "RGBLIGHTING", NULL, 0);
-        BSPX_AddLump(&bspdata, "LIGHTINGDIR", NULL, 0);
+        if (progressive > 0)
+            LightProgressive(&bspdata, loadversion, source, !!lmscaleoverride);
+        else
+            LightWorld(&bspdata, !!lmscaleoverride, true);
 
         if (write_litfile == ~0)
         {
+            /*invalidate any bspx lighting info early*/
+            BSPX_AddLump(&bspdata, "RGBLIGHTING", NULL, 0);
+            BSPX_AddLump(&bspdata, "LIGHTINGDIR", NULL, 0);
+
             WriteLitFile(bsp, faces_sup, source, 2);
+            PrintStageTimes();
             return 0;   //run away before any files are written
         }
-        else
-        {
-            /*fixme: add a new per-surface offset+lmscale lump for compat/versitility?*/
-            if (write_litfile & 1)
-                WriteLitFile(bsp, faces_sup, source, LIT_VERSION);
-            if (write_litfile & 2)
-                BSPX_AddLump(&bspdata, "RGBLIGHTING", lit_filebase, bsp->lightdatasize*3);
-            if (write_luxfile & 1)
-                WriteLuxFile(bsp, source, LIT_VERSION);
-            if (write_luxfile & 2)
-                BSPX_AddLump(&bspdata, "LIGHTINGDIR", lux_filebase, bsp->lightdatasize*3);
-        }
     }
 
-    /* -novanilla + internal lighting = no grey lightmap */
-    if (scaledonly && (write_litfile & 2))
-        bsp->lightdatasize = 0;
-
-#if 0
-    ExportObj(source, bsp);
-#endif
-    
-    WriteEntitiesToString(cfg, bsp);
-    /* Convert data format back if necessary */
-    ConvertBSPFormat(&bspdata, loadversion);
-
-    if (!litonly) {
-        WriteBSPFile(source, &bspdata);
-    }
+    if (progressive > 0 && !onlyents && !litonly)
+        WriteOutputAtomically(&bspdata, loadversion, source);
+    else
+        WriteOutput(&bspdata, loadversion, source);
 
     end = I_FloatTime();
-    logprint("%5.3f seconds elapsed\n", end - start);
+    logprint("%5.3f seconds elapsed\n", end - lightinput.start);
     logprint("\n");
     logprint("stats:\n");
     logprint("%f lights tested, %f hits per sample point\n",
@@ -1268,7 +1639,364 @@ light_main(int argc, const char **argv)
              static_cast<double>(total_bounce_rays) / static_cast<double>(total_samplepoints),
              static_cast<double>(total_bounce_ray_hits) / static_cast<double>(total_samplepoints));
     logprint("%d empty lightmaps\n", static_cast<int>(fully_transparent_lightmaps));
+    PrintStageTimes();
     close_log();
     
     return 0;
 }
+
+/*
+ * --serve support (see serve.cc). The server loads a map and runs the
+ * setup stages that only depend on its geometry; each request is then lit
+ * in a forked child, which starts over from the default options, reloads
+ * the entities and checks that the warm state still matches the file.
+ */
+
+/* everything the command line and LoadEntities can change */
+struct lightoptions_t {
+    globalconfig_t cfg;
+    bool settings_fixed_up;
+    bool dirt_in_use;
+    float fadegate;
+    int softsamples;
+    float surflight_subdivide;
+    int sunsamples;
+    qboolean scaledonly;
+    qboolean surflight_dump;
+    int oversample;
+    int write_litfile;
+    int write_luxfile;
+    qboolean onlyents;
+    qboolean novisapprox;
+    bool nolights;
+    bool debug_highlightseams;
+    debugmode_t debugmode;
+    bool verbose_log;
+    bool litonly;
+    bool incremental;
+    bool texcache;
+    bool nopvs;
+    float progressive;
+    bool fastsky;
+    float adaptive;
+    bool dump_face;
+    vec3_t dump_face_point;
+    bool dump_vert;
+    vec3_t dump_vert_point;
+    qboolean arghradcompat;
+    const char *lmscaleoverride;
+};
+
+static lightoptions_t serve_defaults;
+static mbsp_t serve_bsp;                            // as loaded, before any request swapped in its lumps
+static std::vector<gtexinfo_t> serve_texinfo;       // as loaded, before the textures stage named them
+static std::vector<surfflags_t> serve_texinfoflags; // as loaded, before phong wrote its angles
+static qboolean serve_arghradcompat;
+
+static void
+SaveOptions(lightoptions_t *opts)
+{
+    opts->cfg = cfg_static;
+    opts->settings_fixed_up = settings_fixed_up;
+    opts->dirt_in_use = dirt_in_use;
+    opts->fadegate = fadegate;
+    opts->softsamples = softsamples;
+    opts->surflight_subdivide = surflight_subdivide;
+    opts->sunsamples = sunsamples;
+    opts->scaledonly = scaledonly;
+    opts->surflight_dump = surflight_dump;
+    opts->oversample = oversample;
+    opts->write_litfile = write_litfile;
+    opts->write_luxfile = write_luxfile;
+    opts->onlyents = onlyents;
+    opts->novisapprox = novisapprox;
+    opts->nolights = nolights;
+    opts->debug_highlightseams = debug_highlightseams;
+    opts->debugmode = debugmode;
+    opts->verbose_log = verbose_log;
+    opts->litonly = litonly;
+    opts->incremental = incremental;
+    opts->texcache = texcache;
+    opts->nopvs = nopvs;
+    opts->progressive = progressive;
+    opts->fastsky = fastsky;
+    opts->adaptive = adaptive;
+    opts->dump_face = dump_face;
+    VectorCopy(dump_face_point, opts->dump_face_point);
+    opts->dump_vert = dump_vert;
+    VectorCopy(dump_vert_point, opts->dump_vert_point);
+    opts->arghradcompat = arghradcompat;
+    opts->lmscaleoverride = lightinput.lmscaleoverride;
+}
+
+static void
+RestoreOptions(const lightoptions_t &opts)
+{
+    cfg_static = opts.cfg;
+    settings_fixed_up = opts.settings_fixed_up;
+    dirt_in_use = opts.dirt_in_use;
+    fadegate = opts.fadegate;
+    softsamples = opts.softsamples;
+    surflight_subdivide = opts.surflight_subdivide;
+    sunsamples = opts.sunsamples;
+    scaledonly = opts.scaledonly;
+    surflight_dump = opts.surflight_dump;
+    oversample = opts.oversample;
+    write_litfile = opts.write_litfile;
+    write_luxfile = opts.write_luxfile;
+    onlyents = opts.onlyents;
+    novisapprox = opts.novisapprox;
+    nolights = opts.nolights;
+    debug_highlightseams = opts.debug_highlightseams;
+    debugmode = opts.debugmode;
+    verbose_log = opts.verbose_log;
+    litonly = opts.litonly;
+    incremental = opts.incremental;
+    texcache = opts.texcache;
+    nopvs = opts.nopvs;
+    progressive = opts.progressive;
+    fastsky = opts.fastsky;
+    adaptive = opts.adaptive;
+    dump_face = opts.dump_face;
+    VectorCopy(opts.dump_face_point, dump_face_point);
+    dump_vert = opts.dump_vert;
+    VectorCopy(opts.dump_vert_point, dump_vert_point);
+    arghradcompat = opts.arghradcompat;
+    lightinput.lmscaleoverride = opts.lmscaleoverride;
+}
+
+template <typename T>
+static bool
+SameLump(int count_a, const T *a, int count_b, const T *b)
+{
+    return count_a == count_b
+        && (count_a == 0 || !memcmp(a, b, count_a * sizeof(T)));
+}
+
+/*
+ * Compares everything but the entities and the lighting, which light
+ * itself rewrites, and the texinfo, which the textures stage modifies.
+ */
+static bool
+SameGeometry(const mbsp_t *a, const mbsp_t *b)
+{
+    if (a->loadversion != b->loadversion
+        || !SameLump(a->nummodels, a->dmodels, b->nummodels, b->dmodels)
+        || !SameLump(a->visdatasize, a->dvisdata, b->visdatasize, b->dvisdata)
+        || !SameLump(a->texdatasize, reinterpret_cast<const uint8_t *>(a->dtexdata),
+                     b->texdatasize, reinterpret_cast<const uint8_t *>(b->dtexdata))
+        || !SameLump(a->numleafs, a->dleafs, b->numleafs, b->dleafs)
+        || !SameLump(a->numplanes, a->dplanes, b->numplanes, b->dplanes)
+        || !SameLump(a->numvertexes, a->dvertexes, b->numvertexes, b->dvertexes)
+        || !SameLump(a->numnodes, a->dnodes, b->numnodes, b->dnodes)
+        || !SameLump(a->numclipnodes, a->dclipnodes, b->numclipnodes, b->dclipnodes)
+        || !SameLump(a->numedges, a->dedges, b->numedges, b->dedges)
+        || !SameLump(a->numleaffaces, a->dleaffaces, b->numleaffaces, b->dleaffaces)
+        || !SameLump(a->numleafbrushes, a->dleafbrushes, b->numleafbrushes, b->dleafbrushes)
+        || !SameLump(a->numsurfedges, a->dsurfedges, b->numsurfedges, b->dsurfedges)
+        || !SameLump(a->numareas, a->dareas, b->numareas, b->dareas)
+        || !SameLump(a->numareaportals, a->dareaportals, b->numareaportals, b->dareaportals)
+        || !SameLump(a->numbrushes, a->dbrushes, b->numbrushes, b->dbrushes)
+        || !SameLump(a->numbrushsides, a->dbrushsides, b->numbrushsides, b->dbrushsides)
+        || memcmp(a->dpop, b->dpop, sizeof(a->dpop))
+        || a->numfaces != b->numfaces) {
+        return false;
+    }
+
+    for (int i = 0; i < a->numfaces; i++) {
+        const bsp2_dface_t *fa = &a->dfaces[i];
+        const bsp2_dface_t *fb = &b->dfaces[i];
+        if (fa->planenum != fb->planenum || fa->side != fb->side
+            || fa->firstedge != fb->firstedge || fa->numedges != fb->numedges
+            || fa->texinfo != fb->texinfo) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Points the freshly loaded map at the server's copy of the geometry,
+ * which the trace scene and the phong normals refer to, keeping the
+ * entities and the lighting from the file. Returns false if the file's
+ * geometry, vis data or .texinfo no longer match.
+ */
+static bool
+UseWarmMap()
+{
+    mbsp_t &bsp = lightinput.bspdata.data.mbsp;
+
+    if (!SameGeometry(&bsp, &serve_bsp)
+        || !SameLump(bsp.numtexinfo, bsp.texinfo, static_cast<int>(serve_texinfo.size()), serve_texinfo.data())
+        || arghradcompat != serve_arghradcompat) {
+        return false;
+    }
+
+    surfflags_t *const warmflags = extended_texinfo_flags;
+    LoadExtendedTexinfoFlags(lightinput.bspfilename.c_str(), &bsp);
+    const bool sameflags = !memcmp(extended_texinfo_flags, serve_texinfoflags.data(),
+                                   serve_texinfoflags.size() * sizeof(surfflags_t));
+    free(extended_texinfo_flags);
+    extended_texinfo_flags = warmflags;
+    if (!sameflags)
+        return false;
+
+    const mbsp_t loaded = bsp;
+    bsp = serve_bsp;
+    bsp.entdatasize = loaded.entdatasize;
+    bsp.dentdata = loaded.dentdata;
+    bsp.lightdatasize = loaded.lightdatasize;
+    bsp.dlightdata = loaded.dlightdata;
+    for (int i = 0; i < bsp.numfaces; i++) {
+        memcpy(bsp.dfaces[i].styles, loaded.dfaces[i].styles, sizeof(bsp.dfaces[i].styles));
+        bsp.dfaces[i].lightofs = loaded.dfaces[i].lightofs;
+    }
+    return true;
+}
+
+/*
+ * The trace scene and the phong normals were built from these modelinfo
+ * settings; the rest are only read while lighting.
+ */
+static bool
+SameTraceSettings(const modelinfo_t *a, const modelinfo_t *b)
+{
+    return a->shadow.floatValue() == b->shadow.floatValue()
+        && a->shadowself.floatValue() == b->shadowself.floatValue()
+        && a->shadowworldonly.floatValue() == b->shadowworldonly.floatValue()
+        && a->switchableshadow.floatValue() == b->switchableshadow.floatValue()
+        && a->switchshadstyle.floatValue() == b->switchshadstyle.floatValue()
+        && a->phong.floatValue() == b->phong.floatValue()
+        && a->phong_angle.floatValue() == b->phong_angle.floatValue()
+        && a->alpha.floatValue() == b->alpha.floatValue();
+}
+
+/*
+ * Rebuilds the modelinfo from this request's entities and copies it over
+ * the server's, which the trace scene points to. Exits with
+ * LIGHT_SERVE_STALE if a setting the scene depends on has changed.
+ */
+static void
+RefreshModelInfo()
+{
+    std::vector<modelinfo_t *> warm;
+    std::vector<const modelinfo_t *> warmlists[4];
+    
+    std::swap(modelinfo, warm);
+    std::swap(tracelist, warmlists[0]);
+    std::swap(selfshadowlist, warmlists[1]);
+    std::swap(shadowworldonlylist, warmlists[2]);
+    std::swap(switchableshadowlist, warmlists[3]);
+    
+    FindModelInfo(&lightinput.bspdata.data.mbsp, lightinput.lmscaleoverride);
+    
+    Q_assert(modelinfo.size() == warm.size());
+    for (size_t i = 0; i < warm.size(); i++) {
+        if (!SameTraceSettings(modelinfo[i], warm[i])) {
+            logprint("brush entity shadow, alpha or phong settings changed; rebuilding\n");
+            exit(LIGHT_SERVE_STALE);
+        }
+        *warm[i] = *modelinfo[i];
+        delete modelinfo[i];
+    }
+    
+    modelinfo = std::move(warm);
+    tracelist = std::move(warmlists[0]);
+    selfshadowlist = std::move(warmlists[1]);
+    shadowworldonlylist = std::move(warmlists[2]);
+    switchableshadowlist = std::move(warmlists[3]);
+}
+
+int
+LightServeWarm(int argc, const char **argv)
+{
+    SaveOptions(&serve_defaults);
+    
+    numthreads = GetDefaultThreads();
+    const int i = ParseOptions(argc, argv);
+    
+    LoadInput(argv[i]);
+    DefineStages();
+    
+    const mbsp_t *bsp = &lightinput.bspdata.data.mbsp;
+    serve_texinfo.assign(bsp->texinfo, bsp->texinfo + bsp->numtexinfo);
+    
+    RequireStage(lightstage_t::entities);
+    serve_texinfoflags.assign(extended_texinfo_flags, extended_texinfo_flags + bsp->numtexinfo);
+    
+    RequireStage(lightstage_t::textures);
+    RequireStage(lightstage_t::tracescene);
+    RequireStage(lightstage_t::vertexnormals);
+    
+    serve_bsp = *bsp;
+    serve_arghradcompat = arghradcompat;
+    return 0;
+}
+
+int
+LightServeRequest(int argc, const char **argv)
+{
+    RestoreOptions(serve_defaults);
+    ResetEntities();
+    
+    numthreads = GetDefaultThreads();
+    const int i = ParseOptions(argc, argv);
+    
+    lightinput.start = I_FloatTime();
+    
+    LoadInput(argv[i]);
+    if (!UseWarmMap()) {
+        logprint("map geometry, vis data or .texinfo changed; rebuilding\n");
+        return LIGHT_SERVE_STALE;
+    }
+    
+    for (lightstage_info_t &info : lightstages) {
+        info.reused = info.done;
+    }
+    DefineStage(lightstage_t::entities, "entities", {}, []() {
+        LoadEntities(cfg_static, &lightinput.bspdata.data.mbsp);
+    });
+    DefineStage(lightstage_t::modelinfo, "modelinfo", { lightstage_t::entities }, []() {
+        RefreshModelInfo();
+    });
+    
+    return LightInput();
+}
+
+/*
+ * ==================
+ * main
+ * light modelfile
+ * ==================
+ */
+int
+light_main(int argc, const char **argv)
+{
+    if (argc == 3 && !strcmp(argv[1], "--serve")) {
+        return LightServe(argv[2]);
+    }
+    if (argc >= 3 && !strcmp(argv[1], "--connect")) {
+        const int status = LightConnect(argv[2], argc - 3, argv + 3);
+        if (status >= 0)
+            return status;
+        
+        // nothing is listening; light the map in this process
+        argv[2] = argv[0];
+        return light_main(argc - 2, argv + 2);
+    }
+    
+    init_log("light.log");
+    logprint("---- light / ericw-tools " stringify(ERICWTOOLS_VERSION) " ----\n");
+
+    LowerProcessPriority();
+    numthreads = GetDefaultThreads();
+    
+    const int i = ParseOptions(argc, argv);
+
+    lightinput.start = I_FloatTime();
+
+    LoadInput(argv[i]);
+    DefineStages();
+    
+    return LightInput();
+}
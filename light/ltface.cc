@@ -24,6 +24,8 @@
 #include <light/entities.hh>
 #include <light/trace.hh>
 #include <light/ltface.hh>
+#include <light/relight.hh>
+#include <light/pvs.hh>
 
 #include <common/bsputils.hh>
 #include <common/qvec.hh>
@@ -677,6 +679,67 @@ PositionSamplePointOnFace(const mbsp_t *bsp,
     return position_t(face, point, pointNormal);
 }
 
+/*
+ * With -progressive's coarse pass, only every undersample'th luxel along
+ * each axis is lit, plus the last one; WriteSingleLightmap interpolates
+ * the rest.
+ */
+int
+CoarseSampleCount(int texsize)
+{
+    return (texsize + undersample - 1) / undersample + 1;
+}
+
+int
+CoarseSampleLuxel(int sample, int texsize)
+{
+    return qmin(sample * undersample, texsize);
+}
+
+/*
+ * With -adaptive, faces are lit at the base resolution and only the
+ * luxels that need it are supersampled afterwards (LightFace_Adaptive).
+ */
+static bool
+AdaptiveSupersampling()
+{
+    return adaptive > 0 && oversample > 1 && undersample == 1 && debugmode == debugmode_none;
+}
+
+/* oversampling of the lightsurf_t point grid */
+static int
+PointsOversample()
+{
+    return AdaptiveSupersampling() ? 1 : oversample;
+}
+
+/*
+ * Sets surf->points[i] and friends to the point at texture coordinates
+ * (us, ut), moved out of solid and with the model offset applied.
+ */
+static void
+CalcPoint(const vec3_t offset, lightsurf_t *surf, const mbsp_t *bsp, const bsp2_dface_t *face, vec_t us, vec_t ut, int i)
+{
+    const globalconfig_t &cfg = *surf->cfg;
+    vec_t *point = surf->points[i];
+    vec_t *norm = surf->normals[i];
+    int *realfacenum = &surf->realfacenums[i];
+    
+    TexCoordToWorld(us, ut, &surf->texorg, point);
+
+    // do this before correcting the point, so we can wrap around the inside of pipes
+    const bool phongshaded = (surf->curved && cfg.phongallowed.boolValue());
+    const auto res = CalcPointNormal(bsp, face, vec3_t_to_glm(point), phongshaded, surf->lightmapscale, 0, vec3_t_to_glm(offset));
+    
+    surf->occluded[i] = !res.m_unoccluded;
+    *realfacenum = res.m_actualFace != nullptr ? Face_GetNum(bsp, res.m_actualFace) : -1;
+    glm_to_vec3_t(res.m_position, point);
+    glm_to_vec3_t(res.m_interpolatedNormal, norm);
+    
+    // apply model offset after calling CalcPointNormal
+    VectorAdd(point, offset, point);
+}
+
 /*
  * =================
  * CalcPoints
@@ -687,7 +750,7 @@ PositionSamplePointOnFace(const mbsp_t *bsp,
 static void
 CalcPoints(const modelinfo_t *modelinfo, const vec3_t offset, lightsurf_t *surf, const mbsp_t *bsp, const bsp2_dface_t *face)
 {
-    const globalconfig_t &cfg = *surf->cfg;
+    const int oversample = PointsOversample();
     
     /*
      * Fill in the surface points. The points are biased towards the center of
@@ -696,8 +759,14 @@ CalcPoints(const modelinfo_t *modelinfo, const vec3_t offset, lightsurf_t *surf,
     TexCoordToWorld(surf->exactmid[0], surf->exactmid[1], &surf->texorg, surf->midpoint);
     VectorAdd(surf->midpoint, offset, surf->midpoint);
     
-    surf->width  = (surf->texsize[0] + 1) * oversample;
-    surf->height = (surf->texsize[1] + 1) * oversample;
+    if (undersample > 1) {
+        Q_assert(oversample == 1);
+        surf->width  = CoarseSampleCount(surf->texsize[0]);
+        surf->height = CoarseSampleCount(surf->texsize[1]);
+    } else {
+        surf->width  = (surf->texsize[0] + 1) * oversample;
+        surf->height = (surf->texsize[1] + 1) * oversample;
+    }
     const float starts = (surf->texmins[0] - 0.5 + (0.5 / oversample)) * surf->lightmapscale;
     const float startt = (surf->texmins[1] - 0.5 + (0.5 / oversample)) * surf->lightmapscale;
     const float st_step = surf->lightmapscale / oversample;
@@ -709,32 +778,18 @@ CalcPoints(const modelinfo_t *modelinfo, const vec3_t offset, lightsurf_t *surf,
     surf->occluded = (bool *)calloc(surf->numpoints, sizeof(bool));
     surf->realfacenums = (int *)calloc(surf->numpoints, sizeof(int));
     
-    const auto points = GLM_FacePoints(bsp, face);
-    const auto edgeplanes = GLM_MakeInwardFacingEdgePlanes(points);
-    
     for (int t = 0; t < surf->height; t++) {
         for (int s = 0; s < surf->width; s++) {
             const int i = t*surf->width + s;
-            vec_t *point = surf->points[i];
-            vec_t *norm = surf->normals[i];
-            int *realfacenum = &surf->realfacenums[i];
             
-            const vec_t us = starts + s * st_step;
-            const vec_t ut = startt + t * st_step;
-
-            TexCoordToWorld(us, ut, &surf->texorg, point);
+            vec_t us = starts + s * st_step;
+            vec_t ut = startt + t * st_step;
+            if (undersample > 1) {
+                us = (surf->texmins[0] + CoarseSampleLuxel(s, surf->texsize[0])) * surf->lightmapscale;
+                ut = (surf->texmins[1] + CoarseSampleLuxel(t, surf->texsize[1])) * surf->lightmapscale;
+            }
 
-            // do this before correcting the point, so we can wrap around the inside of pipes
-            const bool phongshaded = (surf->curved && cfg.phongallowed.boolValue());
-            const auto res = CalcPointNormal(bsp, face, vec3_t_to_glm(point), phongshaded, surf->lightmapscale, 0, vec3_t_to_glm(offset));
-            
-            surf->occluded[i] = !res.m_unoccluded;
-            *realfacenum = res.m_actualFace != nullptr ? Face_GetNum(bsp, res.m_actualFace) : -1;
-            glm_to_vec3_t(res.m_position, point);
-            glm_to_vec3_t(res.m_interpolatedNormal, norm);
-            
-            // apply model offset after calling CalcPointNormal
-            VectorAdd(point, offset, point);
+            CalcPoint(offset, surf, bsp, face, us, ut, i);
         }
     }
     
@@ -1212,23 +1267,23 @@ Dirt_GetScaleFactor(const globalconfig_t &cfg, vec_t occlusion, const light_t *e
 
 /*
  * ================
- * CullLight
+ * CullLightBounds
  * 
- * Returns true if the given light doesn't reach lightsurf.
+ * Returns true if the given light doesn't reach a surface with the given
+ * bounding sphere and box.
  * ================
  */
-static inline qboolean
-CullLight(const light_t *entity, const lightsurf_t *lightsurf)
+bool
+CullLightBounds(const globalconfig_t &cfg, const light_t *entity, const vec3_t origin, vec_t radius,
+                const vec3_t mins, const vec3_t maxs)
 {
-    const globalconfig_t &cfg = *lightsurf->cfg;
-    
-    if (!novisapprox && AABBsDisjoint(entity->mins, entity->maxs, lightsurf->mins, lightsurf->maxs)) {
+    if (!novisapprox && AABBsDisjoint(entity->mins, entity->maxs, mins, maxs)) {
         return true;
     }
     
     vec3_t distvec;
-    VectorSubtract(*entity->origin.vec3Value(), lightsurf->origin, distvec);
-    const float dist = VectorLength(distvec) - lightsurf->radius;
+    VectorSubtract(*entity->origin.vec3Value(), origin, distvec);
+    const float dist = VectorLength(distvec) - radius;
     
     /* light is inside surface bounding sphere => can't cull */
     if (dist < 0) {
@@ -1241,6 +1296,30 @@ CullLight(const light_t *entity, const lightsurf_t *lightsurf)
     return fabs(GetLightValue(cfg, entity, dist)) <= fadegate;
 }
 
+/*
+ * ================
+ * CullLight
+ * 
+ * Returns true if the given light doesn't reach lightsurf.
+ * ================
+ */
+static inline qboolean
+CullLight(const light_t *entity, const lightsurf_t *lightsurf)
+{
+    if (CullLightBounds(*lightsurf->cfg, entity, lightsurf->origin, lightsurf->radius,
+                        lightsurf->mins, lightsurf->maxs)) {
+        return true;
+    }
+    
+    const int lightnum = static_cast<int>(entity - GetLights().data());
+    if (Pvs_CullLight(lightsurf, lightnum)) {
+        return true;
+    }
+    
+    lightsurf->lights.push_back(lightnum);
+    return false;
+}
+
 static void Matrix4x4_CM_Transform4(const float *matrix, const float *vector, float *product)
 {
     product[0] = matrix[0]*vector[0] + matrix[4]*vector[1] + matrix[8]*vector[2] + matrix[12]*vector[3];
@@ -1561,6 +1640,228 @@ LightFace_Entity(const mbsp_t *bsp,
     }
 }
 
+/*
+ * Works out the sunlight reaching sample point i if nothing is in the way,
+ * returning false if the point doesn't need a ray.
+ */
+static bool
+LightFace_SkyPointContribution(const sun_t *sun, const lightsurf_t *lightsurf, int i,
+                               const vec3_t incoming, vec3_t color, vec3_t normalcontrib)
+{
+    const globalconfig_t &cfg = *lightsurf->cfg;
+    const vec_t *surfnorm = lightsurf->normals[i];
+    
+    if (lightsurf->occluded[i])
+        return false;
+    
+    float angle = DotProduct(incoming, surfnorm);
+    if (lightsurf->twosided) {
+        if (angle < 0) {
+            angle = -angle;
+        }
+    }
+
+    angle = qmax(0.0f, angle);
+    
+    angle = (1.0 - sun->anglescale) + sun->anglescale * angle;
+    float value = angle * sun->sunlight;
+    if (sun->dirt) {
+        value *= Dirt_GetScaleFactor(cfg, lightsurf->occlusion[i], NULL, 0.0, lightsurf);
+    }
+    
+    VectorScale(sun->sunlight_color, value / 255.0, color);
+    VectorScale(sun->sunvec, value, normalcontrib);
+    
+    /* Quick distance check first */
+    if (fabs(LightSample_Brightness(color)) <= fadegate) {
+        return false;
+    }
+    
+    return true;
+}
+
+/*
+ * Returns true if pushed ray j reached the sun's sky.
+ */
+static bool
+LightFace_SkyRayReachedSun(const sun_t *sun, const lightsurf_t *lightsurf, raystream_intersection_t *rs, int j)
+{
+    if (rs->getPushedRayHitType(j) != hittype_t::SKY) {
+        return false;
+    }
+
+    // check if we hit the wrong texture
+    // TODO: this could be faster!
+    if (!sun->suntexture.empty()) {
+        const bsp2_dface_t *face = rs->getPushedRayHitFace(j);
+        const char* facetex = Face_TextureName(lightsurf->bsp, face);
+        if (sun->suntexture != facetex) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+struct skylightmap_t {
+    int style;
+    lightmap_t *lightmap;
+};
+
+static void
+LightFace_SkyAddSample(lightmapdict_t *lightmaps, const lightsurf_t *lightsurf, skylightmap_t *cached,
+                       int desired_style, int i, const vec3_t color, const vec3_t normalcontrib)
+{
+    // if necessary, switch which lightmap we are writing to.
+    if (desired_style != cached->style) {
+        cached->style = desired_style;
+        cached->lightmap = Lightmap_ForStyle(lightmaps, cached->style, lightsurf);
+    }
+
+    lightsample_t *sample = &cached->lightmap->samples[i];
+    
+    VectorAdd(sample->color, color, sample->color);
+    VectorAdd(sample->direction, normalcontrib, sample->direction);
+    
+    Lightmap_Save(lightmaps, lightsurf, cached->lightmap, cached->style);
+}
+
+/*
+ * Adds the light of the rays in rs that reached the sun.
+ */
+static void
+LightFace_SkyAddRays(const sun_t *sun, const lightsurf_t *lightsurf, lightmapdict_t *lightmaps,
+                     raystream_intersection_t *rs, skylightmap_t *cached)
+{
+    const int N = rs->numPushedRays();
+    for (int j = 0; j < N; j++) {
+        if (!LightFace_SkyRayReachedSun(sun, lightsurf, rs, j)) {
+            continue;
+        }
+
+        const int i = rs->getPushedRayPointIndex(j);
+        
+        // check if we hit a dynamic shadow caster
+        int desired_style = sun->style;
+        if (desired_style == 0) {
+            desired_style = rs->getPushedRayDynamicStyle(j);
+        }
+        
+        vec3_t color, normalcontrib;
+        rs->getPushedRayColor(j, color);
+        rs->getPushedRayNormalContrib(j, normalcontrib);
+        
+        LightFace_SkyAddSample(lightmaps, lightsurf, cached, desired_style, i, color, normalcontrib);
+    }
+}
+
+/*
+ * -fastsky: traces the sun rays of every SKY_COARSE_STEP'th sample point
+ * along each axis of the lightsurf (and the last row and column) first.
+ * A point in between whose four surrounding coarse points all saw the sun
+ * unobstructed, or were all blocked, takes that result without a ray of
+ * its own; the rest are traced as usual. This can miss shadows thinner
+ * than the coarse spacing, so it's meant for previews.
+ */
+#define SKY_COARSE_STEP 4
+
+enum class skyvis_t : uint8_t {
+    NONE,       // no ray traced
+    OPEN,       // reached the sun, untinted, with no dynamic shadow caster
+    BLOCKED,    // didn't reach the sun
+    PARTIAL     // reached the sun through glass or a dynamic shadow caster
+};
+
+static bool
+SkyCoarsePoint(int s, int width)
+{
+    return (s % SKY_COARSE_STEP) == 0 || s == width - 1;
+}
+
+static void
+LightFace_SkyFast(const sun_t *sun, const vec3_t incoming, const lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
+{
+    const int width = lightsurf->width;
+    const int height = lightsurf->height;
+    raystream_intersection_t *rs = lightsurf->intersection_stream;
+    
+    skylightmap_t cached { sun->style, Lightmap_ForStyle(lightmaps, sun->style, lightsurf) };
+    std::vector<skyvis_t> vis(lightsurf->numpoints, skyvis_t::NONE);
+    vec3_t color, normalcontrib;
+    
+    /* trace the coarse points */
+    rs->clearPushedRays();
+    for (int t = 0; t < height; t++) {
+        if (!SkyCoarsePoint(t, height))
+            continue;
+        for (int s = 0; s < width; s++) {
+            const int i = t*width + s;
+            if (!SkyCoarsePoint(s, width))
+                continue;
+            if (!LightFace_SkyPointContribution(sun, lightsurf, i, incoming, color, normalcontrib))
+                continue;
+            rs->pushRay(i, lightsurf->points[i], incoming, MAX_SKY_DIST, color, normalcontrib);
+        }
+    }
+    rs->tracePushedRaysIntersection(lightsurf->modelinfo);
+    
+    const int N = rs->numPushedRays();
+    for (int j = 0; j < N; j++) {
+        const int i = rs->getPushedRayPointIndex(j);
+        if (!LightFace_SkyRayReachedSun(sun, lightsurf, rs, j)) {
+            vis[i] = skyvis_t::BLOCKED;
+            continue;
+        }
+        
+        vec3_t raycolor;
+        rs->getPushedRayColor(j, raycolor);
+        LightFace_SkyPointContribution(sun, lightsurf, i, incoming, color, normalcontrib);
+        
+        if (rs->getPushedRayDynamicStyle(j) == 0 && VectorCompare(raycolor, color, EQUAL_EPSILON)) {
+            vis[i] = skyvis_t::OPEN;
+        } else {
+            vis[i] = skyvis_t::PARTIAL;
+        }
+    }
+    LightFace_SkyAddRays(sun, lightsurf, lightmaps, rs, &cached);
+    
+    /* fill in the rest, tracing only where the coarse points disagree */
+    rs->clearPushedRays();
+    for (int t = 0; t < height; t++) {
+        const int t0 = t - (t % SKY_COARSE_STEP);
+        const int t1 = qmin(t0 + SKY_COARSE_STEP, height - 1);
+        
+        for (int s = 0; s < width; s++) {
+            if (SkyCoarsePoint(s, width) && SkyCoarsePoint(t, height))
+                continue;
+            
+            const int i = t*width + s;
+            if (!LightFace_SkyPointContribution(sun, lightsurf, i, incoming, color, normalcontrib))
+                continue;
+            
+            const int s0 = s - (s % SKY_COARSE_STEP);
+            const int s1 = qmin(s0 + SKY_COARSE_STEP, width - 1);
+            const skyvis_t corners[4] = {
+                vis[t0*width + s0], vis[t0*width + s1],
+                vis[t1*width + s0], vis[t1*width + s1]
+            };
+            
+            if (corners[0] == skyvis_t::OPEN || corners[0] == skyvis_t::BLOCKED) {
+                if (corners[1] == corners[0] && corners[2] == corners[0] && corners[3] == corners[0]) {
+                    if (corners[0] == skyvis_t::OPEN) {
+                        LightFace_SkyAddSample(lightmaps, lightsurf, &cached, sun->style, i, color, normalcontrib);
+                    }
+                    continue;
+                }
+            }
+            
+            rs->pushRay(i, lightsurf->points[i], incoming, MAX_SKY_DIST, color, normalcontrib);
+        }
+    }
+    rs->tracePushedRaysIntersection(lightsurf->modelinfo);
+    LightFace_SkyAddRays(sun, lightsurf, lightmaps, rs, &cached);
+}
+
 /*
  * =============
  * LightFace_Sky
@@ -1569,7 +1870,6 @@ LightFace_Entity(const mbsp_t *bsp,
 static void
 LightFace_Sky(const sun_t *sun, const lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
 {
-    const globalconfig_t &cfg = *lightsurf->cfg;
     const modelinfo_t *modelinfo = lightsurf->modelinfo;
     const plane_t *plane = &lightsurf->plane;
 
@@ -1584,43 +1884,23 @@ LightFace_Sky(const sun_t *sun, const lightsurf_t *lightsurf, lightmapdict_t *li
     if (dp < -ANGLE_EPSILON && !lightsurf->curved && !lightsurf->twosided) {
         return;
     }
+    
+    if (fastsky && !lightsurf->scattered) {
+        LightFace_SkyFast(sun, incoming, lightsurf, lightmaps);
+        return;
+    }
 
     /* Check each point... */
     raystream_intersection_t *rs = lightsurf->intersection_stream;
     rs->clearPushedRays();
     
     for (int i = 0; i < lightsurf->numpoints; i++) {
-        const vec_t *surfpoint = lightsurf->points[i];
-        const vec_t *surfnorm = lightsurf->normals[i];
-        
-        if (lightsurf->occluded[i])
-            continue;
-        
-        float angle = DotProduct(incoming, surfnorm);
-        if (lightsurf->twosided) {
-            if (angle < 0) {
-                angle = -angle;
-            }
-        }
-
-        angle = qmax(0.0f, angle);
-        
-        angle = (1.0 - sun->anglescale) + sun->anglescale * angle;
-        float value = angle * sun->sunlight;
-        if (sun->dirt) {
-            value *= Dirt_GetScaleFactor(cfg, lightsurf->occlusion[i], NULL, 0.0, lightsurf);
-        }
-        
         vec3_t color, normalcontrib;
-        VectorScale(sun->sunlight_color, value / 255.0, color);
-        VectorScale(sun->sunvec, value, normalcontrib);
-        
-        /* Quick distance check first */
-        if (fabs(LightSample_Brightness(color)) <= fadegate) {
+        if (!LightFace_SkyPointContribution(sun, lightsurf, i, incoming, color, normalcontrib)) {
             continue;
         }
         
-        rs->pushRay(i, surfpoint, incoming, MAX_SKY_DIST, color, normalcontrib);
+        rs->pushRay(i, lightsurf->points[i], incoming, MAX_SKY_DIST, color, normalcontrib);
     }
     
     // We need to check if the first hit face is a sky face, so we need
@@ -1628,50 +1908,8 @@ LightFace_Sky(const sun_t *sun, const lightsurf_t *lightsurf, lightmapdict_t *li
     rs->tracePushedRaysIntersection(modelinfo);
     
     /* if sunlight is set, use a style 0 light map */
-    int cached_style = sun->style;
-    lightmap_t *cached_lightmap = Lightmap_ForStyle(lightmaps, cached_style, lightsurf);
-    
-    const int N = rs->numPushedRays();
-    for (int j = 0; j < N; j++) {
-        if (rs->getPushedRayHitType(j) != hittype_t::SKY) {
-            continue;
-        }
-
-        // check if we hit the wrong texture
-        // TODO: this could be faster!
-        if (!sun->suntexture.empty()) {
-            const bsp2_dface_t *face = rs->getPushedRayHitFace(j);
-            const char* facetex = Face_TextureName(lightsurf->bsp, face);
-            if (sun->suntexture != facetex) {
-                continue;
-            }
-        }
-
-        const int i = rs->getPushedRayPointIndex(j);
-        
-        // check if we hit a dynamic shadow caster
-        int desired_style = sun->style;
-        if (desired_style == 0) {
-            desired_style = rs->getPushedRayDynamicStyle(j);
-        }
-        
-        // if necessary, switch which lightmap we are writing to.
-        if (desired_style != cached_style) {
-            cached_style = desired_style;
-            cached_lightmap = Lightmap_ForStyle(lightmaps, cached_style, lightsurf);
-        }
-
-        lightsample_t *sample = &cached_lightmap->samples[i];
-        
-        vec3_t color, normalcontrib;
-        rs->getPushedRayColor(j, color);
-        rs->getPushedRayNormalContrib(j, normalcontrib);
-        
-        VectorAdd(sample->color, color, sample->color);
-        VectorAdd(sample->direction, normalcontrib, sample->direction);
-        
-        Lightmap_Save(lightmaps, lightsurf, cached_lightmap, cached_style);
-    }
+    skylightmap_t cached { sun->style, Lightmap_ForStyle(lightmaps, sun->style, lightsurf) };
+    LightFace_SkyAddRays(sun, lightsurf, lightmaps, rs, &cached);
 }
 
 /*
@@ -1978,7 +2216,10 @@ BounceLight_SphereCull(const mbsp_t *bsp, const bouncelight_t *vpl, const lights
     // get light contribution
     const qvec3f color = BounceLight_ColorAtDist(cfg, vpl->area, vpl->componentwiseMaxColor, dist);
     
-    return LightSample_Brightness(color) < 0.25f;
+    if (LightSample_Brightness(color) < 0.25f)
+        return true;
+    
+    return Pvs_CullBounceLight(lightsurf, static_cast<int>(vpl - BounceLights().data()));
 }
 
 static bool //mxd
@@ -2534,21 +2775,158 @@ DirtAtPoint(const globalconfig_t &cfg, raystream_intersection_t *rs, const vec3_
 }
 
 /*
- * ============
- * LightFace_CalculateDirt
- * ============
+ * Adaptive dirt ("_dirtadaptive" "n"): the dirt vectors are traced in
+ * three rounds, each filling in the angles between those of the previous
+ * ones (4, then 8, then all 16 angle steps, with every elevation step).
+ * After each round, points where the standard error of the mean hit
+ * distance (as a fraction of _dirtdepth) is within n stop; open floors
+ * and enclosed corners usually do after the first round.
  */
-static void
-LightFace_CalculateDirt(lightsurf_t *lightsurf)
+static int
+DirtAdaptiveRound(int vector)
 {
-    const globalconfig_t &cfg = *lightsurf->cfg;
-    
-    Q_assert(dirt_in_use);
+    const int angle = vector / DIRT_NUM_ELEVATION_STEPS;
+    if ((angle % 4) == 0)
+        return 0;
+    if ((angle % 2) == 0)
+        return 1;
+    return 2;
+}
 
-    // batch implementation:
+static uint32_t
+DirtHash(uint32_t h)
+{
+    // lowbias32 integer hash
+    h ^= h >> 16;
+    h *= 0x7feb352dU;
+    h ^= h >> 15;
+    h *= 0x846ca68bU;
+    h ^= h >> 16;
+    return h;
+}
 
-    vec3_t *myUps = (vec3_t *) calloc(lightsurf->numpoints, sizeof(vec3_t));
-    vec3_t *myRts = (vec3_t *) calloc(lightsurf->numpoints, sizeof(vec3_t));
+/*
+ * Random dirt vectors (_dirtmode 1) for adaptive dirt. Each is jittered
+ * within its ordered vector's cell, so the rounds stay stratified, and
+ * depends only on the seed, face, point and vector, so the result
+ * doesn't depend on the thread count.
+ */
+static void
+GetAdaptiveDirtVector(const globalconfig_t &cfg, const lightsurf_t *lightsurf, int point, int vector, vec3_t out)
+{
+    if (cfg.dirtMode.intValue() != 1) {
+        GetDirtVector(cfg, vector, out);
+        return;
+    }
+    
+    const int facenum = Face_GetNum(lightsurf->bsp, lightsurf->face);
+    uint32_t h = DirtHash(static_cast<uint32_t>(cfg.dirtSeed.intValue()));
+    h = DirtHash(h ^ static_cast<uint32_t>(facenum));
+    h = DirtHash(h ^ static_cast<uint32_t>(point));
+    h = DirtHash(h ^ static_cast<uint32_t>(vector));
+    const float u = (h & 0xffff) / 65536.0f;
+    const float v = (h >> 16) / 65536.0f;
+    
+    const float angleStep = (float)DEG2RAD( 360.0f / DIRT_NUM_ANGLE_STEPS );
+    const float elevationStep = (float)DEG2RAD( cfg.dirtAngle.floatValue() / DIRT_NUM_ELEVATION_STEPS );
+    const float angle = (vector / DIRT_NUM_ELEVATION_STEPS + u) * angleStep;
+    const float elevation = (vector % DIRT_NUM_ELEVATION_STEPS + v) * elevationStep;
+    out[ 0 ] = cos( angle ) * sin( elevation );
+    out[ 1 ] = sin( angle ) * sin( elevation );
+    out[ 2 ] = cos( elevation );
+}
+
+static void
+LightFace_CalculateDirtAdaptive(lightsurf_t *lightsurf, const vec3_t *myUps, const vec3_t *myRts)
+{
+    const globalconfig_t &cfg = *lightsurf->cfg;
+    const float depth = cfg.dirtDepth.floatValue();
+    const float maxerror = cfg.dirtAdaptive.floatValue();
+    raystream_intersection_t *rs = lightsurf->intersection_stream;
+    
+    Q_assert(numDirtVectors == DIRT_NUM_VECTORS);
+    
+    // per point: sum and sum of squares of the hit distance / depth
+    std::vector<float> sum(lightsurf->numpoints, 0.0f);
+    std::vector<float> sumsq(lightsurf->numpoints, 0.0f);
+    std::vector<int> count(lightsurf->numpoints, 0);
+    std::vector<bool> done(lightsurf->numpoints, false);
+    
+    for (int i = 0; i < lightsurf->numpoints; i++) {
+        done[i] = lightsurf->occluded[i];
+    }
+    
+    for (int round = 0; round < 3; round++) {
+        for (int j = 0; j < numDirtVectors; j++) {
+            if (DirtAdaptiveRound(j) != round)
+                continue;
+            
+            rs->clearPushedRays();
+            for (int i = 0; i < lightsurf->numpoints; i++) {
+                if (done[i])
+                    continue;
+                
+                vec3_t dirtvec;
+                GetAdaptiveDirtVector(cfg, lightsurf, i, j, dirtvec);
+                
+                vec3_t dir;
+                TransformToTangentSpace(lightsurf->normals[i], myUps[i], myRts[i], dirtvec, dir);
+                
+                rs->pushRay(i, lightsurf->points[i], dir, depth);
+            }
+            
+            if (!rs->numPushedRays())
+                break;
+            
+            // trace the batch. need closest hit for dirt, so intersection.
+            rs->tracePushedRaysIntersection(lightsurf->modelinfo);
+            
+            for (int k = 0; k < rs->numPushedRays(); k++) {
+                const int i = rs->getPushedRayPointIndex(k);
+                float frac = 1.0f;
+                if (rs->getPushedRayHitType(k) == hittype_t::SOLID) {
+                    frac = qmin(depth, rs->getPushedRayHitDist(k)) / depth;
+                }
+                sum[i] += frac;
+                sumsq[i] += frac * frac;
+                count[i]++;
+            }
+        }
+        
+        for (int i = 0; i < lightsurf->numpoints; i++) {
+            if (done[i] || !count[i])
+                continue;
+            
+            const float mean = sum[i] / count[i];
+            const float variance = qmax(0.0f, sumsq[i] / count[i] - mean * mean);
+            if (sqrt(variance / count[i]) <= maxerror) {
+                done[i] = true;
+            }
+        }
+    }
+    
+    for (int i = 0; i < lightsurf->numpoints; i++) {
+        // fully occluded points trace no rays, like the non-adaptive path
+        lightsurf->occlusion[i] = count[i] ? (1 - sum[i] / count[i]) : 1;
+    }
+}
+
+/*
+ * ============
+ * LightFace_CalculateDirt
+ * ============
+ */
+static void
+LightFace_CalculateDirt(lightsurf_t *lightsurf)
+{
+    const globalconfig_t &cfg = *lightsurf->cfg;
+    
+    Q_assert(dirt_in_use);
+
+    // batch implementation:
+
+    vec3_t *myUps = (vec3_t *) calloc(lightsurf->numpoints, sizeof(vec3_t));
+    vec3_t *myRts = (vec3_t *) calloc(lightsurf->numpoints, sizeof(vec3_t));
     
     // init
     for (int i = 0; i < lightsurf->numpoints; i++) {
@@ -2559,6 +2937,13 @@ LightFace_CalculateDirt(lightsurf_t *lightsurf)
     for (int i = 0; i < lightsurf->numpoints; i++) {
         GetUpRtVecs(lightsurf->normals[i], myUps[i], myRts[i]);
     }
+    
+    if (cfg.dirtAdaptive.floatValue() > 0) {
+        LightFace_CalculateDirtAdaptive(lightsurf, myUps, myRts);
+        free(myUps);
+        free(myRts);
+        return;
+    }
 
     for (int j=0; j<numDirtVectors; j++) {
         raystream_intersection_t *rs = lightsurf->intersection_stream;
@@ -2694,12 +3079,9 @@ DumpFullSizeLightmap(const mbsp_t *bsp, const lightsurf_t *lightsurf)
             }
         }
         
-        const int oversampled_width = (lightsurf->texsize[0] + 1) * oversample;
-        const int oversampled_height = (lightsurf->texsize[1] + 1) * oversample;
-        
-        Q_assert(lightsurf->numpoints == (oversampled_height * oversampled_width));
+        Q_assert(lightsurf->numpoints == (lightsurf->height * lightsurf->width));
 
-        WritePPM(std::string{fname}, oversampled_width, oversampled_height, rgbdata.data());
+        WritePPM(std::string{fname}, lightsurf->width, lightsurf->height, rgbdata.data());
     }
 }
 
@@ -2738,38 +3120,52 @@ DumpDownscaledLightmap(const mbsp_t *bsp, const bsp2_dface_t *face, int w, int h
     WritePPM(std::string{fname}, w, h, rgbdata.data());
 }
 
-static std::vector<qvec4f>
-LightmapColorsToGLMVector(const lightsurf_t *lightsurf, const lightmap_t *lm)
+/*
+ * Per-thread images reused by WriteSingleLightmap, so post-processing a
+ * lightmap doesn't allocate once they have grown to the largest face.
+ */
+struct lightmapbuffers_t {
+    std::vector<qvec4f> color;              // full size colors, alpha = not occluded
+    std::vector<qvec4f> direction;          // full size directions, for lux
+    std::vector<qvec4f> blur, blurAll;      // BoxBlurImage's horizontal pass
+    std::vector<qvec4f> upcolor, updirection; // UpsampleCoarseImage output
+    std::vector<qvec4f> row, rowAll;        // one downsampled row of colors
+    std::vector<qvec4f> dirrow, dirrowAll;  // one downsampled row of directions
+};
+
+static thread_local lightmapbuffers_t lightmapbuffers;
+
+static void
+LightmapColorsToGLMVector(const lightsurf_t *lightsurf, const lightmap_t *lm, std::vector<qvec4f> &res)
 {
-    std::vector<qvec4f> res;
+    res.resize(lightsurf->numpoints);
     for (int i=0; i<lightsurf->numpoints; i++) {
         const vec_t *color = lm->samples[i].color;
         const float alpha = lightsurf->occluded[i] ? 0.0f : 1.0f;
-        res.emplace_back(color[0], color[1], color[2], alpha); //mxd. https://clang.llvm.org/extra/clang-tidy/checks/modernize-use-emplace.html
+        res[i] = qvec4f(color[0], color[1], color[2], alpha);
     }
-    return res;
 }
 
-static std::vector<qvec4f>
-LightmapNormalsToGLMVector(const lightsurf_t *lightsurf, const lightmap_t *lm)
+static void
+LightmapNormalsToGLMVector(const lightsurf_t *lightsurf, const lightmap_t *lm, std::vector<qvec4f> &res)
 {
-    std::vector<qvec4f> res;
+    res.resize(lightsurf->numpoints);
     for (int i=0; i<lightsurf->numpoints; i++) {
         const vec_t *color = lm->samples[i].direction;
         const float alpha = lightsurf->occluded[i] ? 0.0f : 1.0f;
-        res.emplace_back(color[0], color[1], color[2], alpha); //mxd. https://clang.llvm.org/extra/clang-tidy/checks/modernize-use-emplace.html
+        res[i] = qvec4f(color[0], color[1], color[2], alpha);
     }
-    return res;
 }
 
 static std::vector<qvec4f>
 LightmapToGLMVector(const mbsp_t *bsp, const lightsurf_t *lightsurf)
 {
+    std::vector<qvec4f> res;
     const lightmap_t *lm = Lightmap_ForStyle_ReadOnly(lightsurf, 0);
     if (lm != nullptr) {
-        return LightmapColorsToGLMVector(lightsurf, lm);
+        LightmapColorsToGLMVector(lightsurf, lm, res);
     }
-    return std::vector<qvec4f>();
+    return res;
 }
 
 static qvec3f
@@ -2803,88 +3199,102 @@ void GLMVector_LinearToGamma(std::vector<qvec3f> &vec) {
 // - If all the samples in the filter kernel have alpha=0, write a sample with alpha=0
 //   (but still average the colors, important so that minlight still works properly
 //    for bmodels that go outside of the world).
-static std::vector<qvec4f>
-IntegerDownsampleImage(const std::vector<qvec4f> &input, int w, int h, int factor)
+//
+// Writes row y of the image downsampled by factor to out[0 .. w/factor-1],
+// using all[] as scratch. The kernels of a row are summed together a source
+// row at a time, each in the same order as a 2D loop over the kernel would.
+static void
+IntegerDownsampleRow(const std::vector<qvec4f> &input, int w, int factor, int y, qvec4f *out, qvec4f *all)
 {
     Q_assert(factor >= 1);
-    if (factor == 1)
-        return input;
     
     const int outw = w/factor;
-    const int outh = h/factor;
     
-    std::vector<qvec4f> res(static_cast<size_t>(outw * outh));
+    // rgb sums, and the weight in [3]
+    for (int x=0; x<outw; x++) {
+        out[x] = qvec4f(0);
+        // These are only used if all the samples in the kernel have alpha = 0
+        all[x] = qvec4f(0);
+    }
     
-    for (int y=0; y<outh; y++) {
+    for (int y0 = 0; y0 < factor; y0++) {
+        const qvec4f *row = &input[static_cast<size_t>((y * factor) + y0) * w];
+        
         for (int x=0; x<outw; x++) {
-
-            float totalWeight = 0.0f;
-            qvec3f totalColor(0);
-            
-            // These are only used if all the samples in the kernel have alpha = 0
-            float totalWeightIgnoringOcclusion = 0.0f;
-            qvec3f totalColorIgnoringOcclusion(0);
-            
-            const int extraradius = 0;
-            const int kernelextent = factor + (2 * extraradius);
-            
-            for (int y0 = 0; y0 < kernelextent; y0++) {
-                for (int x0 = 0; x0 < kernelextent; x0++) {
-                    const int x1 = (x * factor) - extraradius + x0;
-                    const int y1 = (y * factor) - extraradius + y0;
-                    
-                    // check if the kernel goes outside of the source image
-                    if (x1 < 0 || x1 >= w)
-                        continue;
-                    if (y1 < 0 || y1 >= h)
-                        continue;
-                    
-                    // read the input sample
-                    const float weight = 1.0f;
-                    const qvec4f inSample = input.at((y1 * w) + x1);
-                    
-                    totalColorIgnoringOcclusion += qvec3f(inSample) * weight;
-                    totalWeightIgnoringOcclusion += weight;
-                    
-                    // Occluded sample points don't contribute to the filter
-                    if (inSample[3] == 0.0f)
-                        continue;
-                    
-                    totalColor += qvec3f(inSample) * weight;
-                    totalWeight += weight;
-                }
+            for (int x0 = 0; x0 < factor; x0++) {
+                // read the input sample
+                const qvec4f &inSample = row[(x * factor) + x0];
+                const qvec4f weighted(inSample[0], inSample[1], inSample[2], 1.0f);
+                
+                all[x] += weighted;
+                
+                // Occluded sample points don't contribute to the filter
+                if (inSample[3] == 0.0f)
+                    continue;
+                
+                out[x] += weighted;
             }
+        }
+    }
+    
+    for (int x=0; x<outw; x++) {
+        if (out[x][3] > 0.0f) {
+            const qvec3f tmp = qvec3f(out[x]) / out[x][3];
+            out[x] = qvec4f(tmp[0], tmp[1], tmp[2], 1.0f);
+        } else {
+            const qvec3f tmp = qvec3f(all[x]) / all[x][3];
+            out[x] = qvec4f(tmp[0], tmp[1], tmp[2], 0.0f);
+        }
+    }
+}
+
+/*
+ * Bilinearly interpolates the coarse samples of a -progressive preview
+ * pass (see CoarseSampleCount) up to the full lightmap size.
+ */
+void
+UpsampleCoarseImage(const std::vector<qvec4f> &input, const lightsurf_t *lightsurf, std::vector<qvec4f> &res)
+{
+    const int w = lightsurf->width;
+    const int outw = lightsurf->texsize[0] + 1;
+    const int outh = lightsurf->texsize[1] + 1;
+    
+    res.resize(static_cast<size_t>(outw * outh));
+    
+    for (int y=0; y<outh; y++) {
+        const int y0 = y / undersample;
+        const int y1 = qmin(y0 + 1, lightsurf->height - 1);
+        const int ly0 = CoarseSampleLuxel(y0, lightsurf->texsize[1]);
+        const int ly1 = CoarseSampleLuxel(y1, lightsurf->texsize[1]);
+        const float fy = (ly1 > ly0) ? static_cast<float>(y - ly0) / (ly1 - ly0) : 0.0f;
+        
+        for (int x=0; x<outw; x++) {
+            const int x0 = x / undersample;
+            const int x1 = qmin(x0 + 1, w - 1);
+            const int lx0 = CoarseSampleLuxel(x0, lightsurf->texsize[0]);
+            const int lx1 = CoarseSampleLuxel(x1, lightsurf->texsize[0]);
+            const float fx = (lx1 > lx0) ? static_cast<float>(x - lx0) / (lx1 - lx0) : 0.0f;
             
-            const int outIndex = (y * outw) + x;
-            if (totalWeight > 0.0f) {
-                const qvec3f tmp = totalColor / totalWeight;
-                const qvec4f resultColor = qvec4f(tmp[0], tmp[1], tmp[2], 1.0f);
-                res[outIndex] = resultColor;
-            } else {
-                const qvec3f tmp = totalColorIgnoringOcclusion / totalWeightIgnoringOcclusion;
-                const qvec4f resultColor = qvec4f(tmp[0], tmp[1], tmp[2], 0.0f);
-                res[outIndex] = resultColor;
-            }
+            const qvec4f top = input.at((y0 * w) + x0) * (1.0f - fx) + input.at((y0 * w) + x1) * fx;
+            const qvec4f bottom = input.at((y1 * w) + x0) * (1.0f - fx) + input.at((y1 * w) + x1) * fx;
+            res[(y * outw) + x] = top * (1.0f - fy) + bottom * fy;
         }
     }
     
-    return res;
 }
 
-static std::vector<qvec4f>
-FloodFillTransparent(const std::vector<qvec4f> &input, int w, int h)
+static void
+FloodFillTransparent(std::vector<qvec4f> &res, int w, int h)
 {
     // transparent pixels take the average of their neighbours.
     
-    std::vector<qvec4f> res(input);
-    
     while (1) {
         int unhandled_pixels = 0;
         
         for (int y=0; y<h; y++) {
             for (int x=0; x<w; x++) {
                 const int i = (y * w) + x;
-                const qvec4f inSample = res.at(i);
+                const qvec4f &inSample = res[i];
                 
                 if (inSample[3] == 0) {
                     // average the neighbouring non-transparent samples
@@ -2901,7 +3311,7 @@ FloodFillTransparent(const std::vector<qvec4f> &input, int w, int h)
                             if (y1 < 0 || y1 >= h)
                                 continue;
                             
-                            const qvec4f neighbourSample = res.at((y1 * w) + x1);
+                            const qvec4f &neighbourSample = res[(y1 * w) + x1];
                             if (neighbourSample[3] == 1) {
                                 opaque_neighbours++;
                                 neighbours_sum += qvec3f(neighbourSample);
@@ -2911,7 +3321,7 @@ FloodFillTransparent(const std::vector<qvec4f> &input, int w, int h)
                     
                     if (opaque_neighbours > 0) {
                         neighbours_sum *= (1.0f / (float)opaque_neighbours);
-                        res.at(i) = qvec4f(neighbours_sum[0], neighbours_sum[1], neighbours_sum[2], 1.0f);
+                        res[i] = qvec4f(neighbours_sum[0], neighbours_sum[1], neighbours_sum[2], 1.0f);
                         
                         // this sample is now opaque
                     } else {
@@ -2923,7 +3333,7 @@ FloodFillTransparent(const std::vector<qvec4f> &input, int w, int h)
             }
         }
         
-        if (unhandled_pixels == input.size()) {
+        if (unhandled_pixels == res.size()) {
             //logprint("FloodFillTransparent: warning, fully transparent lightmap\n");
             fully_transparent_lightmaps++;
             break;
@@ -2932,92 +3342,88 @@ FloodFillTransparent(const std::vector<qvec4f> &input, int w, int h)
         if (unhandled_pixels == 0)
             break; // all done
     }
-    
-    return res;
 }
 
-static std::vector<qvec4f>
-HighlightSeams(const std::vector<qvec4f> &input, int w, int h)
+static void
+HighlightSeams(std::vector<qvec4f> &res, int w, int h)
 {
-    std::vector<qvec4f> res(input);
+    for (auto &sample : res) {
+        if (sample[3] == 0) {
+            sample = qvec4f(255, 0, 0, 1);
+        }
+    }
+}
 
+// Box blur with the same handling of alpha as IntegerDownsampleRow, done
+// as a horizontal pass into buffers->blur and a vertical one back into image.
+//
+// 2017-09-16: this is a hack, but clamping the x/y instead of discarding
+// the samples outside of the kernel looks better in some cases:
+// https://github.com/ericwa/ericw-tools/issues/171
+static void
+BoxBlurImage(std::vector<qvec4f> &image, int w, int h, int radius, lightmapbuffers_t *buffers)
+{
+    // rgb sums, and the weight in [3]
+    std::vector<qvec4f> &blur = buffers->blur;
+    // These are only used if all the samples in the kernel have alpha = 0
+    std::vector<qvec4f> &blurAll = buffers->blurAll;
+    blur.resize(image.size());
+    blurAll.resize(image.size());
+    
     for (int y=0; y<h; y++) {
+        const qvec4f *in = &image[static_cast<size_t>(y) * w];
+        qvec4f *out = &blur[static_cast<size_t>(y) * w];
+        qvec4f *outAll = &blurAll[static_cast<size_t>(y) * w];
+        
         for (int x=0; x<w; x++) {
-            const int i = (y * w) + x;
-            const qvec4f inSample = res.at(i);
-            
-            if (inSample[3] == 0) {
-                res.at(i) = qvec4f(255, 0, 0, 1);
+            qvec4f total(0), totalAll(0);
+            for (int x0 = -radius; x0 <= radius; x0++) {
+                const qvec4f &inSample = in[qclamp(x + x0, 0, w - 1)];
+                const qvec4f weighted(inSample[0], inSample[1], inSample[2], 1.0f);
+                
+                totalAll += weighted;
+                
+                // Occluded sample points don't contribute to the filter
+                if (inSample[3] == 0.0f)
+                    continue;
+                
+                total += weighted;
             }
+            out[x] = total;
+            outAll[x] = totalAll;
         }
     }
     
-    return res;
-}
-
-static std::vector<qvec4f>
-BoxBlurImage(const std::vector<qvec4f> &input, int w, int h, int radius)
-{
-    std::vector<qvec4f> res(input.size());
+    std::vector<qvec4f> &row = buffers->row;
+    std::vector<qvec4f> &rowAll = buffers->rowAll;
+    row.resize(w);
+    rowAll.resize(w);
     
     for (int y=0; y<h; y++) {
-        for (int x=0; x<w; x++) {
-            
-            float totalWeight = 0.0f;
-            qvec3f totalColor(0);
-            
-            // These are only used if all the samples in the kernel have alpha = 0
-            float totalWeightIgnoringOcclusion = 0.0f;
-            qvec3f totalColorIgnoringOcclusion(0);
-            
-            for (int y0 = -radius; y0 <= radius; y0++) {
-                for (int x0 = -radius; x0 <= radius; x0++) {
-                    const int x1 = qclamp(x + x0, 0, w - 1);
-                    const int y1 = qclamp(y + y0, 0, h - 1);
-                    
-                    // check if the kernel goes outside of the source image
-                    
-                    // 2017-09-16: this is a hack, but clamping the
-                    // x/y instead of discarding the samples outside of the
-                    // kernel looks better in some cases:
-                    // https://github.com/ericwa/ericw-tools/issues/171
-#if 0
-                    if (x1 < 0 || x1 >= w)
-                        continue;
-                    if (y1 < 0 || y1 >= h)
-                        continue;
-#endif
-                    
-                    // read the input sample
-                    const float weight = 1.0f;
-                    const qvec4f inSample = input.at((y1 * w) + x1);
-                    
-                    totalColorIgnoringOcclusion += qvec3f(inSample) * weight;
-                    totalWeightIgnoringOcclusion += weight;
-                    
-                    // Occluded sample points don't contribute to the filter
-                    if (inSample[3] == 0.0f)
-                        continue;
-                    
-                    totalColor += qvec3f(inSample) * weight;
-                    totalWeight += weight;
-                }
+        std::fill(row.begin(), row.end(), qvec4f(0));
+        std::fill(rowAll.begin(), rowAll.end(), qvec4f(0));
+        
+        for (int y0 = -radius; y0 <= radius; y0++) {
+            const size_t y1 = static_cast<size_t>(qclamp(y + y0, 0, h - 1));
+            const qvec4f *in = &blur[y1 * w];
+            const qvec4f *inAll = &blurAll[y1 * w];
+            for (int x=0; x<w; x++) {
+                row[x] += in[x];
+                rowAll[x] += inAll[x];
             }
-            
-            const int outIndex = (y * w) + x;
-            if (totalWeight > 0.0f) {
-                const qvec3f tmp = totalColor / totalWeight;
-                const qvec4f resultColor = qvec4f(tmp[0], tmp[1], tmp[2], 1.0f);
-                res[outIndex] = resultColor;
+        }
+        
+        qvec4f *out = &image[static_cast<size_t>(y) * w];
+        for (int x=0; x<w; x++) {
+            if (row[x][3] > 0.0f) {
+                const qvec3f tmp = qvec3f(row[x]) / row[x][3];
+                out[x] = qvec4f(tmp[0], tmp[1], tmp[2], 1.0f);
             } else {
-                const qvec3f tmp = totalColorIgnoringOcclusion / totalWeightIgnoringOcclusion;
-                const qvec4f resultColor = qvec4f(tmp[0], tmp[1], tmp[2], 0.0f);
-                res[outIndex] = resultColor;
+                const qvec3f tmp = qvec3f(rowAll[x]) / rowAll[x][3];
+                out[x] = qvec4f(tmp[0], tmp[1], tmp[2], 0.0f);
             }
         }
     }
-    
-    return res;
 }
 
 static void
@@ -3191,34 +3597,66 @@ WriteSingleLightmap(const mbsp_t *bsp,
                     const int actual_width, const int actual_height,
                     uint8_t *out, uint8_t *lit, uint8_t *lux)
 {
-        const int oversampled_width = actual_width * oversample;
-        const int oversampled_height = actual_height * oversample;
+        const int oversampled_width = lightsurf->width;
+        const int oversampled_height = lightsurf->height;
+        const int oversample = (undersample > 1) ? 1 : PointsOversample();
+        lightmapbuffers_t *buffers = &lightmapbuffers;
 
-        // allocate new float buffers for the output colors and directions
-        // these are the actual output width*height, without oversampling.
+        // post-process the full size colors in place. directions aren't.
         
-        std::vector<qvec4f> fullres = LightmapColorsToGLMVector(lightsurf, lm);
+        std::vector<qvec4f> &fullres = buffers->color;
+        LightmapColorsToGLMVector(lightsurf, lm, fullres);
+        if (lux)
+            LightmapNormalsToGLMVector(lightsurf, lm, buffers->direction);
         
         if (debug_highlightseams) {
-            fullres = HighlightSeams(fullres, oversampled_width, oversampled_height);
+            HighlightSeams(fullres, oversampled_width, oversampled_height);
         }
         
         // removes all transparent pixels by averaging from adjacent pixels
-        fullres = FloodFillTransparent(fullres, oversampled_width, oversampled_height);
+        FloodFillTransparent(fullres, oversampled_width, oversampled_height);
         
         if (softsamples > 0) {
-            fullres = BoxBlurImage(fullres, oversampled_width, oversampled_height, softsamples);
+            BoxBlurImage(fullres, oversampled_width, oversampled_height, softsamples, buffers);
         }
         
-        const std::vector<qvec4f> output_color = IntegerDownsampleImage(fullres, oversampled_width, oversampled_height, oversample);
-        const std::vector<qvec4f> output_dir = (lux ? IntegerDownsampleImage(LightmapNormalsToGLMVector(lightsurf, lm), oversampled_width, oversampled_height, oversample) : *new std::vector<qvec4f>); //mxd. Skip when lux isn't needed
+        // the source of the output colors and directions, one row at a time.
+        // these are the actual output width*height, without oversampling.
+        const std::vector<qvec4f> *color_image = &fullres;
+        const std::vector<qvec4f> *dir_image = &buffers->direction;
+        if (undersample > 1) {
+            UpsampleCoarseImage(fullres, lightsurf, buffers->upcolor);
+            color_image = &buffers->upcolor;
+            if (lux) {
+                UpsampleCoarseImage(buffers->direction, lightsurf, buffers->updirection);
+                dir_image = &buffers->updirection;
+            }
+        } else if (oversample > 1) {
+            buffers->row.resize(actual_width);
+            buffers->rowAll.resize(actual_width);
+            buffers->dirrow.resize(actual_width);
+            buffers->dirrowAll.resize(actual_width);
+        }
         
         // copy from the float buffers to byte buffers in .bsp / .lit / .lux
         
         for (int t = 0; t < actual_height; t++) {
+            const qvec4f *colors, *directions = nullptr;
+            if (oversample > 1) {
+                IntegerDownsampleRow(*color_image, oversampled_width, oversample, t, buffers->row.data(), buffers->rowAll.data());
+                colors = buffers->row.data();
+                if (lux) {
+                    IntegerDownsampleRow(*dir_image, oversampled_width, oversample, t, buffers->dirrow.data(), buffers->dirrowAll.data());
+                    directions = buffers->dirrow.data();
+                }
+            } else {
+                colors = &(*color_image)[static_cast<size_t>(t) * actual_width];
+                if (lux)
+                    directions = &(*dir_image)[static_cast<size_t>(t) * actual_width];
+            }
+            
             for (int s = 0; s < actual_width; s++) {
-                const int sampleindex = (t * actual_width) + s;
-                qvec4f color = output_color.at(sampleindex);
+                const qvec4f &color = colors[s];
                 
                 *lit++ = color[0];
                 *lit++ = color[1];
@@ -3239,7 +3677,7 @@ WriteSingleLightmap(const mbsp_t *bsp,
                 if (lux) {
                     vec3_t temp;
                     int v;
-                    const qvec4f &direction = output_dir.at(sampleindex);
+                    const qvec4f &direction = directions[s];
                     temp[0] = qv::dot(qvec3f(direction), vec3_t_to_glm(lightsurf->snormal));
                     temp[1] = qv::dot(qvec3f(direction), vec3_t_to_glm(lightsurf->tnormal));
                     temp[2] = qv::dot(qvec3f(direction), vec3_t_to_glm(lightsurf->plane.normal));
@@ -3276,74 +3714,15 @@ static void LightFaceShutdown(lightsurf_t *lightsurf)
 }
 
 /*
- * ============
- * LightFace
- * ============
+ * Lights the points of lightsurf: dirt, then all positive lights,
+ * minlight and all negative lights.
  */
-void
-LightFace(const mbsp_t *bsp, bsp2_dface_t *face, facesup_t *facesup, const globalconfig_t &cfg)
+static void
+LightFace_Sources(const mbsp_t *bsp, const bsp2_dface_t *face, const modelinfo_t *modelinfo, lightsurf_t *lightsurf)
 {
-    /* Find the correct model offset */
-    const modelinfo_t *modelinfo = ModelInfoForFace(bsp, Face_GetNum(bsp, face));
-    if (modelinfo == nullptr) {
-        return;
-    }    
-    
-    /* One extra lightmap is allocated to simplify handling overflow */
-    
-    if (!litonly) {
-        // if litonly is set we need to preserve the existing lightofs
-
-        /* some surfaces don't need lightmaps */
-        if (facesup)
-        {
-            facesup->lightofs = -1;
-            for (int i = 0; i < MAXLIGHTMAPS; i++)
-                facesup->styles[i] = 255;
-        }
-        else
-        {
-            face->lightofs = -1;
-            for (int i = 0; i < MAXLIGHTMAPS; i++)
-                face->styles[i] = 255;
-        }
-    }
-
-    /* don't bother with degenerate faces */
-    if (face->numedges < 3)
-        return;
-
-    if (!Face_IsLightmapped(bsp, face))
-        return;
-
-    const char *texname = Face_TextureName(bsp, face);
-
-    /* don't save lightmaps for "trigger" texture */
-    if (!Q_strcasecmp(texname, "trigger"))
-        return;
-    
-    /* don't save lightmaps for "skip" texture */
-    if (!Q_strcasecmp(texname, "skip"))
-        return;
-    
-    /* all good, this face is going to be lightmapped. */
-    lightsurf_t *lightsurf = new lightsurf_t {};
-    lightsurf->cfg = &cfg;
-    
-    /* if liquid doesn't have the TEX_SPECIAL flag set, the map was qbsp'ed with
-     * lit water in mind. In that case receive light from both top and bottom.
-     * (lit will only be rendered in compatible engines, but degrades gracefully.)
-     */
-    if (/* texname[0] == '*' */ Face_IsTranslucent(bsp, face)) { //mxd
-        lightsurf->twosided = true;
-    }
-    
-    if (!Lightsurf_Init(modelinfo, face, bsp, lightsurf, facesup)) {
-        /* invalid texture axes */
-        return;
-    }
+    const globalconfig_t &cfg = *lightsurf->cfg;
     lightmapdict_t *lightmaps = &lightsurf->lightmapsByStyle;
-
+    
     /* calculate dirt (ambient occlusion) but don't use it yet */
     if (dirt_in_use && (debugmode != debugmode_phong))
         LightFace_CalculateDirt(lightsurf);
@@ -3416,6 +3795,245 @@ LightFace(const mbsp_t *bsp, bsp2_dface_t *face, facesup_t *facesup, const globa
                     LightFace_Sky (&sun, lightsurf, lightmaps);
         }
     }
+}
+
+/*
+ * -adaptive: after lighting the face at the base resolution, picks the
+ * luxels next to a change in occlusion or whose color in any style
+ * differs from the average of their neighbours by more than the
+ * threshold (shadow edges, light spots), lights
+ * oversample*oversample points within each of them, and replaces them
+ * with the average, as IntegerDownsampleRow would for -extra/-extra4.
+ */
+static void
+LightFace_Adaptive(const mbsp_t *bsp, const bsp2_dface_t *face, const modelinfo_t *modelinfo, lightsurf_t *lightsurf)
+{
+    const int width = lightsurf->width;
+    const int height = lightsurf->height;
+    
+    // the four directions (horizontal, vertical, diagonals) to check
+    static const int dirs[4][2] = { {1, 0}, {0, 1}, {1, 1}, {1, -1} };
+    
+    std::vector<bool> refine(lightsurf->numpoints, false);
+    for (int t = 0; t < height; t++) {
+        for (int s = 0; s < width; s++) {
+            const int i = t*width + s;
+            
+            for (const auto &dir : dirs) {
+                const int s0 = s - dir[0], t0 = t - dir[1];
+                const int s1 = s + dir[0], t1 = t + dir[1];
+                const bool has0 = (s0 >= 0 && s0 < width && t0 >= 0 && t0 < height);
+                const bool has1 = (s1 >= 0 && s1 < width && t1 >= 0 && t1 < height);
+                const int n0 = t0*width + s0;
+                const int n1 = t1*width + s1;
+                
+                // a sample point stuck in solid next to one that isn't
+                if (has1 && lightsurf->occluded[n1] != lightsurf->occluded[i]) {
+                    refine[i] = refine[n1] = true;
+                }
+                
+                // a luxel that differs from the average of its neighbours on
+                // either side; smooth gradients from light falloff don't.
+                // luxels on the edge of the lightmap have no such average,
+                // so they are refined along with their neighbour.
+                if (!has0 || !has1)
+                    continue;
+                const bool edge0 = !(s0 - dir[0] >= 0 && s0 - dir[0] < width && t0 - dir[1] >= 0 && t0 - dir[1] < height);
+                const bool edge1 = !(s1 + dir[0] >= 0 && s1 + dir[0] < width && t1 + dir[1] >= 0 && t1 + dir[1] < height);
+                for (const auto &lm : lightsurf->lightmapsByStyle) {
+                    if (lm.style == 255)
+                        continue;
+                    const vec_t *a = lm.samples[n0].color;
+                    const vec_t *b = lm.samples[i].color;
+                    const vec_t *c = lm.samples[n1].color;
+                    if (fabs(b[0] - (a[0] + c[0]) * 0.5f) > adaptive
+                        || fabs(b[1] - (a[1] + c[1]) * 0.5f) > adaptive
+                        || fabs(b[2] - (a[2] + c[2]) * 0.5f) > adaptive) {
+                        refine[i] = true;
+                        refine[n0] = refine[n0] || edge0;
+                        refine[n1] = refine[n1] || edge1;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    
+    std::vector<int> luxels;
+    for (int i = 0; i < lightsurf->numpoints; i++) {
+        if (refine[i])
+            luxels.push_back(i);
+    }
+    
+    if (luxels.empty())
+        return;
+    
+    /* the supersampling points of the chosen luxels, oversample*oversample each */
+    const int subsamples = oversample * oversample;
+    lightsurf_t *sub = new lightsurf_t(*lightsurf);
+    sub->lightmapsByStyle.clear();
+    sub->lights.clear();
+    sub->pvsready = false;
+    sub->scattered = true;
+    sub->numpoints = static_cast<int>(luxels.size()) * subsamples;
+    sub->width = sub->numpoints;
+    sub->height = 1;
+    sub->points = (vec3_t *) calloc(sub->numpoints, sizeof(vec3_t));
+    sub->normals = (vec3_t *) calloc(sub->numpoints, sizeof(vec3_t));
+    sub->occluded = (bool *) calloc(sub->numpoints, sizeof(bool));
+    sub->realfacenums = (int *) calloc(sub->numpoints, sizeof(int));
+    sub->occlusion = (float *) calloc(sub->numpoints, sizeof(float));
+    sub->intersection_stream = MakeIntersectionRayStream(sub->numpoints);
+    sub->occlusion_stream = MakeOcclusionRayStream(sub->numpoints);
+    
+    const float starts = (lightsurf->texmins[0] - 0.5 + (0.5 / oversample)) * lightsurf->lightmapscale;
+    const float startt = (lightsurf->texmins[1] - 0.5 + (0.5 / oversample)) * lightsurf->lightmapscale;
+    const float st_step = lightsurf->lightmapscale / oversample;
+    
+    for (size_t k = 0; k < luxels.size(); k++) {
+        const int s = luxels[k] % width;
+        const int t = luxels[k] / width;
+        for (int j = 0; j < subsamples; j++) {
+            const vec_t us = starts + (s * oversample + (j % oversample)) * st_step;
+            const vec_t ut = startt + (t * oversample + (j / oversample)) * st_step;
+            CalcPoint(modelinfo->offset, sub, bsp, face, us, ut, (k * subsamples) + j);
+        }
+    }
+    
+    LightFace_Sources(bsp, face, modelinfo, sub);
+    
+    /* styles that only reached the supersampling points */
+    for (const auto &sublm : sub->lightmapsByStyle) {
+        if (sublm.style == 255)
+            continue;
+        lightmap_t *lm = Lightmap_ForStyle(&lightsurf->lightmapsByStyle, sublm.style, lightsurf);
+        Lightmap_Save(&lightsurf->lightmapsByStyle, lightsurf, lm, sublm.style);
+    }
+    
+    for (auto &lm : lightsurf->lightmapsByStyle) {
+        if (lm.style == 255)
+            continue;
+        const lightmap_t *sublm = Lightmap_ForStyle_ReadOnly(sub, lm.style);
+        
+        for (size_t k = 0; k < luxels.size(); k++) {
+            lightsample_t total {}, totalIgnoringOcclusion {};
+            int count = 0;
+            
+            if (sublm != nullptr) {
+                for (int j = 0; j < subsamples; j++) {
+                    const int si = (k * subsamples) + j;
+                    const lightsample_t &sample = sublm->samples[si];
+                    VectorAdd(totalIgnoringOcclusion.color, sample.color, totalIgnoringOcclusion.color);
+                    VectorAdd(totalIgnoringOcclusion.direction, sample.direction, totalIgnoringOcclusion.direction);
+                    
+                    // occluded points don't contribute, unless they all are
+                    if (sub->occluded[si])
+                        continue;
+                    VectorAdd(total.color, sample.color, total.color);
+                    VectorAdd(total.direction, sample.direction, total.direction);
+                    count++;
+                }
+            }
+            
+            lightsample_t *out = &lm.samples[luxels[k]];
+            if (count > 0) {
+                VectorScale(total.color, 1.0f / count, out->color);
+                VectorScale(total.direction, 1.0f / count, out->direction);
+            } else {
+                VectorScale(totalIgnoringOcclusion.color, 1.0f / subsamples, out->color);
+                VectorScale(totalIgnoringOcclusion.direction, 1.0f / subsamples, out->direction);
+            }
+        }
+    }
+    
+    for (size_t k = 0; k < luxels.size(); k++) {
+        bool occluded = true;
+        for (int j = 0; j < subsamples; j++) {
+            occluded = occluded && sub->occluded[(k * subsamples) + j];
+        }
+        lightsurf->occluded[luxels[k]] = occluded;
+    }
+    
+    LightFaceShutdown(sub);
+}
+
+/*
+ * ============
+ * LightFace
+ * ============
+ */
+void
+LightFace(const mbsp_t *bsp, bsp2_dface_t *face, facesup_t *facesup, const globalconfig_t &cfg)
+{
+    /* Find the correct model offset */
+    const modelinfo_t *modelinfo = ModelInfoForFace(bsp, Face_GetNum(bsp, face));
+    if (modelinfo == nullptr) {
+        return;
+    }    
+    
+    /* One extra lightmap is allocated to simplify handling overflow */
+    
+    if (!litonly) {
+        // if litonly is set we need to preserve the existing lightofs
+
+        /* some surfaces don't need lightmaps */
+        if (facesup)
+        {
+            facesup->lightofs = -1;
+            for (int i = 0; i < MAXLIGHTMAPS; i++)
+                facesup->styles[i] = 255;
+        }
+        else
+        {
+            face->lightofs = -1;
+            for (int i = 0; i < MAXLIGHTMAPS; i++)
+                face->styles[i] = 255;
+        }
+    }
+
+    /* don't bother with degenerate faces */
+    if (face->numedges < 3)
+        return;
+
+    if (!Face_IsLightmapped(bsp, face))
+        return;
+
+    const char *texname = Face_TextureName(bsp, face);
+
+    /* don't save lightmaps for "trigger" texture */
+    if (!Q_strcasecmp(texname, "trigger"))
+        return;
+    
+    /* don't save lightmaps for "skip" texture */
+    if (!Q_strcasecmp(texname, "skip"))
+        return;
+    
+    /* unchanged since the last -incremental run */
+    if (Relight_ReuseFace(bsp, face, facesup))
+        return;
+    
+    /* all good, this face is going to be lightmapped. */
+    lightsurf_t *lightsurf = new lightsurf_t {};
+    lightsurf->cfg = &cfg;
+    
+    /* if liquid doesn't have the TEX_SPECIAL flag set, the map was qbsp'ed with
+     * lit water in mind. In that case receive light from both top and bottom.
+     * (lit will only be rendered in compatible engines, but degrades gracefully.)
+     */
+    if (/* texname[0] == '*' */ Face_IsTranslucent(bsp, face)) { //mxd
+        lightsurf->twosided = true;
+    }
+    
+    if (!Lightsurf_Init(modelinfo, face, bsp, lightsurf, facesup)) {
+        /* invalid texture axes */
+        return;
+    }
+    lightmapdict_t *lightmaps = &lightsurf->lightmapsByStyle;
+
+    LightFace_Sources(bsp, face, modelinfo, lightsurf);
+    
+    if (AdaptiveSupersampling())
+        LightFace_Adaptive(bsp, face, modelinfo, lightsurf);
     
     /* bounce debug */
     // TODO: add a BounceDebug function that clear the lightmap to make the code more clear
@@ -3442,6 +4060,7 @@ LightFace(const mbsp_t *bsp, bsp2_dface_t *face, facesup_t *facesup, const globa
     LightFace_ScaleAndClamp(lightsurf, lightmaps);
     
     WriteLightmaps(bsp, face, facesup, lightsurf, lightmaps);
+    Relight_RecordFace(bsp, face, facesup, lightsurf);
     
     LightFaceShutdown(lightsurf);
 }
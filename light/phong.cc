@@ -39,6 +39,7 @@
 #include <string>
 
 #include <common/qvec.hh>
+#include <common/threads.hh>
 
 using namespace std;
 
@@ -172,28 +173,64 @@ AngleBetweenPoints(const qvec3f &p1, const qvec3f &p2, const qvec3f &p3)
 }
 
 static bool s_builtPhongCaches;
-static std::map<const bsp2_dface_t *, std::vector<qvec3f>> vertex_normals;
-static std::set<int> interior_verts;
-static map<const bsp2_dface_t *, set<const bsp2_dface_t *>> smoothFaces;
-static map<int, vector<const bsp2_dface_t *>> vertsToFaces;
-static map<int, vector<const bsp2_dface_t *>> planesToFaces;
-static edgeToFaceMap_t EdgeToFaceMap;
+static const mbsp_t *s_phongBsp;
+static faceadjacency_t smoothFaces;     // face number -> faces to smooth with, sorted
+static faceadjacency_t vertsToFaces;    // vertex -> faces using it
+static faceadjacency_t planesToFaces;   // plane number -> faces on it
+static std::vector<bool> interior_verts;
+
+/*
+ * directed edges v0->v1 by v0, each with a face using it. an edge can be
+ * used by more than one face, e.g. two cubes touching just along an edge
+ */
+struct edgeface_t {
+    int v1;
+    const bsp2_dface_t *face;
+};
+static std::vector<int> edgeOffsets;
+static std::vector<edgeface_t> edgeFaces;
+
+/* face number -> phong normal of each of its verts, empty for degenerate faces */
+static std::vector<int> vertexNormalOffsets;
+static std::vector<qvec3f> vertexNormals;
+
 static vector<face_cache_t> FaceCache;
 
-vector<const bsp2_dface_t *> FacesUsingVert(int vertnum)
+facelist_t faceadjacency_t::row(int i) const
 {
-    const auto &vertsToFaces_const = vertsToFaces;
+    if (i < 0 || i + 1 >= static_cast<int>(offsets.size()))
+        return facelist_t{nullptr, nullptr};
     
-    auto it = vertsToFaces_const.find(vertnum);
-    if (it != vertsToFaces_const.end())
-        return it->second;
-    return {};
+    const bsp2_dface_t *const *base = faces.data();
+    return facelist_t{base + offsets[i], base + offsets[i + 1]};
 }
 
-const edgeToFaceMap_t &GetEdgeToFaceMap()
+/*
+ * Stable counting sort of the (row, face) pairs into adj, so the faces
+ * of each row keep the order they had in pairs.
+ */
+static void
+BuildAdjacency(faceadjacency_t *adj, int numrows, const std::vector<std::pair<int, const bsp2_dface_t *>> &pairs)
 {
-    Q_assert(s_builtPhongCaches);
-    return EdgeToFaceMap;
+    adj->offsets.assign(numrows + 1, 0);
+    for (const auto &pair : pairs) {
+        adj->offsets[pair.first + 1]++;
+    }
+    for (int i = 0; i < numrows; i++) {
+        adj->offsets[i + 1] += adj->offsets[i];
+    }
+    
+    std::vector<int> next(adj->offsets.begin(), adj->offsets.end() - 1);
+    adj->faces.resize(pairs.size());
+    for (const auto &pair : pairs) {
+        adj->faces[next[pair.first]++] = pair.second;
+    }
+}
+
+vector<const bsp2_dface_t *> FacesUsingVert(int vertnum)
+{
+    const facelist_t faces = vertsToFaces.row(vertnum);
+    return vector<const bsp2_dface_t *>(faces.begin(), faces.end());
 }
 
 // Uses `smoothFaces` static var
@@ -201,48 +238,43 @@ bool FacesSmoothed(const bsp2_dface_t *f1, const bsp2_dface_t *f2)
 {
     Q_assert(s_builtPhongCaches);
     
-    const auto &facesIt = smoothFaces.find(f1);
-    if (facesIt == smoothFaces.end())
-        return false;
-    
-    const set<const bsp2_dface_t *> &faceSet = facesIt->second;
-    if (faceSet.find(f2) == faceSet.end())
-        return false;
-    
-    return true;
+    const facelist_t faces = smoothFaces.row(static_cast<int>(f1 - s_phongBsp->dfaces));
+    return std::binary_search(faces.begin(), faces.end(), f2);
 }
 
-const std::set<const bsp2_dface_t *> &GetSmoothFaces(const bsp2_dface_t *face)
+facelist_t GetSmoothFaces(const bsp2_dface_t *face)
 {
     Q_assert(s_builtPhongCaches);
     
-    static std::set<const bsp2_dface_t *> empty;
-    const auto it = smoothFaces.find(face);
-    
-    if (it == smoothFaces.end())
-        return empty;
-    
-    return it->second;
+    return smoothFaces.row(static_cast<int>(face - s_phongBsp->dfaces));
 }
 
-const std::vector<const bsp2_dface_t *> &GetPlaneFaces(const bsp2_dface_t *face)
+facelist_t GetPlaneFaces(const bsp2_dface_t *face)
 {
     Q_assert(s_builtPhongCaches);
     
-    static std::vector<const bsp2_dface_t *> empty;
-    const auto it = planesToFaces.find(face->planenum);
-    
-    if (it == planesToFaces.end())
-        return empty;
-    
-    return it->second;
+    return planesToFaces.row(face->planenum);
 }
 
 
 /* given a triangle, just adds the contribution from the triangle to the given vertexes normals, based upon angles at the verts.
  * v1, v2, v3 are global vertex indices */
+using smoothednormals_t = std::vector<std::pair<int, qvec3f>>;
+
+/* the normal being accumulated for global vertex index v, found by a linear search as there are few */
+static qvec3f &
+SmoothedNormal(smoothednormals_t &smoothed_normals, int v)
+{
+    for (auto &pair : smoothed_normals) {
+        if (pair.first == v)
+            return pair.second;
+    }
+    smoothed_normals.emplace_back(v, qvec3f(0));
+    return smoothed_normals.back().second;
+}
+
 static void
-AddTriangleNormals(std::map<int, qvec3f> &smoothed_normals, const qvec3f &norm, const mbsp_t *bsp, int v1, int v2, int v3)
+AddTriangleNormals(smoothednormals_t &smoothed_normals, const qvec3f &norm, const mbsp_t *bsp, int v1, int v2, int v3)
 {
     const qvec3f p1 = Vertex_GetPos_E(bsp, v1);
     const qvec3f p2 = Vertex_GetPos_E(bsp, v2);
@@ -256,15 +288,18 @@ AddTriangleNormals(std::map<int, qvec3f> &smoothed_normals, const qvec3f &norm,
     
     weight = AngleBetweenPoints(p2, p1, p3);
     weight *= areaweight;
-    smoothed_normals[v1] = smoothed_normals[v1] + (norm * weight);
+    qvec3f &n1 = SmoothedNormal(smoothed_normals, v1);
+    n1 = n1 + (norm * weight);
 
     weight = AngleBetweenPoints(p1, p2, p3);
     weight *= areaweight;
-    smoothed_normals[v2] = smoothed_normals[v2] + (norm * weight);
+    qvec3f &n2 = SmoothedNormal(smoothed_normals, v2);
+    n2 = n2 + (norm * weight);
 
     weight = AngleBetweenPoints(p1, p3, p2);
     weight *= areaweight;
-    smoothed_normals[v3] = smoothed_normals[v3] + (norm * weight);
+    qvec3f &n3 = SmoothedNormal(smoothed_normals, v3);
+    n3 = n3 + (norm * weight);
 }
 
 /* access the final phong-shaded vertex normal */
@@ -273,21 +308,22 @@ const qvec3f GetSurfaceVertexNormal(const mbsp_t *bsp, const bsp2_dface_t *f, co
     Q_assert(s_builtPhongCaches);
     
     // handle degenerate faces
-    const auto it = vertex_normals.find(f);
-    if (it == vertex_normals.end()) {
+    const int fnum = static_cast<int>(f - bsp->dfaces);
+    const int first = vertexNormalOffsets.at(fnum);
+    if (first == vertexNormalOffsets.at(fnum + 1)) {
         return qvec3f(0,0,0);
     }
-    const auto &face_normals_vec = it->second;
-    return face_normals_vec.at(vertindex);
+    Q_assert(first + vertindex < vertexNormalOffsets.at(fnum + 1));
+    return vertexNormals[first + vertindex];
 }
 
 static bool
-FacesOnSamePlane(const std::vector<const bsp2_dface_t *> &faces)
+FacesOnSamePlane(const facelist_t &faces)
 {
     if (faces.empty()) {
         return false;
     }
-    const int32_t planenum = faces.at(0)->planenum;
+    const int32_t planenum = (*faces.begin())->planenum;
     for (auto face : faces) {
         if (face->planenum != planenum) {
             return false;
@@ -304,9 +340,12 @@ Face_EdgeIndexSmoothed(const mbsp_t *bsp, const bsp2_dface_t *f, const int edgei
     const int v0 = Face_VertexAtIndex(bsp, f, edgeindex);
     const int v1 = Face_VertexAtIndex(bsp, f, (edgeindex + 1) % f->numedges);
 
-    auto it = EdgeToFaceMap.find(make_pair(v1, v0));
-    if (it != EdgeToFaceMap.end()) {
-        for (const bsp2_dface_t *neighbour : it->second) {
+    if (v1 >= 0 && v1 + 1 < static_cast<int>(edgeOffsets.size())) {
+        for (int i = edgeOffsets[v1]; i < edgeOffsets[v1 + 1]; i++) {
+            if (edgeFaces[i].v1 != v0)
+                continue;
+            
+            const bsp2_dface_t *neighbour = edgeFaces[i].face;
             if (neighbour == f) {
                 // Invalid face, e.g. with vertex numbers: [0, 1, 0, 2]
                 continue;
@@ -350,12 +389,14 @@ Face_EdgeIndexSmoothed(const mbsp_t *bsp, const bsp2_dface_t *f, const int edgei
 #endif
 }
 
-static edgeToFaceMap_t MakeEdgeToFaceMap(const mbsp_t *bsp)
+static void MakeEdgeToFaceMap(const mbsp_t *bsp)
 {
-    edgeToFaceMap_t result;
+    std::vector<std::pair<int, const bsp2_dface_t *>> pairs;
+    std::vector<int> v1s;
     
     for (int i = 0; i < bsp->numfaces; i++) {
         const bsp2_dface_t *f = BSP_GetFace(bsp, i);
+        const size_t firstedge = pairs.size();
         
         // walk edges
         for (int j = 0; j < f->numedges; j++) {
@@ -367,18 +408,36 @@ static edgeToFaceMap_t MakeEdgeToFaceMap(const mbsp_t *bsp)
                 continue;
             }
             
-            const auto edge = make_pair(v0, v1);
-            auto &edgeFacesRef = result[edge];
-            
-            if (find(begin(edgeFacesRef), end(edgeFacesRef), f) != end(edgeFacesRef)) {
+            bool repeated = false;
+            for (size_t k = firstedge; k < pairs.size(); k++) {
+                if (pairs[k].first == v0 && v1s[k] == v1) {
+                    repeated = true;
+                    break;
+                }
+            }
+            if (repeated) {
                 // another sort of degenerate face where the same edge A->B appears more than once on the face
                 continue;
             }
-            edgeFacesRef.push_back(f);
+            pairs.emplace_back(v0, f);
+            v1s.push_back(v1);
         }
     }
     
-    return result;
+    // counting sort by v0, as in BuildAdjacency
+    edgeOffsets.assign(bsp->numvertexes + 1, 0);
+    for (const auto &pair : pairs) {
+        edgeOffsets[pair.first + 1]++;
+    }
+    for (int i = 0; i < bsp->numvertexes; i++) {
+        edgeOffsets[i + 1] += edgeOffsets[i];
+    }
+    
+    std::vector<int> next(edgeOffsets.begin(), edgeOffsets.end() - 1);
+    edgeFaces.resize(pairs.size());
+    for (size_t k = 0; k < pairs.size(); k++) {
+        edgeFaces[next[pairs[k].first]++] = edgeface_t{v1s[k], pairs[k].second};
+    }
 }
 
 static vector<qvec3f> Face_VertexNormals(const mbsp_t *bsp, const bsp2_dface_t *face)
@@ -391,14 +450,26 @@ static vector<qvec3f> Face_VertexNormals(const mbsp_t *bsp, const bsp2_dface_t *
     return normals;
 }
 
-static vector<face_cache_t> MakeFaceCache(const mbsp_t *bsp)
+static void *MakeFaceCacheThread(void *arg)
 {
-    vector<face_cache_t> result;
-    for (int i=0; i<bsp->numfaces; i++) {
+    const mbsp_t *bsp = static_cast<const mbsp_t *>(arg);
+    
+    while (1) {
+        const int i = GetThreadWork();
+        if (i == -1)
+            break;
+        
         const bsp2_dface_t *face = BSP_GetFace(bsp, i);
-        result.push_back(face_cache_t{bsp, face, Face_VertexNormals(bsp, face)});
+        FaceCache[i] = face_cache_t{bsp, face, Face_VertexNormals(bsp, face)};
     }
-    return result;
+    return nullptr;
+}
+
+static void MakeFaceCache(const mbsp_t *bsp)
+{
+    FaceCache.clear();
+    FaceCache.resize(bsp->numfaces);
+    RunThreadsOn(0, bsp->numfaces, MakeFaceCacheThread, const_cast<mbsp_t *>(bsp));
 }
 
 /**
@@ -416,153 +487,129 @@ static int Q2_FacePhongValue(const mbsp_t *bsp, const bsp2_dface_t *face) {
     return 0;
 }
 
-void
-CalculateVertexNormals(const mbsp_t *bsp)
-{
-    logprint("--- %s ---\n", __func__);
+/* per-face data shared by the threads of CalculateVertexNormals */
+struct phongface_t {
+    int phong_angle;
+    int phong_angle_concave;
+    int q2_phong_value;
+    qvec3f normal;
+    qplane3f plane { qvec3f(0), 0 };
+    qvec3f centroid;
+};
 
-    Q_assert(!s_builtPhongCaches);
-    s_builtPhongCaches = true;
-    
-    EdgeToFaceMap = MakeEdgeToFaceMap(bsp);
-    
-    // read _phong and _phong_angle from entities for compatiblity with other qbsp's, at the expense of no
-    // support on func_detail/func_group
-    for (int i=0; i<bsp->nummodels; i++) {
-        const modelinfo_t *info = ModelInfoForModel(bsp, i);
-        const uint8_t phongangle_byte = (uint8_t) qmax(0, qmin(255, (int)rint(info->getResolvedPhongAngle())));
+static std::vector<phongface_t> phongFaces;
+static std::vector<std::vector<const bsp2_dface_t *>> smoothLists;
 
-        if (!phongangle_byte)
-            continue;
-        
-        for (int j=info->model->firstface; j < info->model->firstface + info->model->numfaces; j++) {
-            const bsp2_dface_t *f = BSP_GetFace(bsp, j);
-            
-            extended_texinfo_flags[f->texinfo].phong_angle = phongangle_byte;
-        }
-    }
-    
-    // build "plane -> faces" map
-    for (int i = 0; i < bsp->numfaces; i++) {
-        const bsp2_dface_t *f = BSP_GetFace(bsp, i);
-        planesToFaces[f->planenum].push_back(f);
-    }
+static void *PhongFaceThread(void *arg)
+{
+    const mbsp_t *bsp = static_cast<const mbsp_t *>(arg);
     
-    // build "vert index -> faces" map
-    for (int i = 0; i < bsp->numfaces; i++) {
+    while (1) {
+        const int i = GetThreadWork();
+        if (i == -1)
+            break;
+        
         const bsp2_dface_t *f = BSP_GetFace(bsp, i);
-        for (int j = 0; j < f->numedges; j++) {
-            const int v = Face_VertexAtIndex(bsp, f, j);
-            vertsToFaces[v].push_back(f);
-        }
-    }
-    
-    // track "interior" verts, these are in the middle of a face, and mess up normal interpolation
-    for (int i=0; i<bsp->numvertexes; i++) {
-        auto &faces = vertsToFaces[i];
-        if (faces.size() > 1 && FacesOnSamePlane(faces)) {
-            interior_verts.insert(i);
+        phongface_t &pf = phongFaces[i];
+        
+        pf.phong_angle = extended_texinfo_flags[f->texinfo].phong_angle;
+        pf.phong_angle_concave = extended_texinfo_flags[f->texinfo].phong_angle_concave;
+        if (pf.phong_angle_concave == 0) {
+            pf.phong_angle_concave = pf.phong_angle;
         }
+        pf.q2_phong_value = Q2_FacePhongValue(bsp, f);
+        pf.normal = Face_Normal_E(bsp, f);
+        pf.plane = Face_Plane_E(bsp, f);
+        pf.centroid = GLM_PolyCentroid(GLM_FacePoints(bsp, f));
     }
-    //printf("CalculateVertexNormals: %d interior verts\n", (int)interior_verts.size());
+    return nullptr;
+}
+
+/* builds smoothLists[i], the sorted faces face i is smoothed with */
+static void *SmoothFacesThread(void *arg)
+{
+    const mbsp_t *bsp = static_cast<const mbsp_t *>(arg);
     
-    // build the "face -> faces to smooth with" map
-    for (int i = 0; i < bsp->numfaces; i++) {
-        const bsp2_dface_t *f = BSP_GetFace(const_cast<mbsp_t *>(bsp), i);
+    while (1) {
+        const int i = GetThreadWork();
+        if (i == -1)
+            break;
         
-        const auto f_points = GLM_FacePoints(bsp, f);
-        const qvec3f f_norm = Face_Normal_E(bsp, f);
-        const qplane3f f_plane = Face_Plane_E(bsp, f);
+        const bsp2_dface_t *f = BSP_GetFace(bsp, i);
+        const phongface_t &pf = phongFaces[i];
+        std::vector<const bsp2_dface_t *> &result = smoothLists[i];
         
         // any face normal within this many degrees can be smoothed with this face
-        const int f_phong_angle = extended_texinfo_flags[f->texinfo].phong_angle;
-        int f_phong_angle_concave = extended_texinfo_flags[f->texinfo].phong_angle_concave;
-        if (f_phong_angle_concave == 0) {
-            f_phong_angle_concave = f_phong_angle;
-        }
-        const bool f_wants_phong = (f_phong_angle || f_phong_angle_concave);
-        
-        if (!f_wants_phong)
-            continue;
+        const bool f_wants_phong = (pf.phong_angle || pf.phong_angle_concave);
         
-        for (int j = 0; j < f->numedges; j++) {
-            const int v = Face_VertexAtIndex(bsp, f, j);
-            // walk over all faces incident to f (we will walk over neighbours multiple times, doesn't matter)
-            for (const bsp2_dface_t *f2 : vertsToFaces[v]) {
-                if (f2 == f)
-                    continue;
-                
-                // FIXME: factor out and share with above?
-                const int f2_phong_angle = extended_texinfo_flags[f2->texinfo].phong_angle;
-                int f2_phong_angle_concave = extended_texinfo_flags[f2->texinfo].phong_angle_concave;
-                if (f2_phong_angle_concave == 0) {
-                    f2_phong_angle_concave = f2_phong_angle;
-                }
-                const bool f2_wants_phong = (f2_phong_angle || f2_phong_angle_concave);
-                
-                if (!f2_wants_phong)
-                    continue;
-                
-                const auto f2_points = GLM_FacePoints(bsp, f2);
-                const qvec3f f2_centroid = GLM_PolyCentroid(f2_points);
-                const qvec3f f2_norm = Face_Normal_E(bsp, f2);
-                
-                const vec_t cosangle = qv::dot(f_norm, f2_norm);
-                
-                const bool concave = f_plane.distAbove(f2_centroid) > 0.1;
-                const vec_t f_threshold = concave ? f_phong_angle_concave : f_phong_angle;
-                const vec_t f2_threshold = concave ? f2_phong_angle_concave : f2_phong_angle;
-                const vec_t min_threshold = qmin(f_threshold, f2_threshold);
-                const vec_t cosmaxangle = cos(DEG2RAD(min_threshold));
-
-                // check the angle between the face normals
-                if (cosangle >= cosmaxangle) {
-                    smoothFaces[f].insert(f2);
+        if (f_wants_phong) {
+            for (int j = 0; j < f->numedges; j++) {
+                const int v = Face_VertexAtIndex(bsp, f, j);
+                // walk over all faces incident to f (we will walk over neighbours multiple times, doesn't matter)
+                for (const bsp2_dface_t *f2 : vertsToFaces.row(v)) {
+                    if (f2 == f)
+                        continue;
+                    
+                    const phongface_t &pf2 = phongFaces[f2 - bsp->dfaces];
+                    const bool f2_wants_phong = (pf2.phong_angle || pf2.phong_angle_concave);
+                    
+                    if (!f2_wants_phong)
+                        continue;
+                    
+                    const vec_t cosangle = qv::dot(pf.normal, pf2.normal);
+                    
+                    const bool concave = pf.plane.distAbove(pf2.centroid) > 0.1;
+                    const vec_t f_threshold = concave ? pf.phong_angle_concave : pf.phong_angle;
+                    const vec_t f2_threshold = concave ? pf2.phong_angle_concave : pf2.phong_angle;
+                    const vec_t min_threshold = qmin(f_threshold, f2_threshold);
+                    const vec_t cosmaxangle = cos(DEG2RAD(min_threshold));
+
+                    // check the angle between the face normals
+                    if (cosangle >= cosmaxangle) {
+                        result.push_back(f2);
+                    }
                 }
             }
         }
-    }
-    
-    // Q2: build the "face -> faces to smooth with" map
-    for (int i = 0; i < bsp->numfaces; i++) {
-        const bsp2_dface_t *f = BSP_GetFace(const_cast<mbsp_t *>(bsp), i);
-        const int f_phongValue = Q2_FacePhongValue(bsp, f);
-        if (f_phongValue == 0)
-            continue;
-
-        for (int j = 0; j < f->numedges; j++) {
-            const int v = Face_VertexAtIndex(bsp, f, j);
-            // walk over all faces incident to f (we will walk over neighbours multiple times, doesn't matter)
-            for (const bsp2_dface_t *f2 : vertsToFaces[v]) {
-                if (f2 == f)
-                    continue;
-
-                const int f2_phongValue = Q2_FacePhongValue(bsp, f2);
-                if (f_phongValue != f2_phongValue)
-                    continue;
-
-                // we've already checked f_phongValue is nonzero, so smooth these two faces.
-                smoothFaces[f].insert(f2);
+        
+        // Q2: smooth with the faces with the same nonzero phong value
+        if (pf.q2_phong_value != 0) {
+            for (int j = 0; j < f->numedges; j++) {
+                const int v = Face_VertexAtIndex(bsp, f, j);
+                for (const bsp2_dface_t *f2 : vertsToFaces.row(v)) {
+                    if (f2 == f)
+                        continue;
+                    if (pf.q2_phong_value != phongFaces[f2 - bsp->dfaces].q2_phong_value)
+                        continue;
+                    
+                    result.push_back(f2);
+                }
             }
         }
+        
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
     }
+    return nullptr;
+}
 
-    // finally do the smoothing for each face
-    for (int i = 0; i < bsp->numfaces; i++)
-    {
+/* smooths the vertex normals of face i into its row of vertexNormals */
+static void *VertexNormalsThread(void *arg)
+{
+    const mbsp_t *bsp = static_cast<const mbsp_t *>(arg);
+    smoothednormals_t smoothedNormals;
+    
+    while (1) {
+        const int i = GetThreadWork();
+        if (i == -1)
+            break;
+        
         const bsp2_dface_t *f = BSP_GetFace(bsp, i);
-        if (f->numedges < 3) {
-            logprint("%s: face %d is degenerate with %d edges\n", __func__, i, f->numedges);
-            for (int j = 0; j<f->numedges; j++) {
-                vec3_t pt;
-                Face_PointAtIndex(bsp, f, j, pt);
-                logprint("                         vert at %f %f %f\n", pt[0], pt[1], pt[2]);
-            }
+        if (f->numedges < 3)
             continue;
-        }
         
-        const auto &neighboursToSmooth = smoothFaces[f];
-        const qvec3f f_norm = Face_Normal_E(bsp, f); // get the face normal
+        const facelist_t neighboursToSmooth = smoothFaces.row(i);
+        const qvec3f f_norm = phongFaces[i].normal; // get the face normal
         
         // gather up f and neighboursToSmooth
         std::vector<const bsp2_dface_t *> fPlusNeighbours;
@@ -572,11 +619,11 @@ CalculateVertexNormals(const mbsp_t *bsp)
         }
         
         // global vertex index -> smoothed normal
-        std::map<int, qvec3f> smoothedNormals;
+        smoothedNormals.clear();
 
         // walk fPlusNeighbours
         for (auto f2 : fPlusNeighbours) {
-            const qvec3f f2_norm = Face_Normal_E(bsp, f2);
+            const qvec3f f2_norm = phongFaces[f2 - bsp->dfaces].normal;
             
             /* now just walk around the surface as a triangle fan */
             int v1, v2, v3;
@@ -590,21 +637,13 @@ CalculateVertexNormals(const mbsp_t *bsp)
             }
         }
         
-        // normalize vertex normals (NOTE: updates smoothedNormals map)
+        // normalize vertex normals (NOTE: updates smoothedNormals)
         for (auto &pair : smoothedNormals) {
-            const int vertIndex = pair.first;
             const qvec3f vertNormal = pair.second;
             if (0 == qv::length(vertNormal)) {
                 // this happens when there are colinear vertices, which give zero-area triangles,
                 // so there is no contribution to the normal of the triangle in the middle of the
                 // line. Not really an error, just set it to use the face normal.
-#if 0
-                logprint("Failed to calculate normal for vertex %d at (%f %f %f)\n",
-                         vertIndex,
-                         bsp->dvertexes[vertIndex].point[0],
-                         bsp->dvertexes[vertIndex].point[1],
-                         bsp->dvertexes[vertIndex].point[2]);
-#endif
                 pair.second = f_norm;
             }
             else
@@ -615,21 +654,123 @@ CalculateVertexNormals(const mbsp_t *bsp)
         
         // sanity check
         if (!neighboursToSmooth.size()) {
-            for (auto vertIndexNormalPair : smoothedNormals) {
+            for (const auto &vertIndexNormalPair : smoothedNormals) {
                 Q_assert(GLMVectorCompare(vertIndexNormalPair.second, f_norm, EQUAL_EPSILON));
             }
         }
         
         // now, record all of the smoothed normals that are actually part of `f`
+        qvec3f *out = &vertexNormals[vertexNormalOffsets[i]];
         for (int j=0; j<f->numedges; j++) {
-            int v = Face_VertexAtIndex(bsp, f, j);
-            Q_assert(smoothedNormals.find(v) != smoothedNormals.end());
+            const int v = Face_VertexAtIndex(bsp, f, j);
+            const auto it = std::find_if(smoothedNormals.begin(), smoothedNormals.end(),
+                                         [v](const std::pair<int, qvec3f> &pair) { return pair.first == v; });
+            Q_assert(it != smoothedNormals.end());
+            
+            out[j] = it->second;
+        }
+    }
+    return nullptr;
+}
+
+void
+CalculateVertexNormals(const mbsp_t *bsp)
+{
+    logprint("--- %s ---\n", __func__);
+
+    Q_assert(!s_builtPhongCaches);
+    s_builtPhongCaches = true;
+    s_phongBsp = bsp;
+    
+    MakeEdgeToFaceMap(bsp);
+    
+    // read _phong and _phong_angle from entities for compatiblity with other qbsp's, at the expense of no
+    // support on func_detail/func_group
+    for (int i=0; i<bsp->nummodels; i++) {
+        const modelinfo_t *info = ModelInfoForModel(bsp, i);
+        const uint8_t phongangle_byte = (uint8_t) qmax(0, qmin(255, (int)rint(info->getResolvedPhongAngle())));
+
+        if (!phongangle_byte)
+            continue;
+        
+        for (int j=info->model->firstface; j < info->model->firstface + info->model->numfaces; j++) {
+            const bsp2_dface_t *f = BSP_GetFace(bsp, j);
             
-            vertex_normals[f].push_back(smoothedNormals[v]);
+            extended_texinfo_flags[f->texinfo].phong_angle = phongangle_byte;
+        }
+    }
+    
+    // build "plane -> faces" and "vert index -> faces" adjacency
+    std::vector<std::pair<int, const bsp2_dface_t *>> pairs;
+    pairs.reserve(bsp->numfaces);
+    for (int i = 0; i < bsp->numfaces; i++) {
+        const bsp2_dface_t *f = BSP_GetFace(bsp, i);
+        pairs.emplace_back(f->planenum, f);
+    }
+    BuildAdjacency(&planesToFaces, bsp->numplanes, pairs);
+    
+    pairs.clear();
+    for (int i = 0; i < bsp->numfaces; i++) {
+        const bsp2_dface_t *f = BSP_GetFace(bsp, i);
+        for (int j = 0; j < f->numedges; j++) {
+            const int v = Face_VertexAtIndex(bsp, f, j);
+            pairs.emplace_back(v, f);
+        }
+    }
+    BuildAdjacency(&vertsToFaces, bsp->numvertexes, pairs);
+    
+    // track "interior" verts, these are in the middle of a face, and mess up normal interpolation
+    interior_verts.assign(bsp->numvertexes, false);
+    for (int i=0; i<bsp->numvertexes; i++) {
+        const facelist_t faces = vertsToFaces.row(i);
+        if (faces.size() > 1 && FacesOnSamePlane(faces)) {
+            interior_verts[i] = true;
         }
     }
     
-    FaceCache = MakeFaceCache(bsp);
+    // build the "face -> faces to smooth with" map
+    phongFaces.resize(bsp->numfaces);
+    RunThreadsOn(0, bsp->numfaces, PhongFaceThread, const_cast<mbsp_t *>(bsp));
+    
+    smoothLists.clear();
+    smoothLists.resize(bsp->numfaces);
+    RunThreadsOn(0, bsp->numfaces, SmoothFacesThread, const_cast<mbsp_t *>(bsp));
+    
+    smoothFaces.offsets.assign(bsp->numfaces + 1, 0);
+    for (int i = 0; i < bsp->numfaces; i++) {
+        smoothFaces.offsets[i + 1] = smoothFaces.offsets[i] + static_cast<int>(smoothLists[i].size());
+    }
+    smoothFaces.faces.resize(smoothFaces.offsets[bsp->numfaces]);
+    for (int i = 0; i < bsp->numfaces; i++) {
+        std::copy(smoothLists[i].begin(), smoothLists[i].end(), smoothFaces.faces.begin() + smoothFaces.offsets[i]);
+    }
+    smoothLists.clear();
+    smoothLists.shrink_to_fit();
+
+    // finally do the smoothing for each face
+    vertexNormalOffsets.assign(bsp->numfaces + 1, 0);
+    for (int i = 0; i < bsp->numfaces; i++)
+    {
+        const bsp2_dface_t *f = BSP_GetFace(bsp, i);
+        int numnormals = f->numedges;
+        if (f->numedges < 3) {
+            logprint("%s: face %d is degenerate with %d edges\n", __func__, i, f->numedges);
+            for (int j = 0; j<f->numedges; j++) {
+                vec3_t pt;
+                Face_PointAtIndex(bsp, f, j, pt);
+                logprint("                         vert at %f %f %f\n", pt[0], pt[1], pt[2]);
+            }
+            numnormals = 0;
+        }
+        vertexNormalOffsets[i + 1] = vertexNormalOffsets[i] + numnormals;
+    }
+    vertexNormals.resize(vertexNormalOffsets[bsp->numfaces]);
+    RunThreadsOn(0, bsp->numfaces, VertexNormalsThread, const_cast<mbsp_t *>(bsp));
+    
+    phongFaces.clear();
+    phongFaces.shrink_to_fit();
+    
+    MakeFaceCache(bsp);
 }
 
 const face_cache_t &FaceCacheForFNum(int fnum)
@@ -0,0 +1,332 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#include <light/pvs.hh>
+#include <light/entities.hh>
+#include <light/bounce.hh>
+
+#include <common/bsputils.hh>
+
+#include <algorithm>
+#include <vector>
+
+/*
+ * Leafs are numbered by their bit in a PVS row: leafnum - 1 for Q1 (leaf 0
+ * is the shared solid leaf), the cluster for Q2. Light reaches a sample
+ * point along a line of sight between the light's leaf and the point's, so
+ * that line is in both leafs' PVS. Points within 0.1 units of a node plane
+ * count as being on both sides, like Light_PointInSolid.
+ */
+
+#define PVS_SOLID   -1      // in solid, can't see or be seen
+#define PVS_UNKNOWN -2      // not vised, anything goes
+
+/*
+ * Leaf bounds are stored rounded to whole units, so a face on the edge of
+ * a visible leaf can poke out of them; Pvs_VisibleBounds pads by this much.
+ */
+#define PVS_BOUNDS_PAD 16
+
+static bool pvs_vised;                          // set by Pvs_Setup
+static bool pvs_enabled;                        // set by Pvs_Begin
+static int pvs_numleafs;
+static int pvs_rowbytes;
+static std::vector<int> pvs_rowofs;             // offset into dvisdata of each leaf's row
+static std::vector<vec_t> pvs_bitbounds;        // mins and maxs of each leaf
+
+/* the leafs each face is a marksurface of */
+static std::vector<int> pvs_faceoffsets;
+static std::vector<int> pvs_faceleafs;
+
+/* the leafs each light and bounce light is in; an empty range if unknown */
+static std::vector<int> pvs_lightoffsets;
+static std::vector<int> pvs_lightleafs;
+static std::vector<int> pvs_bounceoffsets;
+static std::vector<int> pvs_bounceleafs;
+
+static int
+Pvs_LeafBit(const mbsp_t *bsp, int leafnum)
+{
+    const mleaf_t *leaf = BSP_GetLeaf(bsp, leafnum);
+    int bit;
+
+    if (bsp->loadversion->game->id == GAME_QUAKE_II) {
+        if (leaf->contents & Q2_CONTENTS_SOLID)
+            return PVS_SOLID;
+        bit = leaf->cluster;
+    } else {
+        if (leaf->contents == CONTENTS_SOLID)
+            return PVS_SOLID;
+        bit = leafnum - 1;
+    }
+
+    if (bit < 0 || bit >= pvs_numleafs || leaf->visofs < 0 || leaf->visofs >= bsp->visdatasize)
+        return PVS_UNKNOWN;
+    return bit;
+}
+
+static void
+Pvs_LeafsAtPoint(const mbsp_t *bsp, int nodenum, const vec3_t point, std::vector<int> *leafs, bool *unknown)
+{
+    while (nodenum >= 0) {
+        const bsp2_dnode_t *node = &bsp->dnodes[nodenum];
+        const vec_t dist = Plane_Dist(point, &bsp->dplanes[node->planenum]);
+
+        if (dist > 0.1) {
+            nodenum = node->children[0];
+        } else if (dist < -0.1) {
+            nodenum = node->children[1];
+        } else {
+            // too close to the plane, check both sides
+            Pvs_LeafsAtPoint(bsp, node->children[0], point, leafs, unknown);
+            nodenum = node->children[1];
+        }
+    }
+
+    const int bit = Pvs_LeafBit(bsp, -1 - nodenum);
+    if (bit == PVS_UNKNOWN)
+        *unknown = true;
+    else if (bit != PVS_SOLID && std::find(leafs->begin(), leafs->end(), bit) == leafs->end())
+        leafs->push_back(bit);
+}
+
+/* appends the leafs at point to the flat list, nothing if unknown; returns whether it placed it */
+static bool
+Pvs_PlacePoint(const mbsp_t *bsp, const vec3_t point, std::vector<int> *offsets, std::vector<int> *flat)
+{
+    std::vector<int> leafs;
+    bool unknown = false;
+    Pvs_LeafsAtPoint(bsp, bsp->dmodels[0].headnode[0], point, &leafs, &unknown);
+
+    if (unknown)
+        leafs.clear();
+    flat->insert(flat->end(), leafs.begin(), leafs.end());
+    offsets->push_back(static_cast<int>(flat->size()));
+    return !leafs.empty();
+}
+
+void
+Pvs_Setup(const mbsp_t *bsp)
+{
+    pvs_vised = false;
+    pvs_faceoffsets.clear();
+    pvs_faceleafs.clear();
+    pvs_bitbounds.clear();
+
+    if (!bsp->visdatasize || !bsp->dvisdata)
+        return;
+
+    if (bsp->loadversion->game->id == GAME_QUAKE_II) {
+        pvs_numleafs = 0;
+        for (int i = 0; i < bsp->numleafs; i++)
+            pvs_numleafs = qmax(pvs_numleafs, bsp->dleafs[i].cluster + 1);
+    } else {
+        pvs_numleafs = bsp->dmodels[0].visleafs;
+    }
+    pvs_rowbytes = (pvs_numleafs + 7) >> 3;
+    if (pvs_numleafs <= 0)
+        return;
+
+    pvs_rowofs.assign(pvs_numleafs, -1);
+    pvs_bitbounds.resize(pvs_numleafs * 6);
+    for (int i = 0; i < pvs_numleafs; i++) {
+        VectorSet(&pvs_bitbounds[i * 6], VECT_MAX, VECT_MAX, VECT_MAX);
+        VectorSet(&pvs_bitbounds[i * 6 + 3], -VECT_MAX, -VECT_MAX, -VECT_MAX);
+    }
+
+    std::vector<int> count(bsp->numfaces + 1, 0);
+    for (int i = 0; i < bsp->numleafs; i++) {
+        const int bit = Pvs_LeafBit(bsp, i);
+        if (bit < 0)
+            continue;
+        pvs_rowofs[bit] = bsp->dleafs[i].visofs;
+
+        // Q2 clusters can be several leafs
+        const mleaf_t *leaf = &bsp->dleafs[i];
+        vec3_t leafmins, leafmaxs;
+        VectorCopy(leaf->mins, leafmins);
+        VectorCopy(leaf->maxs, leafmaxs);
+        AABB_Expand(&pvs_bitbounds[bit * 6], &pvs_bitbounds[bit * 6 + 3], leafmins);
+        AABB_Expand(&pvs_bitbounds[bit * 6], &pvs_bitbounds[bit * 6 + 3], leafmaxs);
+
+        for (int k = 0; k < leaf->nummarksurfaces; k++)
+            count[bsp->dleaffaces[leaf->firstmarksurface + k] + 1]++;
+    }
+
+    pvs_faceoffsets.assign(bsp->numfaces + 1, 0);
+    for (int i = 0; i < bsp->numfaces; i++)
+        pvs_faceoffsets[i + 1] = pvs_faceoffsets[i] + count[i + 1];
+    pvs_faceleafs.resize(pvs_faceoffsets[bsp->numfaces]);
+    std::vector<int> next(pvs_faceoffsets.begin(), pvs_faceoffsets.end() - 1);
+    for (int i = 0; i < bsp->numleafs; i++) {
+        const int bit = Pvs_LeafBit(bsp, i);
+        if (bit < 0)
+            continue;
+
+        const mleaf_t *leaf = &bsp->dleafs[i];
+        for (int k = 0; k < leaf->nummarksurfaces; k++)
+            pvs_faceleafs[next[bsp->dleaffaces[leaf->firstmarksurface + k]]++] = bit;
+    }
+
+    pvs_vised = true;
+}
+
+void
+Pvs_Begin(const mbsp_t *bsp)
+{
+    pvs_enabled = false;
+    pvs_lightoffsets.assign(1, 0);
+    pvs_lightleafs.clear();
+    pvs_bounceoffsets.assign(1, 0);
+    pvs_bounceleafs.clear();
+
+    if (nopvs || !pvs_vised)
+        return;
+
+    int numlights = 0, numbouncelights = 0;
+    for (const light_t &entity : GetLights()) {
+        numlights += Pvs_PlacePoint(bsp, *entity.origin.vec3Value(), &pvs_lightoffsets, &pvs_lightleafs);
+    }
+    for (const bouncelight_t &vpl : BounceLights()) {
+        vec3_t pos;
+        glm_to_vec3_t(vpl.pos, pos);
+        numbouncelights += Pvs_PlacePoint(bsp, pos, &pvs_bounceoffsets, &pvs_bounceleafs);
+    }
+
+    pvs_enabled = true;
+    logprint("PVS culling: %d of %d lights and %d of %d bounce lights are in vised leafs\n",
+             numlights, static_cast<int>(GetLights().size()),
+             numbouncelights, static_cast<int>(BounceLights().size()));
+}
+
+/* ORs together the rows of the given leafs, plus the leafs themselves */
+static void
+Pvs_UnionRows(const mbsp_t *bsp, const std::vector<int> &leafs, std::vector<uint8_t> *out)
+{
+    // a zero run can end past the row
+    static thread_local std::vector<uint8_t> row;
+    row.resize(pvs_rowbytes + 256);
+    out->assign(pvs_rowbytes, 0);
+    for (const int bit : leafs) {
+        DecompressRow(bsp->dvisdata + pvs_rowofs[bit], pvs_rowbytes, row.data());
+        for (int i = 0; i < pvs_rowbytes; i++)
+            (*out)[i] |= row[i];
+        (*out)[bit >> 3] |= 1 << (bit & 7);
+    }
+}
+
+bool
+Pvs_VisibleBounds(const mbsp_t *bsp, const vec3_t point, vec3_t mins, vec3_t maxs)
+{
+    if (nopvs || !pvs_vised)
+        return false;
+
+    std::vector<int> leafs;
+    bool unknown = false;
+    Pvs_LeafsAtPoint(bsp, bsp->dmodels[0].headnode[0], point, &leafs, &unknown);
+    if (unknown || leafs.empty())
+        return false;
+
+    static thread_local std::vector<uint8_t> visible;
+    Pvs_UnionRows(bsp, leafs, &visible);
+
+    AABB_Init(mins, maxs, point);
+    for (int bit = 0; bit < pvs_numleafs; bit++) {
+        if (!(visible[bit >> 3] & (1 << (bit & 7))))
+            continue;
+        const vec_t *bounds = &pvs_bitbounds[bit * 6];
+        if (bounds[0] > bounds[3])
+            continue;
+        AABB_Expand(mins, maxs, bounds);
+        AABB_Expand(mins, maxs, bounds + 3);
+    }
+    
+    const vec3_t pad { PVS_BOUNDS_PAD, PVS_BOUNDS_PAD, PVS_BOUNDS_PAD };
+    AABB_Grow(mins, maxs, pad);
+    return true;
+}
+
+static void
+Pvs_SetupSurface(const lightsurf_t *lightsurf)
+{
+    lightsurf->pvsready = true;
+    lightsurf->pvs.clear();
+
+    // bmodels can be moved, so aren't tied to the leafs they were compiled in
+    if (!lightsurf->modelinfo->isWorld())
+        return;
+
+    const mbsp_t *bsp = lightsurf->bsp;
+    const int facenum = Face_GetNum(bsp, lightsurf->face);
+    std::vector<int> leafs;
+    bool unknown = false;
+
+    for (int i = pvs_faceoffsets[facenum]; i < pvs_faceoffsets[facenum + 1]; i++) {
+        if (std::find(leafs.begin(), leafs.end(), pvs_faceleafs[i]) == leafs.end())
+            leafs.push_back(pvs_faceleafs[i]);
+    }
+
+    // sample points can be off the face, e.g. past its edges
+    for (int i = 0; i < lightsurf->numpoints && !unknown; i++) {
+        if (lightsurf->occluded[i])
+            continue;
+        Pvs_LeafsAtPoint(bsp, bsp->dmodels[0].headnode[0], lightsurf->points[i], &leafs, &unknown);
+    }
+
+    if (unknown || leafs.empty())
+        return;
+
+    Pvs_UnionRows(bsp, leafs, &lightsurf->pvs);
+}
+
+static bool
+Pvs_Cull(const lightsurf_t *lightsurf, const std::vector<int> &offsets, const std::vector<int> &flat, int index)
+{
+    if (!pvs_enabled || index < 0 || index + 1 >= static_cast<int>(offsets.size()))
+        return false;
+
+    const int first = offsets[index];
+    const int last = offsets[index + 1];
+    if (first == last)
+        return false;
+
+    if (!lightsurf->pvsready)
+        Pvs_SetupSurface(lightsurf);
+    if (lightsurf->pvs.empty())
+        return false;
+
+    for (int i = first; i < last; i++) {
+        const int bit = flat[i];
+        if (lightsurf->pvs[bit >> 3] & (1 << (bit & 7)))
+            return false;
+    }
+    return true;
+}
+
+bool
+Pvs_CullLight(const lightsurf_t *lightsurf, int lightnum)
+{
+    return Pvs_Cull(lightsurf, pvs_lightoffsets, pvs_lightleafs, lightnum);
+}
+
+bool
+Pvs_CullBounceLight(const lightsurf_t *lightsurf, int vplnum)
+{
+    return Pvs_Cull(lightsurf, pvs_bounceoffsets, pvs_bounceleafs, vplnum);
+}
@@ -0,0 +1,618 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#include <light/relight.hh>
+#include <light/entities.hh>
+#include <light/ltface.hh>
+
+#include <common/bsputils.hh>
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+/*
+ * Everything that goes into a face's lightmaps other than the lights is
+ * folded into one key: the geometry, texinfo and .texinfo flags, the
+ * options and worldspawn keys, the brush entities' settings and the suns.
+ * Each light gets its own key from its entity keys and the values derived
+ * from them (style, spotlight vectors, visibility bounds).
+ *
+ * The lights that pass CullLight for a face are a superset of the ones
+ * that add anything to it, so a face can be copied from the cache if all
+ * of those lights are unchanged, still in the same relative order (the
+ * sums are order dependent), and none of the added or changed lights pass
+ * CullLight against the face's bounds. Bounced light depends on every
+ * light, so with bounce on, any light change relights everything.
+ */
+
+#define RELIGHT_IDENT "LRLC"
+#define RELIGHT_VERSION 2
+
+struct relightheader_t {
+    char identification[4];
+    int version;
+    uint64_t key;
+    int numlights;
+    int numrecords;
+};
+
+/* one per LightFace call: two per face, for the bsp and the LMSHIFT lightmaps */
+struct relightrecord_t {
+    int valid;
+    vec3_t origin;
+    vec_t radius;
+    vec3_t mins, maxs;
+    int numlights;
+    int numstyles;
+    int size;           // bytes per style in the greyscale lightmap
+    uint8_t styles[MAXLIGHTMAPS];
+    float lmscale;
+    unsigned short extent[2];
+};
+
+struct relightface_t {
+    relightrecord_t record;
+    std::vector<int> lights;    // indices into GetLights()
+    int lightofs;               // offset into filebase
+    std::vector<uint8_t> data;  // greyscale, then lit, then lux (only for the old run)
+};
+
+static bool relight_enabled;
+static uint64_t relight_key;
+static std::vector<uint64_t> relight_lightkeys;
+static std::vector<relightface_t> relight_old;
+static std::vector<relightface_t> relight_new;
+static std::vector<bool> relight_reuse;
+static std::vector<int> relight_lightmap;     // old light index -> new light index, or -1
+
+static std::string
+Relight_Path()
+{
+    char path[1024];
+    strcpy(path, mapfilename);
+    StripExtension(path);
+    DefaultExtension(path, ".lightcache");
+    return path;
+}
+
+//============================================================================
+
+static void
+HashBytes(uint64_t *hash, const void *data, size_t len)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+    for (size_t i = 0; i < len; i++) {
+        *hash ^= bytes[i];
+        *hash *= 0x100000001b3ULL;
+    }
+}
+
+template <typename T>
+static void
+HashValue(uint64_t *hash, const T &value)
+{
+    HashBytes(hash, &value, sizeof(value));
+}
+
+template <typename T>
+static void
+HashLump(uint64_t *hash, int count, const T *data)
+{
+    HashValue(hash, count);
+    if (count)
+        HashBytes(hash, data, count * sizeof(T));
+}
+
+static void
+HashString(uint64_t *hash, const std::string &str)
+{
+    // include the terminator so "ab" "c" and "a" "bc" differ
+    HashBytes(hash, str.c_str(), str.size() + 1);
+}
+
+static void
+HashSurfFlags(uint64_t *hash, const surfflags_t &flags)
+{
+    HashValue(hash, flags.native);
+    HashValue(hash, flags.extended);
+    HashValue(hash, flags.phong_angle);
+    HashValue(hash, flags.minlight);
+    HashValue(hash, flags.minlight_color);
+    HashValue(hash, flags.phong_angle_concave);
+    HashValue(hash, flags.light_alpha);
+}
+
+static void
+HashSettings(uint64_t *hash, const settingsdict_t &dict)
+{
+    for (const lockable_setting_t *setting : dict.allSettings()) {
+        HashString(hash, setting->primaryName());
+        HashString(hash, setting->stringValue());
+
+        // stringValue() rounds
+        if (const auto *vec = dynamic_cast<const lockable_vec_t *>(setting)) {
+            HashValue(hash, vec->floatValue());
+        } else if (const auto *vec3 = dynamic_cast<const lockable_vec3_t *>(setting)) {
+            HashBytes(hash, *vec3->vec3Value(), sizeof(vec3_t));
+        }
+    }
+}
+
+static void
+HashEntDict(uint64_t *hash, const entdict_t &dict)
+{
+    HashValue(hash, static_cast<int>(std::distance(dict.begin(), dict.end())));
+    for (const auto &epair : dict) {
+        HashString(hash, epair.first);
+        HashString(hash, epair.second);
+    }
+}
+
+static uint64_t
+Relight_LightKey(const light_t &light)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    HashEntDict(&hash, *light.epairs);
+
+    // settings() isn't const
+    light_t copy = light;
+    HashSettings(&hash, copy.settings());
+
+    HashValue(&hash, light.spotlight);
+    HashBytes(&hash, light.spotvec, sizeof(vec3_t));
+    HashValue(&hash, light.spotfalloff);
+    HashValue(&hash, light.spotfalloff2);
+    HashBytes(&hash, light.projectionmatrix, sizeof(light.projectionmatrix));
+    HashValue(&hash, light.projectedmip != nullptr);
+    HashValue(&hash, light.generated);
+    HashBytes(&hash, light.mins, sizeof(vec3_t));
+    HashBytes(&hash, light.maxs, sizeof(vec3_t));
+    return hash;
+}
+
+uint64_t
+Relight_Key(const mbsp_t *bsp, const facesup_t *faces_sup, const globalconfig_t &cfg)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    HashString(&hash, stringify(ERICWTOOLS_VERSION));
+    HashValue(&hash, RELIGHT_VERSION);
+    HashValue(&hash, static_cast<int>(sizeof(relightrecord_t)));
+
+    // geometry; the input lighting, face styles and offsets are ours
+    HashString(&hash, bsp->loadversion->short_name);
+    HashLump(&hash, bsp->nummodels, bsp->dmodels);
+    HashLump(&hash, bsp->visdatasize, bsp->dvisdata);
+    HashLump(&hash, bsp->texdatasize, reinterpret_cast<const uint8_t *>(bsp->dtexdata));
+    HashLump(&hash, bsp->numleafs, bsp->dleafs);
+    HashLump(&hash, bsp->numplanes, bsp->dplanes);
+    HashLump(&hash, bsp->numvertexes, bsp->dvertexes);
+    HashLump(&hash, bsp->numnodes, bsp->dnodes);
+    HashLump(&hash, bsp->numedges, bsp->dedges);
+    HashLump(&hash, bsp->numleaffaces, bsp->dleaffaces);
+    HashLump(&hash, bsp->numsurfedges, bsp->dsurfedges);
+    HashValue(&hash, bsp->numfaces);
+    for (int i = 0; i < bsp->numfaces; i++) {
+        const bsp2_dface_t *face = &bsp->dfaces[i];
+        HashValue(&hash, face->planenum);
+        HashValue(&hash, face->side);
+        HashValue(&hash, face->firstedge);
+        HashValue(&hash, face->numedges);
+        HashValue(&hash, face->texinfo);
+    }
+    // the textures as loaded (Q2 reads them from .wal files)
+    if (bsp->rgbatexdatasize) {
+        HashValue(&hash, bsp->drgbatexdata->nummiptex);
+        for (int i = 0; i < bsp->drgbatexdata->nummiptex; i++) {
+            const int ofs = bsp->drgbatexdata->dataofs[i];
+            if (ofs < 0)
+                continue;
+            const rgba_miptex_t *miptex = (const rgba_miptex_t *)((const uint8_t *)bsp->drgbatexdata + ofs);
+            HashString(&hash, miptex->name);
+            HashValue(&hash, miptex->width);
+            HashValue(&hash, miptex->height);
+            HashBytes(&hash, (const uint8_t *)miptex + miptex->offset, static_cast<size_t>(miptex->width) * miptex->height * 4);
+        }
+    }
+    HashValue(&hash, bsp->numtexinfo);
+    for (int i = 0; i < bsp->numtexinfo; i++) {
+        const gtexinfo_t *texinfo = &bsp->texinfo[i];
+        HashBytes(&hash, texinfo->vecs, sizeof(texinfo->vecs));
+        HashSurfFlags(&hash, texinfo->flags);
+        HashValue(&hash, texinfo->miptex);
+        HashValue(&hash, texinfo->value);
+        HashString(&hash, texinfo->texture);
+        HashValue(&hash, texinfo->nexttexinfo);
+        HashSurfFlags(&hash, extended_texinfo_flags[i]);
+    }
+
+    // options and worldspawn keys
+    globalconfig_t cfgcopy = cfg;
+    HashSettings(&hash, cfgcopy.settings());
+    HashValue(&hash, dirt_in_use);
+    HashValue(&hash, numDirtVectors);
+    HashValue(&hash, fadegate);
+    HashValue(&hash, softsamples);
+    HashValue(&hash, surflight_subdivide);
+    HashValue(&hash, sunsamples);
+    HashValue(&hash, scaledonly);
+    HashValue(&hash, oversample);
+    HashValue(&hash, undersample);
+    HashValue(&hash, fastsky);
+    HashValue(&hash, adaptive);
+    HashValue(&hash, write_litfile);
+    HashValue(&hash, write_luxfile);
+    HashValue(&hash, novisapprox);
+    HashValue(&hash, nopvs);
+    HashValue(&hash, nolights);
+    HashValue(&hash, debug_highlightseams);
+    HashValue(&hash, arghradcompat);
+
+    HashValue(&hash, faces_sup != nullptr);
+    if (faces_sup) {
+        for (int i = 0; i < bsp->numfaces; i++)
+            HashValue(&hash, faces_sup[i].lmscale);
+    }
+
+    for (int i = 0; i < bsp->nummodels; i++) {
+        modelinfo_t info = *ModelInfoForModel(bsp, i);
+        HashValue(&hash, info.lightmapscale);
+        HashBytes(&hash, info.offset, sizeof(vec3_t));
+        HashSettings(&hash, info.settings());
+    }
+
+    for (const sun_t &sun : GetSuns()) {
+        HashBytes(&hash, sun.sunvec, sizeof(vec3_t));
+        HashValue(&hash, sun.sunlight);
+        HashBytes(&hash, sun.sunlight_color, sizeof(vec3_t));
+        HashValue(&hash, sun.dirt);
+        HashValue(&hash, sun.anglescale);
+        HashValue(&hash, sun.style);
+        HashString(&hash, sun.suntexture);
+    }
+
+    // the entities other than lights, e.g. spotlight targets
+    std::set<const entdict_t *> lightdicts;
+    for (const light_t &light : GetLights())
+        lightdicts.insert(light.epairs);
+    for (const entdict_t &dict : GetEntdicts()) {
+        if (!lightdicts.count(&dict))
+            HashEntDict(&hash, dict);
+    }
+
+    return hash;
+}
+
+//============================================================================
+
+template <typename T>
+static bool
+ReadVector(FILE *f, std::vector<T> &vec, size_t count)
+{
+    vec.resize(count);
+    return count == 0 || fread(vec.data(), sizeof(T), count, f) == count;
+}
+
+static bool
+Relight_Load(const std::string &path, int numrecords)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+
+    relightheader_t header;
+    bool ok = fread(&header, 1, sizeof(header), f) == sizeof(header)
+        && !memcmp(header.identification, RELIGHT_IDENT, 4)
+        && header.version == RELIGHT_VERSION
+        && header.key == relight_key
+        && header.numrecords == numrecords
+        && header.numlights >= 0;
+
+    std::vector<uint64_t> oldkeys;
+    if (ok)
+        ok = ReadVector(f, oldkeys, header.numlights);
+
+    relight_old.clear();
+    relight_old.resize(numrecords);
+    for (int i = 0; ok && i < numrecords; i++) {
+        relightface_t &old = relight_old[i];
+        ok = fread(&old.record, 1, sizeof(old.record), f) == sizeof(old.record);
+        if (!ok || !old.record.valid)
+            continue;
+        ok = old.record.numlights >= 0 && old.record.numstyles >= 0 && old.record.numstyles <= MAXLIGHTMAPS
+            && ReadVector(f, old.lights, old.record.numlights)
+            && ReadVector(f, old.data, static_cast<size_t>(old.record.size) * old.record.numstyles * 7);
+        for (int light : old.lights) {
+            if (light < 0 || light >= header.numlights)
+                ok = false;
+        }
+    }
+    fclose(f);
+
+    if (!ok) {
+        relight_old.clear();
+        return false;
+    }
+
+    /* pair up unchanged lights: the nth old light with a given key is the nth new one */
+    std::map<uint64_t, std::vector<int>> newbykey;
+    for (int i = 0; i < static_cast<int>(relight_lightkeys.size()); i++)
+        newbykey[relight_lightkeys[i]].push_back(i);
+    std::map<uint64_t, int> oldcount;
+    for (uint64_t key : oldkeys)
+        oldcount[key]++;
+
+    relight_lightmap.assign(oldkeys.size(), -1);
+    std::map<uint64_t, size_t> used;
+    for (size_t i = 0; i < oldkeys.size(); i++) {
+        const auto it = newbykey.find(oldkeys[i]);
+        if (it == newbykey.end() || it->second.size() != static_cast<size_t>(oldcount[oldkeys[i]]))
+            continue;
+        relight_lightmap[i] = it->second.at(used[oldkeys[i]]++);
+    }
+    return true;
+}
+
+void
+Relight_Begin(const mbsp_t *bsp, const facesup_t *faces_sup, const globalconfig_t &cfg)
+{
+    relight_enabled = false;
+    relight_old.clear();
+    relight_new.clear();
+    relight_reuse.clear();
+
+    if (!incremental)
+        return;
+    if (litonly || debugmode != debugmode_none) {
+        logprint("WARNING: -incremental has no effect with -litonly or debug modes\n");
+        return;
+    }
+
+    relight_enabled = true;
+    relight_key = Relight_Key(bsp, faces_sup, cfg);
+    relight_lightkeys.clear();
+    for (const light_t &light : GetLights())
+        relight_lightkeys.push_back(Relight_LightKey(light));
+
+    const int numrecords = bsp->numfaces * 2;
+    relight_new.resize(numrecords);
+    relight_reuse.assign(numrecords, false);
+
+    const std::string path = Relight_Path();
+    if (!Relight_Load(path, numrecords)) {
+        logprint("Incremental: no usable %s, lighting every face\n", path.c_str());
+        return;
+    }
+
+    /* lights that are new or changed since the last run */
+    std::vector<bool> matched(relight_lightkeys.size(), false);
+    for (int light : relight_lightmap) {
+        if (light != -1)
+            matched[light] = true;
+    }
+    std::vector<const light_t *> changed;
+    for (size_t i = 0; i < matched.size(); i++) {
+        if (!matched[i])
+            changed.push_back(&GetLights().at(i));
+    }
+
+    const bool anychange = !changed.empty()
+        || std::find(relight_lightmap.begin(), relight_lightmap.end(), -1) != relight_lightmap.end();
+    if (anychange && cfg.bounce.boolValue()) {
+        logprint("Incremental: lights changed and bounce is enabled, lighting every face\n");
+        return;
+    }
+
+    int reused = 0, total = 0;
+    for (int i = 0; i < numrecords; i++) {
+        relightface_t &old = relight_old[i];
+        if (!old.record.valid)
+            continue;
+        total++;
+
+        bool reuse = true;
+        int last = -1;
+        for (int &light : old.lights) {
+            light = relight_lightmap[light];
+            if (light <= last) {
+                reuse = false;
+                break;
+            }
+            last = light;
+        }
+        for (size_t j = 0; reuse && j < changed.size(); j++) {
+            if (!CullLightBounds(cfg, changed[j], old.record.origin, old.record.radius,
+                                 old.record.mins, old.record.maxs))
+                reuse = false;
+        }
+        if (reuse) {
+            relight_reuse[i] = true;
+            reused++;
+        }
+    }
+
+    logprint("Incremental: %d changed lights, reusing %d of %d lightmaps from %s\n",
+             static_cast<int>(changed.size()), reused, total, path.c_str());
+}
+
+static int
+Relight_Index(const mbsp_t *bsp, const bsp2_dface_t *face, const facesup_t *facesup)
+{
+    return Face_GetNum(bsp, face) * 2 + (facesup ? 1 : 0);
+}
+
+/*
+ * Writes the lightmaps from the last run if this face can be reused.
+ * Called from LightFace after it has cleared the face's styles.
+ */
+bool
+Relight_ReuseFace(const mbsp_t *bsp, bsp2_dface_t *face, facesup_t *facesup)
+{
+    if (!relight_enabled)
+        return false;
+
+    const int index = Relight_Index(bsp, face, facesup);
+    if (!relight_reuse[index])
+        return false;
+
+    const relightface_t &old = relight_old[index];
+    const relightrecord_t &record = old.record;
+
+    uint8_t *styles = facesup ? facesup->styles : face->styles;
+    for (int i = 0; i < MAXLIGHTMAPS; i++)
+        styles[i] = record.styles[i];
+    if (facesup) {
+        facesup->extent[0] = record.extent[0];
+        facesup->extent[1] = record.extent[1];
+        facesup->lmscale = record.lmscale;
+    }
+
+    relightface_t &cur = relight_new[index];
+    cur.record = record;
+    cur.lights = old.lights;
+    cur.lightofs = -1;
+
+    if (!record.numstyles)
+        return true;
+
+    const size_t size = static_cast<size_t>(record.size) * record.numstyles;
+    uint8_t *out, *lit, *lux;
+    GetFileSpace(&out, &lit, &lux, size);
+    memcpy(out, old.data.data(), size);
+    memcpy(lit, old.data.data() + size, size * 3);
+    memcpy(lux, old.data.data() + size * 4, size * 3);
+    cur.lightofs = out - filebase;
+
+    // Q2/HL native colored lightmaps
+    const int lightofs = bsp->loadversion->game->has_rgb_lightmap ? lit - lit_filebase : out - filebase;
+    if (facesup) {
+        facesup->lightofs = lightofs;
+    } else {
+        face->lightofs = lightofs;
+    }
+    return true;
+}
+
+/*
+ * Remembers what LightFace wrote for this face, and the lights that
+ * weren't culled for it.
+ */
+void
+Relight_RecordFace(const mbsp_t *bsp, const bsp2_dface_t *face, const facesup_t *facesup,
+                   const lightsurf_t *lightsurf)
+{
+    if (!relight_enabled)
+        return;
+
+    relightface_t &cur = relight_new[Relight_Index(bsp, face, facesup)];
+    relightrecord_t &record = cur.record;
+
+    memset(&record, 0, sizeof(record));
+    record.valid = 1;
+    VectorCopy(lightsurf->origin, record.origin);
+    record.radius = lightsurf->radius;
+    VectorCopy(lightsurf->mins, record.mins);
+    VectorCopy(lightsurf->maxs, record.maxs);
+
+    cur.lights = lightsurf->lights;
+    std::sort(cur.lights.begin(), cur.lights.end());
+    cur.lights.erase(std::unique(cur.lights.begin(), cur.lights.end()), cur.lights.end());
+    record.numlights = static_cast<int>(cur.lights.size());
+
+    const uint8_t *styles = facesup ? facesup->styles : face->styles;
+    for (int i = 0; i < MAXLIGHTMAPS; i++) {
+        record.styles[i] = styles[i];
+        if (styles[i] != 255)
+            record.numstyles++;
+    }
+    if (facesup) {
+        record.extent[0] = facesup->extent[0];
+        record.extent[1] = facesup->extent[1];
+        record.lmscale = facesup->lmscale;
+    }
+    record.size = (lightsurf->texsize[0] + 1) * (lightsurf->texsize[1] + 1);
+
+    const int lightofs = facesup ? facesup->lightofs : face->lightofs;
+    if (record.numstyles && bsp->loadversion->game->has_rgb_lightmap)
+        cur.lightofs = lightofs / 3;
+    else
+        cur.lightofs = lightofs;
+}
+
+void
+Relight_Finish(const mbsp_t *bsp)
+{
+    if (!relight_enabled)
+        return;
+
+    const std::string path = Relight_Path();
+    const std::string temppath = path + ".tmp";
+    FILE *f = fopen(temppath.c_str(), "wb");
+    if (!f) {
+        logprint("WARNING: couldn't write %s\n", temppath.c_str());
+        return;
+    }
+
+    relightheader_t header {};
+    memcpy(header.identification, RELIGHT_IDENT, 4);
+    header.version = RELIGHT_VERSION;
+    header.key = relight_key;
+    header.numlights = static_cast<int>(relight_lightkeys.size());
+    header.numrecords = static_cast<int>(relight_new.size());
+    fwrite(&header, 1, sizeof(header), f);
+    if (!relight_lightkeys.empty())
+        fwrite(relight_lightkeys.data(), sizeof(uint64_t), relight_lightkeys.size(), f);
+
+    for (const relightface_t &cur : relight_new) {
+        fwrite(&cur.record, 1, sizeof(cur.record), f);
+        if (!cur.record.valid)
+            continue;
+        if (!cur.lights.empty())
+            fwrite(cur.lights.data(), sizeof(int), cur.lights.size(), f);
+        if (cur.record.numstyles) {
+            const size_t size = static_cast<size_t>(cur.record.size) * cur.record.numstyles;
+            fwrite(filebase + cur.lightofs, 1, size, f);
+            fwrite(lit_filebase + cur.lightofs * 3, 1, size * 3, f);
+            fwrite(lux_filebase + cur.lightofs * 3, 1, size * 3, f);
+        }
+    }
+
+    bool ok = !ferror(f);
+    fclose(f);
+    if (ok && rename(temppath.c_str(), path.c_str())) {
+        // rename doesn't replace an existing file on Windows
+        remove(path.c_str());
+        ok = !rename(temppath.c_str(), path.c_str());
+    }
+    if (!ok) {
+        logprint("WARNING: couldn't write %s\n", path.c_str());
+        remove(temppath.c_str());
+    }
+
+    relight_old.clear();
+    relight_new.clear();
+}
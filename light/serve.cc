@@ -0,0 +1,468 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#include <light/serve.hh>
+#include <light/light.hh>
+
+#include <common/cmdlib.hh>
+#include <common/log.hh>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef LINUX
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Protocol: the client sends its working directory and arguments, each
+ * NUL-terminated, then shuts down its side of the connection. It gets back
+ * the log output, then a NUL and the exit status as a single byte.
+ *
+ * The server process itself never lights anything. It keeps one worker,
+ * forked for the map of the first request: the worker loads the map, runs
+ * the setup stages that can be kept, and then lights each request in a
+ * forked child so that the warm state is never modified. Requests for
+ * another map, or whose map has changed under the worker, replace it.
+ */
+
+#ifdef LINUX
+
+static bool
+WriteAll(int fd, const void *data, size_t size)
+{
+    const char *p = static_cast<const char *>(data);
+    while (size > 0) {
+        const ssize_t written = write(fd, p, size);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += written;
+        size -= written;
+    }
+    return true;
+}
+
+static bool
+ReadAll(int fd, void *data, size_t size)
+{
+    char *p = static_cast<char *>(data);
+    while (size > 0) {
+        const ssize_t got = read(fd, p, size);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        p += got;
+        size -= got;
+    }
+    return true;
+}
+
+/* reads until the client shuts down its side */
+static bool
+ReadRequest(int fd, std::string *request)
+{
+    char buf[4096];
+    for (;;) {
+        const ssize_t got = read(fd, buf, sizeof(buf));
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0)
+            return false;
+        if (got == 0)
+            break;
+        request->append(buf, got);
+    }
+    return !request->empty() && request->back() == '\0';
+}
+
+/* splits a request into its working directory and an argv for light_main */
+static const char *
+SplitRequest(const std::string &request, std::vector<const char *> *argv)
+{
+    const char *cwd = request.c_str();
+    argv->push_back("light");
+    for (size_t i = strlen(cwd) + 1; i < request.size(); i += strlen(&request[i]) + 1) {
+        argv->push_back(&request[i]);
+    }
+    return cwd;
+}
+
+static void
+RedirectOutput(int fd)
+{
+    fflush(stdout);
+    fflush(stderr);
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+}
+
+static void
+DiscardOutput()
+{
+    const int devnull = open("/dev/null", O_WRONLY);
+    RedirectOutput(devnull);
+    close(devnull);
+}
+
+/* passes a request to the worker along with the client connection */
+static bool
+SendRequest(int control, const std::string &request, int conn)
+{
+    const uint32_t size = request.size();
+    struct iovec iov;
+    iov.iov_base = const_cast<uint32_t *>(&size);
+    iov.iov_len = sizeof(size);
+
+    char cmsgbuf[CMSG_SPACE(sizeof(int))];
+    memset(cmsgbuf, 0, sizeof(cmsgbuf));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsgbuf;
+    msg.msg_controllen = sizeof(cmsgbuf);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &conn, sizeof(int));
+
+    if (sendmsg(control, &msg, 0) != sizeof(size))
+        return false;
+    return WriteAll(control, request.data(), request.size());
+}
+
+static bool
+ReceiveRequest(int control, std::string *request, int *conn)
+{
+    uint32_t size;
+    struct iovec iov;
+    iov.iov_base = &size;
+    iov.iov_len = sizeof(size);
+
+    char cmsgbuf[CMSG_SPACE(sizeof(int))];
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsgbuf;
+    msg.msg_controllen = sizeof(cmsgbuf);
+
+    if (recvmsg(control, &msg, 0) != sizeof(size))
+        return false;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS)
+        return false;
+    memcpy(conn, CMSG_DATA(cmsg), sizeof(int));
+
+    request->resize(size);
+    return ReadAll(control, &(*request)[0], size);
+}
+
+static void
+StartLog()
+{
+    init_log("light.log");
+    logprint("---- light / ericw-tools " stringify(ERICWTOOLS_VERSION) " ----\n");
+}
+
+/* lights one request in a child of the worker, returning its exit status */
+static int
+LightRequest(const std::string &request, int conn)
+{
+    RedirectOutput(conn);
+
+    const pid_t pid = fork();
+    if (pid == 0) {
+        std::vector<const char *> argv;
+        const char *cwd = SplitRequest(request, &argv);
+        if (chdir(cwd) != 0)
+            Error("Couldn't change to directory %s", cwd);
+        StartLog();
+        exit(LightServeRequest(argv.size(), argv.data()));
+    }
+
+    int status = 1;
+    if (pid > 0) {
+        int wstatus;
+        while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR)
+            ;
+        status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 1;
+    }
+
+    DiscardOutput();
+    return status;
+}
+
+static void
+RunWorker(int control, std::string request, int conn)
+{
+    std::vector<const char *> argv;
+    const char *cwd = SplitRequest(request, &argv);
+
+    RedirectOutput(conn);
+    if (chdir(cwd) != 0)
+        Error("Couldn't change to directory %s", cwd);
+    StartLog();
+    LowerProcessPriority();
+    LightServeWarm(argv.size(), argv.data());
+    close_log();
+
+    for (;;) {
+        const int status = LightRequest(request, conn);
+        close(conn);
+
+        if (!WriteAll(control, &status, sizeof(status)) || status == LIGHT_SERVE_STALE)
+            exit(0);
+        if (!ReceiveRequest(control, &request, &conn))
+            exit(0);
+    }
+}
+
+struct serveworker_t {
+    pid_t pid = -1;
+    int control = -1;
+    std::string key;    // working directory and map argument
+};
+
+static void
+StopWorker(serveworker_t *worker)
+{
+    close(worker->control);
+    while (waitpid(worker->pid, nullptr, 0) < 0 && errno == EINTR)
+        ;
+    worker->pid = -1;
+    worker->control = -1;
+    worker->key.clear();
+}
+
+static void
+StartWorker(serveworker_t *worker, const std::string &key, const std::string &request, int conn, int listener)
+{
+    int control[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, control) != 0)
+        Error("socketpair failed: %s", strerror(errno));
+
+    const pid_t pid = fork();
+    if (pid < 0)
+        Error("fork failed: %s", strerror(errno));
+    if (pid == 0) {
+        close(listener);
+        close(control[0]);
+        RunWorker(control[1], request, conn);
+    }
+
+    close(control[1]);
+    worker->pid = pid;
+    worker->control = control[0];
+    worker->key = key;
+}
+
+/* returns the exit status of the request the worker was handed */
+static int
+WaitForWorker(serveworker_t *worker)
+{
+    int status;
+    if (ReadAll(worker->control, &status, sizeof(status))) {
+        if (status == LIGHT_SERVE_STALE)
+            StopWorker(worker);
+        return status;
+    }
+
+    // the worker died, most likely while loading the map
+    int wstatus = 0;
+    close(worker->control);
+    while (waitpid(worker->pid, &wstatus, 0) < 0 && errno == EINTR)
+        ;
+    worker->pid = -1;
+    worker->control = -1;
+    worker->key.clear();
+    return (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) != 0) ? WEXITSTATUS(wstatus) : 1;
+}
+
+int
+LightServe(const char *socketpath)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketpath) >= sizeof(addr.sun_path))
+        Error("Socket path %s is too long", socketpath);
+    strcpy(addr.sun_path, socketpath);
+
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+        Error("socket failed: %s", strerror(errno));
+    unlink(socketpath);
+    if (bind(listener, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0
+        || listen(listener, 8) != 0) {
+        Error("Couldn't listen on %s: %s", socketpath, strerror(errno));
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    logprint("---- light / ericw-tools " stringify(ERICWTOOLS_VERSION) " ----\n");
+    logprint("serving on %s\n", socketpath);
+
+    serveworker_t worker;
+    for (;;) {
+        const int conn = accept(listener, nullptr, nullptr);
+        if (conn < 0) {
+            if (errno == EINTR)
+                continue;
+            Error("accept failed: %s", strerror(errno));
+        }
+
+        std::string request;
+        std::vector<const char *> argv;
+        if (!ReadRequest(conn, &request)) {
+            close(conn);
+            continue;
+        }
+        SplitRequest(request, &argv);
+        if (argv.size() < 2) {
+            close(conn);
+            continue;
+        }
+        const std::string key = std::string(request.c_str()) + '\0' + argv.back();
+
+        int status;
+        for (int attempt = 0; ; attempt++) {
+            if (worker.pid != -1 && worker.key != key)
+                StopWorker(&worker);
+
+            if (worker.pid == -1)
+                StartWorker(&worker, key, request, conn, listener);
+            else if (!SendRequest(worker.control, request, conn)) {
+                StopWorker(&worker);
+                continue;
+            }
+
+            status = WaitForWorker(&worker);
+            if (status != LIGHT_SERVE_STALE || attempt > 0)
+                break;
+        }
+
+        const char trailer[2] { '\0', static_cast<char>(status) };
+        WriteAll(conn, trailer, sizeof(trailer));
+        close(conn);
+    }
+}
+
+/*
+ * Returns the exit status of the run, or -1 if the server couldn't be
+ * reached.
+ */
+int
+LightConnect(const char *socketpath, int argc, const char **argv)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketpath) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, socketpath);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    char cwd[1024];
+    if (!getcwd(cwd, sizeof(cwd)))
+        Error("getcwd failed: %s", strerror(errno));
+
+    std::string request { cwd };
+    request += '\0';
+    for (int i = 0; i < argc; i++) {
+        request += argv[i];
+        request += '\0';
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    if (!WriteAll(fd, request.data(), request.size()) || shutdown(fd, SHUT_WR) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    bool finished = false;
+    char buf[4096];
+    for (;;) {
+        const ssize_t got = read(fd, buf, sizeof(buf));
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            break;
+
+        const char *nul = static_cast<const char *>(memchr(buf, '\0', got));
+        if (!finished) {
+            fwrite(buf, 1, nul ? nul - buf : got, stdout);
+            fflush(stdout);
+            if (nul) {
+                finished = true;
+                // the status byte may arrive in the next read
+                if (nul + 1 < buf + got) {
+                    close(fd);
+                    return static_cast<unsigned char>(nul[1]);
+                }
+            }
+        } else {
+            close(fd);
+            return static_cast<unsigned char>(buf[0]);
+        }
+    }
+
+    close(fd);
+    fprintf(stderr, "light: lost the connection to %s\n", socketpath);
+    return 1;
+}
+
+#else /* !LINUX */
+
+int
+LightServe(const char *socketpath)
+{
+    Error("--serve needs Unix domain sockets, which this build doesn't support");
+    return 1;
+}
+
+int
+LightConnect(const char *socketpath, int argc, const char **argv)
+{
+    return -1;
+}
+
+#endif /* LINUX */
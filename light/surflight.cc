@@ -163,7 +163,7 @@ MakeSurfaceLightsThread(void *arg)
         VectorSet(l.maxs, 0, 0, 0);
 
         if (!novisapprox)
-            EstimateVisibleBoundsAtPoint(facemidpoint, l.mins, l.maxs);
+            EstimateVisibleBoundsAtPoint(bsp, facemidpoint, l.mins, l.maxs);
 
         // Store light...
         unique_lock<mutex> lck{ surfacelights_lock };
@@ -202,6 +202,11 @@ MakeSurfaceLights(const globalconfig_t &cfg, const mbsp_t *bsp)
 {
     logprint("--- MakeSurfaceLights ---\n");
 
+    // -progressive lights the map more than once
+    surfacelights.clear();
+    surfacelightsByFacenum.clear();
+    total_surflight_points = 0;
+
     make_surface_lights_args_t args { bsp,  &cfg };
     RunThreadsOn(0, bsp->numfaces, MakeSurfaceLightsThread, static_cast<void *>(&args));
 }
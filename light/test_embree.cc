@@ -0,0 +1,248 @@
+#include "gtest/gtest.h"
+
+#include <common/cmdlib.hh>
+#include <embree3/rtcore.h>
+#include <embree3/rtcore_ray.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+/*
+ * Compares the two ways light has traced its ray streams: an array of
+ * RTCRayHit/RTCRay structs with rtcIntersect1M/rtcOccluded1M, and Embree's
+ * structure-of-arrays layout with rtcIntersectNp/rtcOccludedNp. Both must
+ * find the same hits; the times are printed for comparing the two on a
+ * given Embree build.
+ *
+ * The rays are shaped like light's: each stream starts from a 16x16 grid of
+ * luxels on a face and heads towards one point light, over a bumpy floor.
+ */
+
+static const int benchGrid = 128;           // floor quads per side
+static const float benchExtent = 4096.0f;
+static const int benchStreamRays = 256;
+static const int benchStreams = 1024;
+
+static float
+FloorHeight(float x, float y)
+{
+    return 32.0f * sinf(x / 200.0f) * cosf(y / 150.0f);
+}
+
+static RTCScene
+MakeFloorScene(RTCDevice device)
+{
+    RTCScene scene = rtcNewScene(device);
+    rtcSetSceneFlags(scene, RTC_SCENE_FLAG_NONE);
+    rtcSetSceneBuildQuality(scene, RTC_BUILD_QUALITY_HIGH);
+
+    RTCGeometry geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE);
+    const int verts = benchGrid + 1;
+    float *vertices = static_cast<float *>(rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3,
+                                                                   4 * sizeof(float), verts * verts));
+    for (int y = 0; y < verts; y++) {
+        for (int x = 0; x < verts; x++) {
+            float *v = &vertices[4 * (y * verts + x)];
+            v[0] = x * benchExtent / benchGrid;
+            v[1] = y * benchExtent / benchGrid;
+            v[2] = FloorHeight(v[0], v[1]);
+            v[3] = 0;
+        }
+    }
+
+    unsigned *tris = static_cast<unsigned *>(rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3,
+                                                                      3 * sizeof(unsigned), 2 * benchGrid * benchGrid));
+    for (int y = 0; y < benchGrid; y++) {
+        for (int x = 0; x < benchGrid; x++) {
+            const unsigned v0 = y * verts + x;
+            unsigned *t = &tris[6 * (y * benchGrid + x)];
+            t[0] = v0; t[1] = v0 + 1; t[2] = v0 + verts;
+            t[3] = v0 + 1; t[4] = v0 + verts + 1; t[5] = v0 + verts;
+        }
+    }
+
+    rtcCommitGeometry(geom);
+    rtcAttachGeometry(scene, geom);
+    rtcReleaseGeometry(geom);
+    rtcCommitScene(scene);
+    return scene;
+}
+
+struct benchray_t {
+    float org[3];
+    float dir[3];
+    float dist;
+};
+
+static std::vector<benchray_t>
+MakeStreams()
+{
+    std::vector<benchray_t> rays;
+    unsigned seed = 1;
+    auto rnd = [&]() {
+        seed = seed * 1103515245u + 12345u;
+        return static_cast<float>((seed >> 8) & 0xffff) / 65535.0f;
+    };
+
+    for (int s = 0; s < benchStreams; s++) {
+        const float cx = 256.0f + rnd() * (benchExtent - 512.0f);
+        const float cy = 256.0f + rnd() * (benchExtent - 512.0f);
+        const float light[3] = { cx + (rnd() - 0.5f) * 1024.0f, cy + (rnd() - 0.5f) * 1024.0f, 96.0f };
+
+        for (int i = 0; i < benchStreamRays; i++) {
+            benchray_t ray;
+            ray.org[0] = cx + (i % 16) * 16.0f;
+            ray.org[1] = cy + (i / 16) * 16.0f;
+            ray.org[2] = FloorHeight(ray.org[0], ray.org[1]) + 1.0f;
+
+            float len = 0;
+            for (int j = 0; j < 3; j++) {
+                ray.dir[j] = light[j] - ray.org[j];
+                len += ray.dir[j] * ray.dir[j];
+            }
+            len = sqrtf(len);
+            for (int j = 0; j < 3; j++)
+                ray.dir[j] /= len;
+            ray.dist = len;
+            rays.push_back(ray);
+        }
+    }
+    return rays;
+}
+
+TEST(embree, Intersect1MvsNp) {
+    RTCDevice device = rtcNewDevice(nullptr);
+    RTCScene scene = MakeFloorScene(device);
+    const std::vector<benchray_t> rays = MakeStreams();
+
+    RTCIntersectContext ctx;
+    rtcInitIntersectContext(&ctx);
+    ctx.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
+
+    /* intersection and occlusion with rtcIntersect1M/rtcOccluded1M */
+    std::vector<RTCRayHit> aos(benchStreamRays);
+    std::vector<RTCRay> aosocc(benchStreamRays);
+    std::vector<float> hits1M, occluded1M;
+    double intersect1M = 0, occlusion1M = 0;
+
+    for (int s = 0; s < benchStreams; s++) {
+        const benchray_t *stream = &rays[s * benchStreamRays];
+        for (int i = 0; i < benchStreamRays; i++) {
+            RTCRay &ray = aos[i].ray;
+            ray.org_x = stream[i].org[0];
+            ray.org_y = stream[i].org[1];
+            ray.org_z = stream[i].org[2];
+            ray.tnear = 0;
+            ray.dir_x = stream[i].dir[0];
+            ray.dir_y = stream[i].dir[1];
+            ray.dir_z = stream[i].dir[2];
+            ray.time = 0;
+            ray.tfar = stream[i].dist;
+            ray.mask = 1;
+            ray.id = i;
+            ray.flags = 0;
+            aos[i].hit.geomID = RTC_INVALID_GEOMETRY_ID;
+            aos[i].hit.primID = RTC_INVALID_GEOMETRY_ID;
+            for (int l = 0; l < RTC_MAX_INSTANCE_LEVEL_COUNT; l++)
+                aos[i].hit.instID[l] = RTC_INVALID_GEOMETRY_ID;
+            aosocc[i] = ray;
+        }
+
+        double start = I_FloatTime();
+        rtcIntersect1M(scene, &ctx, aos.data(), benchStreamRays, sizeof(RTCRayHit));
+        intersect1M += I_FloatTime() - start;
+
+        start = I_FloatTime();
+        rtcOccluded1M(scene, &ctx, aosocc.data(), benchStreamRays, sizeof(RTCRay));
+        occlusion1M += I_FloatTime() - start;
+
+        for (int i = 0; i < benchStreamRays; i++) {
+            hits1M.push_back(aos[i].hit.geomID == RTC_INVALID_GEOMETRY_ID ? -1.0f : aos[i].ray.tfar);
+            occluded1M.push_back(aosocc[i].tfar);
+        }
+    }
+
+    /* the same with rtcIntersectNp/rtcOccludedNp */
+    std::vector<float> org_x(benchStreamRays), org_y(benchStreamRays), org_z(benchStreamRays);
+    std::vector<float> dir_x(benchStreamRays), dir_y(benchStreamRays), dir_z(benchStreamRays);
+    std::vector<float> tnear(benchStreamRays), time(benchStreamRays), tfar(benchStreamRays);
+    std::vector<unsigned> mask(benchStreamRays), id(benchStreamRays), flags(benchStreamRays);
+    std::vector<float> ng_x(benchStreamRays), ng_y(benchStreamRays), ng_z(benchStreamRays);
+    std::vector<float> u(benchStreamRays), v(benchStreamRays);
+    std::vector<unsigned> primID(benchStreamRays), geomID(benchStreamRays);
+    std::vector<unsigned> instID(benchStreamRays * RTC_MAX_INSTANCE_LEVEL_COUNT);
+    std::vector<float> occtfar(benchStreamRays);
+
+    RTCRayHitNp soa {};
+    soa.ray = { org_x.data(), org_y.data(), org_z.data(), tnear.data(), dir_x.data(), dir_y.data(), dir_z.data(),
+                time.data(), tfar.data(), mask.data(), id.data(), flags.data() };
+    soa.hit.Ng_x = ng_x.data();
+    soa.hit.Ng_y = ng_y.data();
+    soa.hit.Ng_z = ng_z.data();
+    soa.hit.u = u.data();
+    soa.hit.v = v.data();
+    soa.hit.primID = primID.data();
+    soa.hit.geomID = geomID.data();
+    for (int l = 0; l < RTC_MAX_INSTANCE_LEVEL_COUNT; l++)
+        soa.hit.instID[l] = &instID[l * benchStreamRays];
+    RTCRayNp soaocc = soa.ray;
+    soaocc.tfar = occtfar.data();
+
+    std::vector<float> hitsNp, occludedNp;
+    double intersectNp = 0, occlusionNp = 0;
+
+    for (int s = 0; s < benchStreams; s++) {
+        const benchray_t *stream = &rays[s * benchStreamRays];
+        for (int i = 0; i < benchStreamRays; i++) {
+            org_x[i] = stream[i].org[0];
+            org_y[i] = stream[i].org[1];
+            org_z[i] = stream[i].org[2];
+            tnear[i] = 0;
+            dir_x[i] = stream[i].dir[0];
+            dir_y[i] = stream[i].dir[1];
+            dir_z[i] = stream[i].dir[2];
+            time[i] = 0;
+            tfar[i] = occtfar[i] = stream[i].dist;
+            mask[i] = 1;
+            id[i] = i;
+            flags[i] = 0;
+            geomID[i] = primID[i] = RTC_INVALID_GEOMETRY_ID;
+            for (int l = 0; l < RTC_MAX_INSTANCE_LEVEL_COUNT; l++)
+                soa.hit.instID[l][i] = RTC_INVALID_GEOMETRY_ID;
+        }
+
+        // the two queries share the ray inputs but write to their own tfar
+        double start = I_FloatTime();
+        rtcIntersectNp(scene, &ctx, &soa, benchStreamRays);
+        intersectNp += I_FloatTime() - start;
+
+        start = I_FloatTime();
+        rtcOccludedNp(scene, &ctx, &soaocc, benchStreamRays);
+        occlusionNp += I_FloatTime() - start;
+
+        for (int i = 0; i < benchStreamRays; i++) {
+            hitsNp.push_back(geomID[i] == RTC_INVALID_GEOMETRY_ID ? -1.0f : tfar[i]);
+            occludedNp.push_back(occtfar[i]);
+        }
+    }
+
+    rtcReleaseScene(scene);
+    rtcReleaseDevice(device);
+
+    EXPECT_EQ(hits1M, hitsNp);
+    EXPECT_EQ(occluded1M, occludedNp);
+
+    // some rays should be blocked by the bumps and some not
+    const size_t missed = std::count(hits1M.begin(), hits1M.end(), -1.0f);
+    EXPECT_GT(missed, 0u);
+    EXPECT_LT(missed, hits1M.size());
+
+    const double mrays = static_cast<double>(rays.size()) / 1e6;
+    printf("%zu rays in streams of %d:\n", rays.size(), benchStreamRays);
+    printf("  intersection   1M: %8.3f ms (%6.2f Mrays/s)   Np: %8.3f ms (%6.2f Mrays/s)\n",
+           intersect1M * 1000, mrays / intersect1M, intersectNp * 1000, mrays / intersectNp);
+    printf("  occlusion      1M: %8.3f ms (%6.2f Mrays/s)   Np: %8.3f ms (%6.2f Mrays/s)\n",
+           occlusion1M * 1000, mrays / occlusion1M, occlusionNp * 1000, mrays / occlusionNp);
+}
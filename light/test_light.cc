@@ -1,6 +1,9 @@
 #include "gtest/gtest.h"
 
 #include <light/light.hh>
+#include <light/relight.hh>
+#include <light/entities.hh>
+#include <light/pvs.hh>
 
 #include <random>
 #include <algorithm> // for std::sort
@@ -1098,4 +1101,201 @@ TEST(trace, clamp_texcoord) {
     EXPECT_EQ(0, clamp_texcoord(-127.5f, 128));
     EXPECT_EQ(0, clamp_texcoord(-128.0f, 128));
     EXPECT_EQ(127, clamp_texcoord(-129.0f, 128));
-}
\ No newline at end of file
+}
+/**
+ * -incremental reuses the cache only while the key is unchanged, so the key
+ * has to cover the geometry and options but not the lighting it replaces.
+ */
+TEST(relight, Key) {
+    dplane_t planes[1] {};
+    planes[0].normal[2] = 1;
+    planes[0].dist = 64;
+    planes[0].type = 2;
+    
+    bsp2_dface_t faces[1] {};
+    faces[0].lightofs = -1;
+    faces[0].styles[0] = 255;
+    
+    mbsp_t bsp {};
+    bsp.loadversion = &bspver_q1;
+    bsp.numplanes = 1;
+    bsp.dplanes = planes;
+    bsp.numfaces = 1;
+    bsp.dfaces = faces;
+    
+    globalconfig_t cfg {};
+    const uint64_t key = Relight_Key(&bsp, nullptr, cfg);
+    EXPECT_EQ(key, Relight_Key(&bsp, nullptr, cfg));
+    
+    // the lighting and face styles are what the cache stands in for
+    faces[0].lightofs = 1024;
+    faces[0].styles[0] = 0;
+    EXPECT_EQ(key, Relight_Key(&bsp, nullptr, cfg));
+    
+    planes[0].dist = 65;
+    EXPECT_NE(key, Relight_Key(&bsp, nullptr, cfg));
+    planes[0].dist = 64;
+    
+    faces[0].texinfo = 1;
+    EXPECT_NE(key, Relight_Key(&bsp, nullptr, cfg));
+    faces[0].texinfo = 0;
+    
+    cfg.rangescale.setFloatValue(1.0f);
+    EXPECT_NE(key, Relight_Key(&bsp, nullptr, cfg));
+    cfg.rangescale.setFloatValue(0.5f);
+    
+    fastsky = true;
+    EXPECT_NE(key, Relight_Key(&bsp, nullptr, cfg));
+    fastsky = false;
+    
+    nopvs = true;
+    EXPECT_NE(key, Relight_Key(&bsp, nullptr, cfg));
+    nopvs = false;
+    
+    EXPECT_EQ(key, Relight_Key(&bsp, nullptr, cfg));
+}
+
+TEST(pvs, CullLight) {
+    // leaf 1 is x < 0, leaf 2 is 0 < x < 100 and leaf 3 is x > 100,
+    // and leafs 1 and 3 can only see leaf 2
+    dplane_t planes[2] {};
+    planes[0].normal[0] = 1;
+    planes[1].normal[0] = 1;
+    planes[1].dist = 100;
+    
+    bsp2_dnode_t nodes[2] {};
+    nodes[0].planenum = 0;
+    nodes[0].children[0] = 1;
+    nodes[0].children[1] = -2;
+    nodes[1].planenum = 1;
+    nodes[1].children[0] = -4;
+    nodes[1].children[1] = -3;
+    
+    const float leafx[4] { -200, 0, 100, 300 };
+    mleaf_t leafs[4] {};
+    leafs[0].contents = CONTENTS_SOLID;
+    leafs[0].visofs = -1;
+    for (int i = 1; i < 4; i++) {
+        leafs[i].contents = CONTENTS_EMPTY;
+        leafs[i].visofs = i - 1;
+        VectorSet(leafs[i].mins, leafx[i - 1], -100, -100);
+        VectorSet(leafs[i].maxs, leafx[i], 100, 100);
+    }
+    leafs[1].nummarksurfaces = 1;
+    
+    uint8_t visdata[3] { 0x02, 0x05, 0x02 };
+    uint32_t leaffaces[1] { 0 };
+    bsp2_dface_t faces[1] {};
+    
+    dmodelh2_t models[2] {};
+    models[0].visleafs = 3;
+    
+    char entities[] =
+        "{ \"classname\" \"worldspawn\" }\n"
+        "{ \"classname\" \"light\" \"origin\" \"-50 0 0\" }\n"
+        "{ \"classname\" \"light\" \"origin\" \"50 0 0\" }\n"
+        "{ \"classname\" \"light\" \"origin\" \"200 0 0\" }\n"
+        "{ \"classname\" \"light\" \"origin\" \"100.05 0 0\" }\n";
+    
+    mbsp_t bsp {};
+    bsp.loadversion = &bspver_q1;
+    bsp.nummodels = 2;
+    bsp.dmodels = models;
+    bsp.visdatasize = sizeof(visdata);
+    bsp.dvisdata = visdata;
+    bsp.entdatasize = sizeof(entities);
+    bsp.dentdata = entities;
+    bsp.numleafs = 4;
+    bsp.dleafs = leafs;
+    bsp.numplanes = 2;
+    bsp.dplanes = planes;
+    bsp.numnodes = 2;
+    bsp.dnodes = nodes;
+    bsp.numfaces = 1;
+    bsp.dfaces = faces;
+    bsp.numleaffaces = 1;
+    bsp.dleaffaces = leaffaces;
+    
+    globalconfig_t cfg {};
+    ResetEntities();
+    LoadEntities(cfg, &bsp);
+    ASSERT_EQ(4u, GetLights().size());
+    Pvs_Setup(&bsp);
+    Pvs_Begin(&bsp);
+    
+    // the face is in leaf 1
+    const modelinfo_t world { &bsp, &models[0], 16 };
+    const modelinfo_t bmodel { &bsp, &models[1], 16 };
+    vec3_t points[2] { { -50, 0, 0 }, { -60, 0, 0 } };
+    bool occluded[2] {};
+    
+    lightsurf_t surf {};
+    surf.modelinfo = &world;
+    surf.bsp = &bsp;
+    surf.face = &faces[0];
+    surf.numpoints = 2;
+    surf.points = points;
+    surf.occluded = occluded;
+    
+    auto cull = [&](int lightnum) {
+        surf.pvsready = false;
+        return Pvs_CullLight(&surf, lightnum);
+    };
+    
+    // leaf 1 sees leafs 1 and 2, and the bounds are padded a little
+    vec3_t mins, maxs;
+    const vec3_t origin { -50, 0, 0 };
+    ASSERT_TRUE(Pvs_VisibleBounds(&bsp, origin, mins, maxs));
+    EXPECT_LT(mins[0], -200);
+    EXPECT_GT(maxs[0], 100);
+    EXPECT_LT(maxs[0], 300);
+    EXPECT_LT(mins[1], -100);
+    EXPECT_GT(maxs[2], 100);
+    
+    EXPECT_FALSE(cull(0));
+    EXPECT_FALSE(cull(1));
+    EXPECT_TRUE(cull(2));
+    // on the plane between leafs 2 and 3, so in both
+    EXPECT_FALSE(cull(3));
+    EXPECT_FALSE(cull(4));
+    
+    // a sample point off the face, in leaf 2
+    points[1][0] = 50;
+    EXPECT_FALSE(cull(2));
+    occluded[1] = true;
+    EXPECT_TRUE(cull(2));
+    occluded[1] = false;
+    
+    // too close to the plane between leafs 1 and 2 to tell
+    points[1][0] = -0.05;
+    EXPECT_FALSE(cull(2));
+    points[1][0] = -60;
+    EXPECT_TRUE(cull(2));
+    
+    // bmodels can be moved out of the leafs they were compiled in
+    surf.modelinfo = &bmodel;
+    EXPECT_FALSE(cull(2));
+    surf.modelinfo = &world;
+    
+    // a light in a leaf without vis data
+    leafs[3].visofs = -1;
+    Pvs_Setup(&bsp);
+    Pvs_Begin(&bsp);
+    EXPECT_FALSE(cull(2));
+    leafs[3].visofs = 2;
+    
+    nopvs = true;
+    Pvs_Setup(&bsp);
+    Pvs_Begin(&bsp);
+    EXPECT_FALSE(cull(2));
+    EXPECT_FALSE(Pvs_VisibleBounds(&bsp, origin, mins, maxs));
+    nopvs = false;
+    
+    Pvs_Begin(&bsp);
+    EXPECT_TRUE(cull(2));
+    
+    mbsp_t empty {};
+    Pvs_Setup(&empty);
+    Pvs_Begin(&empty);
+    ResetEntities();
+}
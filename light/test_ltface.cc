@@ -1,3 +1,58 @@
 #include "gtest/gtest.h"
 
 #include <light/ltface.hh>
+
+TEST(ltface, CoarseSampleLuxel) {
+    undersample = 4;
+    for (int texsize = 0; texsize < 20; texsize++) {
+        const int count = CoarseSampleCount(texsize);
+        
+        // starts on the first luxel, ends on the last, no gaps wider than undersample
+        EXPECT_EQ(0, CoarseSampleLuxel(0, texsize));
+        EXPECT_EQ(texsize, CoarseSampleLuxel(count - 1, texsize));
+        for (int i = 1; i < count; i++) {
+            const int gap = CoarseSampleLuxel(i, texsize) - CoarseSampleLuxel(i - 1, texsize);
+            EXPECT_GT(gap, 0);
+            EXPECT_LE(gap, undersample);
+        }
+    }
+    undersample = 1;
+}
+
+TEST(ltface, UpsampleCoarseImage) {
+    undersample = 4;
+    
+    lightsurf_t surf {};
+    surf.texsize[0] = 10;
+    surf.texsize[1] = 5;
+    surf.width = CoarseSampleCount(surf.texsize[0]);
+    surf.height = CoarseSampleCount(surf.texsize[1]);
+    
+    // bilinear interpolation reproduces a linear ramp exactly
+    auto ramp = [](int x, int y) { return qvec4f(x, y, 2 * x + 3 * y, 1); };
+    
+    std::vector<qvec4f> coarse;
+    for (int t = 0; t < surf.height; t++) {
+        for (int s = 0; s < surf.width; s++) {
+            coarse.push_back(ramp(CoarseSampleLuxel(s, surf.texsize[0]), CoarseSampleLuxel(t, surf.texsize[1])));
+        }
+    }
+    
+    std::vector<qvec4f> full;
+    UpsampleCoarseImage(coarse, &surf, full);
+    
+    const int outw = surf.texsize[0] + 1;
+    const int outh = surf.texsize[1] + 1;
+    ASSERT_EQ(static_cast<size_t>(outw * outh), full.size());
+    for (int y = 0; y < outh; y++) {
+        for (int x = 0; x < outw; x++) {
+            const qvec4f expected = ramp(x, y);
+            const qvec4f &actual = full[(y * outw) + x];
+            for (int i = 0; i < 4; i++) {
+                EXPECT_FLOAT_EQ(expected[i], actual[i]) << "at " << x << " " << y;
+            }
+        }
+    }
+    
+    undersample = 1;
+}
@@ -50,15 +50,26 @@ uint32_t clamp_texcoord(vec_t in, uint32_t width)
     }
 }
 
+/**
+ * Returns false if SampleTexture returns a blank sample for every point.
+ */
+bool
+SampleTexture_Enabled(const mbsp_t *bsp)
+{
+    if (!bsp->rgbatexdatasize)
+        return false;
+
+    // FIXME: re-enable SampleTexture
+    return false;
+}
+
 color_rgba //mxd. int -> color_rgba
 SampleTexture(const bsp2_dface_t *face, const mbsp_t *bsp, const vec3_t point)
 {
     color_rgba sample{};
-    if (!bsp->rgbatexdatasize)
+    if (!SampleTexture_Enabled(bsp))
         return sample;
 
-    // FIXME: re-enable the following code
-    return sample;
 #if 0
     const auto *miptex = Face_Miptex(bsp, face);
     
@@ -79,9 +90,9 @@ SampleTexture(const bsp2_dface_t *face, const mbsp_t *bsp, const vec3_t point)
     // see: https://github.com/ericwa/ericw-tools/commit/0661098bc57d09b9961aa8314c52545a8f89a1e1#diff-dff5fe3d0288e49cabf1e7bc8fb28819c513be54cb7bbcdbea8b52ee0efd6bf5
     color_rgba *data = (color_rgba*)((uint8_t*)miptex + miptex->offset);
     sample = data[(miptex->width * y) + x];
+#endif
 
     return sample;
-#endif
 }
 
 hitresult_t TestSky(const vec3_t start, const vec3_t dirn, const modelinfo_t *self, const bsp2_dface_t **face_out)
@@ -29,6 +29,7 @@
 #include <cassert>
 #include <climits>
 #include <cstdlib>
+#include <cstring>
 #include <limits>
 
 #ifdef _MSC_VER
@@ -219,6 +220,30 @@ sceneinfo filtergeom; // conditional occluders.. needs to run ray intersection f
 
 static const mbsp_t *bsp_static;
 
+/**
+ * What Embree_FilterFuncN needs to know about the face a filtergeom
+ * triangle belongs to, worked out in Embree_TraceInit rather than for
+ * every candidate hit.
+ */
+enum filterflags_t {
+    FILTER_SHADOWWORLDONLY = 1,
+    FILTER_SHADOWSELF = 2,
+    FILTER_SWITCHABLESHADOW = 4,
+    FILTER_FENCE = 8,
+    FILTER_GLASS = 16
+};
+
+struct filterface_t {
+    const modelinfo_t *modelinfo; // null for "skip" faces
+    const bsp2_dface_t *face;
+    int flags;
+    int switchshadstyle;
+    float alpha;
+};
+
+static std::vector<filterface_t> filtertris; // indexed by filtergeom primID
+static bool filtertextures; // false if SampleTexture only returns blank samples
+
 void ErrorCallback(void* userptr, const RTCError code, const char* str)
 {
     printf("RTC Error %d: %s\n", code, str);
@@ -302,22 +327,21 @@ Embree_FilterFuncN(const struct RTCFilterFunctionNArguments* args)
         }
         
         const unsigned &rayID = RTCRayN_id(ray, N, i);
-        const unsigned &geomID = RTCHitN_geomID(potentialHit, N, i);
         const unsigned &primID = RTCHitN_primID(potentialHit, N, i);
         
         // unpack ray index
         const unsigned rayIndex = rayID;
         
         const modelinfo_t *source_modelinfo = rsi->self;
-        const modelinfo_t *hit_modelinfo = Embree_LookupModelinfo(geomID, primID);
-        if (!hit_modelinfo) {
+        const filterface_t &hit = filtertris[primID];
+        if (!hit.modelinfo) {
             // we hit a "skip" face with no associated model
             // reject hit (???)
             valid[i] = INVALID;
             continue;
         }
         
-        if (hit_modelinfo->shadowworldonly.boolValue()) {
+        if (hit.flags & FILTER_SHADOWWORLDONLY) {
             // we hit "_shadowworldonly" "1" geometry. Ignore the hit unless we are from world.
             if (!source_modelinfo || !source_modelinfo->isWorld()) {
                 // reject hit
@@ -326,22 +350,19 @@ Embree_FilterFuncN(const struct RTCFilterFunctionNArguments* args)
             }
         }
         
-        if (hit_modelinfo->shadowself.boolValue()) {
+        if (hit.flags & FILTER_SHADOWSELF) {
             // only casts shadows on itself
-            if (source_modelinfo != hit_modelinfo) {
+            if (source_modelinfo != hit.modelinfo) {
                 // reject hit
                 valid[i] = INVALID;
                 continue;
             }
         }
         
-        if (hit_modelinfo->switchableshadow.boolValue()) {
+        if (hit.flags & FILTER_SWITCHABLESHADOW) {
             // we hit a dynamic shadow caster. reject the hit, but store the
             // info about what we hit.
-            
-            const int style = hit_modelinfo->switchshadstyle.intValue();
-            
-            AddDynamicOccluderToRay(context, rayIndex, style);
+            AddDynamicOccluderToRay(context, rayIndex, hit.switchshadstyle);
             
             // reject hit
             valid[i] = INVALID;
@@ -349,27 +370,17 @@ Embree_FilterFuncN(const struct RTCFilterFunctionNArguments* args)
         }
         
         // test fence textures and glass
-        const bsp2_dface_t *face = Embree_LookupFace(geomID, primID);
-        float alpha = Face_Alpha(hit_modelinfo, face);
-
-        //mxd
-        bool isFence, isGlass;
-        if(bsp_static->loadversion->game->id == GAME_QUAKE_II) {
-            const int surf_flags = Face_ContentsOrSurfaceFlags(bsp_static, face);
-            isFence = ((surf_flags & Q2_SURF_TRANSLUCENT) == Q2_SURF_TRANSLUCENT); // KMQuake 2-specific. Use texture alpha chanel when both flags are set.
-            isGlass = !isFence && (surf_flags & Q2_SURF_TRANSLUCENT);
-            if(isGlass)
-                alpha = (surf_flags & Q2_SURF_TRANS33 ? 0.66f : 0.33f);
-        } else {
-            const char *name = Face_TextureName(bsp_static, face);
-            isFence = (name[0] == '{');
-            isGlass = (alpha < 1.0f);
-        }
+        const bool isFence = (hit.flags & FILTER_FENCE) != 0;
+        const bool isGlass = (hit.flags & FILTER_GLASS) != 0;
+        float alpha = hit.alpha;
         
         if (isFence || isGlass) {
-            vec3_t hitpoint;
-            Embree_RayEndpoint(ray, N, i, hitpoint);
-            const color_rgba sample = SampleTexture(face, bsp_static, hitpoint); //mxd. Palette index -> color_rgba
+            color_rgba sample{};
+            if (filtertextures) {
+                vec3_t hitpoint;
+                Embree_RayEndpoint(ray, N, i, hitpoint);
+                sample = SampleTexture(hit.face, bsp_static, hitpoint); //mxd. Palette index -> color_rgba
+            }
         
             if (isGlass) {
                 // hit glass...
@@ -594,6 +605,48 @@ MakeFaces(const mbsp_t *bsp, const dmodel_t *model)
     return result;
 }
 
+static filterface_t
+MakeFilterFace(const mbsp_t *bsp, const modelinfo_t *modelinfo, const bsp2_dface_t *face)
+{
+    filterface_t ff {};
+    ff.modelinfo = modelinfo;
+    ff.face = face;
+    
+    if (!modelinfo)
+        return ff;
+    
+    if (modelinfo->shadowworldonly.boolValue())
+        ff.flags |= FILTER_SHADOWWORLDONLY;
+    if (modelinfo->shadowself.boolValue())
+        ff.flags |= FILTER_SHADOWSELF;
+    if (modelinfo->switchableshadow.boolValue())
+        ff.flags |= FILTER_SWITCHABLESHADOW;
+    ff.switchshadstyle = modelinfo->switchshadstyle.intValue();
+    
+    ff.alpha = Face_Alpha(modelinfo, face);
+    
+    //mxd
+    bool isFence, isGlass;
+    if (bsp->loadversion->game->id == GAME_QUAKE_II) {
+        const int surf_flags = Face_ContentsOrSurfaceFlags(bsp, face);
+        isFence = ((surf_flags & Q2_SURF_TRANSLUCENT) == Q2_SURF_TRANSLUCENT); // KMQuake 2-specific. Use texture alpha chanel when both flags are set.
+        isGlass = !isFence && (surf_flags & Q2_SURF_TRANSLUCENT);
+        if (isGlass)
+            ff.alpha = (surf_flags & Q2_SURF_TRANS33 ? 0.66f : 0.33f);
+    } else {
+        const char *name = Face_TextureName(bsp, face);
+        isFence = (name[0] == '{');
+        isGlass = (ff.alpha < 1.0f);
+    }
+    
+    if (isFence)
+        ff.flags |= FILTER_FENCE;
+    if (isGlass)
+        ff.flags |= FILTER_GLASS;
+    
+    return ff;
+}
+
 void
 Embree_TraceInit(const mbsp_t *bsp)
 {
@@ -719,6 +772,12 @@ Embree_TraceInit(const mbsp_t *bsp)
     skygeom = CreateGeometry(bsp, device, scene, skyfaces);
     solidgeom = CreateGeometry(bsp, device, scene, solidfaces);
     filtergeom = CreateGeometry(bsp, device, scene, filterfaces);
+    
+    filtertris.clear();
+    for (size_t i = 0; i < filtergeom.triToFace.size(); i++) {
+        filtertris.push_back(MakeFilterFace(bsp, filtergeom.triToModelinfo[i], filtergeom.triToFace[i]));
+    }
+    filtertextures = SampleTexture_Enabled(bsp);
     CreateGeometryFromWindings(device, scene, skipwindings);
     
     rtcSetGeometryIntersectFilterFunction(rtcGetGeometry(scene,filtergeom.geomID),Embree_FilterFuncN<filtertype_t::INTERSECTION>);
@@ -946,23 +1005,107 @@ public:
 };
 
 
+/**
+ * Ray stream storage in Embree's structure-of-arrays layout, for
+ * rtcIntersectNp/rtcOccludedNp. The rays pushed for one lightsurf and
+ * light are coherent, and this lets Embree trace them as packets rather
+ * than one at a time as rtcIntersect1M/rtcOccluded1M do.
+ */
+class raystream_embree_soa_t {
+public:
+    RTCRayHitNp _np;
+    void *_block;
+    
+public:
+    raystream_embree_soa_t(int maxRays, bool withHits) {
+        // one array per field, each starting on a 64 byte boundary
+        const size_t stride = (static_cast<size_t>(maxRays) + 15) & ~static_cast<size_t>(15);
+        const int rayfields = 12;
+        const int hitfields = withHits ? (7 + RTC_MAX_INSTANCE_LEVEL_COUNT) : 0;
+        
+        _block = q_aligned_malloc(64, sizeof(float) * stride * (rayfields + hitfields));
+        if (!_block)
+            Error("%s: allocation failed", __func__);
+        
+        float *next = static_cast<float *>(_block);
+        auto floats = [&]() { float *p = next; next += stride; return p; };
+        auto uints = [&]() { return reinterpret_cast<unsigned *>(floats()); };
+        
+        memset(&_np, 0, sizeof(_np));
+        _np.ray.org_x = floats();
+        _np.ray.org_y = floats();
+        _np.ray.org_z = floats();
+        _np.ray.tnear = floats();
+        _np.ray.dir_x = floats();
+        _np.ray.dir_y = floats();
+        _np.ray.dir_z = floats();
+        _np.ray.time = floats();
+        _np.ray.tfar = floats();
+        _np.ray.mask = uints();
+        _np.ray.id = uints();
+        _np.ray.flags = uints();
+        if (withHits) {
+            _np.hit.Ng_x = floats();
+            _np.hit.Ng_y = floats();
+            _np.hit.Ng_z = floats();
+            _np.hit.u = floats();
+            _np.hit.v = floats();
+            _np.hit.primID = uints();
+            _np.hit.geomID = uints();
+            for (int l = 0; l < RTC_MAX_INSTANCE_LEVEL_COUNT; l++)
+                _np.hit.instID[l] = uints();
+        }
+    }
+    
+    ~raystream_embree_soa_t() {
+        q_aligned_free(_block);
+    }
+    
+    // same as SetupRay
+    void setRay(int j, const vec3_t start, const vec3_t dir, vec_t dist) {
+        RTCRayNp &ray = _np.ray;
+        ray.org_x[j] = start[0];
+        ray.org_y[j] = start[1];
+        ray.org_z[j] = start[2];
+        ray.tnear[j] = 0.f;
+        
+        ray.dir_x[j] = dir[0]; // can be un-normalized
+        ray.dir_y[j] = dir[1];
+        ray.dir_z[j] = dir[2];
+        ray.time[j] = 0.f; // not using
+        
+        ray.tfar[j] = dist;
+        ray.mask[j] = 1; // we're not using, but needs to be set if embree is compiled with masks
+        ray.id[j] = j;
+        ray.flags[j] = 0; // reserved
+        
+        if (_np.hit.geomID) {
+            _np.hit.geomID[j] = RTC_INVALID_GEOMETRY_ID;
+            _np.hit.primID[j] = RTC_INVALID_GEOMETRY_ID;
+            for (int l = 0; l < RTC_MAX_INSTANCE_LEVEL_COUNT; l++)
+                _np.hit.instID[l][j] = RTC_INVALID_GEOMETRY_ID;
+        }
+    }
+    
+    void getDir(size_t j, vec3_t out) const {
+        out[0] = _np.ray.dir_x[j];
+        out[1] = _np.ray.dir_y[j];
+        out[2] = _np.ray.dir_z[j];
+    }
+};
+
 class raystream_embree_intersection_t : public raystream_embree_common_t, public raystream_intersection_t {
 public:
-    RTCRayHit *_rays;
+    raystream_embree_soa_t _rays;
 public:
     raystream_embree_intersection_t(int maxRays) :
     raystream_embree_common_t(maxRays),
-    _rays { static_cast<RTCRayHit *>(q_aligned_malloc(16, sizeof(RTCRayHit) * maxRays)) }
+    _rays { maxRays, true }
     {}
 
-    ~raystream_embree_intersection_t() {
-        q_aligned_free(_rays);
-    }
-
     void pushRay(int i, const vec_t *origin, const vec3_t dir, float dist, const vec_t *color = nullptr, const vec_t *normalcontrib = nullptr) override {
         Q_assert(_numrays<_maxrays);
-        const RTCRayHit rayHit = SetupRay(_numrays, origin, dir, dist);
-        _rays[_numrays] = rayHit;
+        _rays.setRay(_numrays, origin, dir, dist);
         _rays_maxdist[_numrays] = dist;
         _point_indices[_numrays] = i;
         if (color) {
@@ -980,25 +1123,23 @@ public:
             return;
         
         ray_source_info ctx2(this, self);
-        rtcIntersect1M(scene, &ctx2, _rays, _numrays, sizeof(_rays[0]));
+        rtcIntersectNp(scene, &ctx2, &_rays._np, _numrays);
     }
 
     void getPushedRayDir(size_t j, vec3_t out) override {
         Q_assert(j < _maxrays);
-        out[0] = _rays[j].ray.dir_x;
-        out[1] = _rays[j].ray.dir_y;
-        out[2] = _rays[j].ray.dir_z;        
+        _rays.getDir(j, out);
     }
 
     float getPushedRayHitDist(size_t j) override {
         Q_assert(j < _maxrays);
-        return _rays[j].ray.tfar;
+        return _rays._np.ray.tfar[j];
     }
 
     hittype_t getPushedRayHitType(size_t j) override {
         Q_assert(j < _maxrays);
 
-        const unsigned id = _rays[j].hit.geomID;
+        const unsigned id = _rays._np.hit.geomID[j];
         if (id == RTC_INVALID_GEOMETRY_ID) {
             return hittype_t::NONE;
         } else if (id == skygeom.geomID) {
@@ -1011,13 +1152,13 @@ public:
     const bsp2_dface_t *getPushedRayHitFace(size_t j) override {
         Q_assert(j < _maxrays);
         
-        const RTCRayHit &ray = _rays[j];
+        const unsigned geomID = _rays._np.hit.geomID[j];
         
-        if (ray.hit.geomID == RTC_INVALID_GEOMETRY_ID)
+        if (geomID == RTC_INVALID_GEOMETRY_ID)
             return nullptr;
         
-        const sceneinfo &si = Embree_SceneinfoForGeomID(ray.hit.geomID);
-        const bsp2_dface_t *face = si.triToFace.at(ray.hit.primID);
+        const sceneinfo &si = Embree_SceneinfoForGeomID(geomID);
+        const bsp2_dface_t *face = si.triToFace.at(_rays._np.hit.primID[j]);
         Q_assert(face != nullptr);
         
         return face;
@@ -1026,20 +1167,16 @@ public:
 
 class raystream_embree_occlusion_t : public raystream_embree_common_t, public raystream_occlusion_t {
 public:
-    RTCRay *_rays;
+    raystream_embree_soa_t _rays;
 public:
     raystream_embree_occlusion_t(int maxRays) :
     raystream_embree_common_t(maxRays),
-    _rays { static_cast<RTCRay *>(q_aligned_malloc(16, sizeof(RTCRay) * maxRays)) }
+    _rays { maxRays, false }
     {}
 
-    ~raystream_embree_occlusion_t() {
-        q_aligned_free(_rays);
-    }
-
     void pushRay(int i, const vec_t *origin, const vec3_t dir, float dist, const vec_t *color = nullptr, const vec_t *normalcontrib = nullptr) override {
         Q_assert(_numrays<_maxrays);
-        _rays[_numrays] = SetupRay(_numrays, origin, dir, dist).ray;
+        _rays.setRay(_numrays, origin, dir, dist);
         _rays_maxdist[_numrays] = dist;
         _point_indices[_numrays] = i;
         if (color) {
@@ -1059,20 +1196,17 @@ public:
             return;
 
         ray_source_info ctx2(this, self);
-        rtcOccluded1M(scene, &ctx2, _rays, _numrays, sizeof(_rays[0]));
+        rtcOccludedNp(scene, &ctx2, &_rays._np.ray, _numrays);
     }
 
     bool getPushedRayOccluded(size_t j) override {
         Q_assert(j < _maxrays);
-        return (_rays[j].tfar < 0.0f);
+        return (_rays._np.ray.tfar[j] < 0.0f);
     }
 
     void getPushedRayDir(size_t j, vec3_t out) override {
         Q_assert(j < _maxrays);
-
-        out[0] = _rays[j].dir_x;
-        out[1] = _rays[j].dir_y;
-        out[2] = _rays[j].dir_z; 
+        _rays.getDir(j, out);
     }
 };
 
@@ -169,8 +169,8 @@ AddToBounds(mapentity_t *entity, const vec3_t point)
 
 //===========================================================================
 
-static int
-NormalizePlane(qbsp_plane_t *p, bool flip = true)
+int
+NormalizePlane(qbsp_plane_t *p, bool flip)
 {
     int i;
     vec_t ax, ay, az;
@@ -278,18 +278,21 @@ NewPlane(const vec3_t normal, const vec_t dist, int *side)
 }
 
 /*
- * FindPlane
- * - Returns a global plane number and the side that will be the front
- * - if `side` is null, only an exact match will be fetched.
+ * LookupPlane
+ * - Like FindPlane, but returns -1 instead of adding a new plane
  */
 int
-FindPlane(const vec3_t normal, const vec_t dist, int *side)
+LookupPlane(const vec3_t normal, const vec_t dist, int *side)
 {
     qbsp_plane_t plane = {0};
     VectorCopy(normal, plane.normal);
     plane.dist = dist;
     
-    for (int i : map.planehash[plane_hash_fn(&plane)]) {
+    const auto it = map.planehash.find(plane_hash_fn(&plane));
+    if (it == map.planehash.end())
+        return -1;
+
+    for (int i : it->second) {
         const qbsp_plane_t &p = map.planes.at(i);
         if (PlaneEqual(&p, &plane)) {
             if (side) {
@@ -301,7 +304,22 @@ FindPlane(const vec3_t normal, const vec_t dist, int *side)
             return i;
         }
     }
-    return NewPlane(plane.normal, plane.dist, side);
+    return -1;
+}
+
+/*
+ * FindPlane
+ * - Returns a global plane number and the side that will be the front
+ * - if `side` is null, only an exact match will be fetched.
+ */
+int
+FindPlane(const vec3_t normal, const vec_t dist, int *side)
+{
+    const int planenum = LookupPlane(normal, dist, side);
+    if (planenum != -1)
+        return planenum;
+
+    return NewPlane(normal, dist, side);
 }
 
 
@@ -429,7 +447,7 @@ CreateBrushFaces(const mapentity_t *src, hullbrush_t *hullbrush,
             continue;           // overconstrained plane
 
         // this face is a keeper
-        f = (face_t *)AllocMem(OTHER, sizeof(face_t), true);
+        f = (face_t *)AllocMem(FACE, sizeof(face_t), true);
         f->planenum = PLANENUM_LEAF;
         f->w.numpoints = w->numpoints;
         if (f->w.numpoints > MAXEDGES)
@@ -481,7 +499,7 @@ CreateBrushFaces(const mapentity_t *src, hullbrush_t *hullbrush,
         VectorSubtract(point, rotate_offset, point);
         plane.dist = DotProduct(plane.normal, point);
 
-        free(w);
+        FreeMem(w, WINDING);
 
         f->texinfo = hullnum > 0 ? 0 : mapface->texinfo;
         f->planenum = FindPlane(plane.normal, plane.dist, &f->planeside);
@@ -538,7 +556,7 @@ FreeBrushFaces(face_t *facelist)
 
     for (face = facelist; face; face = next) {
         next = face->next;
-        free(face);
+        FreeMem(face, FACE);
     }
 }
 
@@ -1544,7 +1562,7 @@ int BrushMostlyOnSide (const brush_t *brush, const vec3_t planenormal, vec_t pla
 
 face_t *CopyFace(const face_t *face)
 {
-    face_t *newface = (face_t *)AllocMem(OTHER, sizeof(face_t), true);
+    face_t *newface = (face_t *)AllocMem(FACE, sizeof(face_t), true);
     
     memcpy(newface, face, sizeof(face_t));
     
@@ -1722,7 +1740,7 @@ void SplitBrush (const brush_t *brush,
         int		side;
         
         if (w)
-            free(w);
+            FreeMem(w, WINDING);
         
         side = BrushMostlyOnSide (brush, plane.normal, plane.dist);
         if (side == SIDE_FRONT)
@@ -1791,9 +1809,9 @@ void SplitBrush (const brush_t *brush,
         }
         
         if (cw[0])
-            free(cw[0]);
+            FreeMem(cw[0], WINDING);
         if (cw[1])
-            free(cw[1]);
+            FreeMem(cw[1], WINDING);
     }
     
     
@@ -1851,7 +1869,7 @@ void SplitBrush (const brush_t *brush,
             CopyWindingInto(&newface->w, newwinding);
             newface->planenum = planenum;
             newface->planeside = !planeside;
-            free(newwinding);
+            FreeMem(newwinding, WINDING);
         } else {
             CopyWindingInto(&newface->w, midwinding);
             newface->planenum = planenum;
@@ -1884,7 +1902,7 @@ void SplitBrush (const brush_t *brush,
     *front = b[0];
     *back = b[1];
     
-    free(midwinding);
+    FreeMem(midwinding, WINDING);
 }
 
 #if 0
@@ -74,7 +74,7 @@ NewFaceFromFace(face_t *in)
 {
     face_t *newf;
 
-    newf = (face_t *)AllocMem(OTHER, sizeof(face_t), true);
+    newf = (face_t *)AllocMem(FACE, sizeof(face_t), true);
 
     newf->planenum = in->planenum;
     newf->texinfo = in->texinfo;
@@ -208,7 +208,7 @@ SplitFace(face_t *in, const qbsp_plane_t *split, face_t **front, face_t **back)
         Error("Internal error: numpoints > MAXEDGES (%s)", __func__);
 
     /* free the original face now that it is represented by the fragments */
-    free(in);
+    FreeMem(in, FACE);
 }
 
 /*
@@ -246,7 +246,7 @@ RemoveOutsideFaces(const brush_t *brush, face_t **inside, face_t **outside)
         } else {
             face->next = *inside;
             *inside = face;
-            free(w);
+            FreeMem(w, WINDING);
         }
         face = next;
     }
@@ -403,7 +403,7 @@ FreeFaces(face_t *face)
 
     while (face) {
         next = face->next;
-        free(face);
+        FreeMem(face, FACE);
         face = next;
     }
 }
@@ -536,7 +536,7 @@ CopyBrushFaces(const brush_t *brush)
     facelist = NULL;
     for (face = brush->faces; face; face = face->next) {
         brushfaces++;
-        newface = (face_t *)AllocMem(OTHER, sizeof(face_t), true);
+        newface = (face_t *)AllocMem(FACE, sizeof(face_t), true);
         *newface = *face;
         newface->contents[0] = options.target_game->create_empty_contents();
         newface->contents[1] = brush->contents;
@@ -25,6 +25,13 @@
 #include <qbsp/qbsp.hh>
 #include <qbsp/file.hh>
 
+#ifdef LINUX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 /*
 ==============
 LoadFile
@@ -58,3 +65,88 @@ LoadFile(const char *filename, void *bufptr, bool nofail)
 
     return len;
 }
+
+#ifdef LINUX
+static size_t
+MappedSize(size_t len)
+{
+    /* round up past the end of the file so there is always a zero page after it */
+    const size_t pagesize = sysconf(_SC_PAGESIZE);
+    return (len / pagesize + 1) * pagesize;
+}
+#endif
+
+/*
+==============
+MapFile
+
+Maps a file read-only into memory. The contents are followed by at least
+one zero byte, so the buffer can be parsed as a C string like the ones
+from LoadFile. Release with UnmapFile. Falls back to LoadFile where mmap
+is not available. As with LoadFile, failures are fatal if nofail is set,
+otherwise *bufptr is set to NULL.
+==============
+*/
+size_t
+MapFile(const char *filename, const char **bufptr, bool nofail)
+{
+#ifdef LINUX
+    struct stat st;
+    int fd;
+    size_t len, mappedlen;
+    void *base, *file;
+
+    *bufptr = NULL;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        if (nofail)
+            Error("Failed to open %s: %s", filename, strerror(errno));
+        return 0;
+    }
+    if (fstat(fd, &st))
+        Error("Failed to stat %s: %s", filename, strerror(errno));
+
+    len = st.st_size;
+    mappedlen = MappedSize(len);
+
+    /*
+     * Reserve the whole range as zeroed anonymous memory, then map the file
+     * over the start of it. The tail of the last file page is zero-filled
+     * by the kernel and the pages after it stay anonymous.
+     */
+    base = mmap(NULL, mappedlen, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        Error("Failed to map %s: %s", filename, strerror(errno));
+    if (len) {
+        file = mmap(base, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+        if (file == MAP_FAILED) {
+            if (nofail)
+                Error("Failed to map %s: %s", filename, strerror(errno));
+            munmap(base, mappedlen);
+            close(fd);
+            return 0;
+        }
+    }
+    close(fd);
+
+    *bufptr = (const char *)base;
+    return len;
+#else
+    char *buf = NULL;
+    const size_t len = LoadFile(filename, &buf, nofail);
+
+    *bufptr = buf;
+    return len;
+#endif
+}
+
+void
+UnmapFile(const char *buf, size_t len)
+{
+#ifdef LINUX
+    munmap((void *)buf, MappedSize(len));
+#else
+    free((void *)buf);
+#endif
+}
@@ -25,8 +25,11 @@
 #include <memory>
 #include <list>
 #include <utility>
+#include <algorithm>
 #include <cassert>
+#include <charconv>
 #include <optional>
+#include <string_view>
 
 #include <ctype.h>
 #include <string.h>
@@ -37,6 +40,8 @@
 
 #include <common/qvec.hh>
 
+#include "tbb/parallel_for.h"
+
 #define info_player_start       1
 #define info_player_deathmatch  2
 #define info_player_coop        4
@@ -1143,7 +1148,7 @@ SetTexinfo_QuakeEd(const qbsp_plane_t *plane, const vec3_t planepts[3], const ve
 }
 
 static void
-SetTexinfo_QuArK(parser_t *parser, vec3_t planepts[3],
+SetTexinfo_QuArK(int linenum, vec3_t planepts[3],
                  texcoord_style_t style, mtexinfo_t *out)
 {
     int i;
@@ -1187,7 +1192,7 @@ SetTexinfo_QuArK(parser_t *parser, vec3_t planepts[3],
      */
     determinant = a * d - b * c;
     if (fabs(determinant) < ZERO_EPSILON) {
-        Message(msgWarning, warnDegenerateQuArKTX, parser->linenum);
+        Message(msgWarning, warnDegenerateQuArKTX, linenum);
         for (i = 0; i < 3; i++)
             out->vecs[0][i] = out->vecs[1][i] = 0;
     } else {
@@ -1440,100 +1445,141 @@ parse_error:
     Error("line %d: couldn't parse Brush Primitives texture info", parser->linenum);
 }
 
-static void
-ParseTextureDef(parser_t *parser, mapface_t &mapface, const mapbrush_t *brush, mtexinfo_t *tx,
-                vec3_t planepts[3], const qbsp_plane_t *plane)
-{
-    vec3_t texMat[2];
-    vec3_t axis[2];
-    vec_t shift[2], rotate, scale[2];
+/* A brush face as written in the .map, before any texture or plane lookups */
+struct mapfacedef_t {
+    int linenum;                // line the face starts on
+    int endlinenum;             // line the parser is on after the face
+    vec3_t planepts[3];
+    std::string texname;
     texcoord_style_t tx_type;
-    
-    memset(tx, 0, sizeof(*tx));
-
+    vec3_t texMat[2];           // brush primitives
+    vec3_t axis[2];             // Valve 220
+    vec_t shift[2], rotate, scale[2];
     quark_tx_info_t extinfo;
 
-    if (brush->format == brushformat_t::BRUSH_PRIMITIVES) {
-        ParseBrushPrimTX(parser, texMat);
-        tx_type = TX_BRUSHPRIM;
+    // filled in ahead of time by the parallel brush parser
+    bool precomputed = false;
+    bool normal_ok;
+    qbsp_plane_t plane;
+    stvecs vecs;                // TX_QUAKED and TX_VALVE_220 only
+};
+
+static void
+ParseTextureDef(parser_t *parser, brushformat_t format, mapfacedef_t &def)
+{
+    if (format == brushformat_t::BRUSH_PRIMITIVES) {
+        ParseBrushPrimTX(parser, def.texMat);
+        def.tx_type = TX_BRUSHPRIM;
         
         ParseToken(parser, PARSE_SAMELINE);
-        mapface.texname = std::string(parser->token);
-        
-        EnsureTexturesLoaded();
+        def.texname = std::string(parser->token);
         
         // Read extra Q2 params
-        extinfo = ParseExtendedTX(parser);
-    } else if (brush->format == brushformat_t::NORMAL) {
+        def.extinfo = ParseExtendedTX(parser);
+    } else if (format == brushformat_t::NORMAL) {
         ParseToken(parser, PARSE_SAMELINE);
-        mapface.texname = std::string(parser->token);
+        def.texname = std::string(parser->token);
         
         ParseToken(parser, PARSE_SAMELINE);
         if (!strcmp(parser->token, "[")) {
             parser->unget = true;
-            ParseValve220TX(parser, axis, shift, &rotate, scale);
-            tx_type = TX_VALVE_220;
+            ParseValve220TX(parser, def.axis, def.shift, &def.rotate, def.scale);
+            def.tx_type = TX_VALVE_220;
             
             // Read extra Q2 params
-            extinfo = ParseExtendedTX(parser);
+            def.extinfo = ParseExtendedTX(parser);
         } else {
-            shift[0] = atof(parser->token);
+            def.shift[0] = atof(parser->token);
             ParseToken(parser, PARSE_SAMELINE);
-            shift[1] = atof(parser->token);
+            def.shift[1] = atof(parser->token);
             ParseToken(parser, PARSE_SAMELINE);
-            rotate = atof(parser->token);
+            def.rotate = atof(parser->token);
             ParseToken(parser, PARSE_SAMELINE);
-            scale[0] = atof(parser->token);
+            def.scale[0] = atof(parser->token);
             ParseToken(parser, PARSE_SAMELINE);
-            scale[1] = atof(parser->token);
+            def.scale[1] = atof(parser->token);
             
             // Read extra Q2 params and/or QuArK subtype
-            extinfo = ParseExtendedTX(parser);
-            if (extinfo.quark_tx1) {
-                tx_type = TX_QUARK_TYPE1;
-            } else if (extinfo.quark_tx2) {
-                tx_type = TX_QUARK_TYPE2;
+            def.extinfo = ParseExtendedTX(parser);
+            if (def.extinfo.quark_tx1) {
+                def.tx_type = TX_QUARK_TYPE1;
+            } else if (def.extinfo.quark_tx2) {
+                def.tx_type = TX_QUARK_TYPE2;
             } else {
-                tx_type = TX_QUAKED;
+                def.tx_type = TX_QUAKED;
             }
         }
     }
+}
 
-    tx->miptex = FindMiptex(mapface.texname.c_str(), extinfo.info);
+static void
+SetTexinfoFromDef(mapface_t &mapface, mapfacedef_t &def, mtexinfo_t *tx)
+{
+    memset(tx, 0, sizeof(*tx));
+
+    if (def.tx_type == TX_BRUSHPRIM)
+        EnsureTexturesLoaded();
+
+    tx->miptex = FindMiptex(mapface.texname.c_str(), def.extinfo.info);
 
     const auto &miptex = map.miptex[tx->miptex];
-    mapface.contents = extinfo.info->contents;
-    tx->flags = mapface.flags = { extinfo.info->flags };
-    tx->value = mapface.value = extinfo.info->value;
+    mapface.contents = def.extinfo.info->contents;
+    tx->flags = mapface.flags = { def.extinfo.info->flags };
+    tx->value = mapface.value = def.extinfo.info->value;
 
     Q_assert(contentflags_t { mapface.contents }.is_valid(options.target_game, false));
 
-    if (!planepts || !plane)
-        return;
-
-    switch (tx_type) {
+    switch (def.tx_type) {
     case TX_QUARK_TYPE1:
     case TX_QUARK_TYPE2:
-        SetTexinfo_QuArK(parser, &planepts[0], tx_type, tx);
+        SetTexinfo_QuArK(def.endlinenum, &mapface.planepts[0], def.tx_type, tx);
         break;
     case TX_VALVE_220:
-        SetTexinfo_Valve220(axis, shift, scale, tx);
+        if (def.precomputed)
+            tx->vecs = def.vecs;
+        else
+            SetTexinfo_Valve220(def.axis, def.shift, def.scale, tx);
         break;
     case TX_BRUSHPRIM: {
         const texture_t *texture = WADList_GetTexture(mapface.texname.c_str());
         const int32_t width = texture ? texture->width : 64;
         const int32_t height = texture ? texture->height : 64;
 
-        SetTexinfo_BrushPrimitives(texMat, plane->normal, width, height, tx->vecs);
+        SetTexinfo_BrushPrimitives(def.texMat, mapface.plane.normal, width, height, tx->vecs);
         break;
     }
     case TX_QUAKED:
     default:
-        SetTexinfo_QuakeEd(plane, planepts, shift, rotate, scale, tx);
+        if (def.precomputed)
+            tx->vecs = def.vecs;
+        else
+            SetTexinfo_QuakeEd(&mapface.plane, mapface.planepts, def.shift, def.rotate, def.scale, tx);
         break;
     }
 }
 
+/*
+ * The parts of MakeBrushFace and SetTexinfoFromDef that only depend on the
+ * face itself, so the parallel brush parser can do them ahead of time
+ */
+static void
+PrecomputeFaceDef(mapfacedef_t &def)
+{
+    mapface_t face;
+    mtexinfo_t tx {};
+
+    def.normal_ok = face.set_planepts(def.planepts);
+    def.plane = face.plane;
+
+    if (def.tx_type == TX_VALVE_220)
+        SetTexinfo_Valve220(def.axis, def.shift, def.scale, &tx);
+    else
+        SetTexinfo_QuakeEd(&face.plane, face.planepts, def.shift, def.rotate, def.scale, &tx);
+    def.vecs = tx.vecs;
+
+    def.precomputed = true;
+}
+
 bool mapface_t::set_planepts(const vec3_t *pts)
 {
     for (int i=0; i<3; i++)
@@ -1624,26 +1670,39 @@ ValidateTextureProjection(mapface_t &mapface, mtexinfo_t *tx)
     }
 }
 
+static void
+ParseBrushFaceDef(parser_t *parser, brushformat_t format, mapfacedef_t &def)
+{
+    def.linenum = parser->linenum;
+    ParsePlaneDef(parser, def.planepts);
+    ParseTextureDef(parser, format, def);
+    def.endlinenum = parser->linenum;
+}
+
 static std::unique_ptr<mapface_t>
-ParseBrushFace(parser_t *parser, const mapbrush_t *brush, const mapentity_t *entity)
+MakeBrushFace(mapfacedef_t &def, const mapentity_t *entity)
 {
-    vec3_t planepts[3];
     bool normal_ok;
-    const qbsp_plane_t *plane;
     mtexinfo_t tx;
     int i, j;
     std::unique_ptr<mapface_t> face { new mapface_t };
 
-    face->linenum = parser->linenum;
-    ParsePlaneDef(parser, planepts);
+    face->linenum = def.linenum;
+    face->texname = def.texname;
 
-    normal_ok = face->set_planepts(planepts);
-    plane = &face->plane;
+    if (def.precomputed) {
+        for (i = 0; i < 3; i++)
+            VectorCopy(def.planepts[i], face->planepts[i]);
+        face->plane = def.plane;
+        normal_ok = def.normal_ok;
+    } else {
+        normal_ok = face->set_planepts(def.planepts);
+    }
 
-    ParseTextureDef(parser, *face, brush, &tx, face->planepts, plane);
+    SetTexinfoFromDef(*face, def, &tx);
 
     if (!normal_ok) {
-        Message(msgWarning, warnNoPlaneNormal, parser->linenum);
+        Message(msgWarning, warnNoPlaneNormal, def.endlinenum);
         return nullptr;
     }
 
@@ -1666,6 +1725,57 @@ ParseBrushFace(parser_t *parser, const mapbrush_t *brush, const mapentity_t *ent
     return face;
 }
 
+static void
+AddBrushFace(mapbrush_t &brush, std::unique_ptr<mapface_t> face, int linenum)
+{
+    if (face.get() == nullptr)
+        return;
+
+    // FIXME: can we move this somewhere later?
+    if (options.target_game->id == GAME_QUAKE_II) {
+        // translucent objects are automatically classified as detail
+        if ((face->flags.native & (Q2_SURF_TRANS33 | Q2_SURF_TRANS66))
+            || (face->contents & (Q2_CONTENTS_PLAYERCLIP | Q2_CONTENTS_MONSTERCLIP)))
+            face->contents |= Q2_CONTENTS_DETAIL;
+
+        if (!(face->contents & (((Q2_LAST_VISIBLE_CONTENTS << 1)-1) 
+            | Q2_CONTENTS_PLAYERCLIP | Q2_CONTENTS_MONSTERCLIP)  ) )
+            face->contents |= Q2_CONTENTS_SOLID;
+
+        // hints and skips are never detail, and have no content
+        if (face->flags.native & (Q2_SURF_HINT | Q2_SURF_SKIP) )
+        {
+            face->contents = 0;
+            face->contents &= ~Q2_CONTENTS_DETAIL;
+        }
+    }
+
+    /* Check for duplicate planes */
+    bool discardFace = false;
+    for (int i = 0; i<brush.numfaces; i++) {
+        const mapface_t &check = brush.face(i);
+        if (PlaneEqual(&check.plane, &face->plane)) {
+            Message(msgWarning, warnBrushDuplicatePlane, linenum);
+            discardFace = true;
+            continue;
+        }
+        if (PlaneInvEqual(&check.plane, &face->plane)) {
+            /* FIXME - this is actually an invalid brush */
+            Message(msgWarning, warnBrushDuplicatePlane, linenum);
+            continue;
+        }
+    }
+    if (discardFace)
+        return;
+
+    /* Save the face, update progress */
+    
+    if (0 == brush.numfaces)
+        brush.firstface = map.faces.size();
+    brush.numfaces++;
+    map.faces.push_back(*face);
+}
+
 mapbrush_t
 ParseBrush(parser_t *parser, const mapentity_t *entity)
 {
@@ -1697,53 +1807,9 @@ ParseBrush(parser_t *parser, const mapentity_t *entity)
         if (!strcmp(parser->token, "}"))
             break;
         
-        std::unique_ptr<mapface_t> face = ParseBrushFace(parser, &brush, entity);
-        if (face.get() == nullptr)
-            continue;
-
-        // FIXME: can we move this somewhere later?
-        if (options.target_game->id == GAME_QUAKE_II) {
-		    // translucent objects are automatically classified as detail
-		    if ((face->flags.native & (Q2_SURF_TRANS33 | Q2_SURF_TRANS66))
-                || (face->contents & (Q2_CONTENTS_PLAYERCLIP | Q2_CONTENTS_MONSTERCLIP)))
-			    face->contents |= Q2_CONTENTS_DETAIL;
-
-		    if (!(face->contents & (((Q2_LAST_VISIBLE_CONTENTS << 1)-1) 
-			    | Q2_CONTENTS_PLAYERCLIP | Q2_CONTENTS_MONSTERCLIP)  ) )
-			    face->contents |= Q2_CONTENTS_SOLID;
-
-		    // hints and skips are never detail, and have no content
-		    if (face->flags.native & (Q2_SURF_HINT | Q2_SURF_SKIP) )
-		    {
-			    face->contents = 0;
-			    face->contents &= ~Q2_CONTENTS_DETAIL;
-		    }
-        }
-
-        /* Check for duplicate planes */
-        bool discardFace = false;
-        for (int i = 0; i<brush.numfaces; i++) {
-            const mapface_t &check = brush.face(i);
-            if (PlaneEqual(&check.plane, &face->plane)) {
-                Message(msgWarning, warnBrushDuplicatePlane, parser->linenum);
-                discardFace = true;
-                continue;
-            }
-            if (PlaneInvEqual(&check.plane, &face->plane)) {
-                /* FIXME - this is actually an invalid brush */
-                Message(msgWarning, warnBrushDuplicatePlane, parser->linenum);
-                continue;
-            }
-        }
-        if (discardFace)
-            continue;
-
-        /* Save the face, update progress */
-        
-        if (0 == brush.numfaces)
-            brush.firstface = map.faces.size();
-        brush.numfaces++;
-        map.faces.push_back(*face);
+        mapfacedef_t def;
+        ParseBrushFaceDef(parser, brush.format, def);
+        AddBrushFace(brush, MakeBrushFace(def, entity), def.endlinenum);
     }
     
     // ericw -- brush primitives - there should be another closing }
@@ -1758,6 +1824,373 @@ ParseBrush(parser_t *parser, const mapentity_t *entity)
     return brush;
 }
 
+/*
+ * Parallel brush parsing
+ *
+ * Before the serial parse, PreparseBrushes scans the entity/brush brace
+ * structure of the file and parses the text of every brush in parallel into
+ * a mapbrushdef_t, using the zero-copy tokenizer and no global state.
+ * ParseEntity then picks up the preparsed brush at each "{" and only does the
+ * order dependent work (miptex and texinfo numbering, warnings) serially, so
+ * the result is the same as a fully serial parse. Brushes the fast path gives
+ * up on (syntax errors, escaped strings) are parsed again by ParseBrush,
+ * which reports any errors with the right line numbers.
+ */
+struct mapbrushdef_t {
+    const char *start;          // just after the opening {
+    const char *end;            // just after the closing }
+    int linenum;                // parser line at start
+    int endlinenum;             // parser line at end
+    bool ok;                    // parsed by the fast path
+    brushformat_t format;
+    std::vector<mapfacedef_t> faces;
+};
+
+static std::vector<mapbrushdef_t> preparsed_brushes;
+
+static vec_t
+ParseFloatView(std::string_view token)
+{
+#ifdef __cpp_lib_to_chars
+    double value;
+    const auto result = std::from_chars(token.data(), token.data() + token.size(), value);
+    if (result.ec == std::errc() && result.ptr == token.data() + token.size())
+        return value;
+#endif
+    // anything from_chars doesn't read the same way as atof (leading +, hex, trailing junk)
+    char buf[MAXTOKEN];
+    memcpy(buf, token.data(), token.size());
+    buf[token.size()] = 0;
+    return atof(buf);
+}
+
+static int
+ParseIntView(std::string_view token)
+{
+    int value;
+    const auto result = std::from_chars(token.data(), token.data() + token.size(), value);
+    if (result.ec == std::errc() && result.ptr == token.data() + token.size())
+        return value;
+
+    char buf[MAXTOKEN];
+    memcpy(buf, token.data(), token.size());
+    buf[token.size()] = 0;
+    return atoi(buf);
+}
+
+static bool
+PreparseToken(parser_t *parser, int flags, std::string_view *token)
+{
+    return ParseTokenView(parser, flags, token) == PARSEVIEW_TOKEN;
+}
+
+static bool
+PreparseFloats(parser_t *parser, vec_t *out, int count)
+{
+    std::string_view token;
+
+    for (int i = 0; i < count; i++) {
+        if (!PreparseToken(parser, PARSE_SAMELINE, &token))
+            return false;
+        out[i] = ParseFloatView(token);
+    }
+    return true;
+}
+
+/* same as ParsePlaneDef; the opening ( has already been read */
+static bool
+PreparsePlaneDef(parser_t *parser, vec3_t planepts[3])
+{
+    std::string_view token;
+
+    for (int i = 0; i < 3; i++) {
+        if (i != 0 && (!PreparseToken(parser, PARSE_NORMAL, &token) || token != "("))
+            return false;
+        if (!PreparseFloats(parser, planepts[i], 3))
+            return false;
+        if (!PreparseToken(parser, PARSE_SAMELINE, &token) || token != ")")
+            return false;
+    }
+    return true;
+}
+
+static bool
+PreparseExtendedTX(parser_t *parser, quark_tx_info_t &result)
+{
+    std::string_view token;
+    parseview_t status;
+
+    status = ParseTokenView(parser, PARSE_COMMENT | PARSE_OPTIONAL, &token);
+    if (status == PARSEVIEW_TOKEN) {
+        if (token.substr(0, 4) == "//TX" && token.size() > 4) {
+            if (token[4] == '1')
+                result.quark_tx1 = true;
+            else if (token[4] == '2')
+                result.quark_tx2 = true;
+        }
+        return true;
+    }
+    if (status != PARSEVIEW_NONE)
+        return false;
+
+    // Parse extra Quake 2 surface info
+    status = ParseTokenView(parser, PARSE_OPTIONAL, &token);
+    if (status == PARSEVIEW_NONE)
+        return true;
+    if (status != PARSEVIEW_TOKEN)
+        return false;
+    result.info = extended_texinfo_t { ParseIntView(token) };
+
+    status = ParseTokenView(parser, PARSE_OPTIONAL, &token);
+    if (status == PARSEVIEW_TOKEN)
+        result.info->flags = ParseIntView(token);
+    else if (status != PARSEVIEW_NONE)
+        return false;
+
+    status = ParseTokenView(parser, PARSE_OPTIONAL, &token);
+    if (status == PARSEVIEW_TOKEN)
+        result.info->value = ParseIntView(token);
+    else if (status != PARSEVIEW_NONE)
+        return false;
+
+    return true;
+}
+
+/* same as ParseTextureDef */
+static bool
+PreparseTextureDef(parser_t *parser, brushformat_t format, mapfacedef_t &def)
+{
+    std::string_view token;
+
+    if (format == brushformat_t::BRUSH_PRIMITIVES) {
+        if (!PreparseToken(parser, PARSE_SAMELINE, &token) || token != "(")
+            return false;
+        for (int i = 0; i < 2; i++) {
+            if (!PreparseToken(parser, PARSE_SAMELINE, &token) || token != "(")
+                return false;
+            if (!PreparseFloats(parser, def.texMat[i], 3))
+                return false;
+            if (!PreparseToken(parser, PARSE_SAMELINE, &token) || token != ")")
+                return false;
+        }
+        if (!PreparseToken(parser, PARSE_SAMELINE, &token) || token != ")")
+            return false;
+        def.tx_type = TX_BRUSHPRIM;
+
+        if (!PreparseToken(parser, PARSE_SAMELINE, &token))
+            return false;
+        def.texname = std::string(token);
+
+        return PreparseExtendedTX(parser, def.extinfo);
+    }
+
+    if (!PreparseToken(parser, PARSE_SAMELINE, &token))
+        return false;
+    def.texname = std::string(token);
+
+    if (!PreparseToken(parser, PARSE_SAMELINE, &token))
+        return false;
+    if (token == "[") {
+        for (int i = 0; i < 2; i++) {
+            if (i != 0 && (!PreparseToken(parser, PARSE_SAMELINE, &token) || token != "["))
+                return false;
+            if (!PreparseFloats(parser, def.axis[i], 3) || !PreparseFloats(parser, &def.shift[i], 1))
+                return false;
+            if (!PreparseToken(parser, PARSE_SAMELINE, &token) || token != "]")
+                return false;
+        }
+        if (!PreparseFloats(parser, &def.rotate, 1) || !PreparseFloats(parser, def.scale, 2))
+            return false;
+        def.tx_type = TX_VALVE_220;
+
+        return PreparseExtendedTX(parser, def.extinfo);
+    }
+
+    def.shift[0] = ParseFloatView(token);
+    if (!PreparseFloats(parser, &def.shift[1], 1) || !PreparseFloats(parser, &def.rotate, 1)
+        || !PreparseFloats(parser, def.scale, 2))
+        return false;
+
+    if (!PreparseExtendedTX(parser, def.extinfo))
+        return false;
+    if (def.extinfo.quark_tx1) {
+        def.tx_type = TX_QUARK_TYPE1;
+    } else if (def.extinfo.quark_tx2) {
+        def.tx_type = TX_QUARK_TYPE2;
+    } else {
+        def.tx_type = TX_QUAKED;
+    }
+    return true;
+}
+
+/* same as ParseBrush, up to the point where global state is touched */
+static bool
+PreparseBrush(parser_t *parser, mapbrushdef_t &brush)
+{
+    std::string_view token;
+    bool have_token = false;
+
+    if (!PreparseToken(parser, PARSE_NORMAL, &token))
+        return false;
+
+    if (token == "(") {
+        brush.format = brushformat_t::NORMAL;
+        have_token = true;
+    } else {
+        brush.format = brushformat_t::BRUSH_PRIMITIVES;
+        if (token == "brushDef" && !PreparseToken(parser, PARSE_NORMAL, &token))
+            return false;
+        if (token != "{")
+            return false;
+    }
+
+    while (1) {
+        if (!have_token && !PreparseToken(parser, PARSE_NORMAL, &token))
+            return false;
+        have_token = false;
+
+        if (token == "}")
+            break;
+        if (token != "(")
+            return false;
+
+        mapfacedef_t def;
+        def.linenum = parser->linenum;
+        if (!PreparsePlaneDef(parser, def.planepts) || !PreparseTextureDef(parser, brush.format, def))
+            return false;
+        def.endlinenum = parser->linenum;
+
+        brush.faces.push_back(std::move(def));
+    }
+
+    if (brush.format == brushformat_t::BRUSH_PRIMITIVES) {
+        if (!PreparseToken(parser, PARSE_NORMAL, &token) || token != "}")
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Finds where the brushes start and end, following the same token rules as
+ * ParseEntity. Stops at the first thing ParseEntity would complain about;
+ * the brushes found up to there are still valid.
+ */
+static void
+PrescanBrushes(const char *buf, std::vector<mapbrushdef_t> &brushes)
+{
+    parser_t parser;
+    std::string_view token;
+    parseview_t status;
+
+    ParserInit(&parser, buf);
+
+    while (1) {
+        status = ParseTokenView(&parser, PARSE_NORMAL, &token);
+        if (status == PARSEVIEW_NONE || status == PARSEVIEW_FAIL || token != "{")
+            return;
+
+        while (1) {
+            status = ParseTokenView(&parser, PARSE_NORMAL, &token);
+            if (status == PARSEVIEW_NONE || status == PARSEVIEW_FAIL)
+                return;
+            if (token == "}")
+                break;
+
+            if (token == "{") {
+                mapbrushdef_t brush {};
+                brush.start = parser.pos;
+                brush.linenum = parser.linenum;
+
+                for (int depth = 1; depth; ) {
+                    status = ParseTokenView(&parser, PARSE_NORMAL, &token);
+                    if (status == PARSEVIEW_NONE || status == PARSEVIEW_FAIL)
+                        return;
+                    if (token == "{")
+                        depth++;
+                    else if (token == "}")
+                        depth--;
+                }
+
+                brush.end = parser.pos;
+                brush.endlinenum = parser.linenum;
+                brushes.push_back(std::move(brush));
+                continue;
+            }
+
+            /* epair value */
+            status = ParseTokenView(&parser, PARSE_SAMELINE, &token);
+            if (status == PARSEVIEW_NONE || status == PARSEVIEW_FAIL)
+                return;
+        }
+    }
+}
+
+static void
+PreparseBrushes(const char *buf)
+{
+    preparsed_brushes.clear();
+    PrescanBrushes(buf, preparsed_brushes);
+
+    tbb::parallel_for(static_cast<size_t>(0), preparsed_brushes.size(), [](const size_t i) {
+        mapbrushdef_t &brush = preparsed_brushes[i];
+        parser_t parser;
+
+        parser.pos = brush.start;
+        parser.linenum = brush.linenum;
+        parser.unget = false;
+
+        brush.ok = PreparseBrush(&parser, brush)
+            && parser.pos == brush.end
+            && parser.linenum == brush.endlinenum;
+        if (!brush.ok) {
+            brush.faces.clear();
+            return;
+        }
+
+        for (mapfacedef_t &def : brush.faces) {
+            if (def.tx_type == TX_QUAKED || def.tx_type == TX_VALVE_220)
+                PrecomputeFaceDef(def);
+        }
+    });
+}
+
+static void
+FreePreparsedBrushes(void)
+{
+    std::vector<mapbrushdef_t>().swap(preparsed_brushes);
+}
+
+/* the preparsed brush starting at the parser's position, if there is one */
+static mapbrushdef_t *
+FindPreparsedBrush(const parser_t *parser)
+{
+    auto it = std::lower_bound(preparsed_brushes.begin(), preparsed_brushes.end(), parser->pos,
+                               [](const mapbrushdef_t &brush, const char *pos) {
+        return brush.start < pos;
+    });
+
+    if (it == preparsed_brushes.end() || !it->ok || it->start != parser->pos
+        || it->linenum != parser->linenum || parser->unget)
+        return nullptr;
+    return &*it;
+}
+
+static mapbrush_t
+MakePreparsedBrush(parser_t *parser, mapbrushdef_t &def, const mapentity_t *entity)
+{
+    mapbrush_t brush;
+
+    brush.format = def.format;
+    for (mapfacedef_t &face : def.faces)
+        AddBrushFace(brush, MakeBrushFace(face, entity), face.endlinenum);
+
+    parser->pos = def.end;
+    parser->linenum = def.endlinenum;
+
+    return brush;
+}
+
 bool
 ParseEntity(parser_t *parser, mapentity_t *entity)
 {
@@ -1774,7 +2207,9 @@ ParseEntity(parser_t *parser, mapentity_t *entity)
         if (!strcmp(parser->token, "}"))
             break;
         else if (!strcmp(parser->token, "{")) {
-            mapbrush_t brush = ParseBrush(parser, entity);
+            mapbrushdef_t *def = FindPreparsedBrush(parser);
+            mapbrush_t brush = def ? MakePreparsedBrush(parser, *def, entity)
+                                   : ParseBrush(parser, entity);
             
             if (0 == entity->nummapbrushes)
                 entity->firstmapbrush = map.brushes.size();
@@ -1988,11 +2423,12 @@ IsWorldBrushEntity(const mapentity_t *entity)
 mapentity_t LoadExternalMap(const char *filename)
 {
     parser_t parser;
-    char *buf;
-    int length;
+    const char *buf;
+    size_t length;
     mapentity_t dest {};
     
-    length = LoadFile(filename, &buf, true);
+    length = MapFile(filename, &buf, true);
+    PreparseBrushes(buf);
     ParserInit(&parser, buf);
     
     // parse the worldspawn
@@ -2026,7 +2462,8 @@ mapentity_t LoadExternalMap(const char *filename)
     
     Message(msgStat, "LoadExternalMap: '%s': Loaded %d mapbrushes.\n", filename, dest.nummapbrushes);
     
-    free(buf);
+    FreePreparsedBrushes();
+    UnmapFile(buf, length);
     
     return dest;
 }
@@ -2035,12 +2472,13 @@ void
 LoadMapFile(void)
 {
     parser_t parser;
-    char *buf;
-    int length;
+    const char *buf;
+    size_t length;
 
     Message(msgProgress, "LoadMapFile");
 
-    length = LoadFile(options.szMapName, &buf, true);
+    length = MapFile(options.szMapName, &buf, true);
+    PreparseBrushes(buf);
     ParserInit(&parser, buf);
 
     for (int i=0; ; i++) {
@@ -2056,7 +2494,8 @@ LoadMapFile(void)
     assert(map.entities.back().numbrushes == 0);
     map.entities.pop_back();
 
-    free(buf);
+    FreePreparsedBrushes();
+    UnmapFile(buf, length);
 
     // Print out warnings for entities
     if (!(rgfStartSpots & info_player_start))
@@ -2423,7 +2862,7 @@ WriteBspBrushMap(const char *name, const std::vector<const brush_t *> &list)
             
             fprintf (f, "notexture 0 0 0 1 1\n" );
             
-            free(w);
+            FreeMem(w, WINDING);
         }
         fprintf (f, "}\n");
     }
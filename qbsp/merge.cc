@@ -22,6 +22,14 @@
 
 #include <qbsp/qbsp.hh>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "tbb/parallel_for.h"
+
 #ifdef PARANOID
 static void
 CheckColinear(face_t *f)
@@ -185,7 +193,7 @@ MergeFaceToList(face_t *face, face_t *list)
 #endif
         newf = TryMerge(face, f);
         if (newf) {
-            free(face);
+            FreeMem(face, FACE);
             f->w.numpoints = -1;        // merged out, remove later
             face = newf;
             f = list;
@@ -213,7 +221,7 @@ FreeMergeListScraps(face_t *merged)
     for (; merged; merged = next) {
         next = merged->next;
         if (merged->w.numpoints == -1)
-            free(merged);
+            FreeMem(merged, FACE);
         else {
             merged->next = head;
             head = merged;
@@ -224,47 +232,159 @@ FreeMergeListScraps(face_t *merged)
 }
 
 
+/*
+ * Faces on a plane that can share an edge must share its endpoints, so
+ * MergePlaneFaces indexes the merged list by vertex in a grid of 1 unit
+ * cells and only tries faces near one of the incoming face's vertexes.
+ * Short lists aren't worth indexing and just try every face.
+ */
+#define MERGE_GRID_MINFACES 16
+
+using mergegrid_t = std::unordered_map<uint64_t, std::vector<int>>;
+
+static uint64_t
+MergeGridKey(const int cell[3])
+{
+    return (static_cast<uint64_t>(cell[0] & 0x1fffff) << 42)
+         | (static_cast<uint64_t>(cell[1] & 0x1fffff) << 21)
+         | static_cast<uint64_t>(cell[2] & 0x1fffff);
+}
+
+static void
+MergeGridAdd(mergegrid_t &grid, const face_t *face, const int index)
+{
+    for (int i = 0; i < face->w.numpoints; i++) {
+        int cell[3];
+        for (int j = 0; j < 3; j++)
+            cell[j] = static_cast<int>(floor(face->w.points[i][j]));
+        std::vector<int> &faces = grid[MergeGridKey(cell)];
+        if (faces.empty() || faces.back() != index)
+            faces.push_back(index);
+    }
+}
+
+/*
+ * Adds the index of every face with a vertex within EQUAL_EPSILON of one of
+ * `face`'s vertexes. A vertex that close to a cell boundary also checks the
+ * cell on the other side.
+ */
+static void
+MergeGridCandidates(const mergegrid_t &grid, const face_t *face, std::vector<int> &out)
+{
+    for (int i = 0; i < face->w.numpoints; i++) {
+        int lo[3], hi[3];
+        for (int j = 0; j < 3; j++) {
+            const vec_t v = face->w.points[i][j];
+            lo[j] = static_cast<int>(floor(v - 2 * EQUAL_EPSILON));
+            hi[j] = static_cast<int>(floor(v + 2 * EQUAL_EPSILON));
+        }
+
+        int cell[3];
+        for (cell[0] = lo[0]; cell[0] <= hi[0]; cell[0]++)
+            for (cell[1] = lo[1]; cell[1] <= hi[1]; cell[1]++)
+                for (cell[2] = lo[2]; cell[2] <= hi[2]; cell[2]++) {
+                    const auto it = grid.find(MergeGridKey(cell));
+                    if (it != grid.end())
+                        out.insert(out.end(), it->second.begin(), it->second.end());
+                }
+    }
+}
+
 /*
 ===============
 MergePlaneFaces
+
+Same result as running every face through MergeFaceToList: each incoming
+face tries the merged faces newest first and restarts after a merge.
 ===============
 */
 void
 MergePlaneFaces(surface_t *plane)
 {
-    face_t *f, *next;
-    face_t *merged;
+    std::vector<face_t *> merged;   // in the order they were added
+    std::vector<int> candidates;
+    mergegrid_t grid;
+
+    int numfaces = 0;
+    for (const face_t *f = plane->faces; f; f = f->next)
+        numfaces++;
+    const bool usegrid = numfaces >= MERGE_GRID_MINFACES;
+
+    face_t *next;
+    for (face_t *face = plane->faces; face; face = next) {
+        next = face->next;
+
+        bool again = true;
+        while (again) {
+            again = false;
+
+            candidates.clear();
+            if (usegrid) {
+                MergeGridCandidates(grid, face, candidates);
+                std::sort(candidates.begin(), candidates.end(), std::greater<int>());
+                candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+            } else {
+                for (int i = static_cast<int>(merged.size()) - 1; i >= 0; i--)
+                    candidates.push_back(i);
+            }
 
-    merged = NULL;
+            for (const int i : candidates) {
+                face_t *newf = TryMerge(face, merged[i]);
+                if (newf) {
+                    FreeMem(face, FACE);
+                    merged[i]->w.numpoints = -1;        // merged out, remove later
+                    face = newf;
+                    again = true;
+                    break;
+                }
+            }
+        }
 
-    for (f = plane->faces; f; f = next) {
-        next = f->next;
-        merged = MergeFaceToList(f, merged);
+        if (usegrid)
+            MergeGridAdd(grid, face, static_cast<int>(merged.size()));
+        merged.push_back(face);
     }
 
     // Remove all empty faces (numpoints == -1) and add the remaining
-    // faces to the plane
-    plane->faces = FreeMergeListScraps(merged);
+    // faces to the plane, oldest first as FreeMergeListScraps would
+    face_t *head = NULL;
+    for (auto it = merged.rbegin(); it != merged.rend(); ++it) {
+        face_t *f = *it;
+        if (f->w.numpoints == -1)
+            FreeMem(f, FACE);
+        else {
+            f->next = head;
+            head = f;
+        }
+    }
+    plane->faces = head;
 }
 
 
 /*
 ============
 MergeAll
+
+Surfaces don't share faces, so each plane is merged in parallel.
 ============
 */
 void
 MergeAll(surface_t *surfhead)
 {
-    surface_t *surf;
     int mergefaces = 0;
-    face_t *f;
 
     Message(msgProgress, "MergeAll");
 
-    for (surf = surfhead; surf; surf = surf->next) {
-        MergePlaneFaces(surf);
-        for (f = surf->faces; f; f = f->next)
+    std::vector<surface_t *> surfs;
+    for (surface_t *surf = surfhead; surf; surf = surf->next)
+        surfs.push_back(surf);
+
+    tbb::parallel_for(static_cast<size_t>(0), surfs.size(), [&surfs](const size_t i) {
+        MergePlaneFaces(surfs[i]);
+    });
+
+    for (const surface_t *surf : surfs) {
+        for (const face_t *f = surf->faces; f; f = f->next)
             mergefaces++;
     }
 
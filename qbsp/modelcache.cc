@@ -0,0 +1,793 @@
+/*
+    Copyright (C) 1996-1997  Id Software, Inc.
+    Copyright (C) 1997       Greg Lewis
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+// modelcache.c
+
+#include <qbsp/qbsp.hh>
+#include <qbsp/modelcache.hh>
+
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Everything a bmodel appends to the exported lumps during one hull refers
+ * only to its own nodes/leafs/faces/edges/vertexes (the edge and vertex
+ * hashes are reset for every entity), plus shared planes and texinfo. So a
+ * cache entry stores the appended ranges along with the bases they were
+ * written at, and planes/texinfo by value; splicing re-bases the indices
+ * and exports the planes and texinfo in the same order a real compile
+ * would, so the numbering comes out the same.
+ *
+ * The planes and textures an entity adds to the map while compiling (e.g.
+ * expanded hull planes) are recreated too, in the same order, since later
+ * entities' BSP choices depend on the plane numbering. For the same reason
+ * an entity's own tree depends on the relative order of its brush planes,
+ * so that order is recorded and checked before splicing; e.g. a world edit
+ * that adds one of the entity's planes earlier forces a rebuild.
+ *
+ * The world is never cached: it pulls in func_detail/func_group brushes
+ * and the point entities for the outside fill, and its hull 0 pass writes
+ * the portal and leak files.
+ */
+
+#define MODELCACHE_IDENT "QBMC"
+#define MODELCACHE_VERSION 2
+
+struct modelcacheheader_t {
+    char identification[4];
+    int version;
+    uint64_t key;
+    int hullnum;
+
+    // sizes of the exported lumps when the entity was compiled
+    int nodebase, leafbase, marksurfacebase, facebase, surfedgebase, edgebase, vertexbase, clipnodebase;
+
+    int numbrushplanes, numnewplanes, numnewmiptex;
+    int numplanes, numtexinfos;
+    int numnodes, numleafs, nummarksurfaces, numfaces, numsurfedges, numedges, numvertexes, numclipnodes;
+    int originlen;
+
+    dmodelh2_t model;
+};
+
+struct modelcacheplane_t {
+    vec3_t normal;
+    vec_t dist;
+};
+
+struct modelcachetexinfo_t {
+    char texture[32];
+    stvecs vecs;
+    surfflags_t flags;
+    int32_t value;
+};
+
+struct modelcachebrushplane_t {
+    vec3_t normal;
+    vec_t dist;
+    int isnew;      // added by this entity, rather than already in the map
+};
+
+struct modelcachemiptex_t {
+    char name[32];
+};
+
+struct modelcachemark_t {
+    size_t planes, miptex;
+    size_t nodes, leafs, marksurfaces, faces, surfedges, edges, vertexes, clipnodes;
+};
+
+static std::vector<uint64_t> cachekeys;
+static std::vector<bool> cachekeys_valid;
+static modelcachemark_t cachemark;
+static std::vector<int> cachebrushplanes;
+
+/* reverse of qbsp_plane_t::outputplanenum, grown as planes are exported */
+static std::vector<int> outputplanes;
+
+static bool
+ModelCache_Enabled(const mapentity_t *entity, const int hullnum)
+{
+    if (options.bmodelCacheDir.empty())
+        return false;
+    if (entity == pWorldEnt() || hullnum < 0)
+        return false;
+    // Q2 also exports brush lists per leaf, which aren't cached
+    if (options.target_game->id == GAME_QUAKE_II)
+        return false;
+    return true;
+}
+
+//============================================================================
+
+static void
+HashBytes(uint64_t *hash, const void *data, size_t len)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+    for (size_t i = 0; i < len; i++) {
+        *hash ^= bytes[i];
+        *hash *= 0x100000001b3ULL;
+    }
+}
+
+template <typename T>
+static void
+HashValue(uint64_t *hash, const T &value)
+{
+    HashBytes(hash, &value, sizeof(value));
+}
+
+static void
+HashString(uint64_t *hash, const char *str)
+{
+    // include the terminator so "ab" "c" and "a" "bc" differ
+    HashBytes(hash, str, strlen(str) + 1);
+}
+
+static void
+HashSurfFlags(uint64_t *hash, const surfflags_t &flags)
+{
+    HashValue(hash, flags.native);
+    HashValue(hash, flags.extended);
+    HashValue(hash, flags.phong_angle);
+    HashValue(hash, flags.minlight);
+    HashValue(hash, flags.minlight_color);
+    HashValue(hash, flags.phong_angle_concave);
+    HashValue(hash, flags.light_alpha);
+}
+
+static void
+HashOptions(uint64_t *hash)
+{
+    HashString(hash, stringify(ERICWTOOLS_VERSION));
+    HashValue(hash, MODELCACHE_VERSION);
+    HashString(hash, options.target_version->short_name);
+    HashValue(hash, options.fNoclip);
+    HashValue(hash, options.fNoskip);
+    HashValue(hash, options.fNodetail);
+    HashValue(hash, options.fSplitspecial);
+    HashValue(hash, options.fSplitturb);
+    HashValue(hash, options.fSplitsky);
+    HashValue(hash, options.fTranswater);
+    HashValue(hash, options.fTranssky);
+    HashValue(hash, options.fOldaxis);
+    HashValue(hash, options.forceGoodTree);
+    HashValue(hash, options.fixRotateObjTexture);
+    HashValue(hash, options.fNoTextures);
+    HashValue(hash, options.dxSubdivide);
+    HashValue(hash, options.maxNodeSize);
+    HashValue(hash, options.midsplitSurfFraction);
+    HashValue(hash, options.on_epsilon);
+    HashValue(hash, options.fOmitDetail);
+    HashValue(hash, options.fOmitDetailWall);
+    HashValue(hash, options.fOmitDetailIllusionary);
+    HashValue(hash, options.fOmitDetailFence);
+    HashValue(hash, options.fContentHack);
+    HashValue(hash, options.fTestExpand);
+    HashValue(hash, options.worldExtent);
+}
+
+static void
+HashTexinfo(uint64_t *hash, int texinfonum)
+{
+    const mtexinfo_t &texinfo = map.mtexinfos.at(texinfonum);
+
+    HashString(hash, map.miptex.at(texinfo.miptex).name.c_str());
+    HashValue(hash, texinfo.vecs);
+    HashSurfFlags(hash, texinfo.flags);
+    HashValue(hash, texinfo.value);
+}
+
+uint64_t
+ModelCache_EntityKey(const mapentity_t *entity)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    HashOptions(&hash);
+
+    // "model" is assigned by qbsp itself
+    for (const epair_t *epair = entity->epairs; epair; epair = epair->next) {
+        if (!Q_strcasecmp(epair->key, "model"))
+            continue;
+        HashString(&hash, epair->key);
+        HashString(&hash, epair->value);
+    }
+
+    // hipnotic rotation takes its origin from the target entity
+    const char *target = ValueForKey(entity, "target");
+    if (!strncmp(ValueForKey(entity, "classname"), "rotate_", 7) && target[0]) {
+        for (int i = 0; i < map.numentities(); i++) {
+            const mapentity_t *other = &map.entities.at(i);
+            if (!strcmp(ValueForKey(other, "targetname"), target)) {
+                HashString(&hash, ValueForKey(other, "origin"));
+                break;
+            }
+        }
+    }
+
+    HashValue(&hash, entity->nummapbrushes);
+    for (int i = 0; i < entity->nummapbrushes; i++) {
+        const mapbrush_t &mapbrush = entity->mapbrush(i);
+
+        HashValue(&hash, mapbrush.numfaces);
+        HashValue(&hash, mapbrush.format);
+        HashValue(&hash, mapbrush.contents);
+        for (int j = 0; j < mapbrush.numfaces; j++) {
+            const mapface_t &mapface = mapbrush.face(j);
+
+            HashValue(&hash, mapface.plane.normal);
+            HashValue(&hash, mapface.plane.dist);
+            HashString(&hash, mapface.texname.c_str());
+            HashTexinfo(&hash, mapface.texinfo);
+            HashSurfFlags(&hash, mapface.flags);
+            HashValue(&hash, mapface.contents);
+            HashValue(&hash, mapface.value);
+        }
+    }
+
+    return hash;
+}
+
+/*
+ * The key is computed the first time an entity is processed, since
+ * processing can set keys (e.g. "origin" from an origin brush).
+ */
+static uint64_t
+ModelCache_Key(const mapentity_t *entity)
+{
+    const size_t index = entity - &map.entities.at(0);
+
+    if (cachekeys.size() < map.entities.size()) {
+        cachekeys.resize(map.entities.size());
+        cachekeys_valid.resize(map.entities.size());
+    }
+    if (!cachekeys_valid[index]) {
+        cachekeys[index] = ModelCache_EntityKey(entity);
+        cachekeys_valid[index] = true;
+    }
+    return cachekeys[index];
+}
+
+static std::string
+ModelCache_Path(uint64_t key, const int hullnum)
+{
+    char name[64];
+
+    q_snprintf(name, sizeof(name), "/%016llx-%d.bmc", static_cast<unsigned long long>(key), hullnum);
+    return options.bmodelCacheDir + name;
+}
+
+//============================================================================
+
+template <typename T>
+static bool
+ReadArray(FILE *f, std::vector<T> &vec, int count)
+{
+    if (count < 0)
+        return false;
+    vec.resize(count);
+    return fread(vec.data(), sizeof(T), vec.size(), f) == vec.size();
+}
+
+template <typename T>
+static void
+WriteArray(FILE *f, const T *data, size_t count)
+{
+    fwrite(data, sizeof(T), count, f);
+}
+
+static void
+ExportCachedClipPlanes_r(const std::vector<bsp2_dclipnode_t> &clipnodes, const std::vector<int> &planenums,
+                         int nodenum, int clipnodebase)
+{
+    if (nodenum < 0)
+        return;
+
+    // ExportClipNodes exports the plane after both children
+    const bsp2_dclipnode_t &clipnode = clipnodes.at(nodenum - clipnodebase);
+    ExportCachedClipPlanes_r(clipnodes, planenums, clipnode.children[0], clipnodebase);
+    ExportCachedClipPlanes_r(clipnodes, planenums, clipnode.children[1], clipnodebase);
+    ExportMapPlane(planenums.at(clipnode.planenum));
+}
+
+/*
+==================
+ModelCache_Splice
+
+Returns true if the entity's output for this hull was found in the cache
+and appended to the exported lumps.
+==================
+*/
+bool
+ModelCache_Splice(mapentity_t *entity, const int hullnum)
+{
+    modelcacheheader_t header;
+    std::vector<modelcachebrushplane_t> brushplanes;
+    std::vector<modelcacheplane_t> newplanes;
+    std::vector<modelcachemiptex_t> newmiptex;
+    std::vector<modelcacheplane_t> planes;
+    std::vector<modelcachetexinfo_t> texinfos;
+    std::vector<bsp2_dnode_t> nodes;
+    std::vector<mleaf_t> leafs;
+    std::vector<uint32_t> marksurfaces;
+    std::vector<bsp2_dface_t> faces;
+    std::vector<uint8_t> lmshifts;
+    std::vector<int32_t> surfedges;
+    std::vector<bsp2_dedge_t> edges;
+    std::vector<dvertex_t> vertexes;
+    std::vector<bsp2_dclipnode_t> clipnodes;
+    std::string origin;
+    FILE *f;
+    bool ok = false;
+
+    if (!ModelCache_Enabled(entity, hullnum))
+        return false;
+
+    const uint64_t key = ModelCache_Key(entity);
+
+    f = fopen(ModelCache_Path(key, hullnum).c_str(), "rb");
+    if (!f)
+        return false;
+
+    if (fread(&header, 1, sizeof(header), f) != sizeof(header))
+        goto out;
+    if (strncmp(header.identification, MODELCACHE_IDENT, 4) || header.version != MODELCACHE_VERSION)
+        goto out;
+    if (header.key != key || header.hullnum != hullnum || header.originlen < 0)
+        goto out;
+
+    if (!ReadArray(f, brushplanes, header.numbrushplanes)
+        || !ReadArray(f, newplanes, header.numnewplanes)
+        || !ReadArray(f, newmiptex, header.numnewmiptex)
+        || !ReadArray(f, planes, header.numplanes)
+        || !ReadArray(f, texinfos, header.numtexinfos)
+        || !ReadArray(f, nodes, header.numnodes)
+        || !ReadArray(f, leafs, header.numleafs)
+        || !ReadArray(f, marksurfaces, header.nummarksurfaces)
+        || !ReadArray(f, faces, header.numfaces)
+        || !ReadArray(f, lmshifts, header.numfaces)
+        || !ReadArray(f, surfedges, header.numsurfedges)
+        || !ReadArray(f, edges, header.numedges)
+        || !ReadArray(f, vertexes, header.numvertexes)
+        || !ReadArray(f, clipnodes, header.numclipnodes))
+        goto out;
+    origin.resize(header.originlen);
+    if (fread(&origin[0], 1, origin.size(), f) != origin.size())
+        goto out;
+    ok = true;
+
+out:
+    fclose(f);
+    if (!ok)
+        return false;
+
+    for (const modelcachemiptex_t &miptex : newmiptex) {
+        if (!memchr(miptex.name, 0, sizeof(miptex.name)))
+            return false;
+    }
+
+    /* The brush planes must still sort in the same order */
+    int lastplanenum = -1;
+    for (const modelcachebrushplane_t &plane : brushplanes) {
+        int side;
+        const int planenum = LookupPlane(plane.normal, plane.dist, &side);
+        if (plane.isnew) {
+            if (planenum != -1)
+                return false;
+            continue;
+        }
+        if (planenum <= lastplanenum || side != SIDE_FRONT)
+            return false;
+        lastplanenum = planenum;
+    }
+
+    /*
+     * Check that every plane and texture the record refers to resolves
+     * before adding anything, so a stale record leaves the map untouched.
+     * Planes the record adds are tracked as FindPlane would store them.
+     */
+    std::vector<qbsp_plane_t> pendingplanes;
+    auto PlaneSide = [&](const modelcacheplane_t &cached) {
+        int side;
+        if (LookupPlane(cached.normal, cached.dist, &side) != -1)
+            return side;
+
+        qbsp_plane_t plane {};
+        VectorCopy(cached.normal, plane.normal);
+        plane.dist = cached.dist;
+        for (const qbsp_plane_t &pending : pendingplanes) {
+            // LookupPlane only searches the hash bucket for the distance
+            if (Q_rint(fabs(pending.dist)) != Q_rint(fabs(plane.dist)))
+                continue;
+            if (PlaneEqual(&pending, &plane))
+                return static_cast<int>(SIDE_FRONT);
+            if (PlaneInvEqual(&pending, &plane))
+                return static_cast<int>(SIDE_BACK);
+        }
+        return -1;
+    };
+    for (const modelcacheplane_t &cached : newplanes) {
+        if (PlaneSide(cached) != -1)
+            continue;
+
+        qbsp_plane_t plane {};
+        VectorCopy(cached.normal, plane.normal);
+        plane.dist = cached.dist;
+        NormalizePlane(&plane);
+        pendingplanes.push_back(plane);
+    }
+    for (const modelcacheplane_t &cached : planes) {
+        if (PlaneSide(cached) != SIDE_FRONT)
+            return false;
+    }
+
+    for (const modelcachetexinfo_t &texinfo : texinfos) {
+        auto SameName = [&](const char *name) { return !Q_strcasecmp(name, texinfo.texture); };
+
+        // don't add textures that the map itself doesn't use
+        if (std::none_of(map.miptex.begin(), map.miptex.end(),
+                         [&](const texdata_t &tex) { return SameName(tex.name.c_str()); })
+            && std::none_of(newmiptex.begin(), newmiptex.end(),
+                            [&](const modelcachemiptex_t &miptex) { return SameName(miptex.name); }))
+            return false;
+    }
+
+    /* Add the planes and textures compiling the entity would have */
+    for (const modelcacheplane_t &plane : newplanes) {
+        int side;
+        FindPlane(plane.normal, plane.dist, &side);
+    }
+    for (const modelcachemiptex_t &miptex : newmiptex)
+        FindMiptex(miptex.name, true);
+
+    /* Resolve planes and texinfo before touching the exported lumps */
+    std::vector<int> planenums(planes.size());
+    for (size_t i = 0; i < planes.size(); i++) {
+        int side;
+        planenums[i] = FindPlane(planes[i].normal, planes[i].dist, &side);
+        Q_assert(side == SIDE_FRONT);
+    }
+
+    std::vector<int> texinfonums(texinfos.size());
+    for (size_t i = 0; i < texinfos.size(); i++) {
+        mtexinfo_t mt {};
+        int miptex;
+
+        for (miptex = 0; miptex < map.nummiptex(); miptex++) {
+            if (!Q_strcasecmp(map.miptex[miptex].name.c_str(), texinfos[i].texture))
+                break;
+        }
+        Q_assert(miptex < map.nummiptex());
+
+        mt.vecs = texinfos[i].vecs;
+        mt.miptex = miptex;
+        mt.flags = texinfos[i].flags;
+        mt.value = texinfos[i].value;
+        texinfonums[i] = FindTexinfo(mt);
+    }
+
+    dmodelh2_t *model = &map.exported_models.at(static_cast<size_t>(entity->outputmodelnumber));
+
+    if (hullnum > 0) {
+        const int clipnodedelta = static_cast<int>(map.exported_clipnodes.size()) - header.clipnodebase;
+        const int headnode = header.model.headnode[hullnum];
+
+        ExportCachedClipPlanes_r(clipnodes, planenums, headnode, header.clipnodebase);
+
+        for (bsp2_dclipnode_t clipnode : clipnodes) {
+            clipnode.planenum = map.planes.at(planenums.at(clipnode.planenum)).outputplanenum;
+            for (int i = 0; i < 2; i++) {
+                if (clipnode.children[i] >= 0)
+                    clipnode.children[i] += clipnodedelta;
+            }
+            map.exported_clipnodes.push_back(clipnode);
+        }
+
+        model->headnode[hullnum] = (headnode >= 0) ? headnode + clipnodedelta : headnode;
+
+        Message(msgStat, "%8d clipnodes from bmodel cache", header.numclipnodes);
+    } else {
+        const int nodedelta = static_cast<int>(map.exported_nodes.size()) - header.nodebase;
+        const int leafdelta = static_cast<int>(map.exported_leafs.size()) - header.leafbase;
+        const int marksurfacedelta = static_cast<int>(map.exported_marksurfaces.size()) - header.marksurfacebase;
+        const int facedelta = static_cast<int>(map.exported_faces.size()) - header.facebase;
+        const int surfedgedelta = static_cast<int>(map.exported_surfedges.size()) - header.surfedgebase;
+        const int edgedelta = static_cast<int>(map.exported_edges.size()) - header.edgebase;
+        const int vertexdelta = static_cast<int>(map.exported_vertexes.size()) - header.vertexbase;
+
+        /* MakeFaceEdges: vertexes and edges, then the faces in order */
+        map.exported_vertexes.insert(map.exported_vertexes.end(), vertexes.begin(), vertexes.end());
+        for (bsp2_dedge_t edge : edges) {
+            edge.v[0] += vertexdelta;
+            edge.v[1] += vertexdelta;
+            map.exported_edges.push_back(edge);
+        }
+
+        entity->firstoutputfacenumber = static_cast<int>(map.exported_faces.size());
+        for (size_t i = 0; i < faces.size(); i++) {
+            bsp2_dface_t face = faces[i];
+            face.planenum = ExportMapPlane(planenums.at(face.planenum));
+            face.texinfo = ExportMapTexinfo(texinfonums.at(face.texinfo));
+            face.firstedge += surfedgedelta;
+            map.exported_faces.push_back(face);
+
+            map.exported_lmshifts.push_back(lmshifts[i]);
+            if (lmshifts[i] != 4)
+                map.needslmshifts = true;
+        }
+        for (int32_t surfedge : surfedges)
+            map.exported_surfedges.push_back(surfedge < 0 ? surfedge - edgedelta : surfedge + edgedelta);
+
+        /* ExportDrawNodes: nodes in preorder, which is also array order */
+        for (bsp2_dnode_t node : nodes) {
+            node.planenum = ExportMapPlane(planenums.at(node.planenum));
+            node.firstface += facedelta;
+            for (int i = 0; i < 2; i++) {
+                if (node.children[i] >= 0)
+                    node.children[i] += nodedelta;
+                else if (node.children[i] < -1)
+                    node.children[i] -= leafdelta;
+            }
+            map.exported_nodes.push_back(node);
+        }
+        for (mleaf_t leaf : leafs) {
+            leaf.firstmarksurface += marksurfacedelta;
+            map.exported_leafs.push_back(leaf);
+        }
+        for (uint32_t marksurface : marksurfaces)
+            map.exported_marksurfaces.push_back(marksurface + facedelta);
+
+        model->headnode[0] = header.model.headnode[0] + nodedelta;
+        model->firstface = header.model.firstface + facedelta;
+        model->numfaces = header.model.numfaces;
+        model->visleafs = header.model.visleafs;
+        for (int i = 0; i < 3; i++) {
+            model->mins[i] = header.model.mins[i];
+            model->maxs[i] = header.model.maxs[i];
+        }
+
+        Message(msgStat, "%8d faces from bmodel cache", header.numfaces);
+    }
+
+    if (!origin.empty())
+        SetKeyValue(entity, "origin", origin.c_str());
+
+    return true;
+}
+
+/*
+==================
+ModelCache_Begin
+
+Remember where this entity's output starts in each lump
+==================
+*/
+void
+ModelCache_Begin(mapentity_t *entity, const int hullnum)
+{
+    if (!ModelCache_Enabled(entity, hullnum))
+        return;
+
+    // key from the unmodified entity
+    ModelCache_Key(entity);
+
+    cachemark.planes = map.planes.size();
+    cachemark.miptex = map.miptex.size();
+    cachebrushplanes.clear();
+    cachemark.nodes = map.exported_nodes.size();
+    cachemark.leafs = map.exported_leafs.size();
+    cachemark.marksurfaces = map.exported_marksurfaces.size();
+    cachemark.faces = map.exported_faces.size();
+    cachemark.surfedges = map.exported_surfedges.size();
+    cachemark.edges = map.exported_edges.size();
+    cachemark.vertexes = map.exported_vertexes.size();
+    cachemark.clipnodes = map.exported_clipnodes.size();
+}
+
+/*
+==================
+ModelCache_AddBrushPlanes
+
+Called once the entity's brushes are loaded
+==================
+*/
+void
+ModelCache_AddBrushPlanes(const mapentity_t *entity, const int hullnum)
+{
+    if (!ModelCache_Enabled(entity, hullnum))
+        return;
+
+    for (const brush_t *brush = entity->brushes; brush; brush = brush->next) {
+        for (const face_t *face = brush->faces; face; face = face->next)
+            cachebrushplanes.push_back(face->planenum);
+    }
+    std::sort(cachebrushplanes.begin(), cachebrushplanes.end());
+    cachebrushplanes.erase(std::unique(cachebrushplanes.begin(), cachebrushplanes.end()), cachebrushplanes.end());
+}
+
+/*
+==================
+ModelCache_Store
+
+Write out everything the entity appended since ModelCache_Begin
+==================
+*/
+void
+ModelCache_Store(mapentity_t *entity, const int hullnum)
+{
+    modelcacheheader_t header {};
+    std::vector<modelcachebrushplane_t> brushplanes;
+    std::vector<modelcacheplane_t> newplanes;
+    std::vector<modelcachemiptex_t> newmiptex;
+    std::unordered_map<int, int> localplanes;
+    std::vector<modelcacheplane_t> planes;
+    std::unordered_map<int, int> localtexinfos;
+    std::vector<modelcachetexinfo_t> texinfos;
+    FILE *f;
+
+    if (!ModelCache_Enabled(entity, hullnum))
+        return;
+
+    /* Map output plane numbers back to map planes */
+    if (outputplanes.size() < map.exported_planes.size()) {
+        const size_t known = outputplanes.size();
+        outputplanes.resize(map.exported_planes.size(), -1);
+        for (int i = 0; i < map.numplanes(); i++) {
+            const int outputplanenum = map.planes[i].outputplanenum;
+            if (outputplanenum != PLANENUM_LEAF && static_cast<size_t>(outputplanenum) >= known)
+                outputplanes[outputplanenum] = i;
+        }
+    }
+    auto LocalPlane = [&](int outputplanenum) {
+        auto it = localplanes.find(outputplanenum);
+        if (it != localplanes.end())
+            return it->second;
+
+        const qbsp_plane_t &plane = map.planes.at(outputplanes.at(outputplanenum));
+        modelcacheplane_t cached;
+        VectorCopy(plane.normal, cached.normal);
+        cached.dist = plane.dist;
+
+        const int local = static_cast<int>(planes.size());
+        planes.push_back(cached);
+        localplanes[outputplanenum] = local;
+        return local;
+    };
+
+    std::vector<int> outputtexinfos(map.exported_texinfos.size(), -1);
+    for (int i = 0; i < map.numtexinfo(); i++) {
+        const mtexinfo_t &texinfo = map.mtexinfos[i];
+        if (texinfo.outputnum.has_value())
+            outputtexinfos.at(texinfo.outputnum.value()) = i;
+    }
+    auto LocalTexinfo = [&](int outputtexinfo) {
+        auto it = localtexinfos.find(outputtexinfo);
+        if (it != localtexinfos.end())
+            return it->second;
+
+        const mtexinfo_t &texinfo = map.mtexinfos.at(outputtexinfos.at(outputtexinfo));
+        modelcachetexinfo_t cached {};
+        q_snprintf(cached.texture, sizeof(cached.texture), "%s", map.miptex.at(texinfo.miptex).name.c_str());
+        cached.vecs = texinfo.vecs;
+        cached.flags = texinfo.flags;
+        cached.value = texinfo.value;
+
+        const int local = static_cast<int>(texinfos.size());
+        texinfos.push_back(cached);
+        localtexinfos[outputtexinfo] = local;
+        return local;
+    };
+
+    std::vector<bsp2_dface_t> faces(map.exported_faces.begin() + cachemark.faces, map.exported_faces.end());
+    for (bsp2_dface_t &face : faces) {
+        face.planenum = LocalPlane(face.planenum);
+        face.texinfo = LocalTexinfo(face.texinfo);
+    }
+    std::vector<bsp2_dnode_t> nodes(map.exported_nodes.begin() + cachemark.nodes, map.exported_nodes.end());
+    for (bsp2_dnode_t &node : nodes)
+        node.planenum = LocalPlane(node.planenum);
+    std::vector<bsp2_dclipnode_t> clipnodes(map.exported_clipnodes.begin() + cachemark.clipnodes, map.exported_clipnodes.end());
+    for (bsp2_dclipnode_t &clipnode : clipnodes)
+        clipnode.planenum = LocalPlane(clipnode.planenum);
+
+    for (int planenum : cachebrushplanes) {
+        modelcachebrushplane_t cached;
+        VectorCopy(map.planes.at(planenum).normal, cached.normal);
+        cached.dist = map.planes.at(planenum).dist;
+        cached.isnew = static_cast<size_t>(planenum) >= cachemark.planes;
+        brushplanes.push_back(cached);
+    }
+    for (size_t i = cachemark.planes; i < map.planes.size(); i++) {
+        modelcacheplane_t cached;
+        VectorCopy(map.planes[i].normal, cached.normal);
+        cached.dist = map.planes[i].dist;
+        newplanes.push_back(cached);
+    }
+
+    // texture names that don't fit are rare enough to just not cache
+    for (size_t i = cachemark.miptex; i < map.miptex.size(); i++) {
+        modelcachemiptex_t cached {};
+        if (map.miptex[i].name.size() + 1 >= sizeof(cached.name))
+            return;
+        memcpy(cached.name, map.miptex[i].name.c_str(), map.miptex[i].name.size());
+        newmiptex.push_back(cached);
+    }
+    for (const modelcachetexinfo_t &texinfo : texinfos) {
+        if (strlen(texinfo.texture) + 1 >= sizeof(texinfo.texture))
+            return;
+    }
+
+    const std::string origin = ValueForKey(entity, "origin");
+
+    memcpy(header.identification, MODELCACHE_IDENT, 4);
+    header.version = MODELCACHE_VERSION;
+    header.key = ModelCache_Key(entity);
+    header.hullnum = hullnum;
+    header.nodebase = cachemark.nodes;
+    header.leafbase = cachemark.leafs;
+    header.marksurfacebase = cachemark.marksurfaces;
+    header.facebase = cachemark.faces;
+    header.surfedgebase = cachemark.surfedges;
+    header.edgebase = cachemark.edges;
+    header.vertexbase = cachemark.vertexes;
+    header.clipnodebase = cachemark.clipnodes;
+    header.numbrushplanes = brushplanes.size();
+    header.numnewplanes = newplanes.size();
+    header.numnewmiptex = newmiptex.size();
+    header.numplanes = planes.size();
+    header.numtexinfos = texinfos.size();
+    header.numnodes = nodes.size();
+    header.numleafs = map.exported_leafs.size() - cachemark.leafs;
+    header.nummarksurfaces = map.exported_marksurfaces.size() - cachemark.marksurfaces;
+    header.numfaces = faces.size();
+    header.numsurfedges = map.exported_surfedges.size() - cachemark.surfedges;
+    header.numedges = map.exported_edges.size() - cachemark.edges;
+    header.numvertexes = map.exported_vertexes.size() - cachemark.vertexes;
+    header.numclipnodes = clipnodes.size();
+    header.originlen = origin.size();
+    header.model = map.exported_models.at(static_cast<size_t>(entity->outputmodelnumber));
+
+    f = fopen(ModelCache_Path(header.key, hullnum).c_str(), "wb");
+    if (!f)
+        return; // cache directory not writable, carry on without it
+
+    fwrite(&header, 1, sizeof(header), f);
+    WriteArray(f, brushplanes.data(), brushplanes.size());
+    WriteArray(f, newplanes.data(), newplanes.size());
+    WriteArray(f, newmiptex.data(), newmiptex.size());
+    WriteArray(f, planes.data(), planes.size());
+    WriteArray(f, texinfos.data(), texinfos.size());
+    WriteArray(f, nodes.data(), nodes.size());
+    WriteArray(f, map.exported_leafs.data() + cachemark.leafs, header.numleafs);
+    WriteArray(f, map.exported_marksurfaces.data() + cachemark.marksurfaces, header.nummarksurfaces);
+    WriteArray(f, faces.data(), faces.size());
+    WriteArray(f, map.exported_lmshifts.data() + cachemark.faces, header.numfaces);
+    WriteArray(f, map.exported_surfedges.data() + cachemark.surfedges, header.numsurfedges);
+    WriteArray(f, map.exported_edges.data() + cachemark.edges, header.numedges);
+    WriteArray(f, map.exported_vertexes.data() + cachemark.vertexes, header.numvertexes);
+    WriteArray(f, clipnodes.data(), clipnodes.size());
+    fwrite(origin.data(), 1, origin.size(), f);
+    fclose(f);
+}
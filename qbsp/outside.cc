@@ -21,11 +21,15 @@
 
 #include <qbsp/qbsp.hh>
 
+#include <algorithm>
+#include <atomic>
 #include <vector>
-#include <set>
-#include <list>
 #include <utility>
 
+#include "tbb/blocked_range.h"
+#include "tbb/enumerable_thread_specific.h"
+#include "tbb/parallel_for.h"
+
 /*
 ===========
 PointInLeaf
@@ -62,18 +66,29 @@ InitPtsFile(void)
 
 // new code
 
+/*
+ * The flood fill works on a flat copy of the leaf graph: leafs are numbered
+ * once (node->leafnum) and the passable portals of each leaf are flattened
+ * into a CSR adjacency array, so the flood and the per-leaf passes after it
+ * are array sweeps that can run in parallel.
+ */
+struct leafgraph_t {
+    std::vector<node_t *> leafs;
+    std::vector<int> offsets;           // neighbours of leafs[i] are neighbours[offsets[i] .. offsets[i + 1]]
+    std::vector<int> neighbours;
+};
+
 static void
-ClearOccupied_r(node_t *node)
+GatherLeafs_r(node_t *node, std::vector<node_t *> &leafs)
 {
     if (node->planenum != PLANENUM_LEAF) {
-        ClearOccupied_r(node->children[0]);
-        ClearOccupied_r(node->children[1]);
+        GatherLeafs_r(node->children[0], leafs);
+        GatherLeafs_r(node->children[1], leafs);
         return;
     }
-    
-    /* leaf node */
-    node->occupied = 0;
-    node->occupant = nullptr;
+
+    node->leafnum = leafs.size();
+    leafs.push_back(node);
 }
 
 /*
@@ -105,40 +120,113 @@ static bool Portal_Passable(const portal_t *p)
 
 /*
 ==================
+MakeLeafGraph
+
+Numbers the leafs and builds the adjacency through passable portals, in
+portal list order
+==================
+*/
+static leafgraph_t
+MakeLeafGraph(node_t *headnode)
+{
+    leafgraph_t graph;
+
+    GatherLeafs_r(headnode, graph.leafs);
+
+    const size_t numleafs = graph.leafs.size();
+    graph.offsets.resize(numleafs + 1);
+    graph.offsets[0] = 0;
+
+    tbb::parallel_for(static_cast<size_t>(0), numleafs, [&graph](const size_t i) {
+        node_t *node = graph.leafs[i];
+        int count = 0;
+        int side;
+        for (portal_t *portal = node->portals; portal; portal = portal->next[!side]) {
+            side = (portal->nodes[0] == node);
+            if (Portal_Passable(portal))
+                count++;
+        }
+        graph.offsets[i + 1] = count;
+    });
+
+    for (size_t i = 0; i < numleafs; i++)
+        graph.offsets[i + 1] += graph.offsets[i];
+    graph.neighbours.resize(graph.offsets[numleafs]);
+
+    tbb::parallel_for(static_cast<size_t>(0), numleafs, [&graph](const size_t i) {
+        node_t *node = graph.leafs[i];
+        int next = graph.offsets[i];
+        int side;
+        for (portal_t *portal = node->portals; portal; portal = portal->next[!side]) {
+            side = (portal->nodes[0] == node);
+            if (Portal_Passable(portal))
+                graph.neighbours[next++] = portal->nodes[side]->leafnum;
+        }
+    });
+
+    return graph;
+}
+
+static void
+ClearOccupied(const leafgraph_t &graph)
+{
+    tbb::parallel_for(static_cast<size_t>(0), graph.leafs.size(), [&graph](const size_t i) {
+        graph.leafs[i]->occupied = 0;
+        graph.leafs[i]->occupant = nullptr;
+    });
+}
+
+/*
+==================
+BFSFloodFillFromOccupiedLeafs
+
+Level-synchronous BFS: each frontier is expanded in parallel, with a visited
+bitset deciding which thread claims a leaf. The distances are the same no
+matter which thread wins, so node->occupied is deterministic.
+
 precondition: all leafs have occupied set to 0
 ==================
 */
 static void
-BFSFloodFillFromOccupiedLeafs(const std::vector<node_t *> &occupied_leafs)
+BFSFloodFillFromOccupiedLeafs(const leafgraph_t &graph, const std::vector<node_t *> &occupied_leafs)
 {
-    std::list<std::pair<node_t *, int>> queue;
+    const size_t numleafs = graph.leafs.size();
+    std::vector<std::atomic<uint64_t>> visited((numleafs + 63) / 64);
+    for (auto &bits : visited)
+        bits.store(0, std::memory_order_relaxed);
+
+    std::vector<int> frontier;
     for (node_t *leaf : occupied_leafs) {
-        queue.push_back(std::make_pair(leaf, 1));
+        const int leafnum = leaf->leafnum;
+        visited[leafnum >> 6].fetch_or(uint64_t(1) << (leafnum & 63), std::memory_order_relaxed);
+        leaf->occupied = 1;
+        frontier.push_back(leafnum);
     }
-    
-    while (!queue.empty()) {
-        auto pair = queue.front();
-        queue.pop_front();
-        
-        node_t *node = pair.first;
-        const int dist = pair.second;
-        
-        if (node->occupied == 0) {
-            // we haven't visited this node yet
-            node->occupied = dist;
-            
-            // push neighbouring nodes onto the back of the queue
-            int side;
-            for (portal_t *portal = node->portals; portal; portal = portal->next[!side]) {
-                side = (portal->nodes[0] == node);
-                
-                if (!Portal_Passable(portal))
-                    continue;
-                
-                node_t *neighbour = portal->nodes[side];
-                queue.push_back(std::make_pair(neighbour, dist + 1));
+
+    for (int dist = 2; !frontier.empty(); dist++) {
+        tbb::enumerable_thread_specific<std::vector<int>> next;
+
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, frontier.size()),
+                          [&graph, &frontier, &visited, &next, dist](const tbb::blocked_range<size_t> &range) {
+            std::vector<int> &local = next.local();
+            for (size_t i = range.begin(); i != range.end(); i++) {
+                const int leafnum = frontier[i];
+                for (int j = graph.offsets[leafnum]; j < graph.offsets[leafnum + 1]; j++) {
+                    const int neighbour = graph.neighbours[j];
+                    const uint64_t bit = uint64_t(1) << (neighbour & 63);
+                    if (visited[neighbour >> 6].fetch_or(bit, std::memory_order_relaxed) & bit)
+                        continue;
+                    graph.leafs[neighbour]->occupied = dist;
+                    local.push_back(neighbour);
+                }
             }
-        }
+        });
+
+        // merge in leaf order so the walk doesn't depend on thread scheduling
+        frontier.clear();
+        for (const std::vector<int> &local : next)
+            frontier.insert(frontier.end(), local.begin(), local.end());
+        std::sort(frontier.begin(), frontier.end());
     }
 }
 
@@ -273,50 +361,30 @@ FindOccupiedLeafs(node_t *headnode)
     return result;
 }
 
-/*
-==================
-ResetFacesTouchingOccupiedLeafs
-
-Set f->touchesOccupiedLeaf=false on all faces.
-==================
-*/
-static void
-ResetFacesTouchingOccupiedLeafs(node_t *node)
-{
-    if (node->planenum == PLANENUM_LEAF) {
-        return;
-    }
-
-    for (face_t *face = node->faces; face; face = face->next) {
-        face->touchesOccupiedLeaf = false;
-    }
-
-    ResetFacesTouchingOccupiedLeafs(node->children[0]);
-    ResetFacesTouchingOccupiedLeafs(node->children[1]);
-}
-
 /*
 ==================
 MarkFacesTouchingOccupiedLeafs
 
-Set f->touchesOccupiedLeaf=true on faces that are touching occupied leafs
+Set f->touchesOccupiedLeaf=true on faces that are touching occupied leafs,
+false on all other faces of the leafs. Faces are shared between leafs, so
+this is a serial sweep.
 ==================
 */
 static void
-MarkFacesTouchingOccupiedLeafs(node_t *node)
+MarkFacesTouchingOccupiedLeafs(const leafgraph_t &graph)
 {
-    if (node->planenum != PLANENUM_LEAF) {
-        MarkFacesTouchingOccupiedLeafs(node->children[0]);
-        MarkFacesTouchingOccupiedLeafs(node->children[1]);
-        return;
+    for (node_t *node : graph.leafs) {
+        for (face_t **markface = node->markfaces; *markface; markface++) {
+            (*markface)->touchesOccupiedLeaf = false;
+        }
     }
 
-    // visit the leaf
-
-    if (node->occupied > 0) {
-        // This is an occupied leaf, so we need to keep all of the faces touching it.
-        for (face_t **markface = node->markfaces; *markface; markface++) {
-            (*markface)->touchesOccupiedLeaf = true;
+    for (node_t *node : graph.leafs) {
+        if (node->occupied > 0) {
+            // This is an occupied leaf, so we need to keep all of the faces touching it.
+            for (face_t **markface = node->markfaces; *markface; markface++) {
+                (*markface)->touchesOccupiedLeaf = true;
+            }
         }
     }
 }
@@ -329,70 +397,54 @@ Deletes (by setting f->w.numpoints=0) faces in solid nodes
 ==================
 */
 static void
-ClearOutFaces(node_t *node)
+ClearOutFaces(const leafgraph_t &graph)
 {
-    if (node->planenum != PLANENUM_LEAF) {
-        ClearOutFaces(node->children[0]);
-        ClearOutFaces(node->children[1]);
-        return;
-    }
+    for (node_t *node : graph.leafs) {
+        if (!node->contents.is_solid(options.target_game)) {
+            continue;
+        }
 
-    // visit the leaf
-    if (!node->contents.is_solid(options.target_game)) {
-        return;
-    }
+        for (face_t **markface = node->markfaces; *markface; markface++) {
+            // NOTE: This is how faces are deleted here, kind of ugly
+            (*markface)->w.numpoints = 0;
+        }
 
-    for (face_t **markface = node->markfaces; *markface; markface++) {
-        // NOTE: This is how faces are deleted here, kind of ugly
-        (*markface)->w.numpoints = 0;
+        // FIXME: Shouldn't be needed here
+        node->faces = NULL;
     }
-
-    // FIXME: Shouldn't be needed here
-    node->faces = NULL;
 }
 
-static void
-OutLeafsToSolid_r(node_t *node, int *outleafs_count)
+static int
+OutLeafsToSolid(const leafgraph_t &graph)
 {
-    if (node->planenum != PLANENUM_LEAF) {
-        OutLeafsToSolid_r(node->children[0], outleafs_count);
-        OutLeafsToSolid_r(node->children[1], outleafs_count);
-        return;
-    }
-    
-    // skip leafs reachable from entities
-    if (node->occupied > 0)
-        return;
-    
-    // Don't fill sky, or count solids as outleafs
-    if (node->contents.is_solid(options.target_game)
-        || node->contents.is_sky(options.target_game))
-        return;
+    std::atomic<int> outleafs_count { 0 };
+
+    tbb::parallel_for(static_cast<size_t>(0), graph.leafs.size(), [&graph, &outleafs_count](const size_t i) {
+        node_t *node = graph.leafs[i];
 
-    // Now check all faces touching the leaf. If any of them are partially going into the occupied part of the map,
-    // don't fill the leaf (see comment in FillOutside).
-    bool skipFill = false;
-    for (face_t **markface = node->markfaces; *markface; markface++) {
-        if ((*markface)->touchesOccupiedLeaf) {
-            skipFill = true;
-            break;
+        // skip leafs reachable from entities
+        if (node->occupied > 0)
+            return;
+
+        // Don't fill sky, or count solids as outleafs
+        if (node->contents.is_solid(options.target_game)
+            || node->contents.is_sky(options.target_game))
+            return;
+
+        // Now check all faces touching the leaf. If any of them are partially going into the occupied part of the map,
+        // don't fill the leaf (see comment in FillOutside).
+        for (face_t **markface = node->markfaces; *markface; markface++) {
+            if ((*markface)->touchesOccupiedLeaf) {
+                return;
+            }
         }
-    }
-    if (skipFill) {
-        return;
-    }
 
-    // Finally, we can fill it in as void.
-    node->contents = options.target_game->create_solid_contents();
-    *outleafs_count += 1;
-}
+        // Finally, we can fill it in as void.
+        node->contents = options.target_game->create_solid_contents();
+        outleafs_count++;
+    });
 
-static int
-OutLeafsToSolid(node_t *node)
-{
-    int count = 0;
-    OutLeafsToSolid_r(node, &count);
-    return count;
+    return outleafs_count.load();
 }
 
 //=============================================================================
@@ -413,8 +465,10 @@ FillOutside(node_t *node, const int hullnum)
         return false;
     }
     
+    const leafgraph_t graph = MakeLeafGraph(node);
+
     /* Clear the node->occupied on all leafs to 0 */
-    ClearOccupied_r(node);
+    ClearOccupied(graph);
     
     const std::vector<node_t *> occupied_leafs = FindOccupiedLeafs(node);
 
@@ -423,7 +477,7 @@ FillOutside(node_t *node, const int hullnum)
         return false;
     }
 
-    BFSFloodFillFromOccupiedLeafs(occupied_leafs);
+    BFSFloodFillFromOccupiedLeafs(graph, occupied_leafs);
 
     /* first check to see if an occupied leaf is hit */
     const int side = (outside_node.portals->nodes[0] == &outside_node);
@@ -475,14 +529,13 @@ FillOutside(node_t *node, const int hullnum)
     // In order to avoid this scenario, we need to detect those "void-and-non-void-straddling" faces and not fill those leafs
     // in as solid. This will keep some extra faces around but keep the content types consistent.
 
-    ResetFacesTouchingOccupiedLeafs(node);
-    MarkFacesTouchingOccupiedLeafs(node);
+    MarkFacesTouchingOccupiedLeafs(graph);
 
     /* now go back and fill outside with solid contents */
-    const int outleafs = OutLeafsToSolid(node);
+    const int outleafs = OutLeafsToSolid(graph);
 
     /* remove faces from filled in leafs */
-    ClearOutFaces(node);
+    ClearOutFaces(graph);
 
     Message(msgStat, "%8d outleafs", outleafs);
     return true;
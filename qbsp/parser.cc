@@ -158,3 +158,92 @@ ParseToken(parser_t *p, int flags)
 
     return true;
 }
+
+
+parseview_t
+ParseTokenView(parser_t *p, int flags, std::string_view *token)
+{
+    const char *start;
+    bool escaped = false;
+
+ skipspace:
+    /* skip space */
+    while (*p->pos <= 32) {
+        if (!*p->pos)
+            return (flags & PARSE_SAMELINE) && !(flags & PARSE_OPTIONAL) ? PARSEVIEW_FAIL : PARSEVIEW_NONE;
+        if (*p->pos == '\n') {
+            if (flags & PARSE_OPTIONAL)
+                return PARSEVIEW_NONE;
+            if (flags & PARSE_SAMELINE)
+                return PARSEVIEW_FAIL;
+            p->linenum++;
+        }
+        p->pos++;
+    }
+
+    /* comment field */
+    if (p->pos[0] == '/' && p->pos[1] == '/') {
+        if (flags & PARSE_COMMENT) {
+            start = p->pos;
+            while (*p->pos && *p->pos != '\n')
+                p->pos++;
+            goto out;
+        }
+        if (flags & PARSE_OPTIONAL)
+            return PARSEVIEW_NONE;
+        if (flags & PARSE_SAMELINE)
+            return PARSEVIEW_FAIL;
+        while (*p->pos++ != '\n') {
+            if (!*p->pos)
+                return PARSEVIEW_NONE;
+        }
+        p->linenum++;
+        goto skipspace;
+    }
+    if (flags & PARSE_COMMENT)
+        return PARSEVIEW_NONE;
+
+    if (*p->pos == '"') {
+        /* ParseToken copies escapes verbatim, it only has to find the end */
+        start = ++p->pos;
+        while (*p->pos != '"') {
+            if (!*p->pos)
+                return PARSEVIEW_FAIL;
+            if (*p->pos == '\\') {
+                escaped = true;
+                switch (p->pos[1]) {
+                case 'n':
+                case '\'':
+                case 'r':
+                case 't':
+                case '\\':
+                case 'b':
+                    p->pos++;
+                    break;
+                case '"':
+                    p->pos++;
+                    if (p->pos[1] == '\r' || p->pos[1] == '\n')
+                        return PARSEVIEW_FAIL;
+                    break;
+                default:
+                    break;
+                }
+            }
+            p->pos++;
+        }
+        *token = std::string_view(start, p->pos - start);
+        p->pos++;
+        if (token->size() > MAXTOKEN - 1)
+            return PARSEVIEW_FAIL;
+        return escaped ? PARSEVIEW_ESCAPED : PARSEVIEW_TOKEN;
+    }
+
+    start = p->pos;
+    while (*p->pos > 32)
+        p->pos++;
+ out:
+    *token = std::string_view(start, p->pos - start);
+    if (token->size() > MAXTOKEN - 1)
+        return PARSEVIEW_FAIL;
+    return PARSEVIEW_TOKEN;
+}
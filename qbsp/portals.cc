@@ -24,6 +24,12 @@
 
 #include <fmt/format.h>
 
+#include <atomic>
+#include <utility>
+#include <vector>
+
+#include "tbb/parallel_for.h"
+
 node_t outside_node;    // portals outside the world face this
 
 class portal_state_t {
@@ -31,7 +37,6 @@ public:
     int num_visportals;
     int num_visleafs;        // leafs the player can be in
     int num_visclusters;     // clusters of leafs
-    int iNodesDone;
     bool uses_detail;
 };
 
@@ -367,19 +372,18 @@ RemovePortalFromNode(portal_t *portal, node_t *l)
 
 /*
 ================
-MakeHeadnodePortals
+MakeHeadnodeBounds
 
-The created portals will face the global outside_node
+Fills in the six inward facing planes of the box that encloses the entity.
+The headnode portals lie on these planes and face the global outside_node.
 ================
 */
 static void
-MakeHeadnodePortals(const mapentity_t *entity, node_t *node)
+MakeHeadnodeBounds(const mapentity_t *entity, qbsp_plane_t bplanes[6])
 {
     vec3_t bounds[2];
-    int i, j, n;
-    portal_t *p, *portals[6];
-    qbsp_plane_t bplanes[6], *pl;
-    int side;
+    int i, j;
+    qbsp_plane_t *pl;
 
     // pad with some space so there will never be null volume leafs
     for (i = 0; i < 3; i++) {
@@ -393,12 +397,7 @@ MakeHeadnodePortals(const mapentity_t *entity, node_t *node)
 
     for (i = 0; i < 3; i++)
         for (j = 0; j < 2; j++) {
-            n = j * 3 + i;
-
-            p = (portal_t *)AllocMem(OTHER, sizeof(portal_t), true);
-            portals[n] = p;
-
-            pl = &bplanes[n];
+            pl = &bplanes[j * 3 + i];
             memset(pl, 0, sizeof(*pl));
             if (j) {
                 pl->normal[i] = -1;
@@ -407,24 +406,7 @@ MakeHeadnodePortals(const mapentity_t *entity, node_t *node)
                 pl->normal[i] = 1;
                 pl->dist = bounds[j][i];
             }
-            p->planenum = FindPlane(pl->normal, pl->dist, &side);
-
-            p->winding = BaseWindingForPlane(pl);
-            if (side)
-                AddPortalToNodes(p, &outside_node, node);
-            else
-                AddPortalToNodes(p, node, &outside_node);
-        }
-
-    // clip the basewindings by all the other planes
-    for (i = 0; i < 6; i++) {
-        for (j = 0; j < 6; j++) {
-            if (j == i)
-                continue;
-            portals[i]->winding =
-                ClipWinding(portals[i]->winding, &bplanes[j], true);
         }
-    }
 }
 
 static void
@@ -530,13 +512,292 @@ CheckLeafPortalConsistancy(node_t *node)
 
 //============================================================================
 
+/*
+ * Portalization is done in two passes so that the expensive part can run in
+ * parallel:
+ *
+ *  - every node gets a node portal: its plane clipped to the node's volume
+ *    (the headnode box and the planes of its ancestors), which is then
+ *    filtered down the front subtree and each piece down the back subtree
+ *    until every fragment sits between two leafs (or detail separators).
+ *    The headnode box portals are filtered down the whole tree the same way.
+ *    Nodes don't depend on each other, so this runs in a parallel_for.
+ *
+ *  - the fragments are linked into the portal lists serially, in tree order,
+ *    so the resulting lists don't depend on scheduling.
+ *
+ * The fragments come out in a different order, and with different rounding,
+ * than the serial cutter's (CutNodePortals_r), where each node's portal is
+ * clipped by whatever portals its parent's siblings left on it. That's fine
+ * for filling the outside, but vis output depends on the .prt file, so the
+ * final hull 0 tree is still cut serially by PortalizeWorldForVis.
+ */
+
+struct portalnode_t {
+    node_t *node;
+    int parent;         // index into the node list, -1 for the headnode
+    int side;           // which child of the parent this node is
+};
+
+struct portalfrag_t {
+    node_t *nodes[2];   // [0] = front, [1] = back
+    winding_t *winding;
+};
+
+/*
+================
+GatherPortalNodes_r
+
+Preorder list of the nodes that get a node portal
+================
+*/
+static void
+GatherPortalNodes_r(node_t *node, int parent, int side,
+                    std::vector<portalnode_t> &nodes)
+{
+    /* No portals on leafs or detail separators */
+    if (node->planenum == PLANENUM_LEAF || node->detail_separator)
+        return;
+
+    const int index = nodes.size();
+    nodes.push_back({ node, parent, side });
+
+    GatherPortalNodes_r(node->children[0], index, 0, nodes);
+    GatherPortalNodes_r(node->children[1], index, 1, nodes);
+}
+
+/*
+================
+FilterWinding_r
+
+Splits a winding down the tree, appending each piece along with the leaf
+(or detail separator) it ends up in.  Frees the input winding.
+================
+*/
+static void
+FilterWinding_r(winding_t *winding, node_t *node,
+                std::vector<std::pair<node_t *, winding_t *>> &out)
+{
+    winding_t *frontwinding, *backwinding;
+
+    if (node->planenum == PLANENUM_LEAF || node->detail_separator) {
+        out.push_back({ node, winding });
+        return;
+    }
+
+    DivideWinding(winding, &map.planes[node->planenum], &frontwinding, &backwinding);
+    FreeMem(winding, WINDING);
+
+    if (frontwinding)
+        FilterWinding_r(frontwinding, node->children[0], out);
+    if (backwinding)
+        FilterWinding_r(backwinding, node->children[1], out);
+}
+
+/*
+================
+FilterNodePortal
+
+Cuts the portal of a node into fragments between the leafs of its front and
+back subtrees
+================
+*/
+static void
+FilterNodePortal(winding_t *winding, node_t *node, std::vector<portalfrag_t> &frags)
+{
+    std::vector<std::pair<node_t *, winding_t *>> fronts, backs;
+
+    FilterWinding_r(winding, node->children[0], fronts);
+    for (const auto &front : fronts) {
+        backs.clear();
+        FilterWinding_r(front.second, node->children[1], backs);
+        for (const auto &back : backs)
+            frags.push_back({ { front.first, back.first }, back.second });
+    }
+}
+
+/*
+================
+MakeNodePortal
+
+Creates the portal of a node by taking the full plane winding for the cutting
+plane and clipping it by the planes of its ancestors and the headnode box
+================
+*/
+static winding_t *
+MakeNodePortal(const std::vector<portalnode_t> &nodes, int index,
+               const qbsp_plane_t bplanes[6])
+{
+    const node_t *node = nodes[index].node;
+    qbsp_plane_t clipplane;
+    winding_t *winding;
+    int i;
+
+    winding = BaseWindingForPlane(&map.planes[node->planenum]);
+    for (i = index; winding && nodes[i].parent != -1; i = nodes[i].parent) {
+        clipplane = map.planes[nodes[nodes[i].parent].node->planenum];
+        if (nodes[i].side) {
+            clipplane.dist = -clipplane.dist;
+            VectorSubtract(vec3_origin, clipplane.normal, clipplane.normal);
+        }
+        winding = ClipWinding(winding, &clipplane, true);
+    }
+    for (i = 0; winding && i < 6; i++)
+        winding = ClipWinding(winding, &bplanes[i], true);
+
+    /* If the plane was not clipped on all sides, there was an error */
+    if (!winding)
+        Message(msgWarning, warnPortalClippedAway,
+                (node->mins[0] + node->maxs[0]) * 0.5,
+                (node->mins[1] + node->maxs[1]) * 0.5,
+                (node->mins[2] + node->maxs[2]) * 0.5);
+
+    return winding;
+}
+
+/*
+================
+LinkPortalFrags
+================
+*/
+static void
+LinkPortalFrags(const std::vector<portalfrag_t> &frags, int planenum)
+{
+    portal_t *portal;
+
+    for (const portalfrag_t &frag : frags) {
+        portal = (portal_t *)AllocMem(PORTAL, sizeof(portal_t), true);
+        portal->planenum = planenum;
+        portal->winding = frag.winding;
+        AddPortalToNodes(portal, frag.nodes[0], frag.nodes[1]);
+    }
+}
+
+#ifdef PARANOID
+static void
+CheckPortals_r(node_t *node)
+{
+    CheckLeafPortalConsistancy(node);
+    if (node->planenum != PLANENUM_LEAF && !node->detail_separator) {
+        CheckPortals_r(node->children[0]);
+        CheckPortals_r(node->children[1]);
+    }
+}
+#endif
+
+/*
+================
+CutNodePortals
+================
+*/
+static void
+CutNodePortals(const mapentity_t *entity, node_t *headnode)
+{
+    qbsp_plane_t bplanes[6];
+    std::vector<portalfrag_t> headfrags[6];
+    int planenums[6];
+    int i, j, side;
+
+    MakeHeadnodeBounds(entity, bplanes);
+
+    /* headnode portals: clip the basewindings by all the other box planes */
+    for (i = 0; i < 6; i++) {
+        planenums[i] = FindPlane(bplanes[i].normal, bplanes[i].dist, &side);
+
+        winding_t *winding = BaseWindingForPlane(&bplanes[i]);
+        for (j = 0; j < 6; j++) {
+            if (j == i)
+                continue;
+            winding = ClipWinding(winding, &bplanes[j], true);
+        }
+
+        std::vector<std::pair<node_t *, winding_t *>> pieces;
+        FilterWinding_r(winding, headnode, pieces);
+        for (const auto &piece : pieces) {
+            if (side)
+                headfrags[i].push_back({ { &outside_node, piece.first }, piece.second });
+            else
+                headfrags[i].push_back({ { piece.first, &outside_node }, piece.second });
+        }
+    }
+
+    std::vector<portalnode_t> nodes;
+    GatherPortalNodes_r(headnode, -1, 0, nodes);
+
+    std::vector<std::vector<portalfrag_t>> nodefrags(nodes.size());
+    std::atomic<int> nodesdone { 0 };
+
+    tbb::parallel_for(static_cast<size_t>(0), nodes.size(),
+                      [&nodes, &nodefrags, &bplanes, &nodesdone](const size_t i) {
+        winding_t *winding = MakeNodePortal(nodes, i, bplanes);
+        if (winding)
+            FilterNodePortal(winding, nodes[i].node, nodefrags[i]);
+
+        /* Display progress */
+        Message(msgPercent, ++nodesdone, splitnodes.load());
+    });
+
+    for (i = 0; i < 6; i++)
+        LinkPortalFrags(headfrags[i], planenums[i]);
+    for (size_t n = 0; n < nodes.size(); n++)
+        LinkPortalFrags(nodefrags[n], nodes[n].node->planenum);
+
+#ifdef PARANOID
+    CheckPortals_r(headnode);
+#endif
+}
+
+
+/*
+================
+MakeHeadnodePortals
+
+The created portals will face the global outside_node
+================
+*/
+static void
+MakeHeadnodePortals(const mapentity_t *entity, node_t *node)
+{
+    int i, j, n;
+    portal_t *p, *portals[6];
+    qbsp_plane_t bplanes[6];
+    int side;
+
+    MakeHeadnodeBounds(entity, bplanes);
+
+    for (i = 0; i < 3; i++)
+        for (j = 0; j < 2; j++) {
+            n = j * 3 + i;
+
+            p = (portal_t *)AllocMem(PORTAL, sizeof(portal_t), true);
+            portals[n] = p;
+            p->planenum = FindPlane(bplanes[n].normal, bplanes[n].dist, &side);
+
+            p->winding = BaseWindingForPlane(&bplanes[n]);
+            if (side)
+                AddPortalToNodes(p, &outside_node, node);
+            else
+                AddPortalToNodes(p, node, &outside_node);
+        }
+
+    // clip the basewindings by all the other planes
+    for (i = 0; i < 6; i++) {
+        for (j = 0; j < 6; j++) {
+            if (j == i)
+                continue;
+            portals[i]->winding =
+                ClipWinding(portals[i]->winding, &bplanes[j], true);
+        }
+    }
+}
+
 /*
 ================
 CutNodePortals_r
 ================
 */
 static void
-CutNodePortals_r(node_t *node, portal_state_t *state)
+CutNodePortals_r(node_t *node, int *nodesdone)
 {
     const qbsp_plane_t *plane;
     qbsp_plane_t clipplane;
@@ -565,7 +826,7 @@ CutNodePortals_r(node_t *node, portal_state_t *state)
      * create the new portal by taking the full plane winding for the cutting
      * plane and clipping it by all of the planes from the other portals
      */
-    new_portal = (portal_t *)AllocMem(OTHER, sizeof(portal_t), true);
+    new_portal = (portal_t *)AllocMem(PORTAL, sizeof(portal_t), true);
     new_portal->planenum = node->planenum;
 
     winding = BaseWindingForPlane(plane);
@@ -615,7 +876,7 @@ CutNodePortals_r(node_t *node, portal_state_t *state)
 
         if (!frontwinding) {
             if (backwinding)
-                free(backwinding);
+                FreeMem(backwinding, WINDING);
             
             if (side == 0)
                 AddPortalToNodes(portal, back, other_node);
@@ -625,7 +886,7 @@ CutNodePortals_r(node_t *node, portal_state_t *state)
         }
         if (!backwinding) {
             if (frontwinding)
-                free(frontwinding);
+                FreeMem(frontwinding, WINDING);
             
             if (side == 0)
                 AddPortalToNodes(portal, front, other_node);
@@ -635,10 +896,10 @@ CutNodePortals_r(node_t *node, portal_state_t *state)
         }
 
         /* the winding is split */
-        new_portal = (portal_t *)AllocMem(OTHER, sizeof(portal_t), true);
+        new_portal = (portal_t *)AllocMem(PORTAL, sizeof(portal_t), true);
         *new_portal = *portal;
         new_portal->winding = backwinding;
-        free(portal->winding);
+        FreeMem(portal->winding, WINDING);
         portal->winding = frontwinding;
 
         if (side == 0) {
@@ -651,11 +912,11 @@ CutNodePortals_r(node_t *node, portal_state_t *state)
     }
 
     /* Display progress */
-    state->iNodesDone++;
-    Message(msgPercent, state->iNodesDone, splitnodes.load());
+    (*nodesdone)++;
+    Message(msgPercent, *nodesdone, splitnodes.load());
 
-    CutNodePortals_r(front, state);
-    CutNodePortals_r(back, state);
+    CutNodePortals_r(front, nodesdone);
+    CutNodePortals_r(back, nodesdone);
 }
 
 
@@ -667,26 +928,41 @@ Builds the exact polyhedrons for the nodes and leafs
 ==================
 */
 void
-PortalizeWorld(const mapentity_t *entity, node_t *headnode, const int hullnum)
+PortalizeWorld(const mapentity_t *entity, node_t *headnode)
+{
+    Message(msgProgress, "Portalize");
+
+    CutNodePortals(entity, headnode);
+}
+
+
+/*
+==================
+PortalizeWorldForVis
+
+Same as PortalizeWorld, but with the serial cutter so the portal file for
+vis tracing comes out in the same order, and with the same rounding, as it
+always has. Writes the portal file.
+==================
+*/
+void
+PortalizeWorldForVis(const mapentity_t *entity, node_t *headnode)
 {
     Message(msgProgress, "Portalize");
 
     portal_state_t state;
     memset(&state, 0, sizeof(state));
-    
-    state.iNodesDone = 0;
+    int nodesdone = 0;
 
     MakeHeadnodePortals(entity, headnode);
-    CutNodePortals_r(headnode, &state);
+    CutNodePortals_r(headnode, &nodesdone);
 
-    if (hullnum <= 0) {
-        /* save portal file for vis tracing */
-        WritePortalfile(headnode, &state);
+    /* save portal file for vis tracing */
+    WritePortalfile(headnode, &state);
 
-        Message(msgStat, "%8d vis leafs", state.num_visleafs);
-        Message(msgStat, "%8d vis clusters", state.num_visclusters);
-        Message(msgStat, "%8d vis portals", state.num_visportals);
-    }
+    Message(msgStat, "%8d vis leafs", state.num_visleafs);
+    Message(msgStat, "%8d vis clusters", state.num_visclusters);
+    Message(msgStat, "%8d vis portals", state.num_visportals);
 }
 
 
@@ -713,8 +989,8 @@ FreeAllPortals(node_t *node)
             nextp = p->next[1];
         RemovePortalFromNode(p, p->nodes[0]);
         RemovePortalFromNode(p, p->nodes[1]);
-        free(p->winding);
-        free(p);
+        FreeMem(p->winding, WINDING);
+        FreeMem(p, PORTAL);
     }
     node->portals = NULL;
 }
@@ -27,8 +27,10 @@
 #include <common/aabb.hh>
 #include <qbsp/qbsp.hh>
 #include <qbsp/wad.hh>
+#include <qbsp/modelcache.hh>
 
 #include "tbb/global_control.h"
+#include "tbb/task_arena.h"
 
 static const char *IntroString =
     "---- qbsp / ericw-tools " stringify(ERICWTOOLS_VERSION) " ----\n";
@@ -245,6 +247,16 @@ ProcessEntity(mapentity_t *entity, const int hullnum)
         SetKeyValue(entity, "model", mod);
     }
 
+    if (ModelCache_Splice(entity, hullnum))
+        return;
+    ModelCache_Begin(entity, hullnum);
+
+    /*
+     * Faces, windings, nodes and portals only live until this entity/hull
+     * is exported, so they all come from an arena released at the end
+     */
+    MemArena_Begin();
+
     /*
      * Init the entity
      */
@@ -316,6 +328,7 @@ ProcessEntity(mapentity_t *entity, const int hullnum)
     }
     
     Entity_SortBrushes(entity);
+    ModelCache_AddBrushPlanes(entity, hullnum);
     
     if (!entity->brushes && hullnum) {
         PrintEntity(entity);
@@ -336,7 +349,7 @@ ProcessEntity(mapentity_t *entity, const int hullnum)
         nodes = SolidBSP(entity, surfs, true);
         if (entity == pWorldEnt() && !options.fNofill) {
             // assume non-world bmodels are simple
-            PortalizeWorld(entity, nodes, hullnum);
+            PortalizeWorld(entity, nodes);
             if (FillOutside(nodes, hullnum)) {
                 // Free portals before regenerating new nodes
                 FreeAllPortals(nodes);
@@ -369,7 +382,7 @@ ProcessEntity(mapentity_t *entity, const int hullnum)
         // some portals are solid polygons, and some are paths to other leafs
         if (entity == pWorldEnt() && !options.fNofill) {
             // assume non-world bmodels are simple
-            PortalizeWorld(entity, nodes, hullnum);
+            PortalizeWorld(entity, nodes);
             if (FillOutside(nodes, hullnum)) {
                 FreeAllPortals(nodes);
 
@@ -386,9 +399,13 @@ ProcessEntity(mapentity_t *entity, const int hullnum)
                 DetailToSolid(nodes);
                 
                 // make the real portals for vis tracing
-                PortalizeWorld(entity, nodes, hullnum);
+                PortalizeWorldForVis(entity, nodes);
 
                 TJunc(entity, nodes);
+            } else if (!map.leakfile) {
+                // nothing to fill from; vis gets the portals of this tree
+                FreeAllPortals(nodes);
+                PortalizeWorldForVis(entity, nodes);
             }
             FreeAllPortals(nodes);
         }
@@ -417,6 +434,10 @@ ProcessEntity(mapentity_t *entity, const int hullnum)
     }
 
     FreeBrushes(entity);
+
+    MemArena_End();
+
+    ModelCache_Store(entity, hullnum);
 }
 
 /*
@@ -817,13 +838,14 @@ ProcessFile(void)
     if (!options.fAllverbose)
         options.fVerbose = false;
     CreateHulls();
+    MemArena_PrintStats();
 
     WriteEntitiesToString();
     WADList_Process();
     BSPX_CreateBrushList();
     FinishBSPFile();
 
-    wadlist.clear();
+    WADList_Free();
 }
 
 
@@ -866,6 +888,8 @@ PrintOptions(void)
            "   -subdivide [n]  Use different texture subdivision (default 240)\n"
            "   -wadpath <dir>  Search this directory for wad files (mips will be embedded unless -notex)\n"
            "   -xwadpath <dir> Search this directory for wad files (mips will NOT be embedded, avoiding texture license issues)\n"
+           "   -wadcache <dir> Cache wad directory indexes in this directory to speed up repeat compiles\n"
+           "   -bmodelcache <dir> Reuse brush models that haven't changed since a previous compile, cached in this directory\n"
            "   -oldrottex      Use old rotate_ brush texturing aligned at (0 0 0)\n"
            "   -maxnodesize [n]Triggers simpler BSP Splitting when node exceeds size (default 1024, 0 to disable)\n"
            "   -epsilon [n]    Customize ON_EPSILON (default 0.0001)\n"
@@ -880,6 +904,7 @@ PrintOptions(void)
            "   -leaktest       Make compilation fail if the map leaks\n"
            "   -contenthack    Hack to fix leaks through solids. Causes missing faces in some cases so disabled by default.\n"
            "   -nothreads      Disable multithreading\n"
+           "   -threads n      Use n worker threads (output is identical for any thread count)\n"
            "   sourcefile      .MAP file to process\n"
            "   destfile        .BSP file to output\n");
 
@@ -1045,6 +1070,30 @@ ParseOptions(char *szOptions)
                 wp.path = wadpath;
                 options.wadPathsVec.push_back(wp);
 
+                szTok = szTok2;
+            } else if (!Q_strcasecmp(szTok, "wadcache")) {
+                szTok2 = GetTok(szTok + strlen(szTok) + 1, szEnd);
+                if (!szTok2)
+                    Error("Invalid argument to option %s", szTok);
+
+                options.wadCacheDir = szTok2;
+                /* Remove trailing /, if any */
+                if (options.wadCacheDir.size() > 0 && options.wadCacheDir[options.wadCacheDir.size() - 1] == '/') {
+                    options.wadCacheDir.resize(options.wadCacheDir.size() - 1);
+                }
+
+                szTok = szTok2;
+            } else if (!Q_strcasecmp(szTok, "bmodelcache")) {
+                szTok2 = GetTok(szTok + strlen(szTok) + 1, szEnd);
+                if (!szTok2)
+                    Error("Invalid argument to option %s", szTok);
+
+                options.bmodelCacheDir = szTok2;
+                /* Remove trailing /, if any */
+                if (options.bmodelCacheDir.size() > 0 && options.bmodelCacheDir[options.bmodelCacheDir.size() - 1] == '/') {
+                    options.bmodelCacheDir.resize(options.bmodelCacheDir.size() - 1);
+                }
+
                 szTok = szTok2;
             } else if (!Q_strcasecmp(szTok, "oldrottex")) {
                 options.fixRotateObjTexture = false;
@@ -1116,6 +1165,14 @@ ParseOptions(char *szOptions)
                 options.fContentHack = true;
             } else if (!Q_strcasecmp(szTok, "nothreads")) {
                 options.fNoThreads = true;
+            } else if (!Q_strcasecmp(szTok, "threads")) {
+                szTok2 = GetTok(szTok + strlen(szTok) + 1, szEnd);
+                if (!szTok2)
+                    Error("Invalid argument to option %s", szTok);
+                options.numThreads = atoi(szTok2);
+                if (options.numThreads < 1)
+                    Error("Invalid argument to option %s", szTok);
+                szTok = szTok2;
             } else if (!Q_strcasecmp(szTok, "?") || !Q_strcasecmp(szTok, "help"))
                 PrintOptions();
             else
@@ -1255,15 +1312,18 @@ int qbsp_main(int argc, const char **argv)
 
     InitQBSP(argc, argv);
 
-    // disable TBB if requested
+    // disable TBB or set the thread count if requested
+    if (options.fNoThreads)
+        options.numThreads = 1;
     auto tbbOptions = std::unique_ptr<tbb::global_control>();
-    if (options.fNoThreads) {
-        tbbOptions = std::make_unique<tbb::global_control>(tbb::global_control::max_allowed_parallelism, 1);
+    if (options.numThreads > 0) {
+        tbbOptions = std::make_unique<tbb::global_control>(tbb::global_control::max_allowed_parallelism, options.numThreads);
     }
+    tbb::task_arena arena(options.numThreads > 0 ? options.numThreads : tbb::task_arena::automatic);
 
     // do it!
     start = I_FloatTime();
-    ProcessFile();
+    arena.execute([]() { ProcessFile(); });
     end = I_FloatTime();
 
     Message(msgLiteral, "\n%5.3f seconds elapsed\n", end - start);
@@ -823,7 +823,7 @@ LinkConvexFaces(surface_t *planelist, node_t *leafnode)
             next = f->next;
             leafnode->markfaces[i] = f->original;
             i++;
-            free(f);
+            FreeMem(f, FACE);
         }
         free(surf);
     }
@@ -861,7 +861,7 @@ LinkNodeFaces(surface_t *surface)
     // copy
     for (face_t *f = surface->faces; f; f = f->next) {
         nodefaces++;
-        face_t *newf = (face_t *)AllocMem(OTHER, sizeof(face_t), true);
+        face_t *newf = (face_t *)AllocMem(FACE, sizeof(face_t), true);
         *newf = *f;
         f->original = newf;
         newf->next = list;
@@ -896,8 +896,8 @@ PartitionSurfaces(surface_t *surfaces, node_t *node)
     Message(msgPercent, splitnodes.load(), csgmergefaces);
 
     node->faces = LinkNodeFaces(split);
-    node->children[0] = (node_t *)AllocMem(OTHER, sizeof(node_t), true);
-    node->children[1] = (node_t *)AllocMem(OTHER, sizeof(node_t), true);
+    node->children[0] = (node_t *)AllocMem(NODE, sizeof(node_t), true);
+    node->children[1] = (node_t *)AllocMem(NODE, sizeof(node_t), true);
     node->planenum = split->planenum;
     node->detail_separator = split->detail_separator;
 
@@ -958,16 +958,16 @@ SolidBSP(const mapentity_t *entity, surface_t *surfhead, bool midsplit)
          * collision hull for the engine. Probably could be done a little
          * smarter, but this works.
          */
-        node_t *headnode = (node_t *)AllocMem(OTHER, sizeof(node_t), true);
+        node_t *headnode = (node_t *)AllocMem(NODE, sizeof(node_t), true);
         for (int i = 0; i < 3; i++) {
             headnode->mins[i] = entity->mins[i] - SIDESPACE;
             headnode->maxs[i] = entity->maxs[i] + SIDESPACE;
         }
-        headnode->children[0] = (node_t *)AllocMem(OTHER, sizeof(node_t), true);
+        headnode->children[0] = (node_t *)AllocMem(NODE, sizeof(node_t), true);
         headnode->children[0]->planenum = PLANENUM_LEAF;
         headnode->children[0]->contents = options.target_game->create_empty_contents();
         headnode->children[0]->markfaces = (face_t **)AllocMem(OTHER, sizeof(face_t *), true);
-        headnode->children[1] = (node_t *)AllocMem(OTHER, sizeof(node_t), true);
+        headnode->children[1] = (node_t *)AllocMem(NODE, sizeof(node_t), true);
         headnode->children[1]->planenum = PLANENUM_LEAF;
         headnode->children[1]->contents = options.target_game->create_empty_contents();
         headnode->children[1]->markfaces = (face_t **)AllocMem(OTHER, sizeof(face_t *), true);
@@ -977,7 +977,7 @@ SolidBSP(const mapentity_t *entity, surface_t *surfhead, bool midsplit)
 
     Message(msgProgress, "SolidBSP");
 
-    node_t *headnode = (node_t *)AllocMem(OTHER, sizeof(node_t), true);
+    node_t *headnode = (node_t *)AllocMem(NODE, sizeof(node_t), true);
     usemidsplit = midsplit;
 
     // calculate a bounding box for the entire model
@@ -20,8 +20,9 @@
 */
 
 #include <qbsp/qbsp.hh>
+#include <algorithm>
 #include <map>
-#include <list>
+#include <vector>
 
 /*
 ===============
@@ -140,7 +141,7 @@ GatherNodeFaces_r(node_t *node, std::map<int, face_t *> &planefaces)
         for (f = node->faces; f; f = next) {
             next = f->next;
             if (!f->w.numpoints) {      // face was removed outside
-                free(f);
+                FreeMem(f, FACE);
             } else {
                 f->next = planefaces[f->planenum];
                 planefaces[f->planenum] = f;
@@ -149,7 +150,7 @@ GatherNodeFaces_r(node_t *node, std::map<int, face_t *> &planefaces)
         GatherNodeFaces_r(node->children[0], planefaces);
         GatherNodeFaces_r(node->children[1], planefaces);
     }
-    free(node);
+    FreeMem(node, NODE);
 }
 
 /*
@@ -171,38 +172,67 @@ GatherNodeFaces(node_t *headnode)
 
 //===========================================================================
 
-// This is a kludge.   Should be pEdgeFaces[2].
-static std::map<int, const face_t *> pEdgeFaces0;
-static std::map<int, const face_t *> pEdgeFaces1;
-
-//============================================================================
+/*
+ * Vertex and edge welding for MakeFaceEdges.
+ *
+ * Both tables are flat open-addressing hashes sized once per entity from the
+ * face vertex count, so GetVertex/GetEdge never allocate.
+ *
+ * Vertexes are inserted once, in the cell floor(pos); a lookup probes the
+ * cells floor(pos) - 1 .. floor(pos) on each axis, so a vert at
+ * (0.99, 0.99, 0.99) is still found when searching at (1.01, 1.01, 1.01).
+ *
+ * Edges are chained per (v1, v2) key, newest first, and remember the face(s)
+ * using them. Edge indices are relative to the entity's first edge.
+ */
+struct hashedge_t {
+    const face_t *faces[2];     // [0] = face using it v1->v2, [1] = face using it v2->v1
+    int next;                   // next edge with the same (v1, v2), -1 = end
+};
+
+struct hashedgeslot_t {
+    int v1, v2;
+    int head;                   // newest edge with this key, -1 = empty slot
+};
 
-using vertidx_t = int;
-using edgeidx_t = int;
-static std::map<std::pair<vertidx_t, vertidx_t>, std::list<edgeidx_t>> hashedges;
-static std::map<std::tuple<int,int,int>, std::list<hashvert_t>> hashverts;
+static std::vector<hashvert_t> hashverts;
+static std::vector<hashedgeslot_t> hashedgeslots;
+static std::vector<hashedge_t> hashedges;
+static int firsthashedge;
+static size_t hashmask;
 
-static void
-InitHash(void)
+static inline size_t
+HashInts(int a, int b, int c)
 {
-    pEdgeFaces0.clear();
-    pEdgeFaces1.clear();
-    hashverts.clear();
-    hashedges.clear();
+    uint64_t h = static_cast<uint32_t>(a) * 0x9E3779B97F4A7C15ULL;
+    h ^= static_cast<uint32_t>(b) * 0xC2B2AE3D27D4EB4FULL;
+    h ^= static_cast<uint32_t>(c) * 0x165667B19E3779F9ULL;
+    return static_cast<size_t>(h ^ (h >> 29));
 }
 
 static void
-AddHashEdge(int v1, int v2, int i)
+InitHash(int numverts)
 {
-    hashedges[std::make_pair(v1, v2)].push_front(i);
+    size_t size = 64;
+    while (size < static_cast<size_t>(numverts) * 2)
+        size <<= 1;
+    hashmask = size - 1;
+
+    hashvert_t emptyvert {};
+    emptyvert.num = -1;
+    hashverts.assign(size, emptyvert);
+    hashedgeslots.assign(size, hashedgeslot_t { 0, 0, -1 });
+    hashedges.clear();
+    hashedges.reserve(numverts);
+    firsthashedge = static_cast<int>(map.exported_edges.size());
 }
 
-static std::tuple<int,int,int>
-HashVec(const vec3_t vec)
+static void
+FreeHash(void)
 {
-    return std::make_tuple(static_cast<int>(floor(vec[0])),
-                           static_cast<int>(floor(vec[1])),
-                           static_cast<int>(floor(vec[2])));
+    hashverts = {};
+    hashedgeslots = {};
+    hashedges = {};
 }
 
 static void
@@ -210,22 +240,36 @@ AddHashVert(const vec3_t vert, const int global_vert_num)
 {
     hashvert_t hv;
     VectorCopy(vert, hv.point);
+    for (int i = 0; i < 3; i++)
+        hv.cell[i] = static_cast<int>(floor(vert[i]));
     hv.num = global_vert_num;
-    
-    // insert each vert at floor(pos[axis]) and floor(pos[axis]) + 1 (for each axis)
-    // so e.g. a vert at (0.99, 0.99, 0.99) shows up if we search at (1.01, 1.01, 1.01)
-    // this is a bit wasteful, since it inserts 8 copies of each vert.
-    
-    for (int x=0; x<=1; x++) {
-        for (int y=0; y<=1; y++) {
-            for (int z=0; z<=1; z++) {
-                const auto h = std::make_tuple(static_cast<int>(floor(vert[0])) + x,
-                                               static_cast<int>(floor(vert[1])) + y,
-                                               static_cast<int>(floor(vert[2])) + z);
-                hashverts[h].push_front(hv);
-            }
+
+    size_t slot = HashInts(hv.cell[0], hv.cell[1], hv.cell[2]) & hashmask;
+    while (hashverts[slot].num != -1)
+        slot = (slot + 1) & hashmask;
+    hashverts[slot] = hv;
+}
+
+/*
+ * Returns the newest vertex within POINT_EPSILON of vert that was inserted
+ * into cell (x, y, z), or -1
+ */
+static int
+FindHashVertInCell(const vec3_t vert, int x, int y, int z)
+{
+    int found = -1;
+
+    for (size_t slot = HashInts(x, y, z) & hashmask; hashverts[slot].num != -1; slot = (slot + 1) & hashmask) {
+        const hashvert_t &hv = hashverts[slot];
+        if (hv.cell[0] != x || hv.cell[1] != y || hv.cell[2] != z)
+            continue;
+        if (fabs(hv.point[0] - vert[0]) < POINT_EPSILON &&
+            fabs(hv.point[1] - vert[1]) < POINT_EPSILON &&
+            fabs(hv.point[2] - vert[2]) < POINT_EPSILON) {
+            found = std::max(found, hv.num);
         }
     }
+    return found;
 }
 
 /*
@@ -247,18 +291,20 @@ GetVertex(mapentity_t *entity, const vec3_t in)
             vert[i] = in[i];
     }
 
-    const auto h = HashVec(vert);
-    auto it = hashverts.find(h);
-    if (it != hashverts.end()) {
-        for (hashvert_t &hv : it->second) {
-            if (fabs(hv.point[0] - vert[0]) < POINT_EPSILON &&
-                fabs(hv.point[1] - vert[1]) < POINT_EPSILON &&
-                fabs(hv.point[2] - vert[2]) < POINT_EPSILON) {
+    const int cx = static_cast<int>(floor(vert[0]));
+    const int cy = static_cast<int>(floor(vert[1]));
+    const int cz = static_cast<int>(floor(vert[2]));
+    int found = -1;
 
-                return hv.num;
+    for (int x = cx - 1; x <= cx; x++) {
+        for (int y = cy - 1; y <= cy; y++) {
+            for (int z = cz - 1; z <= cz; z++) {
+                found = std::max(found, FindHashVertInCell(vert, x, y, z));
             }
         }
     }
+    if (found != -1)
+        return found;
 
     const int global_vert_num = static_cast<int>(map.exported_vertexes.size());
 
@@ -274,6 +320,16 @@ GetVertex(mapentity_t *entity, const vec3_t in)
     return global_vert_num;
 }
 
+static hashedgeslot_t &
+FindHashEdgeSlot(int v1, int v2)
+{
+    size_t slot = HashInts(v1, v2, 0) & hashmask;
+    while (hashedgeslots[slot].head != -1
+           && (hashedgeslots[slot].v1 != v1 || hashedgeslots[slot].v2 != v2))
+        slot = (slot + 1) & hashmask;
+    return hashedgeslots[slot];
+}
+
 //===========================================================================
 
 /*
@@ -299,34 +355,32 @@ GetEdge(mapentity_t *entity, const vec3_t p1, const vec3_t p2,
     v2 = GetVertex(entity, p2);
 
     // search for an existing edge from v2->v1
-    const std::pair<int,int> edge_hash_key = std::make_pair(v2, v1);
-
     {
-        bsp2_dedge_t *edge;
-
-        auto it = hashedges.find(edge_hash_key);
-        if (it != hashedges.end()) {
-            for (const int i : it->second) {
-                edge = &map.exported_edges.at(i);
-                if (pEdgeFaces1[i] == NULL
-                    && pEdgeFaces0[i]->contents[0].native == face->contents[0].native) {
-                    pEdgeFaces1[i] = face;
-                    return -i;
-                }
+        const hashedgeslot_t &slot = FindHashEdgeSlot(v2, v1);
+
+        for (int e = slot.head; e != -1; e = hashedges[e].next) {
+            hashedge_t &edge = hashedges[e];
+            if (edge.faces[1] == NULL
+                && edge.faces[0]->contents[0].native == face->contents[0].native) {
+                edge.faces[1] = face;
+                return -(firsthashedge + e);
             }
         }
-
-        /* emit an edge */
-        i = static_cast<int>(map.exported_edges.size());
-        map.exported_edges.push_back({});
-        edge = &map.exported_edges.at(i);
-        edge->v[0] = v1;
-        edge->v[1] = v2;
     }
 
-    AddHashEdge(v1, v2, i);
+    /* emit an edge */
+    i = static_cast<int>(map.exported_edges.size());
+    map.exported_edges.push_back({});
+    bsp2_dedge_t *edge = &map.exported_edges.at(i);
+    edge->v[0] = v1;
+    edge->v[1] = v2;
+
+    hashedgeslot_t &slot = FindHashEdgeSlot(v1, v2);
+    slot.v1 = v1;
+    slot.v2 = v2;
+    hashedges.push_back({ { face, NULL }, slot.head });
+    slot.head = i - firsthashedge;
 
-    pEdgeFaces0[i] = face;
     return i;
 }
 
@@ -503,13 +557,12 @@ MakeFaceEdges(mapentity_t *entity, node_t *headnode)
     CountData_r(entity, headnode, &facesCount, &vertexesCount);
 
     // Accessory data
-    InitHash();
+    InitHash(vertexesCount);
 
     firstface = static_cast<int>(map.exported_faces.size());
     MakeFaceEdges_r(entity, headnode, 0);
 
-    pEdgeFaces0.clear();
-    pEdgeFaces1.clear();
+    FreeHash();
 
     Message(msgProgress, "GrowRegions");
     GrowNodeRegion(entity, headnode);
@@ -2,6 +2,7 @@
 
 #include <qbsp/qbsp.hh>
 #include <qbsp/map.hh>
+#include <qbsp/modelcache.hh>
 
 // FIXME: Clear global data (planes, etc) between each test
 
@@ -292,6 +293,120 @@ TEST(qbsp, SplitBrushOnSide) {
     EXPECT_EQ(nullptr, back);
 }
 
+static int WindingCapacity(const winding_t *w)
+{
+    const size_t size = AllocSize(w) - offsetof(winding_t, points[0]) - sizeof(int);
+    return static_cast<int>(size / sizeof(w->points[0]));
+}
+
+/**
+ * ClipWinding reuses the input winding's block while the result fits in it,
+ * and moves to a new block once it doesn't.
+ */
+TEST(qbsp, ClipWindingInPlace) {
+    qbsp_plane_t floor {};
+    VectorSet(floor.normal, 0, 0, 1);
+    
+    winding_t *w = BaseWindingForPlane(&floor);
+    ASSERT_EQ(4, w->numpoints);
+    ASSERT_GE(WindingCapacity(w), 8);
+    
+    // clip down to a 16-sided polygon around the origin
+    const int sides = 16;
+    const vec_t radius = 64;
+    int inplace = 0, moved = 0;
+    for (int i = 0; i < sides; i++) {
+        const vec_t angle = 2 * Q_PI * i / sides;
+        qbsp_plane_t split {};
+        VectorSet(split.normal, -cos(angle), -sin(angle), 0);
+        split.dist = -radius;
+        
+        const int capacity = WindingCapacity(w);
+        winding_t *clipped = ClipWinding(w, &split, false);
+        ASSERT_NE(nullptr, clipped);
+        ASSERT_LE(clipped->numpoints, WindingCapacity(clipped));
+        
+        if (clipped->numpoints <= capacity) {
+            EXPECT_EQ(w, clipped);
+            inplace++;
+        } else {
+            EXPECT_NE(w, clipped);
+            moved++;
+        }
+        w = clipped;
+    }
+    EXPECT_GT(inplace, 0);
+    EXPECT_GT(moved, 0);
+    
+    ASSERT_EQ(sides, w->numpoints);
+    for (int i = 0; i < w->numpoints; i++) {
+        EXPECT_LT(VectorLength(w->points[i]), radius / cos(Q_PI / sides) + 0.01);
+    }
+    EXPECT_NEAR(sides * radius * radius * tan(Q_PI / sides), WindingArea(w), 0.1);
+    
+    FreeMem(w, WINDING);
+}
+
+static const char *modelcacheDoor = R"(
+    {
+        "classname" "func_door"
+        "angle" "90"
+        "model" "*1"
+        {
+            ( 0 0 0 ) ( 0 1 0 ) ( 0 0 1 ) tech02_1 0 0 0 1 1
+            ( 64 0 0 ) ( 64 0 1 ) ( 64 1 0 ) tech02_1 0 0 0 1 1
+            ( 0 0 0 ) ( 0 0 1 ) ( 1 0 0 ) tech02_1 0 0 0 1 1
+            ( 0 8 0 ) ( 1 8 0 ) ( 0 8 1 ) tech02_1 0 0 0 1 1
+            ( 0 0 0 ) ( 1 0 0 ) ( 0 1 0 ) tech02_1 0 0 0 1 1
+            ( 0 0 96 ) ( 0 1 96 ) ( 1 0 96 ) tech02_1 0 0 0 1 1
+        }
+    }
+    )";
+
+static uint64_t ModelCacheKey(const std::string &map)
+{
+    mapentity_t entity = LoadMap(map.c_str());
+    return ModelCache_EntityKey(&entity);
+}
+
+static std::string Replace(std::string str, const std::string &from, const std::string &to)
+{
+    const size_t pos = str.find(from);
+    Q_assert(pos != std::string::npos);
+    return str.replace(pos, from.size(), to);
+}
+
+/**
+ * The bmodel cache key must change with anything that changes the
+ * compiled model, and nothing else.
+ */
+TEST(qbsp, ModelCacheKey) {
+    const uint64_t key = ModelCacheKey(modelcacheDoor);
+    
+    EXPECT_EQ(key, ModelCacheKey(modelcacheDoor));
+    
+    // qbsp assigns "model" itself
+    EXPECT_EQ(key, ModelCacheKey(Replace(modelcacheDoor, "\"*1\"", "\"*7\"")));
+    
+    EXPECT_NE(key, ModelCacheKey(Replace(modelcacheDoor, "\"90\"", "\"180\"")));
+    EXPECT_NE(key, ModelCacheKey(Replace(modelcacheDoor, "( 64 0 0 ) ( 64 0 1 ) ( 64 1 0 )",
+                                         "( 65 0 0 ) ( 65 0 1 ) ( 65 1 0 )")));
+    EXPECT_NE(key, ModelCacheKey(Replace(modelcacheDoor, "tech02_1 0 0 0 1 1\n        }",
+                                         "tech02_1 8 0 0 1 1\n        }")));
+    EXPECT_NE(key, ModelCacheKey(Replace(modelcacheDoor, "tech02_1 0 0 0 1 1\n        }",
+                                         "sky1 0 0 0 1 1\n        }")));
+    
+    options.fTestExpand = true;
+    EXPECT_NE(key, ModelCacheKey(modelcacheDoor));
+    options.fTestExpand = false;
+    
+    options.on_epsilon = 0.01;
+    EXPECT_NE(key, ModelCacheKey(modelcacheDoor));
+    options.on_epsilon = 0.0001;
+    
+    EXPECT_EQ(key, ModelCacheKey(modelcacheDoor));
+}
+
 #if 0
 TEST(qbsp, MemLeaks) {
     brush_t *brush = load128x128x32Brush();
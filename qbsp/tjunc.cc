@@ -22,22 +22,35 @@
 
 #include <qbsp/qbsp.hh>
 
-static int numwedges, numwverts;
-static int tjuncs;
-static int tjuncfaces;
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
 
-static int cWVerts;
-static int cWEdges;
+#include "tbb/parallel_for.h"
 
-static wvert_t *pWVerts;
-static wedge_t *pWEdges;
+static int numwedges, numwverts;
+static std::atomic<int> tjuncs;
+static std::atomic<int> tjuncfaces;
 
 
 //============================================================================
 
 #define NUM_HASH        1024
 
-static wedge_t *wedge_hash[NUM_HASH];
+/*
+ * Edges only ever match other edges in the same hash bucket, so each bucket
+ * owns its wedges and wverts and the buckets can be filled in parallel.
+ * Storage is a deque because wverts link to each other (and to the wedge's
+ * head) by pointer.
+ */
+struct wedge_bucket_t {
+    wedge_t *chain = nullptr;   // newest first
+    std::deque<wedge_t> wedges;
+    std::deque<wvert_t> wverts;
+};
+
+static std::vector<wedge_bucket_t> wedge_hash;
 static vec3_t hash_min, hash_scale;
 
 static void
@@ -50,7 +63,8 @@ InitHash(vec3_t mins, vec3_t maxs)
 
     VectorCopy(mins, hash_min);
     VectorSubtract(maxs, mins, size);
-    memset(wedge_hash, 0, sizeof(wedge_hash));
+    wedge_hash.clear();
+    wedge_hash.resize(NUM_HASH);
 
     volume = size[0] * size[1];
 
@@ -78,98 +92,131 @@ HashVec(vec3_t vec)
 
 //============================================================================
 
-static void
-CanonicalVector(const vec3_t p1, const vec3_t p2, vec3_t vec)
+/*
+ * Returns false (leaving vec zeroed) for a degenerate edge
+ */
+static bool
+CanonicalVector(const vec3_t p1, const vec3_t p2, vec3_t vec, vec_t *length)
 {
-    vec_t length;
-
     VectorSubtract(p2, p1, vec);
-    length = VectorNormalize(vec);
+    *length = VectorNormalize(vec);
     if (vec[0] > EQUAL_EPSILON)
-        return;
+        return true;
     else if (vec[0] < -EQUAL_EPSILON) {
         VectorSubtract(vec3_origin, vec, vec);
-        return;
+        return true;
     } else
         vec[0] = 0;
 
     if (vec[1] > EQUAL_EPSILON)
-        return;
+        return true;
     else if (vec[1] < -EQUAL_EPSILON) {
         VectorSubtract(vec3_origin, vec, vec);
-        return;
+        return true;
     } else
         vec[1] = 0;
 
     if (vec[2] > EQUAL_EPSILON)
-        return;
+        return true;
     else if (vec[2] < -EQUAL_EPSILON) {
         VectorSubtract(vec3_origin, vec, vec);
-        return;
+        return true;
     } else
         vec[2] = 0;
 
-    Message(msgWarning, warnDegenerateEdge, length, p1[0], p1[1], p1[2]);
+    return false;
 }
 
-static wedge_t *
-FindEdge(vec3_t p1, vec3_t p2, vec_t *t1, vec_t *t2)
-{
+/*
+ * The canonical (parametric) form of one face edge
+ */
+struct edgekey_t {
     vec3_t origin;
-    vec3_t edgevec;
-    wedge_t *edge;
-    vec_t temp;
-    int h;
+    vec3_t dir;
+    vec_t t1, t2;
+    unsigned hash;
+    bool degenerate;
+    vec_t length;
+};
 
-    CanonicalVector(p1, p2, edgevec);
+static void
+CalcEdgeKey(vec3_t p1, vec3_t p2, edgekey_t *key)
+{
+    key->degenerate = !CanonicalVector(p1, p2, key->dir, &key->length);
 
-    *t1 = DotProduct(p1, edgevec);
-    *t2 = DotProduct(p2, edgevec);
+    key->t1 = DotProduct(p1, key->dir);
+    key->t2 = DotProduct(p2, key->dir);
 
-    VectorMA(p1, -*t1, edgevec, origin);
+    VectorMA(p1, -key->t1, key->dir, key->origin);
 
-    if (*t1 > *t2) {
-        temp = *t1;
-        *t1 = *t2;
-        *t2 = temp;
-    }
+    if (key->t1 > key->t2)
+        std::swap(key->t1, key->t2);
+
+    key->hash = HashVec(key->origin);
+}
 
-    h = HashVec(origin);
+static wedge_t *
+FindEdgeInBucket(const wedge_bucket_t &bucket, const edgekey_t &key)
+{
+    vec_t temp;
 
-    for (edge = wedge_hash[h]; edge; edge = edge->next) {
-        temp = edge->origin[0] - origin[0];
+    for (wedge_t *edge = bucket.chain; edge; edge = edge->next) {
+        temp = edge->origin[0] - key.origin[0];
         if (temp < -EQUAL_EPSILON || temp > EQUAL_EPSILON)
             continue;
-        temp = edge->origin[1] - origin[1];
+        temp = edge->origin[1] - key.origin[1];
         if (temp < -EQUAL_EPSILON || temp > EQUAL_EPSILON)
             continue;
-        temp = edge->origin[2] - origin[2];
+        temp = edge->origin[2] - key.origin[2];
         if (temp < -EQUAL_EPSILON || temp > EQUAL_EPSILON)
             continue;
 
-        temp = edge->dir[0] - edgevec[0];
+        temp = edge->dir[0] - key.dir[0];
         if (temp < -EQUAL_EPSILON || temp > EQUAL_EPSILON)
             continue;
-        temp = edge->dir[1] - edgevec[1];
+        temp = edge->dir[1] - key.dir[1];
         if (temp < -EQUAL_EPSILON || temp > EQUAL_EPSILON)
             continue;
-        temp = edge->dir[2] - edgevec[2];
+        temp = edge->dir[2] - key.dir[2];
         if (temp < -EQUAL_EPSILON || temp > EQUAL_EPSILON)
             continue;
 
         return edge;
     }
 
-    if (numwedges >= cWEdges)
-        Error("Internal error: didn't allocate enough edges for tjuncs?");
-    edge = pWEdges + numwedges;
-    numwedges++;
+    return nullptr;
+}
+
+/*
+ * Lookup only; used by the (parallel) fix pass once all edges are registered
+ */
+static const wedge_t *
+FindEdge(vec3_t p1, vec3_t p2, vec_t *t1, vec_t *t2)
+{
+    edgekey_t key;
+
+    CalcEdgeKey(p1, p2, &key);
+    *t1 = key.t1;
+    *t2 = key.t2;
+
+    return FindEdgeInBucket(wedge_hash[key.hash], key);
+}
+
+static wedge_t *
+AddEdgeToBucket(wedge_bucket_t &bucket, const edgekey_t &key)
+{
+    wedge_t *edge = FindEdgeInBucket(bucket, key);
+    if (edge)
+        return edge;
+
+    bucket.wedges.emplace_back();
+    edge = &bucket.wedges.back();
 
-    edge->next = wedge_hash[h];
-    wedge_hash[h] = edge;
+    edge->next = bucket.chain;
+    bucket.chain = edge;
 
-    VectorCopy(origin, edge->origin);
-    VectorCopy(edgevec, edge->dir);
+    VectorCopy(key.origin, edge->origin);
+    VectorCopy(key.dir, edge->dir);
     edge->head.next = edge->head.prev = &edge->head;
     edge->head.t = VECT_MAX;
 
@@ -184,7 +231,7 @@ AddVert
 ===============
 */
 static void
-AddVert(wedge_t *edge, vec_t t)
+AddVert(wedge_bucket_t &bucket, wedge_t *edge, vec_t t)
 {
     wvert_t *v, *newv;
 
@@ -198,11 +245,8 @@ AddVert(wedge_t *edge, vec_t t)
     } while (1);
 
     // insert a new wvert before v
-    if (numwverts >= cWVerts)
-        Error("Internal error: didn't allocate enough vertices for tjuncs?");
-
-    newv = pWVerts + numwverts;
-    numwverts++;
+    bucket.wverts.emplace_back();
+    newv = &bucket.wverts.back();
 
     newv->t = t;
     newv->next = v;
@@ -212,37 +256,21 @@ AddVert(wedge_t *edge, vec_t t)
 }
 
 
-/*
-===============
-AddEdge
-
-===============
-*/
-static void
-AddEdge(vec3_t p1, vec3_t p2)
-{
-    wedge_t *edge;
-    vec_t t1, t2;
-
-    edge = FindEdge(p1, p2, &t1, &t2);
-    AddVert(edge, t1);
-    AddVert(edge, t2);
-}
-
 /*
 ===============
 AddFaceEdges
 
+Computes the canonical form of each edge of f into keys
 ===============
 */
 static void
-AddFaceEdges(face_t *f)
+AddFaceEdges(face_t *f, edgekey_t *keys)
 {
     int i, j;
 
     for (i = 0; i < f->w.numpoints; i++) {
         j = (i + 1) % f->w.numpoints;
-        AddEdge(f->w.points[i], f->w.points[j]);
+        CalcEdgeKey(f->w.points[i], f->w.points[j], &keys[i]);
     }
 }
 
@@ -358,8 +386,8 @@ static void
 FixFaceEdges(face_t *face, face_t *superface, face_t **facelist)
 {
     int i, j;
-    wedge_t *edge;
-    wvert_t *v;
+    const wedge_t *edge;
+    const wvert_t *v;
     vec_t t1, t2;
 
     *superface = *face;
@@ -369,6 +397,8 @@ FixFaceEdges(face_t *face, face_t *superface, face_t **facelist)
         j = (i + 1) % superface->w.numpoints;
 
         edge = FindEdge(superface->w.points[i], superface->w.points[j], &t1, &t2);
+        if (!edge)
+            continue;   // a piece of a registered edge that didn't line up; nothing on it
 
         v = edge->head.next;
         while (v->t < t1 + T_EPSILON)
@@ -404,54 +434,19 @@ FixFaceEdges(face_t *face, face_t *superface, face_t **facelist)
 //============================================================================
 
 static void
-tjunc_count_r(node_t *node)
+tjunc_gather_r(node_t *node, std::vector<std::pair<node_t *, size_t>> &nodes, std::vector<face_t *> &faces)
 {
     face_t *f;
 
     if (node->planenum == PLANENUM_LEAF)
         return;
 
+    nodes.emplace_back(node, faces.size());
     for (f = node->faces; f; f = f->next)
-        cWVerts += f->w.numpoints;
+        faces.push_back(f);
 
-    tjunc_count_r(node->children[0]);
-    tjunc_count_r(node->children[1]);
-}
-
-static void
-tjunc_find_r(node_t *node)
-{
-    face_t *f;
-
-    if (node->planenum == PLANENUM_LEAF)
-        return;
-
-    for (f = node->faces; f; f = f->next)
-        AddFaceEdges(f);
-
-    tjunc_find_r(node->children[0]);
-    tjunc_find_r(node->children[1]);
-}
-
-static void
-tjunc_fix_r(node_t *node, face_t *superface)
-{
-    face_t *face, *next, *facelist;
-
-    if (node->planenum == PLANENUM_LEAF)
-        return;
-
-    facelist = NULL;
-
-    for (face = node->faces; face; face = next) {
-        next = face->next;
-        FixFaceEdges(face, superface, &facelist);
-    }
-
-    node->faces = facelist;
-
-    tjunc_fix_r(node->children[0], superface);
-    tjunc_fix_r(node->children[1], superface);
+    tjunc_gather_r(node->children[0], nodes, faces);
+    tjunc_gather_r(node->children[1], nodes, faces);
 }
 
 /*
@@ -463,23 +458,23 @@ void
 TJunc(const mapentity_t *entity, node_t *headnode)
 {
     vec3_t maxs, mins;
-    face_t *superface;
-    int i, superface_bytes;
+    int i;
 
     Message(msgProgress, "Tjunc");
 
     /*
-     * Guess edges = 1/2 verts
-     * Verts are arbitrarily multiplied by 2 because there appears to
-     * be a need for them to "grow" slightly.
+     * Faces in tree order; everything below is indexed by position in this
+     * list so the results don't depend on thread scheduling
      */
-    cWVerts = 0;
-    tjunc_count_r(headnode);
-    cWEdges = cWVerts;
-    cWVerts *= 2;
+    std::vector<std::pair<node_t *, size_t>> nodes;   // node, index of its first face
+    std::vector<face_t *> faces;
+    tjunc_gather_r(headnode, nodes, faces);
+    nodes.emplace_back(nullptr, faces.size());
 
-    pWVerts = (wvert_t *)AllocMem(OTHER, cWVerts * sizeof(wvert_t), true);
-    pWEdges = (wedge_t *)AllocMem(OTHER, cWEdges * sizeof(wedge_t), true);
+    std::vector<size_t> firstkey(faces.size() + 1);
+    firstkey[0] = 0;
+    for (size_t f = 0; f < faces.size(); f++)
+        firstkey[f + 1] = firstkey[f] + faces[f]->w.numpoints;
 
     /*
      * identify all points on common edges
@@ -495,25 +490,91 @@ TJunc(const mapentity_t *entity, node_t *headnode)
 
     InitHash(mins, maxs);
 
-    numwedges = numwverts = 0;
+    // map: canonical form of every face edge
+    std::vector<edgekey_t> keys(firstkey.back());
+    tbb::parallel_for(static_cast<size_t>(0), faces.size(), [&](const size_t f) {
+        AddFaceEdges(faces[f], &keys[firstkey[f]]);
+    });
+
+    for (size_t f = 0; f < faces.size(); f++) {
+        for (size_t k = firstkey[f]; k < firstkey[f + 1]; k++) {
+            if (keys[k].degenerate) {
+                const vec_t *p1 = faces[f]->w.points[k - firstkey[f]];
+                Message(msgWarning, warnDegenerateEdge, keys[k].length, p1[0], p1[1], p1[2]);
+            }
+        }
+    }
+
+    // group the edge keys by hash bucket, keeping them in face order
+    std::vector<size_t> bucketstart(NUM_HASH + 1, 0);
+    for (const edgekey_t &key : keys)
+        bucketstart[key.hash + 1]++;
+    for (i = 0; i < NUM_HASH; i++)
+        bucketstart[i + 1] += bucketstart[i];
+
+    std::vector<size_t> bucketkeys(keys.size());
+    {
+        std::vector<size_t> fill(bucketstart.begin(), bucketstart.end() - 1);
+        for (size_t k = 0; k < keys.size(); k++)
+            bucketkeys[fill[keys[k].hash]++] = k;
+    }
 
-    tjunc_find_r(headnode);
+    // reduce: each bucket registers its edges and their vertexes
+    tbb::parallel_for(static_cast<size_t>(0), static_cast<size_t>(NUM_HASH), [&](const size_t h) {
+        wedge_bucket_t &bucket = wedge_hash[h];
+        for (size_t b = bucketstart[h]; b < bucketstart[h + 1]; b++) {
+            const edgekey_t &key = keys[bucketkeys[b]];
+            wedge_t *edge = AddEdgeToBucket(bucket, key);
+            AddVert(bucket, edge, key.t1);
+            AddVert(bucket, edge, key.t2);
+        }
+    });
+
+    numwedges = numwverts = 0;
+    for (const wedge_bucket_t &bucket : wedge_hash) {
+        numwedges += bucket.wedges.size();
+        numwverts += bucket.wverts.size();
+    }
 
     Message(msgStat, "%8d world edges", numwedges);
     Message(msgStat, "%8d edge points", numwverts);
 
-    superface_bytes = offsetof(face_t, w.points[MAX_SUPERFACE_POINTS]);
-    superface = (face_t*)AllocMem(OTHER, superface_bytes, true);
-
     /* add extra vertexes on edges where needed */
     tjuncs = tjuncfaces = 0;
-    tjunc_fix_r(headnode, superface);
 
-    free(superface);
+    std::vector<face_t *> fixedfaces(faces.size(), nullptr);
+    tbb::parallel_for(static_cast<size_t>(0), faces.size(), [&](const size_t f) {
+        static thread_local std::unique_ptr<uint8_t[]> superface_buf;
+        if (!superface_buf) {
+            const int superface_bytes = offsetof(face_t, w.points[MAX_SUPERFACE_POINTS]);
+            superface_buf.reset(new uint8_t[superface_bytes]());
+        }
+        face_t *superface = reinterpret_cast<face_t *>(superface_buf.get());
+
+        FixFaceEdges(faces[f], superface, &fixedfaces[f]);
+    });
+
+    /*
+     * Relink the node face lists in the order the serial version produced:
+     * each face's fragments are prepended, in turn, to the node's new list
+     */
+    for (size_t n = 0; n + 1 < nodes.size(); n++) {
+        face_t *facelist = NULL;
+        for (size_t f = nodes[n].second; f < nodes[n + 1].second; f++) {
+            face_t *fragments = fixedfaces[f];
+            if (!fragments)
+                continue;
+            face_t *tail = fragments;
+            while (tail->next)
+                tail = tail->next;
+            tail->next = facelist;
+            facelist = fragments;
+        }
+        nodes[n].first->faces = facelist;
+    }
 
-    free(pWVerts);
-    free(pWEdges);
+    wedge_hash.clear();
 
-    Message(msgStat, "%8d edges added by tjunctions", tjuncs);
-    Message(msgStat, "%8d faces added by tjunctions", tjuncfaces);
+    Message(msgStat, "%8d edges added by tjunctions", tjuncs.load());
+    Message(msgStat, "%8d faces added by tjunctions", tjuncfaces.load());
 }
@@ -19,7 +19,12 @@
     See file, 'COPYING', for details.
 */
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <unordered_set>
+#include <vector>
 #include <stddef.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -29,6 +34,184 @@
 
 #include <qbsp/qbsp.hh>
 
+#include "tbb/concurrent_unordered_set.h"
+
+/*
+ * Memory arena for the short-lived geometry of a single entity/hull
+ * (faces, windings, nodes and portals).
+ *
+ * Between MemArena_Begin() and MemArena_End(), AllocMem() hands out blocks of
+ * those types from per-thread chunks so the TBB tasks in CSG/SolidBSP never
+ * contend on the heap. FreeMem() puts a block on a per-thread free list for
+ * its size, and MemArena_End() releases all chunks in one go.
+ *
+ * Every block carries a small header with its size. FreeMem() tells arena
+ * blocks apart by address: chunks are made of whole pages, which are
+ * recorded in arenaPages while the chunk is alive. Blocks allocated with
+ * malloc while no arena was active (e.g. brushes loaded for the BSPX brush
+ * list) are recorded in heapBlocks. Anything else is from an arena that has
+ * already been released, and its header can't be read.
+ */
+struct memheader_t {
+    uint32_t size;          // usable size of the block, multiple of ARENA_ALIGN
+    uint32_t pad[3];        // keep the block 16-byte aligned
+};
+
+static constexpr size_t ARENA_ALIGN = sizeof(memheader_t);
+static constexpr size_t ARENA_PAGE_SIZE = 64 * 1024;
+static constexpr size_t ARENA_CHUNK_SIZE = 1024 * 1024;
+static constexpr size_t ARENA_NUM_BINS = 512;   // free lists for blocks up to 8KiB
+
+struct memarena_thread_t {
+    char *cursor = nullptr;
+    char *end = nullptr;
+    void *freelist[ARENA_NUM_BINS] = {};
+    size_t allocated = 0;   // bytes handed out, including reused blocks
+    size_t blocks = 0;
+};
+
+static std::mutex arenaLock;
+static std::atomic<bool> arenaActive { false };
+static std::atomic<uint32_t> arenaGeneration { 0 };
+static std::vector<void *> arenaChunks;         // as returned by malloc
+static tbb::concurrent_unordered_set<uintptr_t> arenaPages;
+static std::mutex heapLock;
+static std::unordered_set<void *> heapBlocks;
+static std::vector<std::unique_ptr<memarena_thread_t>> arenaThreads;
+static size_t arenaReserved;
+static size_t arenaPeak;
+static size_t arenaTotalAllocated;
+
+static thread_local uint32_t threadArenaGeneration;
+static thread_local memarena_thread_t *threadArena;
+
+static void *
+MemArena_NewChunk(size_t size)
+{
+    size = (size + ARENA_PAGE_SIZE - 1) & ~(ARENA_PAGE_SIZE - 1);
+    void *mem = malloc(size + ARENA_PAGE_SIZE);
+    if (!mem)
+        Error("allocation of %zu bytes failed (%s)", size, __func__);
+
+    const uintptr_t first = (reinterpret_cast<uintptr_t>(mem) + ARENA_PAGE_SIZE - 1) / ARENA_PAGE_SIZE;
+    for (uintptr_t page = first; page < first + size / ARENA_PAGE_SIZE; page++)
+        arenaPages.insert(page);
+
+    std::unique_lock<std::mutex> lck { arenaLock };
+    arenaChunks.push_back(mem);
+    arenaReserved += size;
+    return reinterpret_cast<void *>(first * ARENA_PAGE_SIZE);
+}
+
+static bool
+MemArena_Owns(const memheader_t *header)
+{
+    return arenaActive && arenaPages.count(reinterpret_cast<uintptr_t>(header) / ARENA_PAGE_SIZE);
+}
+
+static memarena_thread_t *
+MemArena_ThreadState(uint32_t generation)
+{
+    if (threadArenaGeneration != generation) {
+        std::unique_lock<std::mutex> lck { arenaLock };
+        arenaThreads.push_back(std::make_unique<memarena_thread_t>());
+        threadArena = arenaThreads.back().get();
+        threadArenaGeneration = generation;
+    }
+    return threadArena;
+}
+
+static memheader_t *
+MemArena_Alloc(size_t size, uint32_t generation)
+{
+    memarena_thread_t *arena = MemArena_ThreadState(generation);
+    const size_t bin = size / ARENA_ALIGN;
+    const size_t blocksize = sizeof(memheader_t) + size;
+    memheader_t *header;
+
+    arena->allocated += size;
+    arena->blocks++;
+
+    if (bin < ARENA_NUM_BINS && arena->freelist[bin]) {
+        header = static_cast<memheader_t *>(arena->freelist[bin]);
+        arena->freelist[bin] = *reinterpret_cast<void **>(header + 1);
+        return header;
+    }
+
+    // oversized blocks get a chunk of their own
+    if (blocksize > ARENA_CHUNK_SIZE / 4)
+        return static_cast<memheader_t *>(MemArena_NewChunk(blocksize));
+
+    if (arena->cursor + blocksize > arena->end) {
+        arena->cursor = static_cast<char *>(MemArena_NewChunk(ARENA_CHUNK_SIZE));
+        arena->end = arena->cursor + ARENA_CHUNK_SIZE;
+    }
+    header = reinterpret_cast<memheader_t *>(arena->cursor);
+    arena->cursor += blocksize;
+    return header;
+}
+
+/*
+==========
+MemArena_Begin
+==========
+*/
+void
+MemArena_Begin(void)
+{
+    if (arenaActive)
+        Error("Internal error: memory arena already active (%s)", __func__);
+
+    arenaGeneration++;
+    arenaActive = true;
+}
+
+/*
+==========
+MemArena_End
+
+Releases everything allocated from the arena since MemArena_Begin
+==========
+*/
+void
+MemArena_End(void)
+{
+    size_t allocated = 0, blocks = 0;
+
+    arenaActive = false;
+
+    std::unique_lock<std::mutex> lck { arenaLock };
+    for (const auto &arena : arenaThreads) {
+        allocated += arena->allocated;
+        blocks += arena->blocks;
+    }
+    arenaThreads.clear();
+    for (void *chunk : arenaChunks)
+        free(chunk);
+    arenaChunks.clear();
+    arenaPages.clear();
+
+    arenaPeak = std::max(arenaPeak, arenaReserved);
+    arenaTotalAllocated += allocated;
+
+    Message(msgStat, "%8zu KiB arena memory (%zu KiB in %zu allocations)",
+            arenaReserved / 1024, allocated / 1024, blocks);
+
+    arenaReserved = 0;
+}
+
+/*
+==========
+MemArena_PrintStats
+==========
+*/
+void
+MemArena_PrintStats(void)
+{
+    Message(msgStat, "%8zu KiB peak arena memory", arenaPeak / 1024);
+    Message(msgStat, "%8zu KiB total allocated from arenas", arenaTotalAllocated / 1024);
+}
+
 /*
 ==========
 AllocMem
@@ -40,7 +223,7 @@ AllocMem(int Type, int cElements, bool fZero)
     void *pTemp;
     int cSize;
 
-    if (!(Type == WINDING || Type == OTHER))
+    if (Type < WINDING || Type > OTHER)
         Error("Internal error: invalid memory type %d (%s)", Type, __func__);
 
     // For windings, cElements == number of points on winding
@@ -58,9 +241,29 @@ AllocMem(int Type, int cElements, bool fZero)
     } else {
         cSize = cElements;
     }
-    pTemp = malloc(cSize);
-    if (!pTemp)
-        Error("allocation of %d bytes failed (%s)", cSize, __func__);
+
+    if (Type == OTHER) {
+        pTemp = malloc(cSize);
+        if (!pTemp)
+            Error("allocation of %d bytes failed (%s)", cSize, __func__);
+    } else {
+        const size_t size = (cSize + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+        const uint32_t generation = arenaGeneration;
+        memheader_t *header;
+
+        if (arenaActive) {
+            header = MemArena_Alloc(size, generation);
+        } else {
+            header = static_cast<memheader_t *>(malloc(sizeof(memheader_t) + size));
+            if (!header)
+                Error("allocation of %d bytes failed (%s)", cSize, __func__);
+
+            std::unique_lock<std::mutex> lck { heapLock };
+            heapBlocks.insert(header);
+        }
+        header->size = static_cast<uint32_t>(size);
+        pTemp = header + 1;
+    }
 
     if (fZero)
         memset(pTemp, 0, cSize);
@@ -68,6 +271,54 @@ AllocMem(int Type, int cElements, bool fZero)
     return pTemp;
 }
 
+/*
+==========
+FreeMem
+==========
+*/
+void
+FreeMem(void *pMem, int Type)
+{
+    if (!pMem)
+        return;
+
+    if (Type == OTHER) {
+        free(pMem);
+        return;
+    }
+
+    memheader_t *header = static_cast<memheader_t *>(pMem) - 1;
+    if (MemArena_Owns(header)) {
+        const size_t bin = header->size / ARENA_ALIGN;
+        if (bin < ARENA_NUM_BINS) {
+            memarena_thread_t *arena = MemArena_ThreadState(arenaGeneration);
+            *static_cast<void **>(pMem) = arena->freelist[bin];
+            arena->freelist[bin] = header;
+        }
+        return;
+    }
+
+    std::unique_lock<std::mutex> lck { heapLock };
+    if (heapBlocks.erase(header)) {
+        lck.unlock();
+        free(header);
+    }
+    // otherwise it's from a previous arena, which is already gone
+}
+
+/*
+==========
+AllocSize
+
+Usable size of a WINDING/FACE/NODE/PORTAL block from AllocMem
+==========
+*/
+size_t
+AllocSize(const void *pMem)
+{
+    return (static_cast<const memheader_t *>(pMem) - 1)->size;
+}
+
 /* Keep track of output state */
 static bool fInPercent = false;
 
@@ -20,9 +20,15 @@
 */
 
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <stdint.h>
+#include <functional>
 #include <string>
+#include <vector>
 
 #include <qbsp/qbsp.hh>
+#include <qbsp/file.hh>
 #include <qbsp/wad.hh>
 
 uint8_t thepalette[768] = // Quake palette
@@ -35,18 +41,100 @@ uint8_t thepalette[768] = // Quake palette
     43,175,47,47,159,47,47,143,47,47,127,47,47,111,47,47,95,43,43,79,35,35,63,27,27,47,19,19,31,11,11,15,43,0,0,59,0,0,75,7,0,95,7,0,111,15,0,127,23,7,147,31,7,163,39,11,183,51,15,195,75,27,207,99,43,219,127,59,227,151,79,231,171,95,239,191,119,247,211,139,167,123,59,183,155,55,199,195,55,231,227,87,127,191,255,171,231,255,215,255,255,103,0,0,139,0,0,179,0,0,215,0,0,255,0,0,255,243,147,255,247,199,255,255,255,159,91,83
 };
 
+wad_t::~wad_t()
+{
+    if (data) {
+        UnmapFile(data, datalen);
+    }
+}
+
+/*
+ * Global name -> lump lookup over all loaded wads. When several wads
+ * contain the same name, the one nearest the front of wadlist wins, which
+ * is the same one a linear search of wadlist would find.
+ */
+struct wadlump_t {
+    wad_t *wad;
+    const lumpinfo_t *lump;
+};
+
+static std::unordered_map<std::string, wadlump_t, case_insensitive_hash, case_insensitive_equal> wadindex;
+
+/*
+ * On-disk cache of a wad's directory, along with the miptex header of each
+ * lump, so repeat compiles don't need to touch the wad until texture data
+ * is actually copied out of it.
+ */
+#define WADINDEX_IDENT "WIDX"
+#define WADINDEX_VERSION 1
+
+struct wadindexheader_t {
+    char identification[4];
+    int version;
+    int64_t mtime;
+    int64_t filesize;
+    int pathlen;
+    wadinfo_t wadheader;
+};
+
+struct wadindexlump_t {
+    lumpinfo_t lump;
+    int hasmiptex;
+    dmiptex_t miptex;
+};
+
 static bool
-WAD_LoadInfo(wad_t &wad, bool external)
+WAD_Map(wad_t &wad, bool nofail)
+{
+    if (!wad.data)
+        wad.datalen = MapFile(wad.path.c_str(), &wad.data, nofail);
+
+    return wad.data != nullptr;
+}
+
+static void
+WAD_AddLump(wad_t &wad, lumpinfo_t lump, const dmiptex_t *miptex, bool external)
+{
+    if (miptex)
+    {
+        int w = LittleLong(miptex->width);
+        int h = LittleLong(miptex->height);
+        lump.size = sizeof(*miptex) + (w>>0)*(h>>0) + (w>>1)*(h>>1) + (w>>2)*(h>>2) + (w>>3)*(h>>3);
+        if (options.target_game->id == GAME_HALF_LIFE)
+            lump.size += 2+3*256;    //palette size+palette data
+        lump.size = (lump.size+3) & ~3;    //keep things aligned if we can.
+
+        texture_t tex;
+        memcpy(tex.name, miptex->name, 16);
+        tex.name[15] = '\0';
+        tex.width = miptex->width;
+        tex.height = miptex->height;
+        wad.textures.insert({ tex.name, tex });
+
+        //if we're not going to embed it into the bsp, set its size now so we know how much to actually store.
+        if (external)
+            lump.size = lump.disksize = sizeof(dmiptex_t);
+
+        //printf("Created texture_t %s %d %d\n", tex->name, tex->width, tex->height);
+    }
+    else
+        lump.size = 0;
+
+    wad.lumps.insert({ lump.name, lump });
+}
+
+static bool
+WAD_LoadInfo(wad_t &wad, bool external, std::vector<wadindexlump_t> *records)
 {
     wadinfo_t *hdr = &wad.header;
-    int i, len;
-    dmiptex_t miptex;
+    int i;
 
-    external |= options.fNoTextures;
+    if (!WAD_Map(wad, false))
+        return false;
 
-    len = fread(hdr, 1, sizeof(wadinfo_t), wad.file);
-    if (len != sizeof(wadinfo_t))
+    if (wad.datalen < sizeof(wadinfo_t))
         return false;
+    memcpy(hdr, wad.data, sizeof(wadinfo_t));
 
     wad.version = 0;
     if (!strncmp(hdr->identification, "WAD2", 4))
@@ -56,75 +144,158 @@ WAD_LoadInfo(wad_t &wad, bool external)
     if (!wad.version)
         return false;
 
-    fseek(wad.file, hdr->infotableofs, SEEK_SET);
+    if (hdr->infotableofs < 0 || hdr->numlumps < 0
+        || hdr->infotableofs + static_cast<size_t>(hdr->numlumps) * sizeof(lumpinfo_t) > wad.datalen)
+        return false;
+
     wad.lumps.reserve(wad.header.numlumps);
+    if (records)
+        records->resize(wad.header.numlumps);
 
     /* Get the dimensions and make a texture_t */
     for (i = 0; i < wad.header.numlumps; i++) {
-        lumpinfo_t lump;
-
-        len = fread(&lump, 1, sizeof(lump), wad.file);
-        if (len != sizeof(lump))
-            return false;
-
-        auto restore_pos = ftell(wad.file);
-
-        fseek(wad.file, lump.filepos, SEEK_SET);
-        len = fread(&miptex, 1, sizeof(miptex), wad.file);
-
-        if (len == sizeof(miptex))
-        {
-            int w = LittleLong(miptex.width);
-            int h = LittleLong(miptex.height);
-            lump.size = sizeof(miptex) + (w>>0)*(h>>0) + (w>>1)*(h>>1) + (w>>2)*(h>>2) + (w>>3)*(h>>3);
-            if (options.target_game->id == GAME_HALF_LIFE)
-                lump.size += 2+3*256;    //palette size+palette data
-            lump.size = (lump.size+3) & ~3;    //keep things aligned if we can.
-
-            texture_t tex;
-            memcpy(tex.name, miptex.name, 16);
-            tex.name[15] = '\0';
-            tex.width = miptex.width;
-            tex.height = miptex.height;
-            wad.textures.insert({ tex.name, tex });
-
-            //if we're not going to embed it into the bsp, set its size now so we know how much to actually store.
-            if (external)
-                lump.size = lump.disksize = sizeof(dmiptex_t);
-
-            //printf("Created texture_t %s %d %d\n", tex->name, tex->width, tex->height);
-        }
-        else
-            lump.size = 0;
+        wadindexlump_t record {};
 
-        fseek(wad.file, restore_pos, SEEK_SET);
+        memcpy(&record.lump, wad.data + hdr->infotableofs + i * sizeof(lumpinfo_t), sizeof(lumpinfo_t));
 
-        wad.lumps.insert({ lump.name, lump });
+        const lumpinfo_t &lump = record.lump;
+        if (lump.filepos >= 0 && lump.filepos + sizeof(dmiptex_t) <= wad.datalen) {
+            memcpy(&record.miptex, wad.data + lump.filepos, sizeof(dmiptex_t));
+            record.hasmiptex = 1;
+        }
+
+        WAD_AddLump(wad, record.lump, record.hasmiptex ? &record.miptex : nullptr, external);
+        if (records)
+            (*records)[i] = record;
     }
 
     return true;
 }
 
+static std::string
+WAD_IndexPath(const wad_t &wad)
+{
+    const size_t slash = wad.path.find_last_of("/\\");
+    const std::string basename = (slash == std::string::npos) ? wad.path : wad.path.substr(slash + 1);
+    char hash[17];
+
+    /* the full path is hashed so same-named wads from different paths don't collide */
+    snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(std::hash<std::string>()(wad.path)));
+
+    return options.wadCacheDir + "/" + basename + "-" + hash + ".idx";
+}
+
+static bool
+WAD_ReadIndex(wad_t &wad, const struct stat &st, bool external)
+{
+    wadindexheader_t header;
+    std::string path;
+    std::vector<wadindexlump_t> records;
+    bool ok = false;
+    FILE *f;
+
+    f = fopen(WAD_IndexPath(wad).c_str(), "rb");
+    if (!f)
+        return false;
+
+    if (fread(&header, 1, sizeof(header), f) != sizeof(header))
+        goto out;
+    if (strncmp(header.identification, WADINDEX_IDENT, 4) || header.version != WADINDEX_VERSION)
+        goto out;
+    if (header.mtime != static_cast<int64_t>(st.st_mtime) || header.filesize != static_cast<int64_t>(st.st_size))
+        goto out;
+    if (header.pathlen != static_cast<int>(wad.path.size()) || header.wadheader.numlumps < 0)
+        goto out;
+
+    path.resize(header.pathlen);
+    if (fread(&path[0], 1, header.pathlen, f) != static_cast<size_t>(header.pathlen) || path != wad.path)
+        goto out;
+
+    /* a truncated index (e.g. an interrupted write) is simply rebuilt */
+    records.resize(header.wadheader.numlumps);
+    if (fread(records.data(), sizeof(wadindexlump_t), records.size(), f) != records.size())
+        goto out;
+
+    wad.header = header.wadheader;
+    wad.version = !strncmp(wad.header.identification, "WAD3", 4) ? 3 : 2;
+    wad.lumps.reserve(records.size());
+    for (const wadindexlump_t &record : records)
+        WAD_AddLump(wad, record.lump, record.hasmiptex ? &record.miptex : nullptr, external);
+    ok = true;
+
+out:
+    fclose(f);
+    return ok;
+}
+
+static void
+WAD_WriteIndex(const wad_t &wad, const struct stat &st, const std::vector<wadindexlump_t> &records)
+{
+    wadindexheader_t header {};
+    FILE *f;
+
+    f = fopen(WAD_IndexPath(wad).c_str(), "wb");
+    if (!f)
+        return; // cache directory not writable, carry on without it
+
+    memcpy(header.identification, WADINDEX_IDENT, 4);
+    header.version = WADINDEX_VERSION;
+    header.mtime = st.st_mtime;
+    header.filesize = st.st_size;
+    header.pathlen = wad.path.size();
+    header.wadheader = wad.header;
+
+    fwrite(&header, 1, sizeof(header), f);
+    fwrite(wad.path.data(), 1, wad.path.size(), f);
+    fwrite(records.data(), sizeof(wadindexlump_t), records.size(), f);
+    fclose(f);
+}
+
 static void WADList_OpenWad(const char *fpath, bool external)
 {
-    wad_t wad;
-    
-    wad.file = fopen(fpath, "rb");
+    struct stat st;
 
-    if (wad.file) {
-        if (options.fVerbose)
-            Message(msgLiteral, "Opened WAD: %s\n", fpath);
+    if (stat(fpath, &st)) {
+        // Message?
+        return;
+    }
+
+    external |= options.fNoTextures;
 
-        if (WAD_LoadInfo(wad, external)) {
-            wadlist.push_front(wad);
-            wad.file = nullptr; // wadlist now owns this file handle
+    wadlist.emplace_front();
+    wad_t &wad = wadlist.front();
+    wad.path = fpath;
+
+    if (options.fVerbose)
+        Message(msgLiteral, "Opened WAD: %s\n", fpath);
+
+    if (!options.wadCacheDir.empty()) {
+        if (WAD_ReadIndex(wad, st, external))
+            return;
+
+        std::vector<wadindexlump_t> records;
+        if (WAD_LoadInfo(wad, external, &records)) {
+            WAD_WriteIndex(wad, st, records);
             return;
         }
+    } else if (WAD_LoadInfo(wad, external, nullptr)) {
+        return;
+    }
 
-        Message(msgWarning, warnNotWad, fpath);
-        fclose(wad.file);
-    } else {
-        // Message?
+    Message(msgWarning, warnNotWad, fpath);
+    wadlist.pop_front();
+}
+
+static void
+WADList_BuildIndex()
+{
+    wadindex.clear();
+
+    for (auto &wad : wadlist) {
+        for (const auto &lump : wad.lumps) {
+            // keeps the entry from an earlier wad in the list
+            wadindex.insert({ lump.first, { &wad, &lump.second } });
+        }
     }
 }
 
@@ -157,22 +328,55 @@ void WADList_Init(const char *wadstring)
 
         pos++;
     }
+
+    WADList_BuildIndex();
 }
 
-static const lumpinfo_t *
+static const wadlump_t *
 WADList_FindTexture(const char *name)
 {
-    for (auto &wad : wadlist) {
-        auto it = wad.lumps.find(name);
+    auto it = wadindex.find(name);
+
+    if (it == wadindex.end()) {
+        return nullptr;
+    }
+
+    return &it->second;
+}
+
+/*
+ * The texture to load into the bsp: the indexed one, unless it has been
+ * stubbed out with an empty lump, in which case the first later wad in the
+ * list that has it with some data.
+ */
+static bool
+WADList_FindLoadableTexture(const char *name, wadlump_t *out)
+{
+    const wadlump_t *texture = WADList_FindTexture(name);
+
+    if (!texture)
+        return false;
+    if (texture->lump->size) {
+        *out = *texture;
+        return true;
+    }
 
-        if (it == wad.lumps.end()) {
+    bool later = false;
+    for (auto &wad : wadlist) {
+        if (&wad == texture->wad) {
+            later = true;
             continue;
         }
+        if (!later)
+            continue;
 
-        return &it->second;
+        auto it = wad.lumps.find(name);
+        if (it != wad.lumps.end() && it->second.size) {
+            *out = { &wad, &it->second };
+            return true;
+        }
     }
-
-    return NULL;
+    return false;
 }
 
 static void WAD_SanitizeName(dmiptex_t* miptex)
@@ -192,25 +396,20 @@ static void WAD_SanitizeName(dmiptex_t* miptex)
 }
 
 static int
-WAD_LoadLump(const wad_t &wad, const char *name, uint8_t *dest)
+WAD_LoadLump(wad_t &wad, const lumpinfo_t &lump, const char *name, uint8_t *dest)
 {
     int i;
-    int size;
 
-    auto it = wad.lumps.find(name);
+    WAD_Map(wad, true);
 
-    if (it == wad.lumps.end()) {
-        return 0;
-    }
-
-    auto &lump = it->second;
+    if (lump.filepos < 0 || lump.disksize < 0 || lump.filepos + static_cast<size_t>(lump.disksize) > wad.datalen)
+        Error("Failure reading from file");
 
-    fseek(wad.file, lump.filepos, SEEK_SET);
+    /* copied straight out of the mapping */
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(wad.data) + lump.filepos;
 
     if (lump.disksize == sizeof(dmiptex_t)) {
-        size = fread(dest, 1, sizeof(dmiptex_t), wad.file);
-        if (size != sizeof(dmiptex_t))
-            Error("Failure reading from file");
+        memcpy(dest, data, sizeof(dmiptex_t));
 
         WAD_SanitizeName((dmiptex_t*)dest);
         for (i = 0; i < MIPLEVELS; i++)
@@ -220,24 +419,21 @@ WAD_LoadLump(const wad_t &wad, const char *name, uint8_t *dest)
 
     if (lump.size != lump.disksize) {
         logprint("Texture %s is %i bytes in wad, packed to %i bytes in bsp\n", name, lump.disksize, lump.size);
-        std::vector<uint8_t> data(lump.disksize);
-        size = fread(data.data(), 1, lump.disksize, wad.file);
-        if (size != lump.disksize)
-            Error("Failure reading from file");
 
         WAD_SanitizeName((dmiptex_t*)dest);
         auto out = (dmiptex_t *)dest;
-        auto in = (dmiptex_t *)data.data();
-        *out = *in;
+        dmiptex_t in;
+        memcpy(&in, data, sizeof(in));
+        *out = in;
         out->offsets[0] = sizeof(*out);
-        out->offsets[1] = out->offsets[0] + (in->width>>0)*(in->height>>0);
-        out->offsets[2] = out->offsets[1] + (in->width>>1)*(in->height>>1);
-        out->offsets[3] = out->offsets[2] + (in->width>>2)*(in->height>>2);
-        auto palofs     = out->offsets[3] + (in->width>>3)*(in->height>>3);
-        memcpy(dest+out->offsets[0], data.data()+(in->offsets[0]), (in->width>>0)*(in->height>>0));
-        memcpy(dest+out->offsets[1], data.data()+(in->offsets[1]), (in->width>>1)*(in->height>>1));
-        memcpy(dest+out->offsets[2], data.data()+(in->offsets[2]), (in->width>>2)*(in->height>>2));
-        memcpy(dest+out->offsets[3], data.data()+(in->offsets[3]), (in->width>>3)*(in->height>>3));
+        out->offsets[1] = out->offsets[0] + (in.width>>0)*(in.height>>0);
+        out->offsets[2] = out->offsets[1] + (in.width>>1)*(in.height>>1);
+        out->offsets[3] = out->offsets[2] + (in.width>>2)*(in.height>>2);
+        auto palofs     = out->offsets[3] + (in.width>>3)*(in.height>>3);
+        memcpy(dest+out->offsets[0], data+(in.offsets[0]), (in.width>>0)*(in.height>>0));
+        memcpy(dest+out->offsets[1], data+(in.offsets[1]), (in.width>>1)*(in.height>>1));
+        memcpy(dest+out->offsets[2], data+(in.offsets[2]), (in.width>>2)*(in.height>>2));
+        memcpy(dest+out->offsets[3], data+(in.offsets[3]), (in.width>>3)*(in.height>>3));
 
         if (options.target_game->id == GAME_HALF_LIFE)
         {    //palette size. 256 in little endian.
@@ -246,16 +442,14 @@ WAD_LoadLump(const wad_t &wad, const char *name, uint8_t *dest)
 
             //now the palette
             if (wad.version == 3)
-                memcpy(dest+palofs+2, data.data()+(in->offsets[3]+(in->width>>3)*(in->height>>3)+2), 3*256);
+                memcpy(dest+palofs+2, data+(in.offsets[3]+(in.width>>3)*(in.height>>3)+2), 3*256);
             else
                 memcpy(dest+palofs+2, thepalette, 3*256);    //FIXME: quake palette or something.
         }
     }
     else
     {
-        size = fread(dest, 1, lump.disksize, wad.file);
-        if (size != lump.disksize)
-            Error("Failure reading from file");
+        memcpy(dest, data, lump.disksize);
 
         WAD_SanitizeName((dmiptex_t*)dest);
     }
@@ -273,16 +467,12 @@ WADList_LoadTextures(dmiptexlump_t *lump)
     for (i = 0; i < map.nummiptex(); i++) {
         if (lump->dataofs[i])
             continue;
-        size = 0;
-        for (auto &wad : wadlist) {
-            size = WAD_LoadLump(wad, map.miptexTextureName(i).c_str(), data);
-            if (size)
-                break;
-        }
-        if (!size)
+        wadlump_t texture;
+        if (!WADList_FindLoadableTexture(map.miptexTextureName(i).c_str(), &texture))
             continue;
-        if (data + size - (uint8_t *)map.exported_texdata.data() > map.exported_texdata.size())
+        if (data + texture.lump->size - (uint8_t *)map.exported_texdata.data() > map.exported_texdata.size())
             Error("Internal error: not enough texture memory allocated");
+        size = WAD_LoadLump(*texture.wad, *texture.lump, map.miptexTextureName(i).c_str(), data);
         lump->dataofs[i] = data - (uint8_t *)lump;
         data += size;
     }
@@ -316,7 +506,7 @@ void
 WADList_Process()
 {
     int i;
-    const lumpinfo_t *texture;
+    wadlump_t texture;
     dmiptexlump_t *miptexlump;
     
     WADList_AddAnimationFrames();
@@ -326,9 +516,8 @@ WADList_Process()
 
     /* Count texture size.  Slower, but saves memory. */
     for (i = 0; i < map.nummiptex(); i++) {
-        texture = WADList_FindTexture(map.miptexTextureName(i).c_str());
-        if (texture) {
-            texdatasize += texture->size;
+        if (WADList_FindLoadableTexture(map.miptexTextureName(i).c_str(), &texture)) {
+            texdatasize += texture.lump->size;
         }
     }
 
@@ -368,4 +557,10 @@ const texture_t *WADList_GetTexture(const char *name)
     return nullptr;
 }
 
-std::list<wad_t> wadlist;
\ No newline at end of file
+std::list<wad_t> wadlist;
+
+void WADList_Free()
+{
+    wadindex.clear();
+    wadlist.clear();
+}
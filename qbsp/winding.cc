@@ -73,7 +73,8 @@ BaseWindingForPlane(const qbsp_plane_t *p)
     VectorScale(vright, options.worldExtent, vright);
 
     // project a really big axis aligned box onto the plane
-    w = (winding_t *)AllocMem(WINDING, 4, true);
+    // (with room for the first few clips to happen in place)
+    w = (winding_t *)AllocMem(WINDING, 8, true);
 
     VectorSubtract(org, vright, w->points[0]);
     VectorAdd(w->points[0], vup, w->points[0]);
@@ -120,6 +121,20 @@ void CopyWindingInto(winding_t *dest, const winding_t *src) // FIXME: get rid of
     memcpy(dest->points, src->points, sizeof(vec3_t) * src->numpoints);
 }
 
+/*
+==================
+WindingCapacity
+
+Number of points that fit in a winding from AllocMem
+==================
+*/
+static int
+WindingCapacity(const winding_t *w)
+{
+    const size_t size = AllocSize(w) - offsetof(winding_t, points[0]) - sizeof(int);
+    return static_cast<int>(size / sizeof(w->points[0]));
+}
+
 /*
 ==================
 FlipWinding
@@ -147,90 +162,80 @@ CheckWinding(const winding_t *w)
 }
 
 
+/*
+==================
+CalcSides
+
+The distances are computed in one pass and classified in a second so both
+loops vectorize; the arithmetic is the same as DotProduct.
+==================
+*/
 void
 CalcSides(const winding_t *in, const qbsp_plane_t *split, int *sides, vec_t *dists,
           int counts[3])
 {
-    int i;
-    const vec_t *p;
-
-    counts[0] = counts[1] = counts[2] = 0;
-    p = in->points[0];
-    for (i = 0; i < in->numpoints; i++, p += 3) {
-        const vec_t dist = DotProduct(split->normal, p) - split->dist;
-        dists[i] = dist;
-        if (dist > ON_EPSILON)
-            sides[i] = SIDE_FRONT;
-        else if (dist < -ON_EPSILON)
-            sides[i] = SIDE_BACK;
-        else
-            sides[i] = SIDE_ON;
-        counts[sides[i]]++;
+    const int numpoints = in->numpoints;
+    const vec_t *p = in->points[0];
+    const vec_t nx = split->normal[0];
+    const vec_t ny = split->normal[1];
+    const vec_t nz = split->normal[2];
+    const vec_t d = split->dist;
+    const vec_t epsilon = ON_EPSILON;
+    int i, front = 0, back = 0;
+
+    for (i = 0; i < numpoints; i++)
+        dists[i] = nx * p[i * 3] + ny * p[i * 3 + 1] + nz * p[i * 3 + 2] - d;
+
+    for (i = 0; i < numpoints; i++) {
+        const int isfront = dists[i] > epsilon;
+        const int isback = dists[i] < -epsilon;
+        sides[i] = isfront ? SIDE_FRONT : (isback ? SIDE_BACK : SIDE_ON);
+        front += isfront;
+        back += isback;
     }
+
+    counts[SIDE_FRONT] = front;
+    counts[SIDE_BACK] = back;
+    counts[SIDE_ON] = numpoints - front - back;
+
     sides[i] = sides[0];
     dists[i] = dists[0];
 }
 
 /*
 ==================
-ClipWinding
+ClipWindingPoints
 
-Clips the winding to the plane, returning the new winding on the positive side
-Frees the input winding.
-If keepon is true, an exactly on-plane winding will be saved, otherwise
-it will be clipped away.
+Writes the front part of `in` to `out`, given the sides and distances from
+CalcSides. Returns the number of points.
 ==================
 */
-winding_t *
-ClipWinding(winding_t *in, const qbsp_plane_t *split, bool keepon)
+static int
+ClipWindingPoints(const winding_t *in, const qbsp_plane_t *split, const int *sides,
+                  const vec_t *dists, vec3_t *out, const int maxpts)
 {
-    vec_t dists[MAX_POINTS_ON_WINDING + 1];
-    int sides[MAX_POINTS_ON_WINDING + 1];
-    int counts[3];
+    int numpoints = 0;
     vec_t fraction;
     int i, j;
-    vec_t *p1, *p2;
+    const vec_t *p1, *p2;
     vec3_t mid;
-    winding_t *neww;
-    int maxpts;
-
-    if (in->numpoints > MAX_POINTS_ON_WINDING)
-        Error("Internal error: in->numpoints > MAX (%s: %d > %d)",
-              __func__, in->numpoints, MAX_POINTS_ON_WINDING);
-
-    CalcSides(in, split, sides, dists, counts);
-
-    if (keepon && !counts[SIDE_FRONT] && !counts[SIDE_BACK])
-        return in;
-
-    if (!counts[SIDE_FRONT]) {
-        free(in);
-        return NULL;
-    }
-
-    if (!counts[SIDE_BACK])
-        return in;
-
-    /*  can't use maxpoints = counts[0] + 2 because of fp grouping errors */
-    maxpts = in->numpoints + 4;
-    neww = (winding_t *)AllocMem(WINDING, maxpts, true);
 
     for (i = 0; i < in->numpoints; i++) {
         p1 = in->points[i];
 
         if (sides[i] == SIDE_ON) {
-            if (neww->numpoints == maxpts)
+            if (numpoints == maxpts)
                 goto noclip;
-            VectorCopy(p1, neww->points[neww->numpoints]);
-            neww->numpoints++;
+            VectorCopy(p1, out[numpoints]);
+            numpoints++;
             continue;
         }
 
         if (sides[i] == SIDE_FRONT) {
-            if (neww->numpoints == maxpts)
+            if (numpoints == maxpts)
                 goto noclip;
-            VectorCopy(p1, neww->points[neww->numpoints]);
-            neww->numpoints++;
+            VectorCopy(p1, out[numpoints]);
+            numpoints++;
         }
 
         if (sides[i + 1] == SIDE_ON || sides[i + 1] == sides[i])
@@ -249,18 +254,72 @@ ClipWinding(winding_t *in, const qbsp_plane_t *split, bool keepon)
                 mid[j] = p1[j] + fraction * (p2[j] - p1[j]);
         }
 
-        if (neww->numpoints == maxpts)
+        if (numpoints == maxpts)
             goto noclip;
-        VectorCopy(mid, neww->points[neww->numpoints]);
-        neww->numpoints++;
+        VectorCopy(mid, out[numpoints]);
+        numpoints++;
     }
-    free(in);
 
-    return neww;
+    return numpoints;
 
  noclip:
     Error("Internal error: new->numpoints > MAX (%s: %d > %d)",
-          __func__, neww->numpoints, maxpts);
+          "ClipWinding", numpoints, maxpts);
+}
+
+/*
+==================
+ClipWinding
+
+Clips the winding to the plane, returning the new winding on the positive side
+The input winding is clipped in place if the result fits, otherwise it is freed.
+If keepon is true, an exactly on-plane winding will be saved, otherwise
+it will be clipped away.
+==================
+*/
+winding_t *
+ClipWinding(winding_t *in, const qbsp_plane_t *split, bool keepon)
+{
+    vec_t dists[MAX_POINTS_ON_WINDING + 1];
+    int sides[MAX_POINTS_ON_WINDING + 1];
+    int counts[3];
+    vec3_t points[MAX_POINTS_ON_WINDING + 4];
+    int numpoints;
+    winding_t *neww;
+    int maxpts;
+
+    if (in->numpoints > MAX_POINTS_ON_WINDING)
+        Error("Internal error: in->numpoints > MAX (%s: %d > %d)",
+              __func__, in->numpoints, MAX_POINTS_ON_WINDING);
+
+    CalcSides(in, split, sides, dists, counts);
+
+    if (keepon && !counts[SIDE_FRONT] && !counts[SIDE_BACK])
+        return in;
+
+    if (!counts[SIDE_FRONT]) {
+        FreeMem(in, WINDING);
+        return NULL;
+    }
+
+    if (!counts[SIDE_BACK])
+        return in;
+
+    /*  can't use maxpoints = counts[0] + 2 because of fp grouping errors */
+    maxpts = in->numpoints + 4;
+    numpoints = ClipWindingPoints(in, split, sides, dists, points, maxpts);
+
+    /* clip in place if the result fits, instead of allocating */
+    if (numpoints <= WindingCapacity(in)) {
+        neww = in;
+    } else {
+        neww = (winding_t *)AllocMem(WINDING, maxpts, false);
+        FreeMem(in, WINDING);
+    }
+    neww->numpoints = numpoints;
+    memcpy(neww->points, points, numpoints * sizeof(points[0]));
+
+    return neww;
 }
 
 
@@ -459,7 +518,7 @@ void ChopWindingInPlace (winding_t **inout, const vec3_t normal, vec_t dist, vec
     
     if (!counts[0])
     {
-        free(in);
+        FreeMem(in, WINDING);
         *inout = nullptr;
         return;
     }
@@ -514,7 +573,7 @@ void ChopWindingInPlace (winding_t **inout, const vec3_t normal, vec_t dist, vec
     if (f->numpoints > MAX_POINTS_ON_WINDING)
         Error ("ClipWinding: MAX_POINTS_ON_WINDING");
     
-    free(in);
+    FreeMem(in, WINDING);
     
     *inout = f;
 }
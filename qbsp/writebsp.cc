@@ -125,7 +125,7 @@ ExportClipNodes(mapentity_t *entity, node_t *node)
     // FIXME: free more stuff?
     if (node->planenum == PLANENUM_LEAF) {
         int contents = node->contents.native;
-        free(node);
+        FreeMem(node, NODE);
         return contents;
     }
 
@@ -145,9 +145,9 @@ ExportClipNodes(mapentity_t *entity, node_t *node)
     for (face = node->faces; face; face = next) {
         next = face->next;
         memset(face, 0, sizeof(face_t));
-        free(face);
+        FreeMem(face, FACE);
     }
-    free(node);
+    FreeMem(node, NODE);
 
     return nodenum;
 }
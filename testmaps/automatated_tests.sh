@@ -111,6 +111,26 @@ else
     sha256sum --strict --check qbsp.sha256sum || exit 1
 fi
 
+# qbsp output must not depend on the thread count:
+# compile with 1, 4 and the default number of threads and compare
+DETERMINISM_MAPS="quake_map_source/E1M1.map qbspfeatures.map"
+
+for map in ${DETERMINISM_MAPS}; do
+    name=$(basename ${map} .map)
+    for threads in 1 4 default; do
+        if [[ ${threads} == "default" ]]; then
+            qbsp -noverbose ${map} ${name}-threads-${threads}.bsp || exit 1
+        else
+            qbsp -noverbose -threads ${threads} ${map} ${name}-threads-${threads}.bsp || exit 1
+        fi
+    done
+    for ext in bsp prt; do
+        cmp ${name}-threads-1.${ext} ${name}-threads-4.${ext} || exit 1
+        cmp ${name}-threads-1.${ext} ${name}-threads-default.${ext} || exit 1
+    done
+    rm -f ${name}-threads-*.*
+done
+
 # now run vis
 # since vis is slower, launch all as background processes, and then wait for all of them to finish
 # FIXME: vis output is nondeterministic when run with multiple threads, so force 1 thread per process
@@ -134,6 +154,41 @@ for bsp in ${HASH_CHECK_BSPS}; do
     light -threads 1 ${bsp} || exit 1
 done
 
+# relighting through light --serve must match a direct run
+light --serve light-serve.sock &
+SERVE_PID=$!
+sleep 1
+for run in 1 2; do
+    cp qbspfeatures.bsp qbspfeatures-direct.bsp || exit 1
+    cp qbspfeatures.bsp qbspfeatures-serve.bsp || exit 1
+    light -threads 1 -lit -minlight ${run}0 qbspfeatures-direct.bsp || exit 1
+    light --connect light-serve.sock -threads 1 -lit -minlight ${run}0 qbspfeatures-serve.bsp || exit 1
+    cmp qbspfeatures-direct.bsp qbspfeatures-serve.bsp || exit 1
+    cmp qbspfeatures-direct.lit qbspfeatures-serve.lit || exit 1
+done
+kill ${SERVE_PID}
+rm -f light-serve.sock qbspfeatures-direct.* qbspfeatures-serve.*
+
+# -incremental after moving a light must match a full relight
+cp qbspfeatures.bsp qbspfeatures-incremental.bsp || exit 1
+light -threads 1 -lit -incremental qbspfeatures-incremental.bsp || exit 1
+perl -pi -e 's/"origin" "136 -360 224"/"origin" "136 -360 200"/' qbspfeatures-incremental.bsp || exit 1
+cp qbspfeatures-incremental.bsp qbspfeatures-direct.bsp || exit 1
+light -threads 1 -lit -incremental qbspfeatures-incremental.bsp || exit 1
+light -threads 1 -lit qbspfeatures-direct.bsp || exit 1
+cmp qbspfeatures-direct.bsp qbspfeatures-incremental.bsp || exit 1
+cmp qbspfeatures-direct.lit qbspfeatures-incremental.lit || exit 1
+rm -f qbspfeatures-direct.* qbspfeatures-incremental.*
+
+# -progressive must end up with the same output once it has run every pass
+cp qbspfeatures.bsp qbspfeatures-direct.bsp || exit 1
+cp qbspfeatures.bsp qbspfeatures-progressive.bsp || exit 1
+light -threads 1 -lit -extra -dirt qbspfeatures-direct.bsp || exit 1
+light -threads 1 -lit -extra -dirt -progressive 1000 qbspfeatures-progressive.bsp || exit 1
+cmp qbspfeatures-direct.bsp qbspfeatures-progressive.bsp || exit 1
+cmp qbspfeatures-direct.lit qbspfeatures-progressive.lit || exit 1
+rm -f qbspfeatures-direct.* qbspfeatures-progressive.*
+
 # if [[ $UPDATE_HASHES -ne 0 ]]; then
 #     sha256sum ${HASH_CHECK_BSPS} > qbsp-vis-light.sha256sum || exit 1
 # else